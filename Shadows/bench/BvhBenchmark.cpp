@@ -0,0 +1,241 @@
+// Light influence & visibility queries of Bvh against brute force over a stress
+// scene layout, e.g.: g++ -O2 -std=c++14 -I../src BvhBenchmark.cpp ../src/Bvh.cpp
+#include "Bvh.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace std;
+
+// Same layout as Scene::Generate defaults
+static const float spacing = 6.0f;
+static const float casterRadius = 1.5f;
+static const float animated = 0.25f;
+static const int   numQueries = 20;
+
+static unsigned int state = 1;
+
+static float Random(float low, float high) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return low + (high - low) * (state % 100000) / 100000.0f;
+}
+
+static double Seconds(chrono::high_resolution_clock::time_point start) {
+    return chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+}
+
+static Bounds MakeBox(const float center[3], float radius) {
+    Bounds bounds;
+
+    for(int i = 0; i<3; ++i) {
+        bounds.min[i] = center[i] - radius;
+        bounds.max[i] = center[i] + radius;
+    }
+    return bounds;
+}
+
+static bool TouchesSphere(const Bounds& bounds, const float center[3], float radius) {
+    float distance = 0.0f;
+
+    for(int i = 0; i<3; ++i) {
+        float d = max( max(bounds.min[i] - center[i], center[i] - bounds.max[i]), 0.0f );
+        distance += d * d;
+    }
+    return distance <= radius * radius;
+}
+
+static bool InFrustum(const Bounds& bounds, const float planes[6][4]) {
+    for(int i = 0; i<6; ++i) {
+        float d = planes[i][3];
+
+        for(int j = 0; j<3; ++j)
+            d += planes[i][j] * (planes[i][j] > 0.0f ? bounds.max[j] : bounds.min[j]);
+        if (d < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+// Plane through point with inner normal
+static void SetPlane(float plane[4], const float normal[3], const float point[3]) {
+    float length = sqrt(normal[0]*normal[0] + normal[1]*normal[1] + normal[2]*normal[2]);
+
+    plane[3] = 0.0f;
+    for(int i = 0; i<3; ++i) {
+        plane[i] = normal[i] / length;
+        plane[3] -= plane[i] * point[i];
+    }
+}
+
+// Camera above the grid corner looking diagonally over it, 90 degree fov
+static void MakeFrustum(float side, float planes[6][4]) {
+    const float eye[3] = { -10.0f, 30.0f, -10.0f };
+    const float f[3] = { 0.7071f, -0.35f, 0.7071f };    // roughly forward
+    const float r[3] = { 0.7071f, 0.0f, -0.7071f };     // right
+    const float u[3] = { 0.25f, 0.95f, 0.25f };         // roughly up
+    float       normal[3];
+    float       point[3];
+
+    for(int i = 0; i<3; ++i) normal[i] = f[i] + r[i];
+    SetPlane(planes[0], normal, eye);
+    for(int i = 0; i<3; ++i) normal[i] = f[i] - r[i];
+    SetPlane(planes[1], normal, eye);
+    for(int i = 0; i<3; ++i) normal[i] = f[i] + u[i];
+    SetPlane(planes[2], normal, eye);
+    for(int i = 0; i<3; ++i) normal[i] = f[i] - u[i];
+    SetPlane(planes[3], normal, eye);
+    for(int i = 0; i<3; ++i) point[i] = eye[i] + f[i];
+    SetPlane(planes[4], f, point);
+    for(int i = 0; i<3; ++i) {
+        normal[i] = -f[i];
+        point[i] = eye[i] + f[i] * side * 0.5f;
+    }
+    SetPlane(planes[5], normal, point);
+}
+
+static void Run(int casters, int numLights) {
+    int             side = static_cast<int>( ceil( sqrt( static_cast<float>(casters) ) ) );
+    vector<Bounds>  bounds;
+    vector<float>   lights;
+    vector<int>     result;
+    vector<int>     moving;
+    float           planes[6][4];
+    Bvh             bvh;
+    int             errors = 0;
+
+    state = 1;
+    for(int i = 0; i<casters; ++i) {
+        float center[3] = { (i % side) * spacing, Random(1.0f, 3.0f), (i / side) * spacing };
+
+        bounds.push_back( MakeBox(center, casterRadius * Random(0.5f, 1.0f)) );
+        if (Random(0.0f, 1.0f) < animated)
+            moving.push_back(i);
+    }
+    for(int i = 0; i<numLights; ++i) {
+        lights.push_back( Random(0.0f, side * spacing) );
+        lights.push_back( Random(4.0f, 12.0f) );
+        lights.push_back( Random(0.0f, side * spacing) );
+        lights.push_back( spacing * Random(3.0f, 8.0f) );
+    }
+    MakeFrustum(side * spacing, planes);
+
+    // Build
+    chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+    bvh.Build(bounds);
+    double buildTime = Seconds(start);
+
+    // Lights: tree vs all instances
+    long long visited = 0;
+    long long found = 0;
+    start = chrono::high_resolution_clock::now();
+    for(int q = 0; q<numQueries; ++q) {
+        for(int i = 0; i<numLights; ++i) {
+            visited += bvh.QuerySphere(&lights[4*i], lights[4*i + 3], result);
+            found += result.size();
+        }
+    }
+    double sphereTime = Seconds(start);
+
+    long long bruteFound = 0;
+    start = chrono::high_resolution_clock::now();
+    for(int q = 0; q<numQueries; ++q) {
+        for(int i = 0; i<numLights; ++i) {
+            result.clear();
+            for(int j = 0; j<casters; ++j) {
+                if ( TouchesSphere(bounds[j], &lights[4*i], lights[4*i + 3]) )
+                    result.push_back(j);
+            }
+            bruteFound += result.size();
+        }
+    }
+    double bruteSphereTime = Seconds(start);
+
+    // Same sets as brute force
+    for(int i = 0; i<numLights; ++i) {
+        vector<int> expected;
+
+        bvh.QuerySphere(&lights[4*i], lights[4*i + 3], result);
+        for(int j = 0; j<casters; ++j) {
+            if ( TouchesSphere(bounds[j], &lights[4*i], lights[4*i + 3]) )
+                expected.push_back(j);
+        }
+        sort(result.begin(), result.end());
+        errors += result != expected;
+    }
+
+    // Camera
+    long long frustumVisited = 0;
+    int       visible = 0;
+    start = chrono::high_resolution_clock::now();
+    for(int q = 0; q<numQueries * 10; ++q)
+        frustumVisited += bvh.QueryFrustum(planes, result);
+    double frustumTime = Seconds(start);
+    visible = result.size();
+
+    start = chrono::high_resolution_clock::now();
+    for(int q = 0; q<numQueries * 10; ++q) {
+        result.clear();
+        for(int j = 0; j<casters; ++j) {
+            if ( InFrustum(bounds[j], planes) )
+                result.push_back(j);
+        }
+    }
+    double bruteFrustumTime = Seconds(start);
+    errors += visible != static_cast<int>( result.size() );
+
+    // Drift moving casters, refit per frame
+    int    rebuilds = 0;
+    double refitTime = 0.0;
+    for(int frame = 0; frame<100; ++frame) {
+        for(int i = 0; i<(int)moving.size(); ++i) {
+            Bounds b = bvh.GetBounds(moving[i]);
+            float  dx = Random(-0.05f, 0.05f);
+            float  dz = Random(-0.05f, 0.05f);
+
+            b.min[0] += dx; b.max[0] += dx;
+            b.min[2] += dz; b.max[2] += dz;
+            bvh.SetBounds(moving[i], b);
+        }
+        start = chrono::high_resolution_clock::now();
+        rebuilds += bvh.Refit();
+        refitTime += Seconds(start);
+    }
+
+    // Refitted tree still finds the moved casters
+    for(int i = 0; i<numLights; ++i) {
+        int expected = 0;
+
+        bvh.QuerySphere(&lights[4*i], lights[4*i + 3], result);
+        for(int j = 0; j<casters; ++j)
+            expected += TouchesSphere(bvh.GetBounds(j), &lights[4*i], lights[4*i + 3]);
+        errors += expected != static_cast<int>( result.size() );
+    }
+
+    int lightQueries = numQueries * numLights;
+    printf("%6d casters: build %6.2f ms, %5d nodes, refit %5.3f ms (%d rebuilds / 100 frames)\n",
+        casters, buildTime * 1e3, bvh.GetNodeCount(), refitTime * 10.0, rebuilds);
+    printf("        light: %7.0f ns vs %8.0f ns brute, %5.1f casters, %5.1f%% nodes visited, %4.1f%% of instances culled\n",
+        sphereTime * 1e9 / lightQueries, bruteSphereTime * 1e9 / lightQueries,
+        static_cast<double>(found) / lightQueries,
+        100.0 * visited / lightQueries / bvh.GetNodeCount(),
+        100.0 * (1.0 - static_cast<double>(found) / lightQueries / casters));
+    printf("        frustum: %6.1f us vs %7.1f us brute, %d visible, %.0f nodes visited\n",
+        frustumTime * 1e6 / (numQueries * 10), bruteFrustumTime * 1e6 / (numQueries * 10),
+        visible, static_cast<double>(frustumVisited) / (numQueries * 10));
+    if (found != bruteFound || errors)
+        printf("        MISMATCH against brute force (%d)\n", errors);
+}
+
+int main(int argc, char* argv[]) {
+    int lights = argc > 1 ? atoi(argv[1]) : 256;
+
+    Run(1000, lights);
+    Run(10000, lights);
+    Run(50000, lights);
+    return 0;
+}
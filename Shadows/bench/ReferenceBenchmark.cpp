@@ -0,0 +1,220 @@
+// Rays per second of the ray traced soft shadow reference over thread counts,
+// and shadow ray packets against rays traced one by one, e.g.:
+// g++ -O2 -std=c++14 -pthread -I../src ReferenceBenchmark.cpp ../src/SoftShadowReference.cpp ../src/TriangleBvh.cpp ../src/Bvh.cpp
+#include "SoftShadowReference.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+static const float spacing = 6.0f;
+static const float casterRadius = 1.5f;
+static const int   rings = 24;          // sphere tessellation, 2 * rings * rings triangles
+static const int   width = 320;
+static const int   height = 240;
+
+static const float pi = 3.14159265f;
+
+static double Seconds(chrono::high_resolution_clock::time_point start) {
+    return chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+}
+
+static void AddTriangle(vector<float>& triangles, const float a[3], const float b[3], const float c[3]) {
+    triangles.insert(triangles.end(), a, a + 3);
+    triangles.insert(triangles.end(), b, b + 3);
+    triangles.insert(triangles.end(), c, c + 3);
+}
+
+static void SpherePoint(const float center[3], float radius, int ring, int segment, float point[3]) {
+    float theta = pi * ring / rings;
+    float phi = pi * segment / rings;
+
+    point[0] = center[0] + radius * sin(theta) * cos(phi);
+    point[1] = center[1] + radius * cos(theta);
+    point[2] = center[2] + radius * sin(theta) * sin(phi);
+}
+
+static void AddSphere(vector<float>& triangles, const float center[3], float radius) {
+    for(int i = 0; i<rings; ++i) {
+        for(int j = 0; j<2 * rings; ++j) {
+            float a[3], b[3], c[3], d[3];
+
+            SpherePoint(center, radius, i, j, a);
+            SpherePoint(center, radius, i, j + 1, b);
+            SpherePoint(center, radius, i + 1, j + 1, c);
+            SpherePoint(center, radius, i + 1, j, d);
+            AddTriangle(triangles, a, b, c);
+            AddTriangle(triangles, a, c, d);
+        }
+    }
+}
+
+// Inverse view-projection of a camera at eye looking at target, row vectors
+static void MakeCamera(const float eye[3], const float target[3], float fov, float m[16]) {
+    float f[3], r[3], u[3];
+    float length = 0.0f;
+
+    for(int i = 0; i<3; ++i) {
+        f[i] = target[i] - eye[i];
+        length += f[i] * f[i];
+    }
+    for(int i = 0; i<3; ++i)
+        f[i] /= sqrt(length);
+    r[0] = f[2]; r[1] = 0.0f; r[2] = -f[0];
+    length = sqrt(r[0] * r[0] + r[2] * r[2]);
+    r[0] /= length; r[2] /= length;
+    u[0] = f[1] * r[2] - f[2] * r[1];
+    u[1] = f[2] * r[0] - f[0] * r[2];
+    u[2] = f[0] * r[1] - f[1] * r[0];
+
+    // Clip (x, y, z) is eye + (x tan aspect r + y tan u + f) depth. D3D depth
+    // gives 1/depth = a + b z, which ends up as w.
+    float t = tan(fov * 0.5f);
+    float aspect = static_cast<float>(width) / height;
+    float zNear = 1.0f;
+    float zFar = 1000.0f;
+    float a = 1.0f / zNear;
+    float b = -(zFar - zNear) / (zFar * zNear);
+    for(int i = 0; i<3; ++i) {
+        m[i] = t * aspect * r[i];
+        m[4 + i] = t * u[i];
+        m[8 + i] = eye[i] * b;
+        m[12 + i] = f[i] + eye[i] * a;
+    }
+    m[3] = 0.0f;
+    m[7] = 0.0f;
+    m[11] = b;
+    m[15] = a;
+}
+
+static void Run(int casters) {
+    int                 side = static_cast<int>( ceil( sqrt( static_cast<float>(casters) ) ) );
+    float               extent = side * spacing;
+    vector<float>       receivers;
+    vector<float>       blockers;
+    float               invViewProj[16];
+    float               eye[3] = { -0.2f * extent, 0.35f * extent + 10.0f, -0.2f * extent };
+    float               target[3] = { 0.5f * extent, 0.0f, 0.5f * extent };
+    float               light[3] = { 0.5f * extent, 12.0f, 0.5f * extent };
+    SoftShadowReference reference;
+
+    // Ground & casters
+    float g0[3] = { -extent, 0.0f, -extent }, g1[3] = { 2.0f * extent, 0.0f, -extent };
+    float g2[3] = { 2.0f * extent, 0.0f, 2.0f * extent }, g3[3] = { -extent, 0.0f, 2.0f * extent };
+    AddTriangle(receivers, g0, g1, g2);
+    AddTriangle(receivers, g0, g2, g3);
+    for(int i = 0; i<casters; ++i) {
+        float center[3] = { (i % side + 0.5f) * spacing, 2.0f + (i % 3), (i / side + 0.5f) * spacing };
+        AddSphere(blockers, center, casterRadius);
+    }
+    receivers.insert(receivers.end(), blockers.begin(), blockers.end());
+
+    chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+    reference.SetGeometry(receivers, blockers);
+    double buildTime = Seconds(start);
+
+    MakeCamera(eye, target, 1.0f, invViewProj);
+    reference.SetView(invViewProj, width, height);
+    reference.SetLight(light, 1.0f);
+
+    printf("%6d casters, %d triangles: build %.1f ms\n", casters, static_cast<int>(blockers.size() / 9), buildTime * 1e3);
+
+    // Threads
+    double single = 0.0;
+    int    hardware = max(1U, thread::hardware_concurrency());
+    for(int threads = 1; ; threads = min(threads * 2, hardware)) {
+        Utils::WorkerPool pool(threads);
+
+        reference.Compute(pool);
+        const ReferenceStats& stats = reference.GetStats();
+        if (threads == 1)
+            single = stats.GetRaysPerSecond();
+        printf("        %2d threads: %7.2f Mrays/s (x%.2f), %lld shadow rays, %d passes, %d pixels above tolerance\n",
+            threads, stats.GetRaysPerSecond() * 1e-6, stats.GetRaysPerSecond() / single, stats.shadowRays, stats.passes, stats.activePixels);
+        if (threads == hardware)
+            break;
+    }
+
+    // Packets against single rays, same rays from the ground towards the light
+    const int     numPackets = 200000;
+    vector<float> origins(3 * numPackets);
+    vector<float> directions(3 * TriangleBvh::packetSize * numPackets);
+    vector<float> lengths(TriangleBvh::packetSize * numPackets);
+    unsigned int  state = 1;
+    TriangleBvh   bvh;
+
+    for(int k = 0; k<numPackets; ++k) {
+        float* origin = &origins[3 * k];
+
+        state = state * 1664525U + 1013904223U;
+        origin[0] = (state >> 8) % 10000 * extent / 10000.0f;
+        state = state * 1664525U + 1013904223U;
+        origin[2] = (state >> 8) % 10000 * extent / 10000.0f;
+        origin[1] = 0.01f;
+        for(int j = 0; j<TriangleBvh::packetSize; ++j) {
+            float* direction = &directions[3 * (TriangleBvh::packetSize * k + j)];
+            float  length = 0.0f;
+
+            for(int i = 0; i<3; ++i) {
+                state = state * 1664525U + 1013904223U;
+                direction[i] = light[i] + ((state >> 8) % 1000 / 500.0f - 1.0f) * 0.7f - origin[i];
+                length += direction[i] * direction[i];
+            }
+            length = sqrt(length);
+            for(int i = 0; i<3; ++i)
+                direction[i] /= length;
+            lengths[TriangleBvh::packetSize * k + j] = length - 1.0f;
+        }
+    }
+    bvh.Build(blockers);
+
+    float packet[3][TriangleBvh::packetSize];
+    float packetLengths[TriangleBvh::packetSize];
+    int   packetBlocked = 0;
+    start = chrono::high_resolution_clock::now();
+    for(int k = 0; k<numPackets; ++k) {
+        for(int j = 0; j<TriangleBvh::packetSize; ++j) {
+            for(int i = 0; i<3; ++i)
+                packet[i][j] = directions[3 * (TriangleBvh::packetSize * k + j) + i];
+            packetLengths[j] = lengths[TriangleBvh::packetSize * k + j];
+        }
+        int blocked = bvh.Occluded(&origins[3 * k], packet, packetLengths);
+        for(int j = 0; j<TriangleBvh::packetSize; ++j)
+            packetBlocked += (blocked >> j) & 1;
+    }
+    double packetTime = Seconds(start);
+
+    // Other lanes stay empty
+    int singleBlocked = 0;
+    for(int j = 1; j<TriangleBvh::packetSize; ++j)
+        packetLengths[j] = 0.0f;
+    start = chrono::high_resolution_clock::now();
+    for(int k = 0; k<TriangleBvh::packetSize * numPackets; ++k) {
+        for(int i = 0; i<3; ++i)
+            packet[i][0] = directions[3 * k + i];
+        packetLengths[0] = lengths[k];
+        singleBlocked += bvh.Occluded(&origins[3 * (k / TriangleBvh::packetSize)], packet, packetLengths) & 1;
+    }
+    double singleTime = Seconds(start);
+
+    printf("        packets: %6.2f Mrays/s, one by one %6.2f Mrays/s%s\n",
+        numPackets * TriangleBvh::packetSize * 1e-6 / packetTime, numPackets * TriangleBvh::packetSize * 1e-6 / singleTime,
+        packetBlocked == singleBlocked ? "" : ", MISMATCH");
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1) {
+        Run( atoi(argv[1]) );
+        return 0;
+    }
+
+    Run(16);
+    Run(256);
+    Run(4096);
+    return 0;
+}
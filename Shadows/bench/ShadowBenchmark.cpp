@@ -0,0 +1,491 @@
+// Shadow geometry pipeline on the CPU against a null device, so it runs on a
+// build machine without a GPU or Windows. Times welding, vertex cache order,
+// then vertex normals, adjacency, shadow vertices, caps & buffer upload of
+// ShadowGeometry::Build, then silhouette extraction & index upload for a
+// light moving around the mesh & the edge id upload of instanced drawing
+// for the same volumes, then extraction of the same lights again through
+// the silhouette cache. Inputs are the text .x files of the data folder
+// and generated closed tori of 1k to 5M triangles, which must weld to 3
+// edges per 2 triangles. Prints throughput, allocations & heap high water
+// mark per step and the change against a baseline file. Exits with 1 on a
+// regression or a torus welded wrong, e.g.:
+// make -C .. bench, or
+// g++ -O2 -std=c++14 -Inull -I../src ShadowBenchmark.cpp null/NullDevice.cpp ../src/ShadowGeometry.cpp ../src/ShadowMesh.cpp
+//     ../src/ShadowMath.cpp ../src/MeshFile.cpp ../src/VertexCache.cpp ../src/SilhouetteCache.cpp ../src/ScreenQuad.cpp
+//     ../src/MemoryReport.cpp
+// ./a.out                       compare with ShadowBaseline.txt
+// ./a.out --save                write ShadowBaseline.txt
+// ./a.out --baseline file --tolerance 0.2 --data ../data --max 1000000
+#include "MeshFile.h"
+#include "ShadowGeometry.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const int   numLights = 32;          // light positions per run
+static const int   repeatTriangles = 400000;// small meshes repeat until about this many triangles
+static const int   maxRepeats = 50;
+static const char* dataMeshes[] = { "chair.x", "cylinder.X", "ground.x", "group.x", "room.x", "torus.x" };
+static const int   generatedTriangles[] = { 1000, 10000, 100000, 1000000, 5000000 };
+
+static const float pi = 3.14159265f;
+
+//-----------------------------------------------------------------------------
+// Heap counters, every operator new of the process goes through them. Each
+// block carries its size in front so delete can take it off. Not inlined,
+// so gcc does not pair their malloc & free with new & delete of callers.
+//-----------------------------------------------------------------------------
+static const size_t header = 16;
+static long long    allocations = 0;
+static size_t       heapBytes = 0;
+static size_t       heapPeak = 0;
+
+__attribute__((noinline)) void* operator new(size_t size) {
+    char* block = static_cast<char*>( malloc(size + header) );
+
+    if (!block)
+        throw bad_alloc();
+    *reinterpret_cast<size_t*>(block) = size;
+    ++allocations;
+    heapBytes += size;
+    if (heapBytes > heapPeak)
+        heapPeak = heapBytes;
+    return block + header;
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+    if (!p)
+        return;
+
+    char* block = static_cast<char*>(p) - header;
+    heapBytes -= *reinterpret_cast<size_t*>(block);
+    free(block);
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete[](void* p) noexcept { operator delete(p); }
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+void operator delete[](void* p, size_t) noexcept { operator delete(p); }
+
+// One step of the pipeline, best time over repeats
+struct Step
+{
+    double    seconds;
+    long long allocations;
+    size_t    peak;         // heap high water mark above the start of the step
+
+    Step() : seconds(1e30), allocations(-1), peak(0) {}
+};
+
+// Counters around a piece of work
+class Probe
+{
+private:
+    chrono::steady_clock::time_point start;
+    long long                        startAllocations;
+    size_t                           startBytes;
+    size_t                           outerPeak;
+
+public:
+    Probe() : startAllocations(allocations), startBytes(heapBytes), outerPeak(heapPeak) {
+        heapPeak = heapBytes;
+        start = chrono::steady_clock::now();
+    }
+
+    // Add work since construction to step, times are summed
+    void AddTo(double& seconds, long long& count, size_t& peak) {
+        seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        count += allocations - startAllocations;
+        peak = max(peak, heapPeak - startBytes);
+        heapPeak = max(outerPeak, heapPeak);
+    }
+};
+
+static void Keep(Step& step, double seconds, long long count, size_t peak) {
+    step.seconds = min(step.seconds, seconds);
+    step.allocations = count;
+    step.peak = max(step.peak, peak);
+}
+
+// Unwelded triangle list like a loaded mesh, face normals set
+struct SourceMesh
+{
+    string              name;
+    vector<D3DXVECTOR3> vertices;
+    vector<Face>        faces;
+};
+
+static void SetNormals(SourceMesh& mesh) {
+    for(int i = 0; i<(int)mesh.faces.size(); ++i) {
+        Face&       face = mesh.faces[i];
+        D3DXVECTOR3 e1 = mesh.vertices[face.v1] - mesh.vertices[face.v0];
+        D3DXVECTOR3 e2 = mesh.vertices[face.v2] - mesh.vertices[face.v0];
+
+        D3DXVec3Cross(&face.normal, &e1, &e2);
+        D3DXVec3Normalize(&face.normal, &face.normal);
+    }
+}
+
+static void AddFace(SourceMesh& mesh, int v0, int v1, int v2) {
+    Face face = Face();
+
+    face.v0 = v0;
+    face.v1 = v1;
+    face.v2 = v2;
+    mesh.faces.push_back(face);
+}
+
+// Torus of about the given triangle count. Seam vertices are duplicated like
+// an exported mesh with texture coordinates, welding closes it.
+static SourceMesh MakeTorus(int triangles) {
+    SourceMesh mesh;
+    int        rings = max(3, static_cast<int>( sqrt(triangles / 8.0) ));
+    int        sides = max(3, triangles / (2 * rings));
+    float      major = 1.0f;
+    float      minor = 0.3f;
+
+    ostringstream name;
+    name << "torus" << 2 * rings * sides;
+    mesh.name = name.str();
+
+    mesh.vertices.reserve( (rings + 1) * (sides + 1) );
+    for(int i = 0; i<=rings; ++i) {
+        float u = 2.0f * pi * (i % rings) / rings;
+
+        for(int j = 0; j<=sides; ++j) {
+            float v = 2.0f * pi * (j % sides) / sides;
+            float r = major + minor * cos(v);
+
+            mesh.vertices.push_back( D3DXVECTOR3(r * cos(u), minor * sin(v), r * sin(u)) );
+        }
+    }
+
+    mesh.faces.reserve(2 * rings * sides);
+    for(int i = 0; i<rings; ++i) {
+        for(int j = 0; j<sides; ++j) {
+            int a = i * (sides + 1) + j;
+            int b = a + sides + 1;
+
+            AddFace(mesh, a, a + 1, b + 1);
+            AddFace(mesh, a, b + 1, b);
+        }
+    }
+    SetNormals(mesh);
+    return mesh;
+}
+
+// Bytes held at once by Build for a closed mesh, to skip what does not fit
+static double EstimateBytes(const SourceMesh& mesh) {
+    double edges = 1.5 * mesh.faces.size();
+
+    return 2.0 * 6.0 * edges * sizeof(ShadowVert) + 3.0 * mesh.faces.size() * sizeof(Face) + 2.0 * edges * 80.0 +
+           edges * ShadowMesh::edgeRecordSize * sizeof(D3DXVECTOR4);
+}
+
+static const char* stepNames[] = { "weld", "cache order", "normals", "edges", "shadow verts", "caps", "vertex upload", "build", "extract", "index upload",
+                                   "cached extract", "id upload" };
+static const int   numSteps = sizeof(stepNames) / sizeof(stepNames[0]);
+
+// Run the pipeline repeatedly, best time per step
+static bool Run(const SourceMesh& source, vector<Step>& steps, int& edges, double& silhouetteEdges) {
+    int repeats = max(1, min(maxRepeats, repeatTriangles / static_cast<int>( source.faces.size() )));
+
+    steps.assign(numSteps, Step());
+    edges = 0;
+    silhouetteEdges = 0.0;
+
+    for(int k = 0; k<repeats; ++k) {
+        vector<D3DXVECTOR3> vertices = source.vertices;
+        vector<Face>        faces = source.faces;
+        double              seconds = 0.0;
+        long long           count = 0;
+        size_t              peak = 0;
+
+        {
+            Probe probe;
+            ShadowGeometry::Weld(vertices, faces);
+            probe.AddTo(seconds, count, peak);
+        }
+        Keep(steps[0], seconds, count, peak);
+
+        seconds = 0.0;
+        count = 0;
+        peak = 0;
+        {
+            Probe probe;
+            ShadowGeometry::OptimizeOrder(vertices, faces);
+            probe.AddTo(seconds, count, peak);
+        }
+        Keep(steps[1], seconds, count, peak);
+
+        // Steps of Build time themselves, counters cover all of it
+        ShadowGeometry* geometry = new ShadowGeometry();
+        seconds = 0.0;
+        count = 0;
+        peak = 0;
+        bool closed;
+        {
+            Probe probe;
+            closed = geometry->Build(vertices, faces, 0.0f);
+            probe.AddTo(seconds, count, peak);
+        }
+        const GeometryBuildTimes& times = geometry->GetBuildTimes();
+        Keep(steps[2], times.normals, -1, 0);
+        Keep(steps[3], times.edges, -1, 0);
+        Keep(steps[4], times.shadowVertices, -1, 0);
+        Keep(steps[5], times.caps, -1, 0);
+        Keep(steps[6], times.upload, -1, 0);
+        Keep(steps[7], seconds, count, peak);
+        if (!closed) {
+            delete geometry;
+            return false;
+        }
+        edges = geometry->GetEdgeCount();
+
+        // Light circling the mesh & bobbing, one volume reused like an instance
+        const vector<D3DXVECTOR3>& welded = geometry->GetVertices();
+        D3DXVECTOR3  center(0.0f, 0.0f, 0.0f);
+        float        radius = 0.0f;
+        for(int i = 0; i<(int)welded.size(); ++i)
+            center += welded[i];
+        center /= static_cast<float>( welded.size() );
+        for(int i = 0; i<(int)welded.size(); ++i) {
+            D3DXVECTOR3 offset = welded[i] - center;
+            radius = max( radius, D3DXVec3Length(&offset) );
+        }
+
+        ShadowVolume* volume = new ShadowVolume();
+        double        extractSeconds = 0.0, uploadSeconds = 0.0, idSeconds = 0.0;
+        long long     extractCount = 0, uploadCount = 0, idCount = 0;
+        size_t        extractPeak = 0, uploadPeak = 0, idPeak = 0;
+        for(int i = 0; i<numLights; ++i) {
+            float       angle = 2.0f * pi * i / numLights;
+            D3DXVECTOR3 light = center + D3DXVECTOR3( cos(angle), 0.5f + 0.4f * sin(3.0f * angle), sin(angle) ) * (3.0f * radius);
+
+            {
+                Probe probe;
+                geometry->ExtractSilhouette(light, *volume);
+                probe.AddTo(extractSeconds, extractCount, extractPeak);
+            }
+            {
+                Probe probe;
+                geometry->RenderUmbra(*volume, 0);
+                geometry->RenderPenumbra(*volume, 1);
+                probe.AddTo(uploadSeconds, uploadCount, uploadPeak);
+            }
+
+            // Same volume drawn instanced, ids only
+            ShadowGeometry::instancedEdges = true;
+            {
+                Probe probe;
+                geometry->RenderUmbra(*volume, 0);
+                geometry->RenderPenumbra(*volume, 1);
+                probe.AddTo(idSeconds, idCount, idPeak);
+            }
+            ShadowGeometry::instancedEdges = false;
+            silhouetteEdges += volume->stats.edges;
+        }
+        Keep(steps[8], extractSeconds, extractCount, extractPeak);
+        Keep(steps[9], uploadSeconds, uploadCount, uploadPeak);
+        Keep(steps[11], idSeconds, idCount, idPeak);
+        silhouetteEdges /= numLights;
+
+        // Same lights again, from the silhouette cache
+        extractSeconds = 0.0;
+        extractCount = 0;
+        extractPeak = 0;
+        for(int i = 0; i<numLights; ++i) {
+            float       angle = 2.0f * pi * i / numLights;
+            D3DXVECTOR3 light = center + D3DXVECTOR3( cos(angle), 0.5f + 0.4f * sin(3.0f * angle), sin(angle) ) * (3.0f * radius);
+            Probe       probe;
+
+            geometry->ExtractSilhouette(light, *volume);
+            probe.AddTo(extractSeconds, extractCount, extractPeak);
+        }
+        Keep(steps[10], extractSeconds, extractCount, extractPeak);
+
+        delete volume;
+        delete geometry;
+    }
+
+    return true;
+}
+
+// Triangles per second of step, extraction & upload count every light
+static double Throughput(const Step& step, int index, int triangles) {
+    double work = index >= 8 ? static_cast<double>(triangles) * numLights : triangles;
+
+    return step.seconds > 0.0 ? work / step.seconds : 0.0;
+}
+
+typedef map<string, double> Baseline; // "mesh step" to triangles per second
+
+static Baseline ReadBaseline(const string& fileName) {
+    ifstream file(fileName.c_str());
+    Baseline baseline;
+    string   line;
+
+    while (getline(file, line)) {
+        size_t tab = line.rfind('\t');
+        if (line.empty() || line[0] == '#' || tab == string::npos)
+            continue;
+        baseline[ line.substr(0, tab) ] = atof( line.c_str() + tab + 1 );
+    }
+    return baseline;
+}
+
+int main(int argc, char* argv[]) {
+    string   baselineFile = "ShadowBaseline.txt";
+    string   dataFolder = "../data";
+    bool     save = false;
+    double   tolerance = 0.15;
+    int      maxTriangles = 5000000;
+    Baseline baseline, results;
+    int      regressions = 0;
+    int      failures = 0;
+
+    for(int i = 1; i<argc; ++i) {
+        string option = argv[i];
+
+        if (option == "--save")
+            save = true;
+        else if (option == "--baseline" && i+1 < argc)
+            baselineFile = argv[++i];
+        else if (option == "--data" && i+1 < argc)
+            dataFolder = argv[++i];
+        else if (option == "--tolerance" && i+1 < argc)
+            tolerance = atof(argv[++i]);
+        else if (option == "--max" && i+1 < argc)
+            maxTriangles = atoi(argv[++i]);
+        else {
+            printf("usage: %s [--save] [--baseline file] [--data folder] [--tolerance 0.15] [--max triangles]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (!save)
+        baseline = ReadBaseline(baselineFile);
+
+    // Edge textures as big as a D3D10 class card takes
+    ShadowGeometry::edgeTextureRows = 8192;
+
+    // Inputs, generated ones are made when their turn comes
+    vector<SourceMesh> meshes;
+    for(int i = 0; i<(int)(sizeof(dataMeshes) / sizeof(dataMeshes[0])); ++i) {
+        SourceMesh mesh;
+        MeshFile   file;
+
+        mesh.name = dataMeshes[i];
+        if ( file.Load(dataFolder + "/" + dataMeshes[i]) ) {
+            mesh.vertices.swap(file.vertices);
+            mesh.faces.swap(file.faces);
+            meshes.push_back(mesh);
+        }
+        else
+            printf("%s: not found or not a text .x file, skipped\n", dataMeshes[i]);
+    }
+    int numData = meshes.size();
+    for(int i = 0; i<(int)(sizeof(generatedTriangles) / sizeof(generatedTriangles[0])); ++i) {
+        if (generatedTriangles[i] <= maxTriangles)
+            meshes.push_back(SourceMesh());
+    }
+
+    double memory = static_cast<double>( sysconf(_SC_PHYS_PAGES) ) * sysconf(_SC_PAGESIZE);
+
+    printf("%-14s %9s %-14s %10s %10s %10s %10s %8s\n", "mesh", "triangles", "step", "ms", "Mtri/s", "allocs", "peak KB", "change");
+    for(int m = 0; m<(int)meshes.size(); ++m) {
+        SourceMesh& source = meshes[m];
+        if (m >= numData)
+            source = MakeTorus( generatedTriangles[m - numData] );
+
+        int triangles = source.faces.size();
+        if ( EstimateBytes(source) > 0.8 * memory ) {
+            printf("%-14s %9d needs ~%.0f MB, more than this machine has, skipped\n", source.name.c_str(), triangles, EstimateBytes(source) / 1048576.0);
+            source = SourceMesh();
+            continue;
+        }
+
+        vector<Step> steps;
+        int          edges;
+        double       silhouetteEdges;
+        bool         closed = Run(source, steps, edges, silhouetteEdges);
+
+        // A torus welds to a closed manifold, 3 edges per 2 triangles. Else
+        // Weld merged or split vertices & it is not the mesh it claims to be.
+        if ( m >= numData && (!closed || 2 * edges != 3 * triangles) ) {
+            printf("%-14s %9d %d edges instead of %d, welded wrong, no results\n", source.name.c_str(), triangles, edges, 3 * triangles / 2);
+            ++failures;
+            source = SourceMesh();
+            continue;
+        }
+
+        for(int i = 0; i<numSteps; ++i) {
+            // Build stops after the edges of an open mesh
+            if (!closed && i >= 4 && i != 7)
+                continue;
+
+            string key = source.name + " " + stepNames[i];
+            double throughput = Throughput(steps[i], i, triangles);
+            char   change[32] = "";
+            char   allocs[32] = "-";
+            char   peak[32] = "-";
+
+            results[key] = throughput;
+            Baseline::const_iterator base = baseline.find(key);
+            if (base != baseline.end() && base->second > 0.0) {
+                double ratio = throughput / base->second - 1.0;
+                bool   slower = ratio < -tolerance;
+
+                snprintf(change, sizeof(change), "%+.0f%%%s", 100.0 * ratio, slower ? " !" : "");
+                regressions += slower;
+            }
+            if (steps[i].allocations >= 0) {
+                snprintf(allocs, sizeof(allocs), "%lld", steps[i].allocations);
+                snprintf(peak, sizeof(peak), "%.0f", steps[i].peak / 1024.0);
+            }
+            printf("%-14s %9d %-14s %10.3f %10.2f %10s %10s %8s\n", source.name.c_str(), triangles, stepNames[i],
+                steps[i].seconds * 1e3, throughput * 1e-6, allocs, peak, change);
+        }
+        if (closed)
+            printf("%-14s %9d %d edges, %.0f silhouette edges per light\n", source.name.c_str(), triangles, edges, silhouetteEdges);
+        else
+            printf("%-14s %9d not closed, no shadow volumes\n", source.name.c_str(), triangles);
+
+        // Generated meshes are big, free them before the next
+        if (m >= numData)
+            source = SourceMesh();
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("process peak resident %.0f MB, heap peak %.0f MB, %lld allocations\n",
+        usage.ru_maxrss / 1024.0, heapPeak / 1048576.0, allocations);
+
+    if (save) {
+        ofstream file(baselineFile.c_str());
+
+        file << "# ShadowBenchmark baseline: mesh step<TAB>triangles per second\n";
+        for(Baseline::const_iterator i = results.begin(); i != results.end(); ++i)
+            file << i->first << '\t' << static_cast<long long>(i->second) << '\n';
+        printf("baseline written to %s\n", baselineFile.c_str());
+        return file.good() ? 0 : 1;
+    }
+    if (failures > 0)
+        printf("%d meshes welded wrong\n", failures);
+    if (baseline.empty())
+        printf("no baseline in %s, run with --save to make one\n", baselineFile.c_str());
+    else if (regressions > 0)
+        printf("%d steps slower than baseline by more than %.0f%%\n", regressions, 100.0 * tolerance);
+
+    return regressions > 0 || failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,130 @@
+// Handle copy, lookup & validation costs of Utils::Storage and Utils::SlotStorage.
+// Both are header only, e.g.: g++ -O2 -std=c++14 -I../src StorageBenchmark.cpp -pthread
+#include "Storage.h"
+#include "SlotStorage.h"
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+using namespace std;
+
+struct Item
+{
+    int value;
+    Item(int value) : value(value) {}
+};
+
+typedef Utils::Storage<Item, string> MapStorage;
+typedef Utils::SlotStorage<Item>     SlotMap;
+
+static const int numItems = 1000;
+static const int numOps = 4000000;
+
+// Keeps results alive
+static volatile int sink;
+
+// Nanoseconds per operation
+template<class Func>
+static double Measure(Func func) {
+    chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+    func();
+    chrono::high_resolution_clock::time_point end = chrono::high_resolution_clock::now();
+
+    return chrono::duration<double, nano>(end - start).count() / numOps;
+}
+
+static string MakeKey(int i) {
+    return "data\\textures\\texture" + to_string(i) + ".dds";
+}
+
+int main() {
+    vector<string>              names;
+    vector<MapStorage::handle>  mapHandles;
+    vector<unsigned int>        keyIds;
+    vector<SlotMap::handle>     slotHandles;
+    SlotMap                     slotMap;
+
+    for(int i = 0; i<numItems; ++i) {
+        names.push_back( MakeKey(i) );
+        mapHandles.push_back( MapStorage::Instance()->Add(names[i], new Item(i)) );
+        keyIds.push_back( slotMap.Intern(names[i]) );
+        slotHandles.push_back( slotMap.Add(keyIds[i], new Item(i)) );
+    }
+
+    // Stale slot handles
+    vector<SlotMap::handle> stale(slotHandles.begin(), slotHandles.begin() + numItems/2);
+    for(int i = 0; i<numItems/2; ++i) {
+        slotMap.Release(slotHandles[i]);
+        slotHandles[i] = slotMap.Add(keyIds[i], new Item(i));
+    }
+
+    printf("%-28s %12s %12s\n", "ns/op", "Storage", "SlotStorage");
+
+    // Copy, use & drop handle
+    double mapCopy = Measure([&] {
+        int sum = 0;
+        for(int i = 0; i<numOps; ++i) {
+            MapStorage::handle copy = mapHandles[i % numItems];
+            sum += copy->value;
+        }
+        sink = sum;
+    });
+    double slotCopy = Measure([&] {
+        int sum = 0;
+        for(int i = 0; i<numOps; ++i) {
+            SlotMap::handle copy = slotHandles[i % numItems];
+            sum += slotMap.GetObject(copy)->value;
+        }
+        sink = sum;
+    });
+    printf("%-28s %12.2f %12.2f\n", "handle copy + deref", mapCopy, slotCopy);
+
+    // Lookup by string key
+    double mapLookup = Measure([&] {
+        int sum = 0;
+        for(int i = 0; i<numOps; ++i) {
+            MapStorage::handle item = MapStorage::Instance()->Get( names[(i * 7) % numItems] );
+            sum += item->value;
+        }
+        sink = sum;
+    });
+    double slotLookup = Measure([&] {
+        int sum = 0;
+        for(int i = 0; i<numOps; ++i) {
+            sum += slotMap.GetObject( slotMap.Get(names[(i * 7) % numItems]) )->value;
+        }
+        sink = sum;
+    });
+    printf("%-28s %12.2f %12.2f\n", "lookup by string", mapLookup, slotLookup);
+
+    // Lookup by interned key, storage has no interning
+    double slotIdLookup = Measure([&] {
+        int sum = 0;
+        for(int i = 0; i<numOps; ++i) {
+            sum += slotMap.GetObject( slotMap.Get(keyIds[(i * 7) % numItems]) )->value;
+        }
+        sink = sum;
+    });
+    printf("%-28s %12s %12.2f\n", "lookup by interned key", "-", slotIdLookup);
+
+    // Validation as done in the draw loop
+    double mapValid = Measure([&] {
+        int count = 0;
+        for(int i = 0; i<numOps; ++i) {
+            if ( mapHandles[i % numItems] != MapStorage::Instance()->End() ) ++count;
+        }
+        sink = count;
+    });
+    double slotValid = Measure([&] {
+        int count = 0;
+        for(int i = 0; i<numOps; ++i) {
+            if ( slotMap.IsValid( i & 1 ? slotHandles[i % numItems] : stale[i % stale.size()] ) ) ++count;
+        }
+        sink = count;
+    });
+    printf("%-28s %12.2f %12.2f\n", "validation", mapValid, slotValid);
+
+    mapHandles.clear();
+    MapStorage::Free();
+    return 0;
+}
@@ -0,0 +1,157 @@
+// Concurrent Load, Get, Add, handle copy & release on Utils::Storage from 8
+// threads, with the placeholder replaced while loads are in flight. Every
+// handle must show its own item or a placeholder, and once all handles are
+// dropped only the placeholders may be alive. Exits with 1 otherwise. Header
+// only, e.g.:
+// g++ -O2 -std=c++14 -I../src StorageStress.cpp -pthread
+// g++ -O1 -g -std=c++14 -fsanitize=thread -I../src StorageStress.cpp -pthread    under ThreadSanitizer
+#include "Storage.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+struct Item
+{
+    static atomic<int> alive;
+
+    int value;          // key number, negative for placeholders
+    Item(int value) : value(value) { ++alive; }
+    Item(const Item& item) : value(item.value) { ++alive; }
+    ~Item() { --alive; }
+};
+
+atomic<int> Item::alive(0);
+
+typedef Utils::Storage<Item, string> ItemStorage;
+
+static const int numThreads = 8;
+static const int numKeys = 64;          // few keys, so threads share items
+static const int numOps = 200000;       // per thread
+static const int maxHeld = 16;          // handles a thread keeps at once
+
+static atomic<int> errors(0);
+static atomic<int> numPlaceholders(1);
+
+static string MakeKey(int i) {
+    return "data\\textures\\texture" + to_string(i) + ".dds";
+}
+
+// Every third key fails to load, its handles keep showing a placeholder
+static Item* LoadItem(int value) {
+    if (value % 3 == 0)
+        return NULL;
+    if (value % 5 == 0)
+        this_thread::sleep_for( chrono::microseconds(50) );
+    return new Item(value);
+}
+
+static void Check(const ItemStorage::handle& handle, int key) {
+    if ( !handle.Exist() )
+        return;
+    const Item* item = handle.GetObject();
+    if ( item->value != key && item->value >= 0 )
+        ++errors;
+    if ( handle.Ready() && key % 3 != 0 && handle->value != key )
+        ++errors;
+}
+
+static void Stress(int index) {
+    mt19937                     random(index + 1);
+    vector<ItemStorage::handle> held;
+    vector<int>                 heldKeys;
+    ItemStorage*                storage = ItemStorage::Instance();
+
+    for(int i = 0; i<numOps; ++i) {
+        int                 key = random() % numKeys;
+        ItemStorage::handle handle;
+
+        switch (random() % 6) {
+        case 0:
+            handle = storage->Load( MakeKey(key), [key](const string&) { return LoadItem(key); } );
+            break;
+        case 1:
+            handle = storage->Get(MakeKey(key));
+            break;
+        case 2:
+            handle = storage->AddCopy(MakeKey(key), Item(key));
+            break;
+        case 3: {
+            Item* item = new Item(key);
+            handle = storage->Add(MakeKey(key), item);
+            if ( !handle.Exist() )
+                delete item;
+            break;
+        }
+        case 4:
+            // Copy of a held handle
+            if ( !held.empty() ) {
+                int j = random() % held.size();
+                handle = held[j];
+                key = heldKeys[j];
+            }
+            break;
+        default:
+            // Release
+            if ( !held.empty() ) {
+                int j = random() % held.size();
+                held[j] = held.back();
+                heldKeys[j] = heldKeys.back();
+                held.pop_back();
+                heldKeys.pop_back();
+            }
+            break;
+        }
+        Check(handle, key);
+
+        // Placeholders are never handed out for change
+        Item* locked = handle.Exist() ? handle.Lock() : NULL;
+        if ( locked && locked->value < 0 )
+            ++errors;
+
+        if ( handle.Exist() ) {
+            if (held.size() == maxHeld) {
+                held[0].Destroy();
+                held[0] = handle;
+                heldKeys[0] = key;
+            }
+            else {
+                held.push_back(handle);
+                heldKeys.push_back(key);
+            }
+        }
+
+        // Placeholder changes under running loads
+        if (index == 0 && i % 20000 == 0) {
+            storage->SetPlaceholder( new Item(-1 - i) );
+            ++numPlaceholders;
+        }
+    }
+}
+
+int main() {
+    ItemStorage::Instance()->SetPlaceholder( new Item(-1) );
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<thread> threads;
+    for(int i = 0; i<numThreads; ++i)
+        threads.push_back( thread(Stress, i) );
+    for(int i = 0; i<numThreads; ++i)
+        threads[i].join();
+    ItemStorage::Instance()->Wait();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    // Items went with their last handle, placeholders stay until Free
+    int leaked = Item::alive - numPlaceholders;
+    ItemStorage::Free();
+    int left = Item::alive;
+
+    printf("%d threads, %d ops in %.2f s (%.0f ns/op), %d wrong objects, %d items alive after release, %d after Free\n",
+        numThreads, numThreads * numOps, seconds, seconds * 1e9 / (numThreads * numOps), errors.load(), leaked, left);
+
+    return errors > 0 || leaked != 0 || left != 0 ? 1 : 0;
+}
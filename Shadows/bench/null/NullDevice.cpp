@@ -0,0 +1,104 @@
+// Null Direct3D 9 device for building the shadow geometry code without
+// Windows, see bench/ShadowBenchmark.cpp
+#include "Global.h"
+
+static IDirect3DDevice9 nullDevice;
+static ID3DXEffect      nullEffect;
+
+HWND              hWnd = NULL;
+LPDIRECT3D9       pD3D = NULL;
+LPDIRECT3DDEVICE9 pd3dDevice = &nullDevice;
+LPD3DXEFFECT      pLightingEffect = &nullEffect;
+LPD3DXFONT        pFont = NULL;
+
+IDirect3DVertexBuffer9::IDirect3DVertexBuffer9(UINT size, D3DPOOL pool) : pool(pool), data(new char[size]), size(size) {
+}
+
+IDirect3DVertexBuffer9::~IDirect3DVertexBuffer9() {
+    delete [] data;
+}
+
+HRESULT IDirect3DVertexBuffer9::Lock(UINT offset, UINT size, void** ppData, DWORD flags) {
+    *ppData = data + offset;
+    return S_OK;
+}
+
+HRESULT IDirect3DVertexBuffer9::GetDesc(D3DVERTEXBUFFER_DESC* pDesc) {
+    pDesc->Pool = pool;
+    pDesc->Size = size;
+    return S_OK;
+}
+
+IDirect3DIndexBuffer9::IDirect3DIndexBuffer9(UINT size, D3DPOOL pool) : pool(pool), data(new char[size]), size(size) {
+}
+
+IDirect3DIndexBuffer9::~IDirect3DIndexBuffer9() {
+    delete [] data;
+}
+
+HRESULT IDirect3DIndexBuffer9::Lock(UINT offset, UINT size, void** ppData, DWORD flags) {
+    *ppData = data + offset;
+    return S_OK;
+}
+
+HRESULT IDirect3DIndexBuffer9::GetDesc(D3DINDEXBUFFER_DESC* pDesc) {
+    pDesc->Pool = pool;
+    pDesc->Size = size;
+    return S_OK;
+}
+
+IDirect3DTexture9::IDirect3DTexture9(UINT width, UINT height, D3DFORMAT format, D3DPOOL pool) {
+    desc.Format = format;
+    desc.Pool = pool;
+    desc.Width = width;
+    desc.Height = height;
+    pitch = width * (format == D3DFMT_A32B32G32R32F ? 16 : 4);
+    data = new char[pitch * height];
+}
+
+IDirect3DTexture9::~IDirect3DTexture9() {
+    delete [] data;
+}
+
+HRESULT IDirect3DTexture9::GetLevelDesc(UINT level, D3DSURFACE_DESC* pDesc) {
+    *pDesc = desc;
+    return S_OK;
+}
+
+HRESULT IDirect3DTexture9::LockRect(UINT level, D3DLOCKED_RECT* pRect, const RECT* pArea, DWORD flags) {
+    pRect->Pitch = pitch;
+    pRect->pBits = data;
+    return S_OK;
+}
+
+HRESULT IDirect3DDevice9::CreateVertexBuffer(UINT length, DWORD usage, DWORD fvf, D3DPOOL pool, IDirect3DVertexBuffer9** ppBuffer, HANDLE* pShared) {
+    *ppBuffer = new IDirect3DVertexBuffer9(length, pool);
+    return S_OK;
+}
+
+HRESULT IDirect3DDevice9::CreateIndexBuffer(UINT length, DWORD usage, D3DFORMAT format, D3DPOOL pool, IDirect3DIndexBuffer9** ppBuffer, HANDLE* pShared) {
+    *ppBuffer = new IDirect3DIndexBuffer9(length, pool);
+    return S_OK;
+}
+
+HRESULT IDirect3DDevice9::CreateVertexDeclaration(const D3DVERTEXELEMENT9* pElements, IDirect3DVertexDeclaration9** ppDecl) {
+    *ppDecl = new IDirect3DVertexDeclaration9();
+    return S_OK;
+}
+
+HRESULT IDirect3DDevice9::CreateTexture(UINT width, UINT height, UINT levels, DWORD usage, D3DFORMAT format, D3DPOOL pool, IDirect3DTexture9** ppTexture, HANDLE* pShared) {
+    *ppTexture = new IDirect3DTexture9(width, height, format, pool);
+    return S_OK;
+}
+
+HRESULT IDirect3DDevice9::DrawPrimitive(D3DPRIMITIVETYPE type, UINT start, UINT count) {
+    ++drawCalls;
+    primitives += count;
+    return S_OK;
+}
+
+HRESULT IDirect3DDevice9::DrawIndexedPrimitive(D3DPRIMITIVETYPE type, int base, UINT minIndex, UINT vertices, UINT start, UINT count) {
+    ++drawCalls;
+    primitives += count;
+    return S_OK;
+}
@@ -0,0 +1,160 @@
+#pragma once
+// Subset of Direct3D 9 used by the shadow geometry code. Interfaces are not
+// abstract: NullDevice.cpp implements the one device that exists.
+#include "windows.h"
+#include "ShadowMath.h"
+
+#define D3DLOCK_READONLY    0x10
+#define D3DLOCK_DISCARD     0x2000
+#define D3DUSAGE_DYNAMIC    0x200
+#define D3DUSAGE_WRITEONLY  0x8
+#define D3DFVF_XYZ          0x2
+#define D3DDECL_END()       { 0xFF, 0, D3DDECLTYPE_UNUSED, 0, 0, 0 }
+#define D3DSTREAMSOURCE_INDEXEDDATA  (1u << 30)
+#define D3DSTREAMSOURCE_INSTANCEDATA (2u << 30)
+
+typedef DWORD D3DCOLOR;
+
+// States are passed through RenderCalls.h only, values don't matter
+enum D3DRENDERSTATETYPE { D3DRS_FORCE_DWORD = 0x7fffffff };
+enum D3DSAMPLERSTATETYPE { D3DSAMP_FORCE_DWORD = 0x7fffffff };
+enum D3DTRANSFORMSTATETYPE { D3DTS_FORCE_DWORD = 0x7fffffff };
+
+struct D3DCOLORVALUE { float r, g, b, a; };
+struct D3DMATERIAL9 { D3DCOLORVALUE Diffuse, Ambient, Specular, Emissive; float Power; };
+struct D3DRECT { LONG x1, y1, x2, y2; };
+
+enum D3DFORMAT
+{
+    D3DFMT_UNKNOWN = 0,
+    D3DFMT_A8R8G8B8 = 21,
+    D3DFMT_L8 = 50,
+    D3DFMT_A8L8 = 51,
+    D3DFMT_INDEX16 = 101,
+    D3DFMT_INDEX32 = 102,
+    D3DFMT_A32B32G32R32F = 116,
+    D3DFMT_DXT1 = 0x31545844,
+    D3DFMT_DXT5 = 0x35545844
+};
+
+enum D3DPOOL { D3DPOOL_DEFAULT = 0, D3DPOOL_MANAGED = 1, D3DPOOL_SYSTEMMEM = 2 };
+enum D3DPRIMITIVETYPE { D3DPT_TRIANGLELIST = 4, D3DPT_TRIANGLESTRIP = 5 };
+enum D3DDECLTYPE { D3DDECLTYPE_FLOAT3 = 2, D3DDECLTYPE_FLOAT4 = 3, D3DDECLTYPE_UBYTE4 = 5, D3DDECLTYPE_UNUSED = 17 };
+enum D3DDECLMETHOD { D3DDECLMETHOD_DEFAULT = 0 };
+enum D3DDECLUSAGE { D3DDECLUSAGE_POSITION = 0, D3DDECLUSAGE_NORMAL = 3, D3DDECLUSAGE_TEXCOORD = 5 };
+
+struct D3DVERTEXELEMENT9
+{
+    WORD Stream;
+    WORD Offset;
+    BYTE Type;
+    BYTE Method;
+    BYTE Usage;
+    BYTE UsageIndex;
+};
+
+struct D3DVERTEXBUFFER_DESC { D3DPOOL Pool; UINT Size; };
+struct D3DINDEXBUFFER_DESC { D3DPOOL Pool; UINT Size; };
+struct D3DSURFACE_DESC { D3DFORMAT Format; D3DPOOL Pool; UINT Width; UINT Height; };
+struct D3DLOCKED_RECT { int Pitch; void* pBits; };
+
+struct IUnknown
+{
+    virtual ~IUnknown() {}
+    virtual unsigned long Release() { delete this; return 0; }
+};
+
+// Buffers keep their contents in CPU memory
+struct IDirect3DVertexBuffer9 : IUnknown
+{
+    D3DPOOL pool;
+    char*   data;
+    UINT    size;
+
+    IDirect3DVertexBuffer9(UINT size, D3DPOOL pool);
+    ~IDirect3DVertexBuffer9();
+    HRESULT Lock(UINT offset, UINT size, void** ppData, DWORD flags);
+    HRESULT Unlock() { return S_OK; }
+    HRESULT GetDesc(D3DVERTEXBUFFER_DESC* pDesc);
+};
+
+struct IDirect3DIndexBuffer9 : IUnknown
+{
+    D3DPOOL pool;
+    char*   data;
+    UINT    size;
+
+    IDirect3DIndexBuffer9(UINT size, D3DPOOL pool);
+    ~IDirect3DIndexBuffer9();
+    HRESULT Lock(UINT offset, UINT size, void** ppData, DWORD flags);
+    HRESULT Unlock() { return S_OK; }
+    HRESULT GetDesc(D3DINDEXBUFFER_DESC* pDesc);
+};
+
+struct IDirect3DBaseTexture9 : IUnknown
+{
+};
+
+// One level in CPU memory, 4 bytes a texel unless it is A32B32G32R32F
+struct IDirect3DTexture9 : IDirect3DBaseTexture9
+{
+    D3DSURFACE_DESC desc;
+    char*           data;
+    int             pitch;
+
+    IDirect3DTexture9(UINT width, UINT height, D3DFORMAT format, D3DPOOL pool);
+    ~IDirect3DTexture9();
+    DWORD GetLevelCount() { return 1; }
+    HRESULT GetLevelDesc(UINT level, D3DSURFACE_DESC* pDesc);
+    HRESULT LockRect(UINT level, D3DLOCKED_RECT* pRect, const RECT* pArea, DWORD flags);
+    HRESULT UnlockRect(UINT level) { return S_OK; }
+};
+
+struct IDirect3DSurface9 : IUnknown
+{
+};
+
+struct IDirect3DVertexDeclaration9 : IUnknown
+{
+};
+
+// Draws are counted, nothing is rasterized
+struct IDirect3DDevice9 : IUnknown
+{
+    UINT drawCalls;
+    UINT primitives;
+
+    IDirect3DDevice9() : drawCalls(0), primitives(0) {}
+    HRESULT CreateVertexBuffer(UINT length, DWORD usage, DWORD fvf, D3DPOOL pool, IDirect3DVertexBuffer9** ppBuffer, HANDLE* pShared);
+    HRESULT CreateIndexBuffer(UINT length, DWORD usage, D3DFORMAT format, D3DPOOL pool, IDirect3DIndexBuffer9** ppBuffer, HANDLE* pShared);
+    HRESULT CreateVertexDeclaration(const D3DVERTEXELEMENT9* pElements, IDirect3DVertexDeclaration9** ppDecl);
+    HRESULT CreateTexture(UINT width, UINT height, UINT levels, DWORD usage, D3DFORMAT format, D3DPOOL pool, IDirect3DTexture9** ppTexture, HANDLE* pShared);
+    HRESULT SetVertexDeclaration(IDirect3DVertexDeclaration9* pDecl) { return S_OK; }
+    HRESULT SetStreamSource(UINT stream, IDirect3DVertexBuffer9* pBuffer, UINT offset, UINT stride) { return S_OK; }
+    HRESULT SetStreamSourceFreq(UINT stream, UINT setting) { return S_OK; }
+    HRESULT SetIndices(IDirect3DIndexBuffer9* pBuffer) { return S_OK; }
+    HRESULT SetFVF(DWORD fvf) { return S_OK; }
+    HRESULT DrawPrimitive(D3DPRIMITIVETYPE type, UINT start, UINT count);
+    HRESULT DrawIndexedPrimitive(D3DPRIMITIVETYPE type, int base, UINT minIndex, UINT vertices, UINT start, UINT count);
+    HRESULT SetRenderState(D3DRENDERSTATETYPE state, DWORD value) { return S_OK; }
+    HRESULT SetSamplerState(DWORD sampler, D3DSAMPLERSTATETYPE type, DWORD value) { return S_OK; }
+    HRESULT SetTransform(D3DTRANSFORMSTATETYPE type, const D3DMATRIX* pMatrix) { return S_OK; }
+    HRESULT SetMaterial(const D3DMATERIAL9* pMaterial) { return S_OK; }
+    HRESULT SetTexture(DWORD stage, IDirect3DBaseTexture9* pTexture) { return S_OK; }
+    HRESULT SetRenderTarget(DWORD index, IDirect3DSurface9* pSurface) { return S_OK; }
+    HRESULT Clear(DWORD count, const D3DRECT* pRects, DWORD flags, D3DCOLOR color, float z, DWORD stencil) { return S_OK; }
+    HRESULT BeginScene() { return S_OK; }
+    HRESULT EndScene() { return S_OK; }
+    HRESULT Present(const RECT* pSource, const RECT* pDest, HWND window, const void* pDirty) { return S_OK; }
+};
+
+struct IDirect3D9 : IUnknown
+{
+};
+
+typedef IDirect3D9*                  LPDIRECT3D9;
+typedef IDirect3DDevice9*            LPDIRECT3DDEVICE9;
+typedef IDirect3DBaseTexture9*       LPDIRECT3DBASETEXTURE9;
+typedef IDirect3DTexture9*           LPDIRECT3DTEXTURE9;
+typedef IDirect3DSurface9*           LPDIRECT3DSURFACE9;
+typedef IDirect3DVertexDeclaration9* LPDIRECT3DVERTEXDECLARATION9;
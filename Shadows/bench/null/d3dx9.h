@@ -0,0 +1,34 @@
+#pragma once
+// Effect calls used by the shadow geometry code, see d3d9.h. The math is
+// ShadowMath.h.
+#include "d3d9.h"
+
+typedef const char* D3DXHANDLE;
+
+// Passes & parameters do nothing, see IDirect3DDevice9
+struct ID3DXEffect : IUnknown
+{
+    HRESULT SetTechnique(D3DXHANDLE technique) { return S_OK; }
+    HRESULT Begin(UINT* pPasses, DWORD flags) { *pPasses = 1; return S_OK; }
+    HRESULT End() { return S_OK; }
+    HRESULT BeginPass(UINT pass) { return S_OK; }
+    HRESULT EndPass() { return S_OK; }
+    HRESULT SetMatrix(D3DXHANDLE parameter, const D3DXMATRIX* pMatrix) { return S_OK; }
+    HRESULT SetVector(D3DXHANDLE parameter, const D3DXVECTOR4* pVector) { return S_OK; }
+    HRESULT SetFloat(D3DXHANDLE parameter, float value) { return S_OK; }
+    HRESULT SetTexture(D3DXHANDLE parameter, IDirect3DBaseTexture9* pTexture) { return S_OK; }
+};
+
+// Never created by the null device
+struct ID3DXMesh : IUnknown
+{
+    HRESULT DrawSubset(DWORD subset) { return S_OK; }
+};
+
+struct ID3DXFont : IUnknown
+{
+};
+
+typedef ID3DXEffect* LPD3DXEFFECT;
+typedef ID3DXFont*   LPD3DXFONT;
+typedef ID3DXMesh*   LPD3DXMESH;
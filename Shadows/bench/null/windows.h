@@ -0,0 +1,30 @@
+#pragma once
+// Windows types the device free parts of the renderer use, so they build
+// against the null device on other platforms. Not a port of the API.
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+typedef unsigned long  DWORD;
+typedef unsigned short WORD;
+typedef unsigned char  BYTE;
+typedef int            BOOL;
+typedef unsigned int   UINT;
+typedef long           LONG;
+typedef long           HRESULT;
+typedef void*          HANDLE;
+typedef void*          HWND;
+typedef void*          LPVOID;
+typedef const char*    LPCSTR;
+
+#define TRUE  1
+#define FALSE 0
+#define S_OK  ((HRESULT)0)
+#define E_FAIL ((HRESULT)0x80004005L)
+#define SUCCEEDED(hr) ((HRESULT)(hr) >= 0)
+#define FAILED(hr) ((HRESULT)(hr) < 0)
+
+struct RECT
+{
+    LONG left, top, right, bottom;
+};
@@ -21,6 +21,31 @@ sampler textureSampler = sampler_state
     MagFilter = ANISOTROPIC;
 };
 
+// baked visibility of the light, see BakedShadows
+texture bakedVisibility;
+sampler bakedSampler = sampler_state
+{
+    Texture   = (bakedVisibility);
+    MinFilter = LINEAR;
+    MagFilter = LINEAR;
+    MipFilter = LINEAR;
+    AddressU  = CLAMP;
+    AddressV  = CLAMP;
+};
+
+// edge records of instanced silhouettes, 6 texels per edge, see ShadowGeometry
+texture edgeTexture;
+float2  edgeTexelSize;
+sampler edgeSampler = sampler_state
+{
+    Texture   = (edgeTexture);
+    MinFilter = POINT;
+    MagFilter = POINT;
+    MipFilter = NONE;
+    AddressU  = CLAMP;
+    AddressV  = CLAMP;
+};
+
 // depth texture
 texture zTexture;
 sampler zTextureSampler = sampler_state
@@ -73,6 +98,13 @@ struct VS_INPUT_VE
 	float4 edge				: TEXCOORD3;	
 };
 
+// Edge instance: template corner & the id of the edge, low byte first
+struct VS_INPUT_EI
+{
+	float4 corner			: TEXCOORD0;	// end, face of normal, normal w, edge w
+	float4 edgeId			: TEXCOORD1;
+};
+
 struct VS_OUTPUT_VE
 {
 	float4 position			: POSITION;
@@ -122,11 +154,12 @@ float4 RenderScenePS_PL( VS_OUTPUT_PL vertex ) : COLOR0
     float4 		output;
 	float 		dist = length(vertex.lightDirection);
 	float 		attenuation = 1.0 + dist * linearAttenuation;
+	float 		inRange = step(dist, lightRange); // light ends at its range, like the culling
 	
     output =  	DiffuseProduct(vertex.normal, vertex.lightDirection/dist) 
 				+ SpecularProduct( vertex.normal, vertex.eyeDirection, vertex.lightDirection);  
 	
-    return output / attenuation;
+    return output * inRange / attenuation;
 }
 
 // Vertex shader
@@ -151,11 +184,12 @@ float4 RenderScenePS_PLT(VS_OUTPUT_PLT vertex) : COLOR0
     float4 		output;
 	float 		dist = length(vertex.lightDirection);
 	float 		attenuation = 1.0 + dist * linearAttenuation;
+	float 		inRange = step(dist, lightRange);
 	
     output = DiffuseProduct( vertex.normal, vertex.lightDirection/dist ) * tex2D(textureSampler, vertex.texel) 
 				  + SpecularProduct( vertex.normal, vertex.eyeDirection, vertex.lightDirection);
 	
-    return output / attenuation;
+    return output * inRange / attenuation;
 }
 
 technique Lighting
@@ -328,6 +362,42 @@ VS_OUTPUT_VE ExtrudePenumbra( VS_INPUT_VE vertex )
     return result;    
 }
 
+// Shadow vertex of an edge instance from its record, as
+// ShadowMesh::ExpandEdgeCorner does on the CPU
+VS_INPUT_VE FetchEdgeVertex( VS_INPUT_EI instance )
+{
+	VS_INPUT_VE vertex;
+	float4      texel = float4( (instance.edgeId.x * 6.0 + 0.5) * edgeTexelSize.x,
+	                            (instance.edgeId.y + instance.edgeId.z * 256.0 + 0.5) * edgeTexelSize.y, 0.0, 0.0 );
+	float3      v0 = tex2Dlod(edgeSampler, texel).xyz;
+	float3      v1 = tex2Dlod(edgeSampler, texel + float4(edgeTexelSize.x, 0.0, 0.0, 0.0)).xyz;
+	float3      n0 = tex2Dlod(edgeSampler, texel + float4(2.0 * edgeTexelSize.x, 0.0, 0.0, 0.0)).xyz;
+	float3      n1 = tex2Dlod(edgeSampler, texel + float4(3.0 * edgeTexelSize.x, 0.0, 0.0, 0.0)).xyz;
+	float3      f0 = tex2Dlod(edgeSampler, texel + float4(4.0 * edgeTexelSize.x, 0.0, 0.0, 0.0)).xyz;
+	float3      f1 = tex2Dlod(edgeSampler, texel + float4(5.0 * edgeTexelSize.x, 0.0, 0.0, 0.0)).xyz;
+	bool        atV1 = instance.corner.x > 0.5;
+	bool        fromF1 = instance.corner.y > 0.5;
+
+	vertex.position = float4(atV1 ? v1 : v0, 1.0);
+	vertex.vNormal0 = atV1 ? n1 : n0;
+	vertex.vNormal1 = atV1 ? n0 : n1;
+	vertex.normal = float4(fromF1 ? f1 : f0, instance.corner.z);
+	vertex.backNormal = fromF1 ? f0 : f1;
+	vertex.edge = float4((v1 - v0) * instance.corner.w, instance.corner.w);
+	
+	return vertex;
+}
+
+float4 ExtrudeEdgeFromLight( VS_INPUT_EI instance ) : POSITION
+{
+	return ExtrudeFromLight( FetchEdgeVertex(instance) );
+}
+
+VS_OUTPUT_VE ExtrudeEdgePenumbra( VS_INPUT_EI instance )
+{
+	return ExtrudePenumbra( FetchEdgeVertex(instance) );
+}
+
 // Pixel shader
 float4 PenumbraAlpha( VS_OUTPUT_VE vertex ) : COLOR0
 {
@@ -347,6 +417,20 @@ float4 PenumbraAlpha( VS_OUTPUT_VE vertex ) : COLOR0
 		return 1.0;
 }
 
+// PenumbraAlpha for shader model 3, whose pixel shaders take no POSITION
+float4 EdgePenumbraAlpha( float4 front : TEXCOORD0, float4 back : TEXCOORD1, float4 left : TEXCOORD2,
+                          float4 right : TEXCOORD3, float4 projPos : TEXCOORD4 ) : COLOR0
+{
+	VS_OUTPUT_VE vertex;
+
+	vertex.position = 0.0;
+	vertex.front = front;
+	vertex.back = back;
+	vertex.left = left;
+	vertex.right = right;
+	vertex.projPos = projPos;
+	return PenumbraAlpha(vertex);
+}
 
 technique ShowPenumbraCone
 {
@@ -434,6 +518,67 @@ technique Shadow
         StencilFunc = LessEqual;
         StencilPass = Keep;		
     }
+
+    // P0 & P1 over edge instances, vertex texture fetch needs shader model 3
+    pass P2
+    {          
+        VertexShader = compile vs_3_0 ExtrudeEdgeFromLight();
+        PixelShader  = compile ps_3_0 Fill(); 
+		
+		CullMode = None;
+		
+        AlphaBlendEnable = false;   
+        BlendOp = Add;
+        SrcBlend = DestAlpha;
+        DestBlend = One;		
+		ColorWriteEnable = false;
+
+		ZEnable = true;
+        ZWriteEnable = false;
+        ZFunc = LessEqual;
+
+		SlopeScaleDepthBias = 0.0;
+		DepthBias = 0.0;
+		
+        TwoSidedStencilMode = true;
+        StencilEnable = true;
+	    StencilMask = 0xFF;
+        StencilWriteMask = 0xFF;	
+        Ccw_StencilFunc = Always;
+        Ccw_StencilZFail = Incr;
+        Ccw_StencilPass = Keep;
+        StencilFunc = Always;
+        StencilZFail = Decr;
+        StencilPass = Keep;	
+    }
+
+    pass P3
+    {          
+        VertexShader = compile vs_3_0 ExtrudeEdgePenumbra();
+        PixelShader  = compile ps_3_0 EdgePenumbraAlpha(); 
+		
+        CullMode = None;
+		ColorWriteEnable = alpha;
+        
+		ZEnable = true;
+		ZWriteEnable = false;
+		ZFunc = Greater;
+        
+		SlopeScaleDepthBias = 0.1;
+		DepthBias = 0.0001;
+		
+		AlphaBlendEnable = true;
+		BlendOp = Min;
+        SrcBlend = One;
+        DestBlend = One;
+
+		StencilEnable = true;
+		TwoSidedStencilMode = false;
+		StencilRef = 0x10;
+	    StencilWriteMask = 0;	
+        StencilFunc = LessEqual;
+        StencilPass = Keep;		
+    }
 }
 
 
@@ -504,3 +649,82 @@ technique ClearStencilAlpha
     }
 }
 
+// Pixel shader
+float4 UmbraAlphaPS() : COLOR0
+{
+	return 0.0f;
+}
+
+// Light visibility of the approximation in alpha, umbra pixels get 0
+technique UmbraAlpha
+{
+    pass P0
+    {          
+        VertexShader = compile vs_2_0 ClearStencilAlphaVS();
+        PixelShader  = compile ps_2_0 UmbraAlphaPS(); 
+
+		CullMode = none;
+		ZEnable = false;	
+		AlphaBlendEnable = false;
+		StencilEnable = true;
+		TwoSidedStencilMode = false;
+        StencilMask = 0xFF;		
+        StencilWriteMask = 0;
+        StencilFunc = Greater;
+		StencilRef = 0x10;
+		StencilPass = Keep;
+		ColorWriteEnable = alpha;
+    }
+}
+
+
+struct VS_OUTPUT_BS
+{
+    float4 position : POSITION;
+    float2 texel    : TEXCOORD0;
+};
+
+// VertexShader
+VS_OUTPUT_BS BakedShadowVS( float4 position : POSITION, float2 texel : TEXCOORD0 )
+{
+	VS_OUTPUT_BS result;
+
+	result.position = mul(position, worldViewProjMatrix);
+	result.texel = texel;
+
+	return result;
+}
+
+// Pixel shader
+float4 BakedShadowPS( VS_OUTPUT_BS vertex ) : COLOR0
+{
+	return tex2D(bakedSampler, vertex.texel).r;
+}
+
+// Shadows of static casters into alpha, combined with the penumbra of the
+// volumes by the minimum
+technique BakedShadow
+{
+    pass P0
+    {
+        VertexShader = compile vs_2_0 BakedShadowVS();
+        PixelShader  = compile ps_2_0 BakedShadowPS();
+
+		CullMode = CCW;
+		ColorWriteEnable = alpha;
+
+		ZEnable = true;
+		ZWriteEnable = false;
+		ZFunc = LessEqual;
+		SlopeScaleDepthBias = 0.0;
+		DepthBias = -0.00001;
+
+		AlphaBlendEnable = true;
+		BlendOp = Min;
+		SrcBlend = One;
+		DestBlend = One;
+
+		StencilEnable = false;
+		TwoSidedStencilMode = false;
+    }
+}
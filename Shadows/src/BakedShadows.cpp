@@ -0,0 +1,133 @@
+#include "BakedShadows.h"
+#include "RenderCalls.h"
+#include <cstring>
+
+using namespace std;
+
+// Vertex of a receiver, see fvf
+struct BakedVertex
+{
+    float position[3];
+    float texcoord[2];
+};
+
+BakedShadows::BakedShadows() {
+}
+
+BakedShadows::~BakedShadows() {
+    Clear();
+}
+
+void BakedShadows::Clear() {
+    for(int i = 0; i<receivers.size(); ++i) {
+        if (receivers[i].pVertexBuffer)
+            receivers[i].pVertexBuffer->Release();
+    }
+    for(int i = 0; i<layers.size(); ++i) {
+        if (layers[i])
+            layers[i]->Release();
+    }
+    receivers.clear();
+    layers.clear();
+    lightmap.Clear();
+    isStatic.clear();
+}
+
+bool BakedShadows::Load(const string& sceneFile, const Scene& scene) {
+    Clear();
+    scene.GetStaticInstances(isStatic);
+    if ( !lightmap.Load( Lightmap::GetFileName(sceneFile) ) )
+        return false;
+    if ( lightmap.key != scene.GetStaticKey() || lightmap.instances != scene.instances.size() ) {
+        lightmap.Clear();
+        return false;
+    }
+
+    // Triangle lists, the order of the file
+    for(int i = 0; i<lightmap.receivers.size(); ++i) {
+        const LightmapReceiver& source = lightmap.receivers[i];
+        Receiver                receiver = { source.instance, (int)source.positions.size() / 9, NULL };
+        BakedVertex*            vertices;
+
+        if ( FAILED( pd3dDevice->CreateVertexBuffer(3 * receiver.triangles * sizeof(BakedVertex), D3DUSAGE_WRITEONLY, fvf, D3DPOOL_MANAGED, &receiver.pVertexBuffer, NULL) ) ) {
+            Clear();
+            return false;
+        }
+        receiver.pVertexBuffer->Lock(0, 0, (void**)&vertices, 0);
+        for(int j = 0; j<3 * receiver.triangles; ++j) {
+            memcpy(vertices[j].position, &source.positions[3 * j], sizeof(vertices[j].position));
+            memcpy(vertices[j].texcoord, &source.texcoords[2 * j], sizeof(vertices[j].texcoord));
+        }
+        receiver.pVertexBuffer->Unlock();
+        receivers.push_back(receiver);
+    }
+
+    // Mipmaps keep distant receivers from flickering
+    for(int i = 0; i<lightmap.layers.size(); ++i) {
+        IDirect3DTexture9* pTexture = NULL;
+        D3DLOCKED_RECT     rect;
+
+        if ( FAILED( pd3dDevice->CreateTexture(lightmap.size, lightmap.size, 0, D3DUSAGE_AUTOGENMIPMAP, D3DFMT_L8, D3DPOOL_MANAGED, &pTexture, NULL) ) ) {
+            Clear();
+            return false;
+        }
+        pTexture->LockRect(0, &rect, NULL, 0);
+        for(int y = 0; y<lightmap.size; ++y)
+            memcpy((unsigned char*)rect.pBits + y * rect.Pitch, &lightmap.layers[i].visibility[y * lightmap.size], lightmap.size);
+        pTexture->UnlockRect(0);
+        layers.push_back(pTexture);
+
+        // Position & radius are all that is left to check
+        vector<unsigned char>().swap(lightmap.layers[i].visibility);
+    }
+    for(int i = 0; i<lightmap.receivers.size(); ++i) {
+        vector<float>().swap(lightmap.receivers[i].positions);
+        vector<float>().swap(lightmap.receivers[i].texcoords);
+    }
+    return true;
+}
+
+// Light is where its layer was baked
+bool BakedShadows::IsBaked(int lightIndex, const Light& light) const {
+    const float position[3] = { light.position.x, light.position.y, light.position.z };
+
+    return lightIndex < layers.size() && lightmap.Matches(lightIndex, position, light.radius);
+}
+
+// Baked visibility of light into alpha for the visible static receivers
+void BakedShadows::Render(int lightIndex, const D3DXMATRIX& world, const vector<Mesh>& meshes, const vector<char>& meshVisible) const {
+    D3DXMATRIX projMatrix;
+    UINT       uPasses;
+
+    Device::Marker("BakedShadows");
+    pd3dDevice->GetTransform(D3DTS_PROJECTION, &projMatrix);
+    Effect::SetTechnique("BakedShadow");
+    Effect::SetTexture("bakedVisibility", layers[lightIndex]);
+    Effect::Begin(&uPasses);
+    Device::SetFVF(fvf);
+    for(int i = 0; i<receivers.size(); ++i) {
+        const Receiver& receiver = receivers[i];
+        D3DXMATRIX      worldViewProjMatrix;
+
+        if (!meshVisible[receiver.instance])
+            continue;
+
+        D3DXMatrixMultiply(&worldViewProjMatrix, &meshes[receiver.instance].GetTransform(), &world);
+        D3DXMatrixMultiply(&worldViewProjMatrix, &worldViewProjMatrix, &projMatrix);
+        Effect::SetMatrix("worldViewProjMatrix", &worldViewProjMatrix);
+
+        Effect::BeginPass(0);
+        Device::SetStreamSource(0, receiver.pVertexBuffer, 0, sizeof(BakedVertex));
+        Device::DrawPrimitive(D3DPT_TRIANGLELIST, 0, receiver.triangles);
+        Effect::EndPass();
+    }
+    Effect::End();
+}
+
+// Vertex buffers & layers
+void BakedShadows::AddMemoryUsage(MemoryReport& report) const {
+    for(int i = 0; i<receivers.size(); ++i)
+        report.Add("lightmap", "baked shadows", MemoryReport::Of(receivers[i].pVertexBuffer));
+    for(int i = 0; i<layers.size(); ++i)
+        report.Add("lightmap", "baked shadows", MemoryReport::Of(layers[i]));
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include "Lightmap.h"
+#include "MemoryReport.h"
+#include "Mesh.h"
+#include "Scene.h"
+#include <string>
+#include <vector>
+
+//-----------------------------------------------------------------------------
+// BakedShadows class
+// Soft shadows of static casters from the lightmap tools/LightmapBake wrote
+// for the scene. A light whose layer matches it draws the static receivers
+// once more with their layer, which goes into destination alpha with the
+// minimum like the penumbra wedges, so it composes with the volumes of the
+// dynamic casters. Static casters then need a volume only where it can fall
+// on a dynamic receiver. A light moved or resized away from its bake falls
+// back to volumes for every caster.
+//-----------------------------------------------------------------------------
+class BakedShadows
+{
+private:
+    // Static instance & its triangles with atlas coordinates
+    struct Receiver
+    {
+        int                     instance;
+        int                     triangles;
+        IDirect3DVertexBuffer9* pVertexBuffer;
+    };
+
+    std::vector<Receiver>           receivers;
+    std::vector<IDirect3DTexture9*> layers;     // per light of the scene
+    Lightmap                        lightmap;   // lights of the layers, visibility is dropped
+    std::vector<char>               isStatic;   // per instance
+
+public:
+    // Position & atlas coordinates
+    static const DWORD fvf = D3DFVF_XYZ | D3DFVF_TEX1;
+
+    BakedShadows();
+    ~BakedShadows();
+
+    // Load the scene's lightmap if it was baked for its static instances.
+    // Returns false if missing, damaged or stale.
+    bool Load(const std::string& sceneFile, const Scene& scene);
+
+    void Clear();
+
+    bool IsLoaded() const { return !layers.empty(); }
+
+    // Instance never moves, see Scene::GetStaticInstances
+    bool IsStatic(int instance) const { return instance < isStatic.size() && isStatic[instance]; }
+
+    // Light is where its layer was baked
+    bool IsBaked(int lightIndex, const Light& light) const;
+
+    // Baked visibility of light into alpha for the visible static receivers
+    void Render(int lightIndex, const D3DXMATRIX& world, const std::vector<Mesh>& meshes, const std::vector<char>& meshVisible) const;
+
+    // Vertex buffers & layers
+    void AddMemoryUsage(MemoryReport& report) const;
+};
@@ -0,0 +1,335 @@
+#include "Bvh.h"
+#include <algorithm>
+#include <cfloat>
+
+using namespace std;
+
+// Bins along the split axis
+static const int numBins = 16;
+
+float Bvh::rebuildFactor = 1.5f;
+
+void Bounds::Reset() {
+    for(int i = 0; i<3; ++i) {
+        min[i] = FLT_MAX;
+        max[i] = -FLT_MAX;
+    }
+}
+
+void Bounds::Add(const Bounds& bounds) {
+    for(int i = 0; i<3; ++i) {
+        if (bounds.min[i] < min[i]) min[i] = bounds.min[i];
+        if (bounds.max[i] > max[i]) max[i] = bounds.max[i];
+    }
+}
+
+// Surface area, zero for empty box
+float Bounds::GetArea() const {
+    float dx = max[0] - min[0];
+    float dy = max[1] - min[1];
+    float dz = max[2] - min[2];
+
+    if (dx < 0.0f || dy < 0.0f || dz < 0.0f)
+        return 0.0f;
+    return 2.0f * (dx*dy + dy*dz + dz*dx);
+}
+
+static float Centroid(const Bounds& bounds, int axis) {
+    return 0.5f * (bounds.min[axis] + bounds.max[axis]);
+}
+
+Bvh::Bvh() : buildCost(0.0f), cost(0.0f) {
+}
+
+void Bvh::Build(const vector<Bounds>& bounds) {
+    itemBounds = bounds;
+    items.resize( itemBounds.size() );
+    for(int i = 0; i<(int)items.size(); ++i)
+        items[i] = i;
+
+    nodes.clear();
+    if (items.empty()) {
+        buildCost = cost = 0.0f;
+        return;
+    }
+
+    nodes.reserve( 2 * items.size() );
+    nodes.push_back( Node() );
+    Split(0, 0, items.size(), 0);
+    buildCost = cost = ComputeCost();
+}
+
+// Split node items by binned surface area heuristic
+void Bvh::Split(int node, int first, int count, int depth) {
+    Bounds  bounds, centroids;
+    int     axis = 0;
+    int     middle = first;
+
+    bounds.Reset();
+    centroids.Reset();
+    for(int i = first; i<first + count; ++i) {
+        const Bounds& item = itemBounds[ items[i] ];
+        Bounds        center;
+
+        for(int j = 0; j<3; ++j)
+            center.min[j] = center.max[j] = Centroid(item, j);
+        bounds.Add(item);
+        centroids.Add(center);
+    }
+    nodes[node].bounds = bounds;
+    nodes[node].first = first;
+    nodes[node].count = count;
+
+    if (count <= maxLeafItems)
+        return;
+
+    // Longest centroid extent
+    for(int j = 1; j<3; ++j) {
+        if (centroids.max[j] - centroids.min[j] > centroids.max[axis] - centroids.min[axis])
+            axis = j;
+    }
+
+    float extent = centroids.max[axis] - centroids.min[axis];
+    if (extent > 0.0f && depth < maxSahDepth) {
+        Bounds binBounds[numBins];
+        int    binCounts[numBins] = { 0 };
+        float  leftArea[numBins];
+        int    leftCount[numBins];
+        float  bestCost = FLT_MAX;
+        int    bestSplit = 0;
+        float  scale = numBins / extent;
+
+        for(int i = 0; i<numBins; ++i)
+            binBounds[i].Reset();
+        for(int i = first; i<first + count; ++i) {
+            const Bounds& item = itemBounds[ items[i] ];
+            int           bin = min( static_cast<int>( (Centroid(item, axis) - centroids.min[axis]) * scale ), numBins - 1 );
+
+            binBounds[bin].Add(item);
+            ++binCounts[bin];
+        }
+
+        // Sweep from left, then evaluate splits sweeping from right
+        Bounds sweep;
+        int    sweepCount = 0;
+
+        sweep.Reset();
+        for(int i = 0; i<numBins - 1; ++i) {
+            sweep.Add(binBounds[i]);
+            sweepCount += binCounts[i];
+            leftArea[i] = sweep.GetArea();
+            leftCount[i] = sweepCount;
+        }
+
+        sweep.Reset();
+        sweepCount = 0;
+        for(int i = numBins - 1; i>0; --i) {
+            float splitCost;
+
+            sweep.Add(binBounds[i]);
+            sweepCount += binCounts[i];
+            splitCost = leftArea[i-1] * leftCount[i-1] + sweep.GetArea() * sweepCount;
+            if (leftCount[i-1] > 0 && sweepCount > 0 && splitCost < bestCost) {
+                bestCost = splitCost;
+                bestSplit = i;
+            }
+        }
+
+        if (bestSplit > 0) {
+            int* begin = &items[0] + first;
+            int* split = partition( begin, begin + count, [&](int item) {
+                return min( static_cast<int>( (Centroid(itemBounds[item], axis) - centroids.min[axis]) * scale ), numBins - 1 ) < bestSplit;
+            } );
+
+            middle = split - &items[0];
+        }
+    }
+
+    // Same centroids or too deep: halve by median
+    if (middle == first || middle == first + count) {
+        int* begin = &items[0] + first;
+
+        middle = first + count / 2;
+        nth_element( begin, &items[0] + middle, begin + count, [&](int left, int right) {
+            return Centroid(itemBounds[left], axis) < Centroid(itemBounds[right], axis);
+        } );
+    }
+
+    // Children follow the parent, so refit can walk nodes backwards
+    int left = nodes.size();
+    nodes.push_back( Node() );
+    nodes.push_back( Node() );
+    nodes[node].first = left;
+    nodes[node].count = 0;
+    Split(left, first, middle - first, depth + 1);
+    Split(left + 1, middle, first + count - middle, depth + 1);
+}
+
+// Surface area heuristic of the whole tree
+float Bvh::ComputeCost() const {
+    float rootArea = nodes[0].bounds.GetArea();
+    float sum = 0.0f;
+
+    if (rootArea <= 0.0f)
+        return 0.0f;
+
+    for(int i = 0; i<(int)nodes.size(); ++i)
+        sum += nodes[i].bounds.GetArea() * (nodes[i].count > 0 ? nodes[i].count : 1);
+    return sum / rootArea;
+}
+
+// Move item, takes effect with next Refit
+void Bvh::SetBounds(int item, const Bounds& bounds) {
+    itemBounds[item] = bounds;
+}
+
+// Update node boxes bottom up
+bool Bvh::Refit() {
+    if (nodes.empty())
+        return false;
+
+    for(int i = nodes.size() - 1; i>=0; --i) {
+        Node& node = nodes[i];
+
+        node.bounds.Reset();
+        if (node.count > 0) {
+            for(int j = node.first; j<node.first + node.count; ++j)
+                node.bounds.Add( itemBounds[ items[j] ] );
+        }
+        else {
+            node.bounds.Add( nodes[node.first].bounds );
+            node.bounds.Add( nodes[node.first + 1].bounds );
+        }
+    }
+
+    // Boxes of moved items overlap more and more
+    cost = ComputeCost();
+    if (cost > rebuildFactor * buildCost) {
+        Build(itemBounds);
+        return true;
+    }
+    return false;
+}
+
+// Items whose box touches the sphere
+int Bvh::QuerySphere(const float center[3], float radius, vector<int>& result) const {
+    int stack[maxStack];
+    int size = 0;
+    int visited = 0;
+
+    result.clear();
+    if (nodes.empty())
+        return 0;
+
+    stack[size++] = 0;
+    while (size > 0) {
+        const Node& node = nodes[ stack[--size] ];
+        float       distance = 0.0f;
+
+        // Squared distance from center to box
+        ++visited;
+        for(int i = 0; i<3; ++i) {
+            float d = 0.0f;
+
+            if (center[i] < node.bounds.min[i])
+                d = node.bounds.min[i] - center[i];
+            else if (center[i] > node.bounds.max[i])
+                d = center[i] - node.bounds.max[i];
+            distance += d * d;
+        }
+        if (distance > radius * radius)
+            continue;
+
+        if (node.count > 0) {
+            for(int i = node.first; i<node.first + node.count; ++i) {
+                const Bounds& bounds = itemBounds[ items[i] ];
+
+                // Leaf box may be bigger than the item box
+                distance = 0.0f;
+                for(int j = 0; j<3; ++j) {
+                    float d = max( max(bounds.min[j] - center[j], center[j] - bounds.max[j]), 0.0f );
+                    distance += d * d;
+                }
+                if (distance <= radius * radius)
+                    result.push_back( items[i] );
+            }
+        }
+        else {
+            stack[size++] = node.first + 1;
+            stack[size++] = node.first;
+        }
+    }
+
+    return visited;
+}
+
+// Box is outside plane, or fully inside it
+static bool Outside(const Bounds& bounds, const float plane[4]) {
+    float d = plane[3];
+
+    for(int i = 0; i<3; ++i)
+        d += plane[i] * (plane[i] > 0.0f ? bounds.max[i] : bounds.min[i]);
+    return d < 0.0f;
+}
+
+static bool Inside(const Bounds& bounds, const float plane[4]) {
+    float d = plane[3];
+
+    for(int i = 0; i<3; ++i)
+        d += plane[i] * (plane[i] > 0.0f ? bounds.min[i] : bounds.max[i]);
+    return d >= 0.0f;
+}
+
+// Items whose box is inside all planes. Planes a node is fully inside are
+// not tested again below it.
+int Bvh::QueryFrustum(const float planes[6][4], vector<int>& result) const {
+    int stack[maxStack];
+    int masks[maxStack];
+    int size = 0;
+    int visited = 0;
+
+    result.clear();
+    if (nodes.empty())
+        return 0;
+
+    stack[size] = 0;
+    masks[size++] = (1 << 6) - 1;
+    while (size > 0) {
+        --size;
+
+        const Node& node = nodes[ stack[size] ];
+        int         mask = masks[size];
+        bool        outside = false;
+
+        ++visited;
+        for(int i = 0; i<6 && !outside; ++i) {
+            if ( !(mask & (1 << i)) )
+                continue;
+            if ( Outside(node.bounds, planes[i]) )
+                outside = true;
+            else if ( Inside(node.bounds, planes[i]) )
+                mask &= ~(1 << i);
+        }
+        if (outside)
+            continue;
+
+        if (node.count > 0) {
+            for(int i = node.first; i<node.first + node.count; ++i) {
+                bool culled = false;
+
+                for(int j = 0; j<6 && !culled; ++j)
+                    culled = (mask & (1 << j)) && Outside(itemBounds[ items[i] ], planes[j]);
+                if (!culled)
+                    result.push_back( items[i] );
+            }
+        }
+        else {
+            stack[size] = node.first + 1;
+            masks[size++] = mask;
+            stack[size] = node.first;
+            masks[size++] = mask;
+        }
+    }
+
+    return visited;
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <vector>
+
+// Axis aligned box
+struct Bounds
+{
+    float min[3];
+    float max[3];
+
+    void Reset();
+    void Add(const Bounds& bounds);
+    float GetArea() const;
+};
+
+//-----------------------------------------------------------------------------
+// Bvh class
+// Bounding volume hierarchy over items given by their boxes (mesh instances).
+// Moved items are refitted in place, tree is rebuilt when refitting made it
+// much worse than the built one. Plain floats, so it runs without a device.
+//-----------------------------------------------------------------------------
+class Bvh
+{
+public:
+    // Leaf if count > 0: items[first, first+count). Otherwise children are
+    // nodes first and first+1, both after their parent. Root is node 0.
+    struct Node
+    {
+        Bounds bounds;
+        int    first;
+        int    count;
+    };
+
+private:
+    std::vector<Node>   nodes;
+    std::vector<int>    items;          // item ids ordered by leaves
+    std::vector<Bounds> itemBounds;     // by item id
+    float               buildCost;      // cost right after build
+    float               cost;
+
+    // Split items[first, first+count) of node, binned surface area heuristic.
+    // Deep nodes split at the median, so traversal stacks stay small.
+    void Split(int node, int first, int count, int depth);
+
+    // Sum of node areas relative to root, cost of an average query
+    float ComputeCost() const;
+
+public:
+    static const int maxLeafItems = 4;
+    static const int maxSahDepth = 40;
+    static const int maxStack = 64;
+
+    // Rebuild when refits make the tree this much worse
+    static float rebuildFactor;
+
+    Bvh();
+
+    void Build(const std::vector<Bounds>& bounds);
+
+    // Move item, takes effect with next Refit
+    void SetBounds(int item, const Bounds& bounds);
+
+    // Update node boxes bottom up, rebuilds if tree got too loose.
+    // Returns true when rebuilt.
+    bool Refit();
+
+    // Items whose box touches the sphere. Returns visited node count.
+    int QuerySphere(const float center[3], float radius, std::vector<int>& result) const;
+
+    // Items whose box is on the inner side of all planes (ax + by + cz + d >= 0).
+    // Returns visited node count.
+    int QueryFrustum(const float planes[6][4], std::vector<int>& result) const;
+
+    int GetItemCount() const { return itemBounds.size(); }
+    int GetNodeCount() const { return nodes.size(); }
+    float GetCost() const { return cost; }
+    const Bounds& GetBounds(int item) const { return itemBounds[item]; }
+
+    // Tree for own traversals, e.g. rays
+    const Node& GetNode(int node) const { return nodes[node]; }
+    int GetLeafItem(int index) const { return items[index]; }
+};
@@ -0,0 +1,314 @@
+#include "CaptureReplay.h"
+#include <algorithm>
+#include <cstring>
+#include <ostream>
+#include <sstream>
+
+using namespace std;
+
+// Arguments naming the state a command sets, the rest is its value. Effect
+// values & textures are set by name.
+static const int slotArgs[NumCaptureOps] = {
+    -1,     // Marker
+    -1,     // Clear
+    -1, -1, -1,
+    1,      // SetRenderState: state
+    2,      // SetSamplerState: sampler, type
+    1,      // SetTransform: type
+    0,      // SetMaterial
+    1,      // SetTexture: stage
+    1,      // SetRenderTarget: index
+    1,      // SetStreamSource: stream
+    0,      // SetIndices
+    0,      // SetVertexDeclaration
+    0,      // SetFVF
+    -1, -1, -1, -1, -1,
+    0,      // SetTechnique
+    -1, -1, -1, -1,
+    0,      // SetValue
+    0,      // Effect SetTexture
+    1       // SetStreamSourceFreq: stream
+};
+
+CaptureReplay::CaptureReplay() : indices(0), instances(1), badDraws(0), unknownDraws(0) {
+    memset(ops, 0, sizeof(ops));
+}
+
+// Replay from default state
+void CaptureReplay::Run(const FrameCapture& capture) {
+    const vector<CaptureCommand>& commands = capture.GetCommands();
+    int                           stage = 0;
+
+    memset(ops, 0, sizeof(ops));
+    stages.clear();
+    stageIds.clear();
+    state.clear();
+    indexLists.clear();
+    indices = badDraws = unknownDraws = 0;
+    instances = 1;
+
+    ReplayStage first = { "before markers", 1, 0, 0, 0, 0, 0 };
+    stages.push_back(first);
+
+    for(int i = 0; i<(int)commands.size(); ++i) {
+        const CaptureCommand& command = commands[i];
+        ReplayOpStats&        stats = ops[command.op];
+
+        ++stats.calls;
+        stats.bytes += command.size;
+
+        switch (command.op) {
+            case CaptureMarker: {
+                string                     name = capture.GetName(command.name);
+                map<string, int>::iterator found = stageIds.find(name);
+
+                if ( found == stageIds.end() ) {
+                    ReplayStage added = { name, 0, 0, 0, 0, 0, 0 };
+                    found = stageIds.insert( make_pair( name, static_cast<int>( stages.size() ) ) ).first;
+                    stages.push_back(added);
+                }
+                stage = found->second;
+                ++stages[stage].entered;
+                break;
+            }
+
+            case CaptureVertexUpload:
+            case CaptureIndexUpload:
+                stages[stage].uploadBytes += command.size;
+                if (command.op == CaptureIndexUpload && command.args[1] >= 0) {
+                    StateValue& list = indexLists[ command.args[0] ];
+                    size_t      end = command.args[1] + command.size;
+
+                    if (list.size() < end)
+                        list.resize(end);
+                    if (command.size > 0)
+                        memcpy(&list[ command.args[1] ], capture.GetData(command), command.size);
+                }
+                break;
+
+            case CaptureDraw:
+                ++stages[stage].draws;
+                stages[stage].primitives += command.args[2];
+                break;
+
+            case CaptureDrawIndexed:
+                ++stages[stage].draws;
+                stages[stage].primitives += (long long)command.args[5] * instances;
+                CheckDraw(command);
+                break;
+
+            case CaptureDrawSubset:
+                ++stages[stage].draws;
+                break;
+
+            default:
+                if (slotArgs[command.op] < 0)
+                    break;
+                ++stages[stage].stateCalls;
+                if ( !SetState(capture, command) ) {
+                    ++stats.redundant;
+                    ++stages[stage].redundant;
+                }
+                if (command.op == CaptureIndices)
+                    indices = command.args[0];
+                // D3DSTREAMSOURCE_INDEXEDDATA in the top bits, instances below
+                if (command.op == CaptureStreamSourceFreq && command.args[0] == 0)
+                    instances = (command.args[1] >> 30 & 3) == 1 ? command.args[1] & 0x3fffffff : 1;
+                break;
+        }
+    }
+}
+
+// Sets state of command, false if it had that value
+bool CaptureReplay::SetState(const FrameCapture& capture, const CaptureCommand& command) {
+    StateKey   key;
+    StateValue value;
+    int        slots = slotArgs[command.op];
+    int        args = FrameCapture::GetArgCount(command.op);
+    bool       byName = FrameCapture::HasName(command.op) && command.op != CaptureTechnique;
+
+    // An FVF replaces the declaration & the other way around
+    key.push_back(command.op == CaptureFvf ? CaptureVertexDeclaration : command.op);
+    key.insert(key.end(), command.args, command.args + slots);
+    if (byName)
+        key.push_back(command.name);
+
+    value.push_back( static_cast<unsigned char>(command.op) );
+    value.insert(value.end(), (const unsigned char*)(command.args + slots), (const unsigned char*)(command.args + args));
+    if (!byName)
+        value.insert(value.end(), (const unsigned char*)&command.name, (const unsigned char*)(&command.name + 1));
+    if (command.size > 0)
+        value.insert(value.end(), capture.GetData(command), capture.GetData(command) + command.size);
+
+    StateValue& current = state[key];
+    if (current == value)
+        return false;
+    current.swap(value);
+    return true;
+}
+
+// Check indices read by the draw
+void CaptureReplay::CheckDraw(const CaptureCommand& command) {
+    int base = command.args[1];
+    int minIndex = command.args[2];
+    int vertices = command.args[3];
+    int start = command.args[4];
+    int primitives = command.args[5];
+    int count = command.args[0] == 5 ? primitives + 2 : primitives * 3;   // strip or list
+
+    map<int, StateValue>::const_iterator found = indexLists.find(indices);
+    if ( found == indexLists.end() ) {
+        ++unknownDraws;
+        return;
+    }
+
+    const StateValue& list = found->second;
+    if ( start < 0 || count < 0 || (size_t)(start + count) * sizeof(int) > list.size() ) {
+        ++badDraws;
+        return;
+    }
+    for(int i = 0; i<count; ++i) {
+        int index;
+
+        memcpy(&index, &list[ (start + i) * sizeof(int) ], sizeof(int));
+        if (base + index < minIndex || base + index >= minIndex + vertices) {
+            ++badDraws;
+            return;
+        }
+    }
+}
+
+// Tables of ops & stages
+void CaptureReplay::Write(ostream& out) const {
+    out << "op\tcalls\tredundant\tbytes" << endl;
+    for(int i = 0; i<NumCaptureOps; ++i) {
+        if (ops[i].calls > 0)
+            out << FrameCapture::GetOpName( static_cast<CaptureOp>(i) ) << '\t' << ops[i].calls << '\t' << ops[i].redundant << '\t' << ops[i].bytes << endl;
+    }
+
+    out << endl << "stage\tentered\tdraws\tprimitives\tstate sets\tredundant\tupload bytes" << endl;
+    for(int i = 0; i<(int)stages.size(); ++i) {
+        const ReplayStage& stage = stages[i];
+
+        if (i > 0 || stage.draws > 0 || stage.stateCalls > 0 || stage.uploadBytes > 0)
+            out << stage.name << '\t' << stage.entered << '\t' << stage.draws << '\t' << stage.primitives << '\t'
+                << stage.stateCalls << '\t' << stage.redundant << '\t' << stage.uploadBytes << endl;
+    }
+
+    out << endl << "indexed draws outside their index list or vertex range\t" << badDraws << endl;
+    out << "indexed draws from buffers uploaded before the capture\t" << unknownDraws << endl;
+}
+
+// Stage of name, NULL if there is none
+const ReplayStage* CaptureReplay::FindStage(const string& name) const {
+    map<string, int>::const_iterator found = stageIds.find(name);
+
+    if ( name == stages[0].name )
+        return &stages[0];
+    return found != stageIds.end() ? &stages[found->second] : NULL;
+}
+
+// Command as text
+string CaptureReplay::Describe(const FrameCapture& capture, int index) {
+    const CaptureCommand& command = capture.GetCommands()[index];
+    ostringstream         text;
+
+    text << index << ' ' << FrameCapture::GetOpName(command.op);
+    if ( FrameCapture::HasName(command.op) )
+        text << ' ' << capture.GetName(command.name);
+    for(int i = 0; i<FrameCapture::GetArgCount(command.op); ++i)
+        text << ' ' << command.args[i];
+    if ( FrameCapture::HasData(command.op) )
+        text << ", " << command.size << " bytes";
+    return text.str();
+}
+
+// Commands equal, names compared as text
+static bool SameCommand(const FrameCapture& a, const CaptureCommand& x, const FrameCapture& b, const CaptureCommand& y) {
+    if ( x.op != y.op || x.size != y.size || strcmp( a.GetName(x.name), b.GetName(y.name) ) != 0 )
+        return false;
+    if ( memcmp( x.args, y.args, FrameCapture::GetArgCount(x.op) * sizeof(int) ) != 0 )
+        return false;
+    return x.size == 0 || memcmp(a.GetData(x), b.GetData(y), x.size) == 0;
+}
+
+// Writes the ops & stages that differ, then the first command that differs
+bool CaptureReplay::Diff(const FrameCapture& a, const FrameCapture& b, ostream& out) {
+    CaptureReplay                 first;
+    CaptureReplay                 second;
+    const vector<CaptureCommand>& x = a.GetCommands();
+    const vector<CaptureCommand>& y = b.GetCommands();
+    int                           differing = 0;
+    int                           firstDifference = -1;
+
+    first.Run(a);
+    second.Run(b);
+
+    out << "op\tcalls\tredundant\tbytes" << endl;
+    for(int i = 0; i<NumCaptureOps; ++i) {
+        const ReplayOpStats& p = first.ops[i];
+        const ReplayOpStats& q = second.ops[i];
+
+        if (p.calls != q.calls || p.redundant != q.redundant || p.bytes != q.bytes)
+            out << FrameCapture::GetOpName( static_cast<CaptureOp>(i) ) << '\t' << p.calls << " -> " << q.calls << '\t'
+                << p.redundant << " -> " << q.redundant << '\t' << p.bytes << " -> " << q.bytes << endl;
+    }
+
+    // By name, a stage of one capture only has none on the other side
+    vector<string> names;
+    for(int i = 0; i<(int)first.stages.size(); ++i)
+        names.push_back(first.stages[i].name);
+    for(int i = 0; i<(int)second.stages.size(); ++i) {
+        if ( !first.FindStage(second.stages[i].name) )
+            names.push_back(second.stages[i].name);
+    }
+
+    out << endl << "stage\tdraws\tprimitives\tstate sets\tredundant\tupload bytes" << endl;
+    for(int i = 0; i<(int)names.size(); ++i) {
+        ReplayStage        none = { names[i], 0, 0, 0, 0, 0, 0 };
+        const ReplayStage& p = first.FindStage(names[i]) ? *first.FindStage(names[i]) : none;
+        const ReplayStage& q = second.FindStage(names[i]) ? *second.FindStage(names[i]) : none;
+
+        if (p.draws != q.draws || p.primitives != q.primitives || p.stateCalls != q.stateCalls || p.redundant != q.redundant || p.uploadBytes != q.uploadBytes)
+            out << names[i] << '\t' << p.draws << " -> " << q.draws << '\t' << p.primitives << " -> " << q.primitives << '\t'
+                << p.stateCalls << " -> " << q.stateCalls << '\t' << p.redundant << " -> " << q.redundant << '\t'
+                << p.uploadBytes << " -> " << q.uploadBytes << endl;
+    }
+
+    out << endl;
+    if (first.badDraws != second.badDraws)
+        out << "indexed draws outside their index list or vertex range\t" << first.badDraws << " -> " << second.badDraws << endl;
+
+    for(int i = 0; i<(int)x.size() && i<(int)y.size(); ++i) {
+        if ( !SameCommand(a, x[i], b, y[i]) ) {
+            ++differing;
+            if (firstDifference < 0)
+                firstDifference = i;
+        }
+    }
+    if (firstDifference < 0 && x.size() != y.size())
+        firstDifference = static_cast<int>( min( x.size(), y.size() ) );
+
+    out << "commands\t" << x.size() << " -> " << y.size() << ", " << differing << " of the common ones differ" << endl;
+    if (firstDifference < 0) {
+        out << "same commands" << endl;
+        return true;
+    }
+    out << "first difference" << endl
+        << "< " << (firstDifference < (int)x.size() ? Describe(a, firstDifference) : "end") << endl
+        << "> " << (firstDifference < (int)y.size() ? Describe(b, firstDifference) : "end") << endl;
+
+    // Same call, other contents
+    if ( firstDifference < (int)x.size() && firstDifference < (int)y.size() && x[firstDifference].size == y[firstDifference].size ) {
+        const unsigned char* p = a.GetData(x[firstDifference]);
+        const unsigned char* q = b.GetData(y[firstDifference]);
+
+        for(size_t i = 0; i<x[firstDifference].size; ++i) {
+            if (p[i] != q[i]) {
+                out << "data differs from byte " << i << endl;
+                break;
+            }
+        }
+    }
+    return false;
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include "FrameCapture.h"
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <vector>
+
+// Calls of one op in a capture
+struct ReplayOpStats
+{
+    int       calls;
+    int       redundant;    // set a state to the value it had
+    size_t    bytes;        // uploaded or set
+};
+
+// Work of the commands after markers of one name
+struct ReplayStage
+{
+    std::string name;
+    int         entered;        // markers of the name
+    int         draws;
+    long long   primitives;     // of every instance, DrawSubset draws count none
+    int         stateCalls;
+    int         redundant;
+    size_t      uploadBytes;
+};
+
+//-----------------------------------------------------------------------------
+// CaptureReplay class
+// Recording backend for captured frames: runs the commands of a capture
+// against device state it keeps itself, with nothing drawn. Counts calls,
+// redundant state sets & uploaded bytes per op and per stage between
+// markers, and checks indexed draws against the index lists uploaded in the
+// frame: every index read has to be uploaded & lie in the vertex range the
+// draw gives. Index buffers are taken as 32 bit, like the shadow volumes.
+// State set before the capture is unknown, so the first set of each state
+// counts as a change.
+//-----------------------------------------------------------------------------
+class CaptureReplay
+{
+private:
+    typedef std::vector<int>           StateKey;       // op & slot
+    typedef std::vector<unsigned char> StateValue;
+
+    ReplayOpStats                       ops[NumCaptureOps];
+    std::vector<ReplayStage>            stages;         // in order of the first marker
+    std::map<std::string, int>          stageIds;
+    std::map<StateKey, StateValue>      state;
+    std::map<int, StateValue>           indexLists;     // by buffer id, uploaded in the frame
+    int                                 indices;        // bound index buffer
+    int                                 instances;      // of indexed draws, from the stream 0 frequency
+    int                                 badDraws;
+    int                                 unknownDraws;
+
+    // Sets state of command, false if it had that value
+    bool SetState(const FrameCapture& capture, const CaptureCommand& command);
+
+    // Check indices read by the draw
+    void CheckDraw(const CaptureCommand& command);
+
+    // Stage of name, NULL if there is none
+    const ReplayStage* FindStage(const std::string& name) const;
+
+public:
+    CaptureReplay();
+
+    // Replay from default state
+    void Run(const FrameCapture& capture);
+
+    const ReplayOpStats& GetOpStats(CaptureOp op) const { return ops[op]; }
+    const std::vector<ReplayStage>& GetStages() const { return stages; }
+    // Indexed draws reading indices outside the upload or the vertex range
+    int GetBadDraws() const { return badDraws; }
+    // Indexed draws from buffers uploaded before the capture
+    int GetUnknownDraws() const { return unknownDraws; }
+
+    // Tables of ops & stages
+    void Write(std::ostream& out) const;
+
+    // Command as text, e.g. "412 DrawIndexedPrimitive 4 0 0 1200 36 56"
+    static std::string Describe(const FrameCapture& capture, int index);
+
+    // Writes the ops & stages that differ, then the first command that
+    // differs. True if the captures are the same.
+    static bool Diff(const FrameCapture& a, const FrameCapture& b, std::ostream& out);
+};
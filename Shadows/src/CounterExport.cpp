@@ -0,0 +1,68 @@
+#include "CounterExport.h"
+#include <chrono>
+
+using namespace std;
+
+int CounterExport::pollInterval = 5;
+
+CounterExport::CounterExport() : stop(false), lines(0) {
+}
+
+CounterExport::~CounterExport() {
+    Stop();
+}
+
+// Start appending to file
+bool CounterExport::Start(const string& fileName) {
+    Stop();
+
+    file.open(fileName.c_str(), ios::out | ios::app);
+    if (!file)
+        return false;
+    file.precision(9);
+
+    stop = false;
+    thread = std::thread(&CounterExport::Run, this);
+    return true;
+}
+
+// Write the last frame & close the file
+void CounterExport::Stop() {
+    stop = true;
+    if ( thread.joinable() )
+        thread.join();
+    if ( file.is_open() )
+        file.close();
+}
+
+void CounterExport::Run() {
+    CounterRegistry* registry = CounterRegistry::Instance();
+
+    while (!stop) {
+        if ( registry->Acquire() )
+            Write( registry->GetSnapshot() );
+        else
+            this_thread::sleep_for( chrono::milliseconds(pollInterval) );
+    }
+    if ( registry->Acquire() )
+        Write( registry->GetSnapshot() );
+    file.flush();
+}
+
+// One flat JSON object, names escaped
+void CounterExport::Write(const CounterSnapshot& snapshot) {
+    file << "{\"frame\":" << snapshot.frame << ",\"time\":" << snapshot.time;
+    for(int i = 0; i<(int)snapshot.names.size(); ++i) {
+        const string& name = snapshot.names[i];
+
+        file << ",\"";
+        for(int j = 0; j<(int)name.size(); ++j) {
+            if (name[j] == '"' || name[j] == '\\')
+                file << '\\';
+            file << name[j];
+        }
+        file << "\":" << snapshot.values[i];
+    }
+    file << "}\n";
+    ++lines;
+}
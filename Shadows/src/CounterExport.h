@@ -0,0 +1,46 @@
+#pragma once
+#include "CounterRegistry.h"
+#include <atomic>
+#include <fstream>
+#include <string>
+#include <thread>
+
+//-----------------------------------------------------------------------------
+// CounterExport class
+// Appends the frames closed in the counter registry to a file as JSON lines
+// for dashboards, one flat object per frame:
+// {"frame":12,"time":0.531,"silhouette edges":596,...}
+// Runs on its own thread as the registry's reader. Frames closed faster than
+// it writes are skipped, the frame numbers show the gaps.
+//-----------------------------------------------------------------------------
+class CounterExport
+{
+private:
+    std::ofstream       file;
+    std::thread         thread;
+    std::atomic<bool>   stop;
+    std::atomic<int>    lines;
+
+    // Thread body
+    void Run();
+
+    void Write(const CounterSnapshot& snapshot);
+
+    CounterExport(const CounterExport&);
+    CounterExport& operator = (const CounterExport&);
+
+public:
+    // Milliseconds between looks for a new frame
+    static int pollInterval;
+
+    CounterExport();
+    ~CounterExport();
+
+    // Start appending to file, false if it can't be opened
+    bool Start(const std::string& fileName);
+
+    // Write the last frame & close the file
+    void Stop();
+
+    int GetLinesWritten() const { return lines; }
+};
@@ -0,0 +1,46 @@
+#include "CounterRegistry.h"
+#include <algorithm>
+
+using namespace std;
+
+CounterRegistry* CounterRegistry::instance = NULL;
+
+CounterRegistry::CounterRegistry() : frame(0), start( chrono::steady_clock::now() ) {
+}
+
+CounterRegistry* CounterRegistry::Instance() {
+    if (!instance)
+        instance = new CounterRegistry();
+    return instance;
+}
+
+// Id of counter, the same one for the same name
+int CounterRegistry::Register(const string& name) {
+    vector<string>::iterator i = find(names.begin(), names.end(), name);
+
+    if (i != names.end())
+        return i - names.begin();
+    names.push_back(name);
+    values.push_back(0.0);
+    return names.size() - 1;
+}
+
+void CounterRegistry::CopyFrame(CounterSnapshot& snapshot, double time) const {
+    snapshot.frame = frame;
+    snapshot.time = time;
+    if (snapshot.names.size() != names.size())
+        snapshot.names = names;
+    snapshot.values.assign( values.begin(), values.end() );
+}
+
+// Publish the frame & start the next one
+void CounterRegistry::EndFrame() {
+    double time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    CopyFrame(last, time);
+    CopyFrame(snapshots.GetBack(), time);
+    snapshots.Publish();
+
+    ++frame;
+    fill(values.begin(), values.end(), 0.0);
+}
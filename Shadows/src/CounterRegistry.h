@@ -0,0 +1,66 @@
+#pragma once
+#include "TripleBuffer.h"
+#include <chrono>
+#include <string>
+#include <vector>
+
+// Counter values of one frame
+struct CounterSnapshot
+{
+    unsigned int             frame;     // frames closed before this one
+    double                   time;      // seconds since the registry was made, at the end of the frame
+    std::vector<std::string> names;     // by counter id
+    std::vector<double>      values;
+
+    CounterSnapshot() : frame(0), time(0.0) {}
+};
+
+//-----------------------------------------------------------------------------
+// CounterRegistry class
+// Named per frame counters of all subsystems: silhouette edges, triangles,
+// bytes uploaded, draw calls... A subsystem registers a name once for an id
+// and adds to it on the render thread, EndFrame closes the frame and starts
+// the next one from 0. Closed frames are published through a triple buffer,
+// so one reader thread (CounterExport) takes snapshots without locks and
+// never holds up rendering.
+//-----------------------------------------------------------------------------
+class CounterRegistry
+{
+private:
+    static CounterRegistry* instance;
+
+    std::vector<std::string>                names;
+    std::vector<double>                     values;     // frame in progress
+    unsigned int                            frame;
+    CounterSnapshot                         last;       // last closed frame
+    Utils::TripleBuffer<CounterSnapshot>    snapshots;
+    std::chrono::steady_clock::time_point   start;
+
+    // Copy frame in progress, names only when counters were added
+    void CopyFrame(CounterSnapshot& snapshot, double time) const;
+
+    CounterRegistry();
+    CounterRegistry(const CounterRegistry&);
+    CounterRegistry& operator = (const CounterRegistry&);
+
+public:
+    static CounterRegistry* Instance();
+
+    // Id of counter, the same one for the same name
+    int Register(const std::string& name);
+
+    // Render thread: count into the frame in progress
+    void Add(int id, double value) { values[id] += value; }
+    void Max(int id, double value) { if (value > values[id]) values[id] = value; }
+    void Set(int id, double value) { values[id] = value; }
+
+    // Render thread: publish the frame & start the next one
+    void EndFrame();
+
+    // Render thread: last closed frame, e.g. for an overlay
+    const CounterSnapshot& GetLastFrame() const { return last; }
+
+    // Reader thread: take newest closed frame, false if there is none since last call
+    bool Acquire() { return snapshots.Acquire(); }
+    const CounterSnapshot& GetSnapshot() const { return snapshots.GetFront(); }
+};
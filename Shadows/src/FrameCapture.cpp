@@ -0,0 +1,302 @@
+#include "FrameCapture.h"
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+using namespace std;
+
+FrameCapture* FrameCapture::instance = NULL;
+
+// Layout of each op in the file
+struct CaptureOpInfo
+{
+    const char* name;
+    int         args;
+    bool        named;
+    bool        data;
+};
+
+static const CaptureOpInfo opInfo[NumCaptureOps] = {
+    { "Marker", 0, true, false },
+    { "Clear", 3, false, true },
+    { "BeginScene", 0, false, false },
+    { "EndScene", 0, false, false },
+    { "Present", 0, false, false },
+    { "SetRenderState", 2, false, false },
+    { "SetSamplerState", 3, false, false },
+    { "SetTransform", 1, false, true },
+    { "SetMaterial", 0, false, true },
+    { "SetTexture", 2, false, false },
+    { "SetRenderTarget", 2, false, false },
+    { "SetStreamSource", 4, false, false },
+    { "SetIndices", 1, false, false },
+    { "SetVertexDeclaration", 1, false, false },
+    { "SetFVF", 1, false, false },
+    { "VertexUpload", 3, false, true },
+    { "IndexUpload", 3, false, true },
+    { "DrawPrimitive", 3, false, false },
+    { "DrawIndexedPrimitive", 6, false, false },
+    { "DrawSubset", 2, false, false },
+    { "SetTechnique", 0, true, false },
+    { "Effect Begin", 0, false, false },
+    { "Effect End", 0, false, false },
+    { "BeginPass", 1, false, false },
+    { "EndPass", 0, false, false },
+    { "SetValue", 0, true, true },
+    { "Effect SetTexture", 1, true, false },
+    { "SetStreamSourceFreq", 2, false, false }
+};
+
+static const char         magic[4] = { 'S', 'C', 'A', 'P' };
+static const unsigned int version = 1;
+
+// Varint of value, 7 bits per byte, low first
+static void WriteVarint(ostream& file, size_t value) {
+    while (value >= 0x80) {
+        file.put( static_cast<char>((value & 0x7f) | 0x80) );
+        value >>= 7;
+    }
+    file.put( static_cast<char>(value) );
+}
+
+// False past end or on overlong values
+static bool ReadVarint(const vector<unsigned char>& file, size_t& at, size_t& value) {
+    value = 0;
+    for(int shift = 0; shift < 64 && at < file.size(); shift += 7) {
+        unsigned char byte = file[at++];
+
+        value |= static_cast<size_t>(byte & 0x7f) << shift;
+        if ( !(byte & 0x80) )
+            return true;
+    }
+    return false;
+}
+
+// Small negative arguments stay short
+static size_t ZigZag(int value) {
+    return (static_cast<unsigned int>(value) << 1) ^ static_cast<unsigned int>(value >> 31);
+}
+
+static int UnZigZag(size_t value) {
+    unsigned int bits = static_cast<unsigned int>(value);
+    return static_cast<int>(bits >> 1) ^ -static_cast<int>(bits & 1);
+}
+
+FrameCapture::FrameCapture() : recording(false), frame(0), objects(0) {
+}
+
+FrameCapture* FrameCapture::Instance() {
+    if (!instance)
+        instance = new FrameCapture();
+    return instance;
+}
+
+// Drop what was recorded & record calls of this thread
+void FrameCapture::Begin(unsigned int frameNumber) {
+    frame = frameNumber;
+    objects = 0;
+    commands.clear();
+    payload.clear();
+    names.clear();
+    nameIds.clear();
+    objectIds.clear();
+    locks.clear();
+    recorder = this_thread::get_id();
+    recording = true;
+}
+
+void FrameCapture::End() {
+    recording = false;
+    locks.clear();
+}
+
+// Id of object, 0 for NULL
+int FrameCapture::GetId(const void* object) {
+    if (!object)
+        return 0;
+
+    map<const void*, int>::iterator found = objectIds.find(object);
+    if ( found != objectIds.end() )
+        return found->second;
+    objectIds[object] = ++objects;
+    return objects;
+}
+
+CaptureCommand& FrameCapture::Add(CaptureOp op, const void* data, size_t size) {
+    CaptureCommand command;
+
+    memset(&command, 0, sizeof(command));
+    command.op = op;
+    command.name = -1;
+    command.data = payload.size();
+    command.size = data ? size : 0;
+    if (command.size > 0)
+        payload.insert( payload.end(), (const unsigned char*)data, (const unsigned char*)data + size );
+    commands.push_back(command);
+    return commands.back();
+}
+
+void FrameCapture::Record(CaptureOp op, int a, int b, int c, int d, int e, int f) {
+    CaptureCommand& command = Add(op, NULL, 0);
+    int             args[CaptureCommand::maxArgs] = { a, b, c, d, e, f };
+
+    memcpy(command.args, args, sizeof(args));
+}
+
+void FrameCapture::RecordData(CaptureOp op, const void* data, size_t size, int a, int b, int c) {
+    CaptureCommand& command = Add(op, data, size);
+
+    command.args[0] = a;
+    command.args[1] = b;
+    command.args[2] = c;
+}
+
+void FrameCapture::RecordName(CaptureOp op, const char* name, const void* data, size_t size, int a) {
+    CaptureCommand&            command = Add(op, data, size);
+    map<string, int>::iterator found = nameIds.find(name);
+
+    if ( found == nameIds.end() ) {
+        found = nameIds.insert( make_pair( string(name), static_cast<int>( names.size() ) ) ).first;
+        names.push_back(name);
+    }
+    command.name = found->second;
+    command.args[0] = a;
+}
+
+// Contents are read at unlock
+void FrameCapture::Locked(const void* buffer, const void* data, int offset, int size, int flags) {
+    Lock lock = { data, offset, size, flags };
+    locks[buffer] = lock;
+}
+
+void FrameCapture::Unlocked(CaptureOp op, const void* buffer) {
+    map<const void*, Lock>::iterator found = locks.find(buffer);
+
+    // Locked before the capture began
+    if ( found == locks.end() )
+        return;
+
+    const Lock& lock = found->second;
+    RecordData(op, lock.data, lock.size, GetId(buffer), lock.offset, lock.flags);
+    locks.erase(found);
+}
+
+bool FrameCapture::Save(const string& fileName) const {
+    ofstream file(fileName.c_str(), ios::binary);
+
+    file.write(magic, sizeof(magic));
+    WriteVarint(file, version);
+    WriteVarint(file, frame);
+    WriteVarint(file, objects);
+    WriteVarint(file, names.size());
+    for(int i = 0; i<(int)names.size(); ++i) {
+        WriteVarint(file, names[i].size());
+        file.write(names[i].data(), names[i].size());
+    }
+
+    WriteVarint(file, commands.size());
+    for(int i = 0; i<(int)commands.size(); ++i) {
+        const CaptureCommand& command = commands[i];
+        const CaptureOpInfo&  info = opInfo[command.op];
+
+        file.put( static_cast<char>(command.op) );
+        for(int j = 0; j<info.args; ++j)
+            WriteVarint( file, ZigZag(command.args[j]) );
+        if (info.named)
+            WriteVarint(file, command.name + 1);
+        if (info.data) {
+            WriteVarint(file, command.size);
+            if (command.size > 0)
+                file.write((const char*)&payload[command.data], command.size);
+        }
+    }
+
+    file.close();
+    return !file.fail();
+}
+
+bool FrameCapture::Load(const string& fileName) {
+    ifstream              file(fileName.c_str(), ios::binary);
+    vector<unsigned char> contents;
+    size_t                at = sizeof(magic);
+    size_t                value;
+    size_t                count;
+
+    if (!file)
+        return false;
+    contents.assign( istreambuf_iterator<char>(file), istreambuf_iterator<char>() );
+
+    Begin(0);
+    End();
+    if ( contents.size() < sizeof(magic) || memcmp(&contents[0], magic, sizeof(magic)) != 0 )
+        return false;
+    if ( !ReadVarint(contents, at, value) || value != version )
+        return false;
+    if ( !ReadVarint(contents, at, value) )
+        return false;
+    frame = static_cast<unsigned int>(value);
+    if ( !ReadVarint(contents, at, value) || value > 0x7fffffff )
+        return false;
+    objects = static_cast<int>(value);
+
+    if ( !ReadVarint(contents, at, count) || count > contents.size() )
+        return false;
+    names.resize(count);
+    for(int i = 0; i<(int)names.size(); ++i) {
+        if ( !ReadVarint(contents, at, value) || value > contents.size() - at )
+            return false;
+        names[i].assign((const char*)&contents[at], value);
+        nameIds[ names[i] ] = i;
+        at += value;
+    }
+
+    if ( !ReadVarint(contents, at, count) || count > contents.size() )
+        return false;
+    commands.reserve(count);
+    for(size_t i = 0; i<count; ++i) {
+        CaptureCommand command;
+
+        memset(&command, 0, sizeof(command));
+        if ( at >= contents.size() || contents[at] >= NumCaptureOps )
+            return false;
+        command.op = static_cast<CaptureOp>( contents[at++] );
+        command.name = -1;
+
+        const CaptureOpInfo& info = opInfo[command.op];
+        for(int j = 0; j<info.args; ++j) {
+            if ( !ReadVarint(contents, at, value) )
+                return false;
+            command.args[j] = UnZigZag(value);
+        }
+        if (info.named) {
+            if ( !ReadVarint(contents, at, value) || value > names.size() )
+                return false;
+            command.name = static_cast<int>(value) - 1;
+        }
+        command.data = payload.size();
+        if (info.data) {
+            if ( !ReadVarint(contents, at, command.size) || command.size > contents.size() - at )
+                return false;
+            payload.insert( payload.end(), contents.begin() + at, contents.begin() + at + command.size );
+            at += command.size;
+        }
+        commands.push_back(command);
+    }
+    return at == contents.size();
+}
+
+int FrameCapture::GetArgCount(CaptureOp op) {
+    return opInfo[op].args;
+}
+
+bool FrameCapture::HasName(CaptureOp op) {
+    return opInfo[op].named;
+}
+
+bool FrameCapture::HasData(CaptureOp op) {
+    return opInfo[op].data;
+}
+
+const char* FrameCapture::GetOpName(CaptureOp op) {
+    return opInfo[op].name;
+}
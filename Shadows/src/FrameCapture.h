@@ -0,0 +1,134 @@
+#pragma once
+#include <cstddef>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Recorded device & effect calls, arguments in order. Objects are ids, 0 for
+// NULL, colors & flags are their bits.
+enum CaptureOp
+{
+    CaptureMarker,              // name: stage of the frame
+    CaptureClear,               // flags, color, stencil; data: z
+    CaptureBeginScene,
+    CaptureEndScene,
+    CapturePresent,
+    CaptureRenderState,         // state, value
+    CaptureSamplerState,        // sampler, type, value
+    CaptureTransform,           // type; data: matrix
+    CaptureMaterial,            // data: material
+    CaptureTexture,             // stage, texture
+    CaptureRenderTarget,        // index, surface
+    CaptureStreamSource,        // stream, buffer, offset, stride
+    CaptureIndices,             // buffer
+    CaptureVertexDeclaration,   // declaration
+    CaptureFvf,                 // fvf
+    CaptureVertexUpload,        // buffer, offset, flags; data: contents
+    CaptureIndexUpload,         // buffer, offset, flags; data: contents
+    CaptureDraw,                // type, start, primitives
+    CaptureDrawIndexed,         // type, base, min index, vertices, start, primitives
+    CaptureDrawSubset,          // mesh, subset
+    CaptureTechnique,           // name
+    CaptureEffectBegin,
+    CaptureEffectEnd,
+    CaptureBeginPass,           // pass
+    CaptureEndPass,
+    CaptureEffectValue,         // name; data: matrix, vector or float
+    CaptureEffectTexture,       // texture; name
+    CaptureStreamSourceFreq,    // stream, setting
+    NumCaptureOps
+};
+
+struct CaptureCommand
+{
+    static const int maxArgs = 6;
+
+    CaptureOp op;
+    int       args[maxArgs];
+    int       name;     // in names, -1 for none
+    size_t    data;     // offset in payload
+    size_t    size;     // bytes of data, 0 for none
+};
+
+//-----------------------------------------------------------------------------
+// FrameCapture class
+// Device & effect calls of one frame with their arguments, uploaded buffer
+// contents included, so the frame can be replayed without the renderer.
+// RenderCalls.h records into the instance between Begin & End, calls from
+// other threads than the one that began are left out. Objects get small ids
+// in order of first use & names go to a table, so two captures of the same
+// frame compare equal. Saved with varint arguments, see Save.
+//-----------------------------------------------------------------------------
+class FrameCapture
+{
+private:
+    // Buffer between lock & unlock
+    struct Lock
+    {
+        const void* data;
+        int         offset;
+        int         size;
+        int         flags;
+    };
+
+    static FrameCapture* instance;
+
+    bool                            recording;
+    std::thread::id                 recorder;
+    unsigned int                    frame;
+    int                             objects;
+    std::vector<CaptureCommand>     commands;
+    std::vector<unsigned char>      payload;
+    std::vector<std::string>        names;
+    std::map<std::string, int>      nameIds;
+    std::map<const void*, int>      objectIds;
+    std::map<const void*, Lock>     locks;
+
+    CaptureCommand& Add(CaptureOp op, const void* data, size_t size);
+
+    FrameCapture(const FrameCapture&);
+    FrameCapture& operator = (const FrameCapture&);
+
+public:
+    FrameCapture();
+
+    static FrameCapture* Instance();
+
+    // Drop what was recorded & record calls of this thread
+    void Begin(unsigned int frameNumber);
+    void End();
+
+    // Recording on this thread
+    bool IsRecording() const { return recording && std::this_thread::get_id() == recorder; }
+
+    // Id of object, 0 for NULL
+    int GetId(const void* object);
+
+    void Record(CaptureOp op, int a = 0, int b = 0, int c = 0, int d = 0, int e = 0, int f = 0);
+    void RecordData(CaptureOp op, const void* data, size_t size, int a = 0, int b = 0, int c = 0);
+    void RecordName(CaptureOp op, const char* name, const void* data = NULL, size_t size = 0, int a = 0);
+
+    // Buffer contents are recorded at unlock, op is CaptureVertexUpload or
+    // CaptureIndexUpload
+    void Locked(const void* buffer, const void* data, int offset, int size, int flags);
+    void Unlocked(CaptureOp op, const void* buffer);
+
+    // Header, name table, then each command as op, its arguments as zigzag
+    // varints, name index & data size as varints, then data. False if the
+    // file can't be written or read or is broken.
+    bool Save(const std::string& fileName) const;
+    bool Load(const std::string& fileName);
+
+    unsigned int GetFrame() const { return frame; }
+    const std::vector<CaptureCommand>& GetCommands() const { return commands; }
+    const unsigned char* GetData(const CaptureCommand& command) const { return command.size > 0 ? &payload[command.data] : NULL; }
+    const char* GetName(int name) const { return name >= 0 ? names[name].c_str() : ""; }
+    int GetObjectCount() const { return objects; }
+
+    // Arguments of op, also written to the file
+    static int GetArgCount(CaptureOp op);
+    static bool HasName(CaptureOp op);
+    static bool HasData(CaptureOp op);
+    static const char* GetOpName(CaptureOp op);
+};
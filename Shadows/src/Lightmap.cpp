@@ -0,0 +1,135 @@
+#include "Lightmap.h"
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+using namespace std;
+
+static const int lightmapFileVersion = 1;
+
+// Light may drift this far from the baked one, e.g. moved there & back
+static const float lightTolerance = 1e-3f;
+
+Lightmap::Lightmap() {
+    Clear();
+}
+
+void Lightmap::Clear() {
+    key = 0;
+    size = 0;
+    instances = 0;
+    receivers.clear();
+    layers.clear();
+}
+
+bool Lightmap::Save(const string& fileName) const {
+    ofstream file(fileName.c_str(), ios::binary);
+    int      header[6] = { lightmapFileVersion, (int)key, size, instances, (int)receivers.size(), (int)layers.size() };
+
+    if (!file)
+        return false;
+
+    file.write("SLMP", 4);
+    file.write((const char*)header, sizeof(header));
+    for(int i = 0; i<(int)receivers.size(); ++i) {
+        const LightmapReceiver& receiver = receivers[i];
+        int                     counts[2] = { receiver.instance, (int)receiver.positions.size() / 9 };
+
+        file.write((const char*)counts, sizeof(counts));
+        file.write((const char*)&receiver.positions[0], receiver.positions.size() * sizeof(float));
+        file.write((const char*)&receiver.texcoords[0], receiver.texcoords.size() * sizeof(float));
+    }
+    for(int i = 0; i<(int)layers.size(); ++i) {
+        const LightmapLayer& layer = layers[i];
+
+        file.write((const char*)layer.position, sizeof(layer.position));
+        file.write((const char*)&layer.radius, sizeof(float));
+        file.write((const char*)&layer.visibility[0], layer.visibility.size());
+    }
+
+    file.close();
+    return !file.fail();
+}
+
+bool Lightmap::Load(const string& fileName) {
+    ifstream  file(fileName.c_str(), ios::binary);
+    char      magic[4];
+    int       header[6];
+    long long remaining;
+
+    Clear();
+    if (!file)
+        return false;
+
+    file.seekg(0, ios::end);
+    remaining = static_cast<long long>( file.tellg() ) - sizeof(magic) - sizeof(header);
+    file.seekg(0, ios::beg);
+
+    file.read(magic, 4);
+    file.read((char*)header, sizeof(header));
+    if ( !file || memcmp(magic, "SLMP", 4) != 0 || header[0] != lightmapFileVersion )
+        return false;
+
+    // Counts are checked against the bytes left, so damage can't allocate much
+    key = static_cast<unsigned int>(header[1]);
+    size = header[2];
+    instances = header[3];
+    if ( size <= 0 || size > 8192 || instances < 0 || header[4] < 0 || header[5] < 0 ||
+         (long long)( header[4] * 2 * sizeof(int) ) + (long long)header[5] * size * size > remaining )
+        return false;
+
+    receivers.resize(header[4]);
+    for(int i = 0; i<(int)receivers.size(); ++i) {
+        LightmapReceiver& receiver = receivers[i];
+        int               counts[2];
+
+        file.read((char*)counts, sizeof(counts));
+        remaining -= sizeof(counts);
+        if ( !file || counts[0] < 0 || counts[0] >= instances || counts[1] <= 0 || (long long)( counts[1] * 15 * sizeof(float) ) > remaining )
+            return false;
+        receiver.instance = counts[0];
+        receiver.positions.resize(9 * counts[1]);
+        receiver.texcoords.resize(6 * counts[1]);
+        file.read((char*)&receiver.positions[0], receiver.positions.size() * sizeof(float));
+        file.read((char*)&receiver.texcoords[0], receiver.texcoords.size() * sizeof(float));
+        remaining -= counts[1] * 15 * sizeof(float);
+    }
+
+    layers.resize(header[5]);
+    for(int i = 0; i<(int)layers.size(); ++i) {
+        LightmapLayer& layer = layers[i];
+
+        file.read((char*)layer.position, sizeof(layer.position));
+        file.read((char*)&layer.radius, sizeof(float));
+        layer.visibility.resize(size * size);
+        file.read((char*)&layer.visibility[0], layer.visibility.size());
+    }
+
+    if (!file) {
+        Clear();
+        return false;
+    }
+    return true;
+}
+
+// Light is where layer was baked
+bool Lightmap::Matches(int layer, const float position[3], float radius) const {
+    if (layer < 0 || layer >= (int)layers.size())
+        return false;
+
+    const LightmapLayer& baked = layers[layer];
+    for(int i = 0; i<3; ++i) {
+        if (fabs(baked.position[i] - position[i]) > lightTolerance)
+            return false;
+    }
+    return fabs(baked.radius - radius) <= lightTolerance;
+}
+
+string Lightmap::GetFileName(const string& sceneFile) {
+    size_t dot = sceneFile.find_last_of('.');
+    size_t slash = sceneFile.find_last_of("/\\");
+
+    if (dot == string::npos || (slash != string::npos && dot < slash))
+        return sceneFile + ".lightmap";
+    return sceneFile.substr(0, dot) + ".lightmap";
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// Static instance drawn with the lightmap
+struct LightmapReceiver
+{
+    int                instance;
+    std::vector<float> positions;   // object space, 9 floats per triangle
+    std::vector<float> texcoords;   // atlas, 6 floats per triangle
+};
+
+// Visibility of one light of the scene
+struct LightmapLayer
+{
+    float                      position[3];    // light when baked
+    float                      radius;
+    std::vector<unsigned char> visibility;     // size x size, rows top down, 255 lit
+};
+
+//-----------------------------------------------------------------------------
+// Lightmap class
+// Soft shadows of static casters made by LightmapBaker: charts of the
+// static receivers of a scene packed into one square atlas, and a layer of
+// visibility per light of the scene. Key is Scene::GetStaticKey of the scene
+// it was baked for. A layer holds the shadows of its light only while the
+// light stays where it was baked. Binary file like the .lod files.
+//-----------------------------------------------------------------------------
+class Lightmap
+{
+public:
+    unsigned int                  key;
+    int                           size;         // texels per side
+    int                           instances;    // of the scene
+    std::vector<LightmapReceiver> receivers;
+    std::vector<LightmapLayer>    layers;       // per light of the scene
+
+    Lightmap();
+
+    void Clear();
+
+    // Returns false if not written
+    bool Save(const std::string& fileName) const;
+
+    // Returns false if missing or damaged
+    bool Load(const std::string& fileName);
+
+    // Light is where layer was baked
+    bool Matches(int layer, const float position[3], float radius) const;
+
+    // Next to the scene, data/default.scene gives data/default.lightmap
+    static std::string GetFileName(const std::string& sceneFile);
+};
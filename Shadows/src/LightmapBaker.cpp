@@ -0,0 +1,532 @@
+#include "LightmapBaker.h"
+#include "ShadowMesh.h"
+#include "SoftShadowReference.h"
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <map>
+
+using namespace std;
+
+LightmapSettings LightmapBaker::settings = { 1024, 2, 45.0f, 4, 2, 16, 0.02f, 8 };
+
+// Shadow ray origins leave the surface by this part of the scene size
+static const float offsetScale = 1e-4f;
+
+// Part of the atlas the first packing tries to fill
+static const float packingFill = 0.8f;
+
+// Texture coordinates are tested for overlap at this resolution, a few
+// texel centers covered twice are let through
+static const int   overlapGrid = 256;
+static const float overlapAllowed = 0.001f;
+
+static double Seconds(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static float Dot(const float a[3], const float b[3]) {
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+// Doubled signed area of 2d triangle
+static float Cross2(const float a[2], const float b[2], const float c[2]) {
+    return (b[0] - a[0]) * (c[1] - a[1]) - (b[1] - a[1]) * (c[0] - a[0]);
+}
+
+LightmapBaker::LightmapBaker() : offset(0.0f), size(0) {
+    memset(&stats, 0, sizeof(stats));
+}
+
+// Whole mesh as one chart scaled to world size, if its coordinates stay in
+// [0, 1] and no texel center is covered twice
+bool LightmapBaker::AddTextureChart(int receiver) {
+    const Receiver&       source = receivers[receiver];
+    const MeshFile&       mesh = *source.mesh;
+    vector<unsigned char> hits(overlapGrid * overlapGrid, 0);
+    double                textureArea = 0.0, worldArea = 0.0;
+    int                   hit = 0, overlapping = 0;
+    Chart                 chart;
+
+    if (mesh.texcoords.empty())
+        return false;
+    for(int i = 0; i<(int)mesh.texcoords.size(); ++i) {
+        const D3DXVECTOR2& uv = mesh.texcoords[i];
+
+        if (uv.x < -eps || uv.x > 1.0f + eps || uv.y < -eps || uv.y > 1.0f + eps)
+            return false;
+    }
+
+    for(int i = 0; i<(int)mesh.faces.size(); ++i) {
+        const Face& face = mesh.faces[i];
+        const int   ids[3] = { face.v0, face.v1, face.v2 };
+        float       corners[3][2];
+        D3DXVECTOR3 e1 = D3DXVECTOR3(&source.positions[9 * i + 3]) - D3DXVECTOR3(&source.positions[9 * i]);
+        D3DXVECTOR3 e2 = D3DXVECTOR3(&source.positions[9 * i + 6]) - D3DXVECTOR3(&source.positions[9 * i]);
+        D3DXVECTOR3 normal;
+
+        for(int j = 0; j<3; ++j) {
+            corners[j][0] = mesh.texcoords[ ids[j] ].x * overlapGrid;
+            corners[j][1] = mesh.texcoords[ ids[j] ].y * overlapGrid;
+        }
+        float area = Cross2(corners[0], corners[1], corners[2]);
+        float sign = area < 0.0f ? -1.0f : 1.0f;
+
+        // Faces squashed to nothing would share their texels
+        worldArea += 0.5f * D3DXVec3Length( D3DXVec3Cross(&normal, &e1, &e2) );
+        if (fabs(area) < 1e-12f && D3DXVec3Length(&normal) > 0.0f)
+            return false;
+        textureArea += 0.5 * fabs(area) / (overlapGrid * overlapGrid);
+
+        int x0 = max(0, static_cast<int>( floor( min(corners[0][0], min(corners[1][0], corners[2][0])) ) ));
+        int x1 = min(overlapGrid - 1, static_cast<int>( ceil( max(corners[0][0], max(corners[1][0], corners[2][0])) ) ));
+        int y0 = max(0, static_cast<int>( floor( min(corners[0][1], min(corners[1][1], corners[2][1])) ) ));
+        int y1 = min(overlapGrid - 1, static_cast<int>( ceil( max(corners[0][1], max(corners[1][1], corners[2][1])) ) ));
+        for(int y = y0; y<=y1; ++y) {
+            for(int x = x0; x<=x1; ++x) {
+                float center[2] = { x + 0.5f, y + 0.5f };
+
+                // Centers on an edge count for neither face
+                if ( sign * Cross2(corners[0], corners[1], center) <= 0.0f ||
+                     sign * Cross2(corners[1], corners[2], center) <= 0.0f ||
+                     sign * Cross2(corners[2], corners[0], center) <= 0.0f )
+                    continue;
+                ++hit;
+                if (hits[y * overlapGrid + x]++ > 0)
+                    ++overlapping;
+            }
+        }
+    }
+    if (textureArea <= 0.0 || overlapping > hit * overlapAllowed)
+        return false;
+
+    // Same texel density as the generated charts
+    float scale = static_cast<float>( sqrt(worldArea / textureArea) );
+    float minU = 1.0f, minV = 1.0f, maxU = 0.0f, maxV = 0.0f;
+
+    for(int i = 0; i<(int)mesh.texcoords.size(); ++i) {
+        minU = min(minU, mesh.texcoords[i].x);
+        minV = min(minV, mesh.texcoords[i].y);
+        maxU = max(maxU, mesh.texcoords[i].x);
+        maxV = max(maxV, mesh.texcoords[i].y);
+    }
+
+    chart.receiver = receiver;
+    chart.width = (maxU - minU) * scale;
+    chart.height = (maxV - minV) * scale;
+    for(int i = 0; i<(int)mesh.faces.size(); ++i) {
+        const Face& face = mesh.faces[i];
+        const int   ids[3] = { face.v0, face.v1, face.v2 };
+
+        chart.faces.push_back(i);
+        for(int j = 0; j<3; ++j) {
+            chart.uv.push_back( (mesh.texcoords[ ids[j] ].x - minU) * scale );
+            chart.uv.push_back( (mesh.texcoords[ ids[j] ].y - minV) * scale );
+        }
+    }
+    charts.push_back(chart);
+    ++stats.textureCharts;
+    return true;
+}
+
+// Faces join the chart of a neighbour while their normal stays within
+// chartAngle of the chart's first face, then are projected along it
+void LightmapBaker::AddGeneratedCharts(int receiver) {
+    const Receiver&                  source = receivers[receiver];
+    vector<D3DXVECTOR3>              vertices = source.mesh->vertices;
+    vector<Face>                     faces = source.mesh->faces;
+    map< pair<int, int>, vector<int> > edgeFaces;
+    vector<int>                      chartOf;
+    vector<int>                      queue;
+    float                            cosMax = cos( D3DXToRadian(settings.chartAngle) );
+
+    // Neighbours across welded edges
+    ShadowMesh::Weld(vertices, faces);
+    for(int i = 0; i<(int)faces.size(); ++i) {
+        const int ids[3] = { faces[i].v0, faces[i].v1, faces[i].v2 };
+
+        for(int j = 0; j<3; ++j)
+            edgeFaces[ make_pair( min(ids[j], ids[(j + 1) % 3]), max(ids[j], ids[(j + 1) % 3]) ) ].push_back(i);
+    }
+
+    chartOf.assign(faces.size(), -1);
+    for(int seed = 0; seed<(int)faces.size(); ++seed) {
+        if (chartOf[seed] >= 0)
+            continue;
+
+        const float* axis = &source.normals[3 * seed];
+        Chart        chart;
+
+        chart.receiver = receiver;
+        chartOf[seed] = static_cast<int>( charts.size() );
+        queue.assign(1, seed);
+        for(int k = 0; k<(int)queue.size(); ++k) {
+            int       face = queue[k];
+            const int ids[3] = { faces[face].v0, faces[face].v1, faces[face].v2 };
+
+            chart.faces.push_back(face);
+            for(int j = 0; j<3; ++j) {
+                const vector<int>& neighbours = edgeFaces[ make_pair( min(ids[j], ids[(j + 1) % 3]), max(ids[j], ids[(j + 1) % 3]) ) ];
+
+                for(int n = 0; n<(int)neighbours.size(); ++n) {
+                    const float* normal = &source.normals[3 * neighbours[n]];
+
+                    // Faces without area go anywhere
+                    if ( chartOf[ neighbours[n] ] < 0 && (Dot(normal, axis) >= cosMax || Dot(normal, normal) == 0.0f) ) {
+                        chartOf[ neighbours[n] ] = chartOf[seed];
+                        queue.push_back( neighbours[n] );
+                    }
+                }
+            }
+        }
+
+        // Frame around the first normal
+        float tangent[3], bitangent[3];
+        float sign = axis[2] >= 0.0f ? 1.0f : -1.0f;
+        float a = -1.0f / (sign + axis[2]);
+        float b = axis[0] * axis[1] * a;
+        tangent[0] = 1.0f + sign * axis[0] * axis[0] * a;
+        tangent[1] = sign * b;
+        tangent[2] = -sign * axis[0];
+        bitangent[0] = b;
+        bitangent[1] = sign + axis[1] * axis[1] * a;
+        bitangent[2] = -axis[1];
+
+        float minU = FLT_MAX, minV = FLT_MAX, maxU = -FLT_MAX, maxV = -FLT_MAX;
+        for(int k = 0; k<(int)chart.faces.size(); ++k) {
+            for(int j = 0; j<3; ++j) {
+                const float* corner = &source.positions[9 * chart.faces[k] + 3 * j];
+                float        u = Dot(corner, tangent);
+                float        v = Dot(corner, bitangent);
+
+                chart.uv.push_back(u);
+                chart.uv.push_back(v);
+                minU = min(minU, u);
+                minV = min(minV, v);
+                maxU = max(maxU, u);
+                maxV = max(maxV, v);
+            }
+        }
+        for(int k = 0; k<(int)chart.uv.size(); k += 2) {
+            chart.uv[k] -= minU;
+            chart.uv[k + 1] -= minV;
+        }
+        chart.width = maxU - minU;
+        chart.height = maxV - minV;
+        charts.push_back(chart);
+    }
+}
+
+// Shelves filled left to right with the charts by height
+bool LightmapBaker::Pack(float texelsPerUnit) {
+    vector< pair<int, int> > order;
+    int                      x = 0, y = 0, shelf = 0;
+
+    for(int i = 0; i<(int)charts.size(); ++i) {
+        Chart& chart = charts[i];
+
+        chart.columns = max(1, static_cast<int>( ceil(chart.width * texelsPerUnit) )) + 2 * settings.padding;
+        chart.rows = max(1, static_cast<int>( ceil(chart.height * texelsPerUnit) )) + 2 * settings.padding;
+        order.push_back( make_pair(-chart.rows, i) );
+    }
+    sort(order.begin(), order.end());
+
+    for(int i = 0; i<(int)order.size(); ++i) {
+        Chart& chart = charts[ order[i].second ];
+
+        if (x + chart.columns > size) {
+            x = 0;
+            y += shelf;
+            shelf = 0;
+        }
+        if (chart.columns > size || y + chart.rows > size)
+            return false;
+        chart.x = x;
+        chart.y = y;
+        x += chart.columns;
+        shelf = max(shelf, chart.rows);
+    }
+    return true;
+}
+
+// Texel centers inside a face get the point of the face under them
+void LightmapBaker::Rasterize(float texelsPerUnit) {
+    points.assign(3 * size * size, 0.0f);
+    normals.assign(3 * size * size, 0.0f);
+    covered.assign(size * size, 0);
+
+    for(int i = 0; i<(int)charts.size(); ++i) {
+        const Chart&    chart = charts[i];
+        const Receiver& source = receivers[chart.receiver];
+
+        for(int k = 0; k<(int)chart.faces.size(); ++k) {
+            const float* world = &source.positions[9 * chart.faces[k]];
+            float        corners[3][2];
+
+            for(int j = 0; j<3; ++j) {
+                corners[j][0] = chart.x + settings.padding + chart.uv[6 * k + 2 * j] * texelsPerUnit;
+                corners[j][1] = chart.y + settings.padding + chart.uv[6 * k + 2 * j + 1] * texelsPerUnit;
+            }
+            float area = Cross2(corners[0], corners[1], corners[2]);
+            if (fabs(area) < 1e-12f)
+                continue;
+
+            int x0 = max(chart.x, static_cast<int>( floor( min(corners[0][0], min(corners[1][0], corners[2][0])) ) ));
+            int x1 = min(chart.x + chart.columns - 1, static_cast<int>( ceil( max(corners[0][0], max(corners[1][0], corners[2][0])) ) ));
+            int y0 = max(chart.y, static_cast<int>( floor( min(corners[0][1], min(corners[1][1], corners[2][1])) ) ));
+            int y1 = min(chart.y + chart.rows - 1, static_cast<int>( ceil( max(corners[0][1], max(corners[1][1], corners[2][1])) ) ));
+            for(int y = y0; y<=y1; ++y) {
+                for(int x = x0; x<=x1; ++x) {
+                    float center[2] = { x + 0.5f, y + 0.5f };
+                    float w0 = Cross2(corners[1], corners[2], center) / area;
+                    float w1 = Cross2(corners[2], corners[0], center) / area;
+                    float w2 = 1.0f - w0 - w1;
+                    int   texel = y * size + x;
+
+                    if (w0 < -eps || w1 < -eps || w2 < -eps)
+                        continue;
+                    for(int j = 0; j<3; ++j) {
+                        points[3 * texel + j] = w0 * world[j] + w1 * world[3 + j] + w2 * world[6 + j];
+                        normals[3 * texel + j] = source.normals[3 * chart.faces[k] + j];
+                    }
+                    covered[texel] = 1;
+                }
+            }
+        }
+    }
+}
+
+// Passes of the strata until the texel settles, like the reference pixels
+void LightmapBaker::BakeRows(int first, int last, const Light& light, int layer, vector<unsigned char>& visibility, long long& rays) const {
+    const float position[3] = { light.position.x, light.position.y, light.position.z };
+
+    for(int y = first; y<last; ++y) {
+        for(int x = 0; x<size; ++x) {
+            int          texel = y * size + x;
+            const float* point = &points[3 * texel];
+            float        sum = 0.0f, sumSquares = 0.0f;
+            int          k = 0;
+
+            // Out of range the light adds nothing, texels outside charts
+            // are filled by Dilate
+            float toLight[3] = { position[0] - point[0], position[1] - point[1], position[2] - point[2] };
+            if ( !covered[texel] || sqrt( Dot(toLight, toLight) ) > light.range + light.radius ) {
+                visibility[texel] = 255;
+                continue;
+            }
+
+            unsigned int seed = (texel + static_cast<unsigned int>(layer) * size * size) * 0x9e3779b9U;
+            for(; k<settings.maxPasses; ++k) {
+                if (k >= settings.minPasses) {
+                    float mean = sum / k;
+                    float variance = max(0.0f, sumSquares - k * mean * mean) / (k - 1);
+
+                    if (sqrt(variance / k) < settings.tolerance)
+                        break;
+                }
+
+                float value = SoftShadowReference::SampleLight(casters, point, &normals[3 * texel], offset, position, light.radius, settings.strata, seed + k, rays);
+                sum += value;
+                sumSquares += value * value;
+            }
+            visibility[texel] = static_cast<unsigned char>( sum / k * 255.0f + 0.5f );
+        }
+    }
+}
+
+// Texels outside charts take the mean of covered neighbours, rounds times
+void LightmapBaker::Dilate(vector<unsigned char>& visibility, int rounds) const {
+    vector<char>          filled(covered);
+    vector<char>          next;
+    vector<unsigned char> values;
+
+    for(int round = 0; round<rounds; ++round) {
+        next = filled;
+        values = visibility;
+        for(int y = 0; y<size; ++y) {
+            for(int x = 0; x<size; ++x) {
+                const int offsets[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+                int       texel = y * size + x;
+                int       sum = 0, count = 0;
+
+                if (filled[texel])
+                    continue;
+                for(int i = 0; i<4; ++i) {
+                    int nx = x + offsets[i][0];
+                    int ny = y + offsets[i][1];
+
+                    if (nx >= 0 && nx < size && ny >= 0 && ny < size && filled[ny * size + nx]) {
+                        sum += visibility[ny * size + nx];
+                        ++count;
+                    }
+                }
+                if (count > 0) {
+                    values[texel] = static_cast<unsigned char>( (sum + count / 2) / count );
+                    next[texel] = 1;
+                }
+            }
+        }
+        filled.swap(next);
+        visibility.swap(values);
+    }
+}
+
+bool LightmapBaker::Bake(const Scene& scene, const vector<MeshFile>& meshes, Utils::WorkerPool& pool, Lightmap& lightmap) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<D3DXMATRIX>               world;
+    vector<char>                     isStatic;
+    vector<char>                     closed( meshes.size(), -1 );
+    vector<float>                    casterTriangles;
+    float                            boxMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+    float                            boxMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+    memset(&stats, 0, sizeof(stats));
+    receivers.clear();
+    charts.clear();
+    lightmap.Clear();
+    size = settings.size;
+
+    // Static instances in world space
+    scene.GetWorldTransforms(world);
+    scene.GetStaticInstances(isStatic);
+    for(int i = 0; i<(int)scene.instances.size(); ++i) {
+        int             meshIndex = scene.instances[i].mesh;
+        const MeshFile& mesh = meshes[meshIndex];
+        Receiver        receiver;
+
+        if (!isStatic[i] || mesh.faces.empty())
+            continue;
+
+        // Casters have to be closed like for the volumes
+        if (closed[meshIndex] < 0) {
+            vector<D3DXVECTOR3> vertices = mesh.vertices;
+            vector<Face>        faces = mesh.faces;
+            ShadowMesh          shadowMesh;
+
+            ShadowMesh::Weld(vertices, faces);
+            closed[meshIndex] = shadowMesh.Build(vertices, faces, 0.0f);
+        }
+
+        receiver.instance = i;
+        receiver.mesh = &mesh;
+        for(int j = 0; j<(int)mesh.faces.size(); ++j) {
+            const int   ids[3] = { mesh.faces[j].v0, mesh.faces[j].v1, mesh.faces[j].v2 };
+            D3DXVECTOR3 corners[3], e1, e2, normal;
+
+            for(int k = 0; k<3; ++k) {
+                D3DXVECTOR4 transformed;
+
+                D3DXVec3Transform(&transformed, &mesh.vertices[ ids[k] ], &world[i]);
+                corners[k] = D3DXVECTOR3(transformed.x, transformed.y, transformed.z);
+                receiver.positions.insert(receiver.positions.end(), &corners[k].x, &corners[k].x + 3);
+                for(int axis = 0; axis<3; ++axis) {
+                    boxMin[axis] = min(boxMin[axis], (&corners[k].x)[axis]);
+                    boxMax[axis] = max(boxMax[axis], (&corners[k].x)[axis]);
+                }
+            }
+            e1 = corners[1] - corners[0];
+            e2 = corners[2] - corners[0];
+            D3DXVec3Normalize( &normal, D3DXVec3Cross(&normal, &e1, &e2) );
+            receiver.normals.insert(receiver.normals.end(), &normal.x, &normal.x + 3);
+        }
+
+        if (closed[meshIndex]) {
+            casterTriangles.insert(casterTriangles.end(), receiver.positions.begin(), receiver.positions.end());
+            ++stats.casters;
+        }
+        receivers.push_back(receiver);
+    }
+    if (receivers.empty())
+        return false;
+
+    casters.Build(casterTriangles);
+    stats.receivers = receivers.size();
+    stats.casterTriangles = casterTriangles.size() / 9;
+
+    float diagonal = 0.0f;
+    for(int i = 0; i<3; ++i)
+        diagonal += (boxMax[i] - boxMin[i]) * (boxMax[i] - boxMin[i]);
+    offset = offsetScale * sqrt(diagonal);
+
+    // Charts, then the largest density they fit in at
+    float area = 0.0f;
+    for(int i = 0; i<(int)receivers.size(); ++i) {
+        if ( !AddTextureChart(i) )
+            AddGeneratedCharts(i);
+    }
+    for(int i = 0; i<(int)charts.size(); ++i)
+        area += max(charts[i].width * charts[i].height, 1e-12f);
+
+    float texelsPerUnit = sqrt(packingFill * size * size / area);
+    while ( !Pack(texelsPerUnit) )
+        texelsPerUnit *= 0.95f;
+    Rasterize(texelsPerUnit);
+
+    stats.charts = charts.size();
+    stats.texelsPerUnit = texelsPerUnit;
+    for(int i = 0; i<(int)covered.size(); ++i)
+        stats.texels += covered[i];
+    stats.coverage = static_cast<float>(stats.texels) / (size * size);
+
+    // Receivers with their atlas coordinates, faces in mesh order
+    lightmap.key = scene.GetStaticKey();
+    lightmap.size = size;
+    lightmap.instances = scene.instances.size();
+    lightmap.receivers.resize( receivers.size() );
+    for(int i = 0; i<(int)receivers.size(); ++i) {
+        const MeshFile&   mesh = *receivers[i].mesh;
+        LightmapReceiver& receiver = lightmap.receivers[i];
+
+        receiver.instance = receivers[i].instance;
+        receiver.texcoords.resize(6 * mesh.faces.size());
+        for(int j = 0; j<(int)mesh.faces.size(); ++j) {
+            const int ids[3] = { mesh.faces[j].v0, mesh.faces[j].v1, mesh.faces[j].v2 };
+
+            for(int k = 0; k<3; ++k)
+                receiver.positions.insert(receiver.positions.end(), &mesh.vertices[ ids[k] ].x, &mesh.vertices[ ids[k] ].x + 3);
+        }
+    }
+    for(int i = 0; i<(int)charts.size(); ++i) {
+        const Chart& chart = charts[i];
+        vector<float>& texcoords = lightmap.receivers[chart.receiver].texcoords;
+
+        for(int k = 0; k<(int)chart.faces.size(); ++k) {
+            for(int j = 0; j<3; ++j) {
+                texcoords[6 * chart.faces[k] + 2 * j] = (chart.x + settings.padding + chart.uv[6 * k + 2 * j] * texelsPerUnit) / size;
+                texcoords[6 * chart.faces[k] + 2 * j + 1] = (chart.y + settings.padding + chart.uv[6 * k + 2 * j + 1] * texelsPerUnit) / size;
+            }
+        }
+    }
+    stats.chartSeconds = Seconds(start);
+
+    // Every light, a few rows per job
+    start = chrono::steady_clock::now();
+    lightmap.layers.resize( scene.lights.size() );
+    for(int l = 0; l<(int)scene.lights.size(); ++l) {
+        const Light&      light = scene.lights[l];
+        LightmapLayer&    layer = lightmap.layers[l];
+        int               jobs = (size + settings.rowsPerJob - 1) / settings.rowsPerJob;
+        vector<long long> rays(jobs, 0);
+
+        layer.position[0] = light.position.x;
+        layer.position[1] = light.position.y;
+        layer.position[2] = light.position.z;
+        layer.radius = light.radius;
+        layer.visibility.resize(size * size);
+        for(int i = 0; i<jobs; ++i) {
+            int first = i * settings.rowsPerJob;
+            int last = min(first + settings.rowsPerJob, size);
+
+            pool.Push( [this, first, last, &light, l, &layer, &rays, i] { BakeRows(first, last, light, l, layer.visibility, rays[i]); } );
+        }
+        pool.Wait();
+        for(int i = 0; i<jobs; ++i)
+            stats.rays += rays[i];
+
+        Dilate(layer.visibility, settings.padding);
+    }
+    stats.bakeSeconds = Seconds(start);
+    return true;
+}
@@ -0,0 +1,116 @@
+#pragma once
+#include "Lightmap.h"
+#include "MeshFile.h"
+#include "Scene.h"
+#include "TriangleBvh.h"
+#include "WorkerPool.h"
+#include <vector>
+
+// Atlas & sampling, see LightmapBaker::settings
+struct LightmapSettings
+{
+    int   size;         // atlas texels per side
+    int   padding;      // texels around each chart, filled from its border
+    float chartAngle;   // degrees faces of a generated chart may turn from its first face
+    int   strata;       // light is split in strata x strata cells, one sample each per pass
+    int   minPasses;    // passes before a texel may stop
+    int   maxPasses;
+    float tolerance;    // texel stops when standard error of its visibility is below
+    int   rowsPerJob;
+};
+
+// Work of the last Bake
+struct LightmapStats
+{
+    int       receivers;
+    int       casters;          // static closed instances
+    int       casterTriangles;
+    int       charts;
+    int       textureCharts;    // taken from the texture coordinates of a mesh
+    float     texelsPerUnit;
+    float     coverage;         // part of the atlas covered by charts
+    int       texels;           // baked per light
+    long long rays;
+    double    chartSeconds;
+    double    bakeSeconds;
+};
+
+//-----------------------------------------------------------------------------
+// LightmapBaker class
+// Offline soft shadows of the static part of a scene. Instances that never
+// move receive, the closed ones among them also cast, like the volumes do.
+// Each receiver gets charts: its own texture coordinates when they stay in
+// [0, 1] without overlapping, otherwise faces flood filled while their
+// normals stay near the first face's & projected along it. Charts are
+// scaled to one texel density & packed on shelves, the density shrinks
+// until they fit. Every covered texel then traces the visible part of each
+// light sphere like SoftShadowReference, rows of texels run on all cores
+// and random numbers hang on texel & pass only. Texels around the charts
+// take their neighbours' values, so filtering stays inside the shadows.
+//-----------------------------------------------------------------------------
+class LightmapBaker
+{
+private:
+    // Faces of one receiver in one rectangle of the atlas
+    struct Chart
+    {
+        int                receiver;
+        std::vector<int>   faces;       // into faces of the receiver's mesh
+        std::vector<float> uv;          // 6 floats per face, world units
+        float              width;
+        float              height;
+        int                x, y;        // atlas texels of the padded rectangle
+        int                columns, rows;
+    };
+
+    // Static instance & its world space faces
+    struct Receiver
+    {
+        int                instance;
+        const MeshFile*    mesh;
+        std::vector<float> positions;   // 9 floats per face
+        std::vector<float> normals;     // 3 floats per face
+    };
+
+    std::vector<Receiver> receivers;
+    std::vector<Chart>    charts;
+    TriangleBvh           casters;
+    float                 offset;       // shadow ray origins leave the surface this far
+
+    // Per atlas texel: surface point & normal
+    int                   size;
+    std::vector<float>    points;
+    std::vector<float>    normals;
+    std::vector<char>     covered;
+
+    LightmapStats         stats;
+
+    // Chart of receiver from mesh texture coordinates, false if unusable
+    bool AddTextureChart(int receiver);
+
+    // Flood filled charts of receiver
+    void AddGeneratedCharts(int receiver);
+
+    // Place charts at density, false if they don't fit
+    bool Pack(float texelsPerUnit);
+
+    // Surface of every texel inside a chart
+    void Rasterize(float texelsPerUnit);
+
+    // Visibility of light for texel rows [first, last)
+    void BakeRows(int first, int last, const Light& light, int layer, std::vector<unsigned char>& visibility, long long& rays) const;
+
+    // Texels outside charts take the mean of covered neighbours, rounds times
+    void Dilate(std::vector<unsigned char>& visibility, int rounds) const;
+
+public:
+    static LightmapSettings settings;
+
+    LightmapBaker();
+
+    // Bake lights of scene. meshes holds the loaded meshes of the scene in
+    // its order. Returns false if nothing static can receive.
+    bool Bake(const Scene& scene, const std::vector<MeshFile>& meshes, Utils::WorkerPool& pool, Lightmap& lightmap);
+
+    const LightmapStats& GetStats() const { return stats; }
+};
@@ -1,6 +1,18 @@
 #include "Mesh.h"
+#include "BakedShadows.h"
+#include "CounterExport.h"
+#include "MemoryReport.h"
+#include "QualityController.h"
+#include "RenderCalls.h"
+#include "Scene.h"
+#include "ShadowStreamer.h"
+#include "Simulation.h"
+#include "SoftShadowReference.h"
+#include "TransformGraph.h"
 #include <stdexcept>
 #include <functional>
+#include <fstream>
+#include <sstream>
 
 using namespace std;
 
@@ -10,24 +22,82 @@ extern LPDIRECT3DDEVICE9 pd3dDevice = NULL;
 extern LPD3DXEFFECT pLightingEffect = NULL;
 extern LPD3DXFONT pFont = NULL;
 
-bool animate;
 bool showPenumbraCone;
+bool showVolumeArea;
+bool showTimings;
+bool showCounters;
+float savedMergeAngle; // merge angle while merging is on
 const D3DXCOLOR fontColor = D3DXCOLOR(1.0f, 1.0f, 0.0f, 1.0f);
 
 int nLights;
 Camera camera;
-Mesh lightMesh;
+vector<Mesh> lightMeshes; // light spheres, one instance per light
 vector<Mesh> meshes;
 vector<Light> lights;
-
-// FPS
+Scene scene;
+Simulation simulation;
+unsigned int simulationStep; // step of the drawn state
+
+// Instance transforms with parents, box hierarchy & per frame query results
+TransformGraph transforms;
+Bvh sceneBvh;
+vector<int> visibleMeshes;
+vector<char> meshVisible;
+vector<int> litMeshes;
+vector<Bounds> receivers;
+
+// Screen area of umbra sides this frame, clipped & extruded to light range
+float volumeArea;
+float unclippedVolumeArea;
+
+// Ray traced reference of the first light, requested by G-key
+bool compareReference;
+std::string referenceText;
+
+// FPS & render thread time
 int framesLeft;
 float fps;
-float lastTime;
-
-static const int DYNAMIC_OBJ = 0;
-static const int STATIC_OBJ = 1;
-static const int ROOM  = 2;
+double lastTime;
+float renderTime;
+
+// Frame budget controller of shadow quality, decisions go to quality_log.txt
+QualityController quality;
+ofstream qualityLog;
+unsigned int frameNumber;
+double frameStart;      // start of the last frame
+float shadowTime;       // ms in RenderShadows this frame
+float coverage;         // umbra sides per pixel, measured every coverageInterval frames
+static const int coverageInterval = 8;
+
+// Pages shadow levels under the budget given by -shadowbudget
+ShadowStreamer streamer;
+
+// Shadows of static casters baked by tools/LightmapBake, B-key switches
+BakedShadows bakedShadows;
+bool useBakedShadows;
+vector<Bounds> dynamicReceivers;
+
+// Device & effect calls of a frame to capture_<frame>.cap, requested by
+// F-key or -capture <frame>
+bool captureFrame;
+int captureAt = -1;
+
+// Per frame counters of all subsystems, JSON lines file given by -counters
+CounterExport counterExport;
+std::string counterFile;
+static CounterRegistry* frameCounters = CounterRegistry::Instance();
+static const int lightsCounter = frameCounters->Register("lights");
+static const int visibleCounter = frameCounters->Register("visible meshes");
+static const int inversionsCounter = frameCounters->Register("inversions");
+static const int avoidedCounter = frameCounters->Register("inversions avoided");
+static const int renderMsCounter = frameCounters->Register("render ms");
+static const int fpsCounter = frameCounters->Register("fps");
+static const int qualityCounter = frameCounters->Register("quality steps");
+static const int umbraOnlyCounter = frameCounters->Register("umbra only casters");
+static const int bakedLightsCounter = frameCounters->Register("baked lights");
+static const int bakedCastersCounter = frameCounters->Register("casters left to the bake");
+
+static const char* defaultScene = "data\\default.scene";
 
 static const int width = 800;
 static const int height = 800;
@@ -35,18 +105,21 @@ static const int height = 800;
 int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nCmdShow);
 LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
 void Init(void);
-void InitScene(void);
+std::string PrepareScene(const char* commandLine);
+void InitScene(const std::string& sceneFile);
 void InitEffects(void);
 void ShutDown(void);
 void Render(void);
-void Update(void);
+void StartSimulation(void);
+void ApplySimulationState(void);
+void CompareReference(void);
 
 // Misc functions
 inline DWORD F2DW(float f) {
 	return *((DWORD*)&f);
 }
 
-float GetTime() {
+double GetTime() {
 	// var
 	LARGE_INTEGER frequency;
 	LARGE_INTEGER performanceCount;
@@ -55,17 +128,42 @@ float GetTime() {
 	QueryPerformanceFrequency(&frequency);
 	QueryPerformanceCounter(&performanceCount);
 	 
-	return (float)(performanceCount.QuadPart) / frequency.QuadPart;
+	return (double)(performanceCount.QuadPart) / frequency.QuadPart;
 }
 
-D3DXMATRIX GetCameraTransform() {
-    D3DXMATRIX   transform;
+D3DXVECTOR3 GetCameraPosition() {
     D3DXVECTOR3  position;
 
     position.x = cosf(camera.yaw)*cosf(camera.pitch)*camera.radius;
     position.z = sinf(camera.yaw)*cosf(camera.pitch)*camera.radius;
     position.y = sinf(camera.pitch)*camera.radius;
 
+    return position;
+}
+
+// Frustum planes of camera, inner side positive
+void GetFrustumPlanes(const D3DXMATRIX& view, float planes[6][4]) {
+    D3DXMATRIX projMatrix;
+    D3DXMATRIX m;
+
+    pd3dDevice->GetTransform(D3DTS_PROJECTION, &projMatrix);
+    D3DXMatrixMultiply(&m, &view, &projMatrix);
+
+    // Clip space -w <= x, y <= w and 0 <= z <= w
+    for(int i = 0; i<4; ++i) {
+        planes[0][i] = m.m[i][3] + m.m[i][0];
+        planes[1][i] = m.m[i][3] - m.m[i][0];
+        planes[2][i] = m.m[i][3] + m.m[i][1];
+        planes[3][i] = m.m[i][3] - m.m[i][1];
+        planes[4][i] = m.m[i][2];
+        planes[5][i] = m.m[i][3] - m.m[i][2];
+    }
+}
+
+D3DXMATRIX GetCameraTransform() {
+    D3DXMATRIX   transform;
+    D3DXVECTOR3  position = GetCameraPosition();
+
     D3DXMatrixLookAtLH(&transform, &position, &camera.eyePt, &camera.up);
     return transform;
 }
@@ -105,17 +203,21 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
     {
         // Try init
 	    Init();
-        InitScene();
+        InitScene( PrepareScene(lpCmdLine) );
         InitEffects();
+        StartSimulation();
 
+        // Render thread, simulation runs on its own
         while(uMsg.message != WM_QUIT) {
 		    if(PeekMessage(&uMsg, NULL, 0, 0, PM_REMOVE)) { 
 			    TranslateMessage(&uMsg);
 			    DispatchMessage(&uMsg);
 		    }
             else {
+                ApplySimulationState();
+                if (compareReference)
+                    CompareReference();
 		        Render();
-                Update();
             }
 	    }
     }
@@ -138,71 +240,17 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 LRESULT CALLBACK WindowProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) {
     switch(msg)
 	{
+        // Keys are handled by the simulation
         case WM_KEYDOWN:
-		{
-            D3DXMATRIX   transform;
-
-			switch( wParam )
-			{
-                // pause/contunie animation
-                case 0x50: // P-key
-                    animate = !animate;
-                    break;
-
-                
-                // show/hide penumbra cone
-                case 0x52: // R-key
-                    showPenumbraCone = !showPenumbraCone;
-                    break;
-
-                
-                // show/hide second light
-                case 0x4C: // L-key
-                    nLights = 3 - nLights;
-                    break;
-
-                // increase light radius
-                case VK_OEM_PLUS:
-                    lights[0].radius += 0.02f;
-                    break;
-
-				// Move 2nd light source
-				case VK_LEFT:
-					lights[0].position.z -= 0.2f;
-					break;
-
-				case VK_RIGHT:
-					lights[0].position.z += 0.2f;
-					break;
-
-				case VK_UP:
-					lights[0].position.x -= 0.2f;
-					break;
-
-				case VK_DOWN:
-					lights[0].position.x += 0.2f;
-					break;
-
-				case 0x44: // D key
-					lights[0].position.y -= 0.2f;
-					break;
-
-				case 0x55: // U key
-					lights[0].position.y += 0.2f;
-					break;
-
-                // decrease light radius
-                case VK_OEM_MINUS:
-                    if (lights[0].radius > 0.02) lights[0].radius -= 0.02f;
-                    break;
-
-				case VK_ESCAPE:
-					PostQuitMessage(0);
-					break;
-			}
-
+            if (wParam == VK_ESCAPE)
+                PostQuitMessage(0);
+            else if (wParam == 0x47) // G-key, render thread compares
+                compareReference = true;
+            else if (wParam == 0x46) // F-key, render thread captures
+                captureFrame = true;
+            else
+                simulation.PostKey(wParam);
             break;
-        }
 
         // Move camera around
         case WM_MOUSEMOVE:
@@ -211,8 +259,7 @@ LRESULT CALLBACK WindowProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) {
             GetCursorPos(&pos);
             if (pos.x != 400 && pos.y != 300)
             {
-                camera.yaw += (pos.x - 400.0f) * 0.001f;
-                camera.pitch += (pos.y - 300.0f) * 0.001f;
+                simulation.PostLook((pos.x - 400.0f) * 0.001f, (pos.y - 300.0f) * 0.001f);
                 SetCursorPos(400, 300);
             }
             break;
@@ -221,7 +268,7 @@ LRESULT CALLBACK WindowProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) {
 
         // Move camera forward or backward
         case WM_MOUSEWHEEL:
-            camera.radius -= static_cast<float>( GET_WHEEL_DELTA_WPARAM(wParam) ) / 50.0f; // wheel rotation 
+            simulation.PostZoom( static_cast<float>( GET_WHEEL_DELTA_WPARAM(wParam) ) / 50.0f ); // wheel rotation
             break;
 
 		case WM_CLOSE:
@@ -253,6 +300,15 @@ void Init(void) {
 	else
 		dwBehaviorFlags |= D3DCREATE_SOFTWARE_VERTEXPROCESSING;
 
+    // Instanced silhouettes read edge records from a float vertex texture
+    if ( d3dCaps.VertexShaderVersion >= D3DVS_VERSION(3, 0) && (d3dCaps.DeclTypes & D3DDTCAPS_UBYTE4) &&
+         d3dCaps.MaxTextureWidth >= ShadowGeometry::edgesPerRow * ShadowMesh::edgeRecordSize &&
+         SUCCEEDED( pD3D->CheckDeviceFormat(D3DADAPTER_DEFAULT, D3DDEVTYPE_HAL, d3ddm.Format, D3DUSAGE_QUERY_VERTEXTEXTURE, D3DRTYPE_TEXTURE, D3DFMT_A32B32G32R32F) ) )
+        ShadowGeometry::edgeTextureRows = d3dCaps.MaxTextureHeight;
+
+	// Textures are created on storage worker threads
+	dwBehaviorFlags |= D3DCREATE_MULTITHREADED;
+
 	memset(&d3dpp, 0, sizeof(d3dpp));
 
     d3dpp.BackBufferFormat = D3DFMT_A8R8G8B8;
@@ -270,18 +326,77 @@ void Init(void) {
     ScreenQuad::Instance()->Init();
 }
 
-void InitScene(void) {
+// Scene file from command line: [options] [scene file] or [options]
+// -stress <casters> <lights>, options are -counters <file>, -budget <ms>,
+// -shadowbudget <MB> & -capture <frame>. Stress scenes are generated into
+// the data folder.
+string PrepareScene(const char* commandLine) {
+    istringstream arguments(commandLine);
+    string        argument;
+
+    if ( !(arguments >> argument) )
+        return defaultScene;
+    while (argument == "-counters" || argument == "-budget" || argument == "-shadowbudget" || argument == "-capture") {
+        if (argument == "-counters") {
+            if ( !(arguments >> counterFile) )
+                throw runtime_error("Usage: -counters <file>");
+            if ( !counterExport.Start(counterFile) )
+                throw runtime_error("Can't write " + counterFile);
+        }
+        else if (argument == "-budget") {
+            float budget = 0.0f;
+
+            if ( !(arguments >> budget) || budget <= 0.0f )
+                throw runtime_error("Usage: -budget <ms>");
+            quality.SetBudget(budget);
+            quality.Enable(true);
+        }
+        else if (argument == "-capture") {
+            if ( !(arguments >> captureAt) || captureAt < 0 )
+                throw runtime_error("Usage: -capture <frame>");
+        }
+        else {
+            float megabytes = 0.0f;
+
+            if ( !(arguments >> megabytes) || megabytes <= 0.0f )
+                throw runtime_error("Usage: -shadowbudget <MB>");
+            ShadowStreamer::budget = static_cast<size_t>(megabytes * 1024.0f * 1024.0f);
+        }
+        if ( !(arguments >> argument) )
+            return defaultScene;
+    }
+    if (argument != "-stress")
+        return argument;
+
+    StressSceneSettings settings = Scene::stressSettings;
+    Scene               stress;
+    ostringstream       fileName;
+
+    arguments >> settings.casters >> settings.lights;
+    if ( settings.casters < 1 || settings.lights < 1 )
+        throw runtime_error("Usage: -stress <casters> <lights>");
+
+    stress.Generate(settings, "data\\");
+    fileName << "data\\stress_" << settings.casters << "_" << settings.lights << ".scene";
+    if ( !stress.Save(fileName.str()) )
+        throw runtime_error("Can't write " + fileName.str());
+
+    return fileName.str();
+}
+
+void InitScene(const string& sceneFile) {
     // Set matrices
     D3DXMATRIX  matProj;
-    D3DXMATRIX  transform;
 
-    camera.yaw = 0.0f;
-    camera.radius = 60.0f;
-    camera.pitch = 0.5f;
+    scene.Load(sceneFile);
+    camera.yaw = scene.cameraYaw;
+    camera.radius = scene.cameraRadius;
+    camera.pitch = scene.cameraPitch;
     camera.eyePt = D3DXVECTOR3(0.0, 0.0, 0.0);
     camera.up = D3DXVECTOR3(0.0, 1.0, 0.0);
 
-    D3DXMatrixPerspectiveFovLH(&matProj, D3DX_PI/4, 1.0f, static_cast<float>(width)/height, 500.0f);
+    // Far plane behind the whole scene
+    D3DXMatrixPerspectiveFovLH(&matProj, D3DX_PI/4, 1.0f, static_cast<float>(width)/height, max(500.0f, 3.0f * camera.radius));
     pd3dDevice->SetTransform(D3DTS_PROJECTION, &matProj);
 
     // States
@@ -291,63 +406,107 @@ void InitScene(void) {
 	pd3dDevice->SetSamplerState(0, D3DSAMP_MINFILTER, D3DTEXF_ANISOTROPIC);
 	pd3dDevice->SetSamplerState(0, D3DSAMP_MAGFILTER, D3DTEXF_ANISOTROPIC);
 
-    // Load scene
-    meshes.resize(3);
-    meshes[DYNAMIC_OBJ].Load("E:\\sem6\\acg\\test_shadows\\Shadows\\Shadows\\data\\group.x");
-    meshes[STATIC_OBJ].Load("E:\\sem6\\acg\\test_shadows\\Shadows\\Shadows\\data\\torus.x");
-    meshes[ROOM].Load("E:\\sem6\\acg\\test_shadows\\Shadows\\Shadows\\data\\ground.x");
-    lightMesh.Load("E:\\sem6\\acg\\test_shadows\\Shadows\\Shadows\\data\\light.x");
+    // White texture until mesh textures are loaded
+    TextureData* placeholder = new TextureData();
+    D3DLOCKED_RECT rect;
 
-    D3DXMatrixTranslation(&transform, 8.0f, 3.0f, 0.0f);
-    meshes[DYNAMIC_OBJ].Transform(transform);
-	
-	D3DXMatrixRotationX(&transform, D3DX_PI / 2);
-	meshes[STATIC_OBJ].Transform(transform);
+    D3DXCreateTexture(pd3dDevice, 1, 1, 1, 0, D3DFMT_A8R8G8B8, D3DPOOL_MANAGED, &placeholder->pTexture);
+    placeholder->pTexture->LockRect(0, &rect, NULL, 0);
+    *(DWORD*)rect.pBits = D3DCOLOR_ARGB(255, 255, 255, 255);
+    placeholder->pTexture->UnlockRect(0);
+    TextureStorage::Instance()->SetPlaceholder(placeholder);
 
-	D3DXMatrixRotationY(&transform, D3DX_PI / 2);
-	meshes[STATIC_OBJ].Transform(transform);
-	
-	D3DXMatrixTranslation(&transform, 0.0f, 1.0f, 0.0f);
-	meshes[STATIC_OBJ].Transform(transform);
+    // Shadow vertices are not read back on CPU
+    ShadowGeometry::releaseCpuCopies = true;
 
-	D3DXMatrixScaling(&transform, 2.0f, 2.0f, 2.0f);
-	meshes[STATIC_OBJ].Transform(transform);
+    // Instances share meshes of the same file
+    transforms.Clear();
+    meshes.resize( scene.instances.size() );
+    for(int i = 0; i<meshes.size(); ++i) {
+        meshes[i].Load( scene.GetPath( scene.meshes[ scene.instances[i].mesh ] ).c_str() );
+        transforms.Add( scene.instances[i].transform, scene.instances[i].parent );
+    }
+    transforms.Update();
+    for(int i = 0; i<meshes.size(); ++i)
+        meshes[i].SetTransform( transforms.GetWorld(i), transforms.GetWorldInverse(i) );
+
+    // Hierarchy over instance boxes
+    vector<Bounds> bounds( meshes.size() );
+    for(int i = 0; i<meshes.size(); ++i)
+        meshes[i].GetBounds(bounds[i]);
+    sceneBvh.Build(bounds);
+    meshVisible.assign(meshes.size(), 1);
 
-    D3DXMatrixScaling(&transform, 3.0f, 3.0f, 3.0f);
-    meshes[ROOM].Transform(transform);
+    // Shadow caster levels of detail, once per mesh file
+    ofstream     report("shadow_lods.txt");
+    vector<bool> reported( scene.meshes.size(), false );
+
+    for(int i = 0; i<meshes.size(); ++i) {
+        if ( !reported[ scene.instances[i].mesh ] ) {
+            reported[ scene.instances[i].mesh ] = true;
+            meshes[i].WriteShadowLodReport(report);
+        }
+    }
 
     // Lights
-    lights.resize(2);
+    lights = scene.lights;
+    if ( lights.empty() )
+        throw runtime_error("Scene has no lights");
+
+    // Light spheres share one mesh
+    if ( !scene.lightMesh.empty() ) {
+        lightMeshes.resize( lights.size() );
+        for(int i = 0; i<lightMeshes.size(); ++i)
+            lightMeshes[i].Load( scene.GetPath(scene.lightMesh).c_str() );
+    }
+
+    // Static shadows of the lights where they were baked
+    useBakedShadows = bakedShadows.Load(sceneFile, scene);
 
-    lights[0].position = D3DXVECTOR4(-15.0, 12.0, 0.0, 1.0);
-    lights[0].color = D3DXVECTOR4(0.0, 1.0, 1.0, 1.0);
-    lights[0].linearAttenuation = 0.03f;
-    lights[0].radius = 1.0f;
-    lights[0].range = 150.0f;
+    // Memory of meshes, shadow data & textures once they are loaded
+    MemoryReport      memory;
+    set<const void*>  counted;
 
-    lights[1].position = D3DXVECTOR4(20.0, 13.0, 0.0, 1.0);
-    lights[1].color = D3DXVECTOR4(0.0, 1.0, 1.0, 1.0);
-    lights[1].linearAttenuation = 0.01f;
-    lights[1].range = 150.0f;
-    lights[1].radius = 2.0f;
+    TextureStorage::Instance()->Wait();
+    for(int i = 0; i<meshes.size(); ++i)
+        meshes[i].AddMemoryUsage(memory, counted);
+    for(int i = 0; i<lightMeshes.size(); ++i)
+        lightMeshes[i].AddMemoryUsage(memory, counted);
+    memory.Add("z texture", "render targets", MemoryReport::Of( ZTexture::Instance()->GetZTexture() ));
+    bakedShadows.AddMemoryUsage(memory);
+
+    ofstream memoryReport("memory_report.txt");
+    memory.Write(memoryReport);
+
+    qualityLog.open("quality_log.txt");
+    qualityLog.precision(3);
+    qualityLog << fixed << "Shadow quality controller, budget " << quality.GetBudget() << " ms, "
+               << (quality.IsEnabled() ? "on" : "off, Q switches it on") << endl;
+    quality.SetLog(&qualityLog);
 
-    animate = true;
 	nLights = 1;
-    lastTime = GetTime();
+    lastTime = frameStart = GetTime();
     framesLeft = 0;
     showPenumbraCone = false;
-    
+    savedMergeAngle = ShadowGeometry::mergeAngle;
 }
 
 void InitEffects(void) {
     LPD3DXBUFFER    pBufferErrors = NULL;
 
     // Load effect
-	D3DXCreateEffectFromFileA( pd3dDevice, "E:\\sem6\\acg\\test_shadows\\Shadows\\Shadows\\shaders\\Lighting.fx", NULL, NULL, 0, NULL, &pLightingEffect, &pBufferErrors);
+	D3DXCreateEffectFromFileA( pd3dDevice, "shaders\\Lighting.fx", NULL, NULL, 0, NULL, &pLightingEffect, &pBufferErrors);
 }
 
 void ShutDown(void) {
+    simulation.Stop();
+    counterExport.Stop();
+    streamer.Stop();
     for_each(meshes.begin(), meshes.end(), mem_fun_ref(&Mesh::Clear));
+    for_each(lightMeshes.begin(), lightMeshes.end(), mem_fun_ref(&Mesh::Clear));
+    MeshStorage::Free();
+    TextureStorage::Free();
+    bakedShadows.Clear();
     if (pFont) pFont->Release();
     if (pLightingEffect) pLightingEffect->Release();
     if (pd3dDevice) pd3dDevice->Release();
@@ -359,24 +518,26 @@ void ShutDown(void) {
 void RenderAmbient() {
     D3DXMATRIX worldTransform = GetCameraTransform();
 
+    Device::Marker("Ambient");
+
     // Clear states
-	pd3dDevice->SetRenderState(D3DRS_LIGHTING, TRUE);
-	pd3dDevice->SetRenderState(D3DRS_ALPHABLENDENABLE, FALSE);
-	pd3dDevice->SetRenderState(D3DRS_ZWRITEENABLE, TRUE);
-	pd3dDevice->SetRenderState(D3DRS_STENCILENABLE, FALSE);
-	pd3dDevice->SetRenderState(D3DRS_COLORWRITEENABLE, D3DCOLORWRITEENABLE_RED|D3DCOLORWRITEENABLE_GREEN|D3DCOLORWRITEENABLE_BLUE);
+	Device::SetRenderState(D3DRS_LIGHTING, TRUE);
+	Device::SetRenderState(D3DRS_ALPHABLENDENABLE, FALSE);
+	Device::SetRenderState(D3DRS_ZWRITEENABLE, TRUE);
+	Device::SetRenderState(D3DRS_STENCILENABLE, FALSE);
+	Device::SetRenderState(D3DRS_COLORWRITEENABLE, D3DCOLORWRITEENABLE_RED|D3DCOLORWRITEENABLE_GREEN|D3DCOLORWRITEENABLE_BLUE);
 
     // shift scene a little to prevent z-fighting
-	pd3dDevice->SetRenderState(D3DRS_SLOPESCALEDEPTHBIAS, F2DW(0.01f));
-	pd3dDevice->SetRenderState(D3DRS_DEPTHBIAS, F2DW(1e-5f));
+	Device::SetRenderState(D3DRS_SLOPESCALEDEPTHBIAS, F2DW(0.01f));
+	Device::SetRenderState(D3DRS_DEPTHBIAS, F2DW(1e-5f));
 
 	// Render
-    for(int i=0; i<meshes.size(); i++)
-        meshes[i].RenderAmbient(worldTransform);
+    for(int i=0; i<visibleMeshes.size(); i++)
+        meshes[ visibleMeshes[i] ].RenderAmbient(worldTransform);
 
     // Draw white lights spheres
-	pd3dDevice->SetRenderState( D3DRS_LIGHTING,	FALSE );
-    for(int i=0; i<nLights; ++i) {
+	Device::SetRenderState( D3DRS_LIGHTING,	FALSE );
+    for(int i=0; i<nLights && i<lightMeshes.size(); ++i) {
         D3DXMATRIX transform;
         D3DXMATRIX scaling;
 
@@ -384,8 +545,8 @@ void RenderAmbient() {
         D3DXMatrixScaling(&scaling, lights[i].radius, lights[i].radius, lights[i].radius);
         D3DXMatrixMultiply(&transform, &scaling, &transform);
 
-        lightMesh.SetTransform(transform);
-        lightMesh.RenderAmbient(worldTransform);
+        lightMeshes[i].SetTransform(transform);
+        lightMeshes[i].RenderAmbient(worldTransform);
     }
 
 }
@@ -394,75 +555,192 @@ void RenderZFill() {
     D3DXMATRIX  worldTransform = GetCameraTransform();
     UINT        uPasses;
 
+    Device::Marker("ZFill");
     ZTexture::Instance()->SetAsTarget();
    
-    pd3dDevice->Clear(0, NULL, D3DCLEAR_TARGET | D3DCLEAR_ZBUFFER, D3DCOLOR_COLORVALUE(0.0f, 0.0f, 0.0f, 1.0f), 1.0f, 0);
-    pd3dDevice->BeginScene();
+    Device::Clear(D3DCLEAR_TARGET | D3DCLEAR_ZBUFFER, D3DCOLOR_COLORVALUE(0.0f, 0.0f, 0.0f, 1.0f), 1.0f, 0);
+    Device::BeginScene();
 
     // Render
-    pLightingEffect->SetTechnique("ZFill");
-    pLightingEffect->Begin(&uPasses, 0);
-    for(int i =0; i<meshes.size(); ++i)
-        meshes[i].RenderZF(worldTransform);
-    pLightingEffect->End();
-    pd3dDevice->EndScene();
+    Effect::SetTechnique("ZFill");
+    Effect::Begin(&uPasses);
+    for(int i =0; i<visibleMeshes.size(); ++i)
+        meshes[ visibleMeshes[i] ].RenderZF(worldTransform);
+    Effect::End();
+    Device::EndScene();
     ZTexture::Instance()->RestoreTarget();
 }
 
-void RenderLightened(const Light& light) {
+// Distance from eye to center of instance box
+float GetCasterDistance(int instance, const D3DXVECTOR3& eyePosition) {
+    const Bounds& bounds = sceneBvh.GetBounds(instance);
+    D3DXVECTOR3   center( bounds.min[0] + bounds.max[0], bounds.min[1] + bounds.max[1], bounds.min[2] + bounds.max[2] );
+
+    return D3DXVec3Length( &(center * 0.5f - eyePosition) );
+}
+
+// Umbra into stencil & penumbra into alpha, leaves litMeshes of the light.
+// Quality settings may keep silhouettes of earlier frames & leave out the
+// penumbra of distant casters or of the whole light. Where the light is
+// baked, static casters only shadow dynamic receivers & the lightmap adds
+// the rest.
+void RenderShadows(int lightIndex) {
+    const Light&           light = lights[lightIndex];
+    const QualitySettings& settings = quality.GetSettings();
     D3DXMATRIX  worldTransform = GetCameraTransform();
+    D3DXVECTOR3 eyePosition = GetCameraPosition();
     UINT        uPasses;
+    double      start = GetTime();
+    bool        update = (frameNumber + lightIndex) % settings.updateInterval == 0;
+    bool        soft = lightIndex < nLights - settings.hardLights;
+    bool        measureArea = showVolumeArea || ( quality.IsEnabled() && frameNumber % coverageInterval == 0 );
+    float       penumbraDistance = settings.penumbraDistance * camera.radius;
+    bool        baked = useBakedShadows && bakedShadows.IsBaked(lightIndex, light);
+
+    Device::Marker("Shadows");
+
+    // Only meshes in range cast or receive this light
+    sceneBvh.QuerySphere(light.position, light.range, litMeshes);
+
+    // Volumes end behind the farthest visible receiver
+    receivers.clear();
+    dynamicReceivers.clear();
+    for(int i = 0; i<litMeshes.size(); ++i) {
+        if (meshVisible[ litMeshes[i] ]) {
+            receivers.push_back( sceneBvh.GetBounds(litMeshes[i]) );
+            if ( !bakedShadows.IsStatic(litMeshes[i]) )
+                dynamicReceivers.push_back( sceneBvh.GetBounds(litMeshes[i]) );
+        }
+    }
+    frameCounters->Add(bakedLightsCounter, baked ? 1 : 0);
 
     // shadow
-    pLightingEffect->SetTechnique("Shadow");
+    Effect::SetTechnique("Shadow");
     
-    pLightingEffect->Begin(&uPasses, 0);
-    for(int i = 0; i<meshes.size(); ++i) {
-        if (meshes[i].IsClosed()) {
-            meshes[i].ComputeShadowVolumes(light);
-            meshes[i].SetShadowConstants(worldTransform, light);
-            meshes[i].RenderUmbra(0);
-            meshes[i].RenderPenumbra(1);
+    Effect::Begin(&uPasses);
+    for(int i = 0; i<litMeshes.size(); ++i) {
+        Mesh& mesh = meshes[ litMeshes[i] ];
+
+        if (mesh.IsClosed()) {
+            bool fromBake = baked && bakedShadows.IsStatic(litMeshes[i]);
+            bool reuse = !update && mesh.ReuseShadowVolume(lightIndex);
+            bool shadowed = mesh.ClipShadowVolume(light, lightIndex, fromBake ? dynamicReceivers : receivers, reuse);
+
+            if (fromBake && !shadowed) {
+                frameCounters->Add(bakedCastersCounter, 1);
+                continue;
+            }
+
+            if (!shadowed && !showVolumeArea)
+                continue;
+
+            if (!reuse) {
+                mesh.SelectShadowLod(eyePosition, light);
+                mesh.ComputeShadowVolumes(light, lightIndex);
+            }
+            if (showVolumeArea)
+                unclippedVolumeArea += mesh.GetUmbraArea(worldTransform, light, light.range);
+            if (!shadowed)
+                continue;
+            if (measureArea)
+                volumeArea += mesh.GetUmbraArea(worldTransform, light, mesh.GetExtrusion());
+
+            mesh.SetShadowConstants(worldTransform, light);
+            mesh.RenderUmbra(0);
+            if ( soft && GetCasterDistance(litMeshes[i], eyePosition) <= penumbraDistance )
+                mesh.RenderPenumbra(1);
+            else
+                frameCounters->Add(umbraOnlyCounter, 1);
         }
     }
-	pLightingEffect->End();
+	Effect::End();
+
+    if (baked)
+        bakedShadows.Render(lightIndex, worldTransform, meshes, meshVisible);
+
+    shadowTime += static_cast<float>(GetTime() - start) * 1000.0f;
+}
+
+void RenderLightened(int lightIndex) {
+    const Light& light = lights[lightIndex];
+    D3DXMATRIX  worldTransform = GetCameraTransform();
+    UINT        uPasses;
+
+    RenderShadows(lightIndex);
 
     // Draw penumra cone
     if (showPenumbraCone) {
-        pLightingEffect->SetTechnique("ShowPenumbraCone");
-        pLightingEffect->Begin(&uPasses, 0);
-        for(int i = 0; i<meshes.size(); i++) {
-            if (meshes[i].IsClosed()) {
-                meshes[i].SetShadowConstants(worldTransform, light);
-                meshes[i].RenderUmbra(0);
+        Device::Marker("PenumbraCone");
+        Effect::SetTechnique("ShowPenumbraCone");
+        Effect::Begin(&uPasses);
+        for(int i = 0; i<litMeshes.size(); i++) {
+            const Mesh& mesh = meshes[ litMeshes[i] ];
+
+            if (mesh.IsClosed() && mesh.GetExtrusion() > 0.0f) {
+                mesh.SetShadowConstants(worldTransform, light);
+                mesh.RenderUmbra(0);
             }
         }
-        pLightingEffect->End();
+        Effect::End();
     }
 
-    // Add lightened
-    pLightingEffect->SetTechnique("Lighting");
-    pLightingEffect->Begin(&uPasses, 0);
-    for(int i=0; i<meshes.size(); i++)
+    // Add lightened, visible receivers only
+    Device::Marker("Lighting");
+    Effect::SetTechnique("Lighting");
+    Effect::Begin(&uPasses);
+    for(int i=0; i<litMeshes.size(); i++)
     {
-        meshes[i].Render(worldTransform, light);
-        meshes[i].RenderTextured(worldTransform, light);
+        const Mesh& mesh = meshes[ litMeshes[i] ];
+
+        if (meshVisible[ litMeshes[i] ]) {
+            mesh.Render(worldTransform, light);
+            mesh.RenderTextured(worldTransform, light);
+        }
     }
-    pLightingEffect->End();
+    Effect::End();
 }
 
 void ClearStencilAlpha() {
     UINT uPasses;
-    pLightingEffect->SetTechnique("ClearStencilAlpha");
-    pLightingEffect->Begin(&uPasses, 0);
+    Device::Marker("ClearStencilAlpha");
+    Effect::SetTechnique("ClearStencilAlpha");
+    Effect::Begin(&uPasses);
     ScreenQuad::Instance()->Render();
-    pLightingEffect->End();
+    Effect::End();
+}
+
+// Visible meshes of this frame
+void QueryVisibleMeshes() {
+    float planes[6][4];
+
+    Mesh::SetCamera( GetCameraTransform() );
+    GetFrustumPlanes(GetCameraTransform(), planes);
+    for(int i = 0; i<visibleMeshes.size(); ++i)
+        meshVisible[ visibleMeshes[i] ] = 0;
+    sceneBvh.QueryFrustum(planes, visibleMeshes);
+    for(int i = 0; i<visibleMeshes.size(); ++i)
+        meshVisible[ visibleMeshes[i] ] = 1;
 }
 
 void Render(void) {
+    double        start = GetTime();
+    FrameCapture* capture = FrameCapture::Instance();
+
+    if ( captureFrame || static_cast<int>(frameNumber) == captureAt ) {
+        capture->Begin(frameNumber);
+        captureFrame = false;
+    }
+
+    QueryVisibleMeshes();
+    volumeArea = unclippedVolumeArea = 0.0f;
+    shadowTime = 0.0f;
+    Mesh::lodSettings.scale = quality.GetSettings().lodScale;
+    streamer.Update( meshes, lights, nLights, GetCameraPosition() );
+
     RenderZFill();
-    pd3dDevice->Clear(0, NULL, D3DCLEAR_TARGET | D3DCLEAR_ZBUFFER | D3DCLEAR_STENCIL, D3DCOLOR_COLORVALUE(0.0f, 0.0f, 0.0f, 1.0f), 1.0f, 0);
-    pd3dDevice->BeginScene();
+    Device::Marker("Clear");
+    Device::Clear(D3DCLEAR_TARGET | D3DCLEAR_ZBUFFER | D3DCLEAR_STENCIL, D3DCOLOR_COLORVALUE(0.0f, 0.0f, 0.0f, 1.0f), 1.0f, 0);
+    Device::BeginScene();
 
     // Ambient part
     RenderAmbient();
@@ -471,32 +749,293 @@ void Render(void) {
     // Add lightened component
     for(int i = 0; i<nLights; i++) {
         ClearStencilAlpha();
-        RenderLightened(lights[i]);
+        RenderLightened(i);
+    }
+
+    if (showVolumeArea) {
+        RECT          rect = { 10, 10, 0, 0 };
+        ostringstream text;
+
+        text.precision(2);
+        text << fixed << "Umbra sides: " << volumeArea * 1e-6f << " Mpixels, "
+             << unclippedVolumeArea * 1e-6f << " Mpixels unclipped";
+        pFont->DrawTextA(NULL, text.str().c_str(), -1, &rect, DT_NOCLIP, fontColor);
+    }
+
+    if ( !referenceText.empty() ) {
+        RECT rect = { 10, 70, 0, 0 };
+        pFont->DrawTextA(NULL, referenceText.c_str(), -1, &rect, DT_NOCLIP, fontColor);
     }
-    pd3dDevice->EndScene();
-    pd3dDevice->Present(NULL, NULL, NULL, NULL);
+
+    if (showTimings) {
+        const SimulationState& state = simulation.GetState();
+        RECT          rect = { 10, 30, 0, 0 };
+        ostringstream text;
+
+        text.precision(2);
+        text << fixed << "Simulation: " << state.stepTime << " ms/step at " << 1.0f / Simulation::stepLength << " Hz, step " << simulationStep
+             << "  Render: " << renderTime << " ms/frame, " << fps << " fps";
+        pFont->DrawTextA(NULL, text.str().c_str(), -1, &rect, DT_NOCLIP, fontColor);
+
+        const TransformCounters& counters = Mesh::counters;
+        rect.top = 50;
+        text.str("");
+        text << "Inversions: " << transforms.GetInversions() + counters.inversions << ", " << counters.inversionsAvoided << " avoided"
+             << "  Object space lights: " << counters.lightHits << " cached, " << counters.lightMisses << " transformed";
+        pFont->DrawTextA(NULL, text.str().c_str(), -1, &rect, DT_NOCLIP, fontColor);
+
+        // Since load, meshes sharing data count once
+        SilhouetteCacheStats cache;
+        set<const void*>     counted;
+        memset(&cache, 0, sizeof(cache));
+        for(int i = 0; i<meshes.size(); ++i)
+            meshes[i].AddSilhouetteCacheStats(cache, counted);
+        rect.top = 90;
+        text.str("");
+        text << "Silhouette cache: " << 100.0f * cache.GetHitRate() << "% hits, " << cache.entries << " entries in "
+             << cache.bytes / 1024.0f << " KB, " << cache.evictions << " evicted, " << cache.secondsSaved * 1000.0 << " ms saved";
+        pFont->DrawTextA(NULL, text.str().c_str(), -1, &rect, DT_NOCLIP, fontColor);
+
+        // Since load, with -shadowbudget only
+        if (ShadowStreamer::budget > 0) {
+            const StreamingStats& streaming = streamer.GetStats();
+            rect.top = 110;
+            text.str("");
+            text << "Shadow pages: " << streaming.residentLevels << " resident in " << streaming.residentBytes / 1048576.0f << " of "
+                 << ShadowStreamer::budget / 1048576.0f << " MB, " << streaming.loads << " loaded, " << streaming.evictions << " evicted, "
+                 << streaming.bytesRead / 1048576.0 << " MB read";
+            pFont->DrawTextA(NULL, text.str().c_str(), -1, &rect, DT_NOCLIP, fontColor);
+        }
+    }
+    // Counters of the last closed frame
+    if (showCounters) {
+        const CounterSnapshot& frame = frameCounters->GetLastFrame();
+        RECT                   rect = { 10, 130, 0, 0 };
+
+        for(int i = 0; i<frame.names.size(); ++i, rect.top += 20) {
+            ostringstream text;
+
+            text.precision(2);
+            text << fixed << frame.names[i] << ": " << frame.values[i];
+            pFont->DrawTextA(NULL, text.str().c_str(), -1, &rect, DT_NOCLIP, fontColor);
+        }
+    }
+
+    frameCounters->Set(lightsCounter, nLights);
+    frameCounters->Set(visibleCounter, visibleMeshes.size());
+    frameCounters->Set(inversionsCounter, transforms.GetInversions() + Mesh::counters.inversions);
+    frameCounters->Set(avoidedCounter, Mesh::counters.inversionsAvoided);
+    transforms.ResetCounters();
+    Mesh::counters = TransformCounters();
+    Device::EndScene();
+
+    // Render thread time without waiting in Present
+    double time = GetTime();
+
+    renderTime += (static_cast<float>(time - start) * 1000.0f - renderTime) * 0.05f;
+    ++framesLeft;
+    if (time - lastTime > 0.25) {
+        fps = static_cast<float>(framesLeft / (time - lastTime));
+        framesLeft = 0;
+        lastTime = time;
+    }
+    frameCounters->Set(renderMsCounter, (time - start) * 1000.0);
+    frameCounters->Set(fpsCounter, fps);
+
+    // Frame before this one ended at start, Present included
+    FrameTimings timings;
+
+    if ( quality.IsEnabled() && frameNumber % coverageInterval == 0 )
+        coverage = volumeArea / (width * height);
+    timings.frameMs = static_cast<float>(start - frameStart) * 1000.0f;
+    timings.cpuMs = renderTime;
+    timings.shadowMs = shadowTime;
+    timings.coverage = coverage;
+    timings.lights = nLights;
+    quality.Update(timings);
+    frameStart = start;
+    ++frameNumber;
+    frameCounters->Set(qualityCounter, quality.GetTotalSteps());
+    frameCounters->EndFrame();
+
+    Device::Marker("Present");
+    Device::Present();
+
+    if ( capture->IsRecording() ) {
+        ostringstream fileName;
+
+        capture->End();
+        fileName << "capture_" << capture->GetFrame() << ".cap";
+        capture->Save( fileName.str() );
+    }
+}
+
+// Penumbra wedges of the first light against ray traced ground truth. Both
+// visibility buffers, their difference & the numbers go next to the exe.
+void CompareReference(void) {
+    const Light&        light = lights[0];
+    D3DXMATRIX          viewMatrix = GetCameraTransform();
+    D3DXMATRIX          projMatrix;
+    D3DXMATRIX          invViewProj;
+    D3DSURFACE_DESC     desc;
+    D3DLOCKED_RECT      rect;
+    LPDIRECT3DSURFACE9  pBackBuffer = NULL;
+    LPDIRECT3DSURFACE9  pCopy = NULL;
+    UINT                uPasses;
+    vector<float>       receiverTriangles;
+    vector<float>       casterTriangles;
+    SoftShadowReference reference;
+
+    compareReference = false;
+
+    // Frame like Render draws it, alpha ends as visibility of the light
+    QueryVisibleMeshes();
+    RenderZFill();
+    Device::Clear(D3DCLEAR_TARGET | D3DCLEAR_ZBUFFER | D3DCLEAR_STENCIL, D3DCOLOR_COLORVALUE(0.0f, 0.0f, 0.0f, 1.0f), 1.0f, 0);
+    Device::BeginScene();
+    RenderAmbient();
+    ClearStencilAlpha();
+    RenderShadows(0);
+    Effect::SetTechnique("UmbraAlpha");
+    Effect::Begin(&uPasses);
+    ScreenQuad::Instance()->Render();
+    Effect::End();
+    Device::EndScene();
+
+    // Alpha of the back buffer
+    pd3dDevice->GetBackBuffer(0, 0, D3DBACKBUFFER_TYPE_MONO, &pBackBuffer);
+    pBackBuffer->GetDesc(&desc);
+    pd3dDevice->CreateOffscreenPlainSurface(desc.Width, desc.Height, desc.Format, D3DPOOL_SYSTEMMEM, &pCopy, NULL);
+    pd3dDevice->GetRenderTargetData(pBackBuffer, pCopy);
+
+    vector<float> approximation(desc.Width * desc.Height);
+    pCopy->LockRect(&rect, NULL, D3DLOCK_READONLY);
+    for(int y = 0; y<desc.Height; ++y) {
+        const DWORD* row = (const DWORD*)( (const char*)rect.pBits + y * rect.Pitch );
+
+        for(int x = 0; x<desc.Width; ++x)
+            approximation[y * desc.Width + x] = (row[x] >> 24) / 255.0f;
+    }
+    pCopy->UnlockRect();
+    pCopy->Release();
+    pBackBuffer->Release();
+
+    // Scene as drawn, casters are the closed meshes in light range
+    for(int i = 0; i<visibleMeshes.size(); ++i)
+        meshes[ visibleMeshes[i] ].GetTriangles(receiverTriangles);
+    for(int i = 0; i<lightMeshes.size(); ++i)
+        lightMeshes[i].GetTriangles(receiverTriangles);
+    for(int i = 0; i<litMeshes.size(); ++i) {
+        if ( meshes[ litMeshes[i] ].IsClosed() )
+            meshes[ litMeshes[i] ].GetTriangles(casterTriangles);
+    }
+
+    pd3dDevice->GetTransform(D3DTS_PROJECTION, &projMatrix);
+    D3DXMatrixMultiply(&invViewProj, &viewMatrix, &projMatrix);
+    D3DXMatrixInverse(&invViewProj, NULL, &invViewProj);
+
+    Utils::WorkerPool pool;
+    reference.SetGeometry(receiverTriangles, casterTriangles);
+    reference.SetView(&invViewProj._11, desc.Width, desc.Height);
+    reference.SetLight(&light.position.x, light.radius);
+    reference.Compute(pool);
+
+    // Differences where the reference has a receiver
+    const vector<float>& visibility = reference.GetVisibility();
+    vector<float>        difference( visibility.size() );
+    for(int i = 0; i<visibility.size(); ++i) {
+        if (visibility[i] < 0.0f)
+            approximation[i] = -1.0f;
+        difference[i] = visibility[i] < 0.0f ? -1.0f : fabs(approximation[i] - visibility[i]);
+    }
+    SoftShadowReference::WriteImage("reference.pgm", visibility, desc.Width, desc.Height);
+    SoftShadowReference::WriteImage("approximation.pgm", approximation, desc.Width, desc.Height);
+    SoftShadowReference::WriteImage("difference.pgm", difference, desc.Width, desc.Height);
+
+    const ReferenceStats& stats = reference.GetStats();
+    VisibilityError       error = SoftShadowReference::Compare(visibility, approximation);
+    ostringstream         text;
+    ofstream              report("reference.txt");
+
+    text.precision(3);
+    text << fixed << "Reference: mean error " << error.meanAbs << ", rms " << error.rms << ", max " << error.max
+         << ", " << 100.0f * error.overTenth << "% over 0.1; penumbra " << error.penumbraPixels << " pixels, mean " << error.penumbraMeanAbs
+         << ", rms " << error.penumbraRms;
+    referenceText = text.str();
+
+    report << referenceText << endl
+           << "Light radius " << light.radius << ", " << receiverTriangles.size() / 9 << " receiver & " << casterTriangles.size() / 9 << " caster triangles" << endl
+           << stats.primaryRays << " camera & " << stats.shadowRays << " shadow rays in " << stats.seconds << " s on " << pool.GetNumThreads() << " threads, "
+           << stats.GetRaysPerSecond() * 1e-6 << " Mrays/s" << endl
+           << stats.passes << " passes of " << SoftShadowReference::settings.strata * SoftShadowReference::settings.strata << " samples, "
+           << stats.activePixels << " pixels above tolerance after the last" << endl;
 }
 
-void Update(void) {
-    D3DXMATRIX  rotY;
-    float       time = GetTime();
+// Simulation starts from the loaded scene
+void StartSimulation(void) {
+    SimulationState initial;
+
+    initial.transforms.resize( scene.instances.size() );
+    for(int i = 0; i<initial.transforms.size(); ++i)
+        initial.transforms[i] = scene.instances[i].transform;
+    initial.lights = lights;
+    initial.camera = camera;
+    initial.nLights = nLights;
+    initial.animate = true;
+    initial.showPenumbraCone = showPenumbraCone;
+    initial.showVolumeArea = showVolumeArea;
+    initial.showTimings = showTimings;
+    initial.showCounters = showCounters;
+    initial.adaptiveQuality = quality.IsEnabled();
+    initial.bakedShadows = useBakedShadows;
+    initial.lodEnabled = Mesh::lodSettings.enabled;
+    initial.mergeEdges = ShadowGeometry::mergeAngle > 0.0f;
+    initial.instancedEdges = ShadowGeometry::instancedEdges;
+    initial.clipExtrusion = Mesh::clipExtrusion;
+    initial.step = 0;
+    initial.stepTime = 0.0f;
+
+    simulation.Start(scene, initial);
+}
 
-    ++framesLeft; 
-    if (time - lastTime < 0.01) 
+// Draw newest simulation step. Only spinning instances & their children move.
+void ApplySimulationState(void) {
+    if ( !simulation.Acquire() )
         return;
 
-    // fps  
-    fps = framesLeft / (time - lastTime);
-    framesLeft = 0;
+    const SimulationState& state = simulation.GetState();
+
+    camera = state.camera;
+    lights = state.lights;
+    nLights = state.nLights;
+    showPenumbraCone = state.showPenumbraCone;
+    showVolumeArea = state.showVolumeArea;
+    showTimings = state.showTimings;
+    showCounters = state.showCounters;
+    if ( state.adaptiveQuality != quality.IsEnabled() )
+        quality.Enable(state.adaptiveQuality);
+    useBakedShadows = state.bakedShadows && bakedShadows.IsLoaded();
+    Mesh::lodSettings.enabled = state.lodEnabled;
+    Mesh::clipExtrusion = state.clipExtrusion;
+    ShadowGeometry::mergeAngle = state.mergeEdges ? savedMergeAngle : 0.0f;
+    ShadowGeometry::instancedEdges = state.instancedEdges;
+    simulationStep = state.step;
+
+    for(int i = 0; i<scene.animations.size(); ++i) {
+        int instance = scene.animations[i].instance;
+        transforms.SetLocal( instance, state.transforms[instance] );
+    }
+    transforms.Update();
 
-    // Animate scene
-    if (animate) {
-        D3DXMatrixRotationY(&rotY, 0.2f * (time - lastTime));
-        meshes[DYNAMIC_OBJ].Transform(rotY);
+    const vector<int>& updated = transforms.GetUpdated();
+    for(int i = 0; i<updated.size(); ++i) {
+        int    instance = updated[i];
+        Bounds bounds;
 
-		D3DXMatrixRotationY(&rotY,-1.0f * (time - lastTime));
-		meshes[STATIC_OBJ].Transform(rotY);
+        meshes[instance].SetTransform( transforms.GetWorld(instance), transforms.GetWorldInverse(instance) );
+        meshes[instance].GetBounds(bounds);
+        sceneBvh.SetBounds(instance, bounds);
     }
-
-    lastTime = GetTime();
-}
\ No newline at end of file
+    if ( !updated.empty() )
+        sceneBvh.Refit();
+}
@@ -0,0 +1,115 @@
+#include "MemoryReport.h"
+#include <map>
+
+using namespace std;
+
+MemoryUsage& MemoryUsage::operator += (const MemoryUsage& usage) {
+    cpu += usage.cpu;
+    mirror += usage.mirror;
+    gpu += usage.gpu;
+    return *this;
+}
+
+// Managed resources keep a system memory copy
+static MemoryUsage PoolUsage(D3DPOOL pool, size_t size) {
+    MemoryUsage usage;
+
+    if (pool == D3DPOOL_SYSTEMMEM)
+        usage.cpu = size;
+    else {
+        usage.gpu = size;
+        if (pool == D3DPOOL_MANAGED)
+            usage.mirror = size;
+    }
+    return usage;
+}
+
+MemoryUsage MemoryReport::Of(IDirect3DVertexBuffer9* pBuffer) {
+    D3DVERTEXBUFFER_DESC desc;
+
+    if (!pBuffer)
+        return MemoryUsage();
+    pBuffer->GetDesc(&desc);
+    return PoolUsage(desc.Pool, desc.Size);
+}
+
+MemoryUsage MemoryReport::Of(IDirect3DIndexBuffer9* pBuffer) {
+    D3DINDEXBUFFER_DESC desc;
+
+    if (!pBuffer)
+        return MemoryUsage();
+    pBuffer->GetDesc(&desc);
+    return PoolUsage(desc.Pool, desc.Size);
+}
+
+MemoryUsage MemoryReport::Of(IDirect3DTexture9* pTexture) {
+    D3DSURFACE_DESC desc;
+    size_t          size = 0;
+
+    if (!pTexture)
+        return MemoryUsage();
+    for(DWORD i = 0; i<pTexture->GetLevelCount(); ++i) {
+        pTexture->GetLevelDesc(i, &desc);
+        switch (desc.Format) {
+            // 4x4 blocks
+            case D3DFMT_DXT1:
+                size += ((desc.Width + 3) / 4) * ((desc.Height + 3) / 4) * 8;
+                break;
+            case D3DFMT_DXT5:
+                size += ((desc.Width + 3) / 4) * ((desc.Height + 3) / 4) * 16;
+                break;
+            case D3DFMT_L8:
+                size += desc.Width * desc.Height;
+                break;
+            case D3DFMT_A8L8:
+                size += desc.Width * desc.Height * 2;
+                break;
+            case D3DFMT_A32B32G32R32F:
+                size += desc.Width * desc.Height * 16;
+                break;
+            default:
+                size += desc.Width * desc.Height * 4;
+                break;
+        }
+    }
+    return PoolUsage(desc.Pool, size);
+}
+
+void MemoryReport::Add(const string& owner, const string& subsystem, const MemoryUsage& usage) {
+    Row row;
+
+    row.owner = owner;
+    row.subsystem = subsystem;
+    row.usage = usage;
+    rows.push_back(row);
+}
+
+void MemoryReport::Clear() {
+    rows.clear();
+}
+
+MemoryUsage MemoryReport::GetTotal() const {
+    MemoryUsage total;
+
+    for(int i = 0; i<(int)rows.size(); ++i)
+        total += rows[i].usage;
+    return total;
+}
+
+void MemoryReport::Write(ostream& out) const {
+    map<string, MemoryUsage> subsystems;
+    MemoryUsage              total = GetTotal();
+
+    out << "owner\tsubsystem\tcpu\tmirror\tgpu" << endl;
+    for(int i = 0; i<(int)rows.size(); ++i) {
+        const Row& row = rows[i];
+
+        out << row.owner << '\t' << row.subsystem << '\t' << row.usage.cpu << '\t' << row.usage.mirror << '\t' << row.usage.gpu << endl;
+        subsystems[row.subsystem] += row.usage;
+    }
+
+    out << endl;
+    for(map<string, MemoryUsage>::const_iterator i = subsystems.begin(); i != subsystems.end(); ++i)
+        out << "total\t" << i->first << '\t' << i->second.cpu << '\t' << i->second.mirror << '\t' << i->second.gpu << endl;
+    out << "total\tall\t" << total.cpu << '\t' << total.mirror << '\t' << total.gpu << endl;
+}
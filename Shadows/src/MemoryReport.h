@@ -0,0 +1,54 @@
+#pragma once
+#include "Global.h"
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Bytes held by a resource
+struct MemoryUsage
+{
+    size_t cpu;     // plain CPU arrays
+    size_t mirror;  // system memory copies of managed resources
+    size_t gpu;     // video memory
+
+    MemoryUsage() : cpu(0), mirror(0), gpu(0) {}
+    MemoryUsage& operator += (const MemoryUsage& usage);
+    size_t GetTotal() const { return cpu + mirror + gpu; }
+};
+
+//-----------------------------------------------------------------------------
+// MemoryReport class
+// Collects memory usage of subsystems per owner (mesh, shadow level, ...)
+// and writes it with totals per subsystem.
+//-----------------------------------------------------------------------------
+class MemoryReport
+{
+private:
+    struct Row
+    {
+        std::string owner;
+        std::string subsystem;
+        MemoryUsage usage;
+    };
+
+    std::vector<Row> rows;
+
+public:
+    void Add(const std::string& owner, const std::string& subsystem, const MemoryUsage& usage);
+    void Clear();
+    MemoryUsage GetTotal() const;
+
+    // Rows, subsystem totals & grand total as tab separated table
+    void Write(std::ostream& out) const;
+
+    // Usage of arrays & resources
+    template<class T>
+    static MemoryUsage Of(const std::vector<T>& array) {
+        MemoryUsage usage;
+        usage.cpu = array.capacity() * sizeof(T);
+        return usage;
+    }
+    static MemoryUsage Of(IDirect3DVertexBuffer9* pBuffer);
+    static MemoryUsage Of(IDirect3DIndexBuffer9* pBuffer);
+    static MemoryUsage Of(IDirect3DTexture9* pTexture);
+};
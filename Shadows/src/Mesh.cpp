@@ -1,13 +1,100 @@
 #include "Mesh.h"
+#include "Simplifier.h"
+#include "MemoryReport.h"
+#include "TransformGraph.h"
+#include "CounterRegistry.h"
+#include "ShadowStreamer.h"
+#include "TextureFile.h"
+#include "RenderCalls.h"
 #include <string>
 #include <stdexcept>
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cfloat>
 #include <boost/lambda/lambda.hpp>
 #include <boost/lambda/bind.hpp>
 
 using namespace std;
 using namespace boost::lambda;
 
+// Shadow level of detail chain
+static const int   maxShadowLods = 5;
+static const int   minLodFaces = 64;
+static const float lodReduction = 0.5f;
+static const int   lodFileVersion = 2;
+
+ShadowLodSettings Mesh::lodSettings = { true, 0.0015f, 0.05f, 1.0f };
+bool Mesh::clipExtrusion = true;
+TransformCounters Mesh::counters = { 0, 0, 0, 0 };
+D3DXMATRIX Mesh::viewProj;
+D3DXMATRIX Mesh::invViewProj;
+
+// Silhouettes of the frame, one volume per caster & light
+static CounterRegistry* frameCounters = CounterRegistry::Instance();
+static const int shadowVolumes = frameCounters->Register("shadow volumes");
+static const int silhouetteEdges = frameCounters->Register("silhouette edges");
+static const int maxSilhouetteEdges = frameCounters->Register("max silhouette edges");
+
+// Cone half angle sine above which extrusion is not clipped
+static const float maxClipSine = 0.9f;
+
+// Times receiver box is cut to the cone part spanning it
+static const int clipPasses = 3;
+
+// Block compressed chain tools/TextureConvert made of the file, levels are
+// copied from the mapped file. False if there is none or it is stale.
+static bool LoadConvertedTexture(const string& fileName, LPDIRECT3DTEXTURE9* ppTexture) {
+    TextureFile file;
+
+    if ( !file.Open( TextureFile::GetFileName(fileName) ) || !file.IsCurrent(fileName) )
+        return false;
+
+    const TextureLevel& top = file.GetLevel(0);
+    D3DFORMAT           format = file.GetFormat() == TEXTURE_BC1 ? D3DFMT_DXT1 : D3DFMT_DXT5;
+
+    if ( FAILED( pd3dDevice->CreateTexture(top.width, top.height, file.GetLevelCount(), 0, format, D3DPOOL_MANAGED, ppTexture, NULL) ) )
+        return false;
+
+    // Rows of blocks, the locked pitch may be wider
+    for(int i = 0; i<file.GetLevelCount(); ++i) {
+        const unsigned char* blocks = file.GetData(i);
+        int                  rowBytes = file.GetRowBytes(i);
+        D3DLOCKED_RECT       rect;
+
+        if ( FAILED( (*ppTexture)->LockRect(i, &rect, NULL, 0) ) ) {
+            (*ppTexture)->Release();
+            *ppTexture = NULL;
+            return false;
+        }
+        for(int y = 0; y<(file.GetLevel(i).height + 3) / 4; ++y)
+            memcpy((unsigned char*)rect.pBits + y * rect.Pitch, blocks + y * rowBytes, rowBytes);
+        (*ppTexture)->UnlockRect(i);
+    }
+    return true;
+}
+
+// Create texture from file, runs on storage worker thread
+static TextureData* LoadTexture(const string& fileName) {
+    TextureData* texture = new TextureData();
+
+    if ( LoadConvertedTexture(fileName, &texture->pTexture) )
+        return texture;
+    if ( FAILED( D3DXCreateTextureFromFileA(pd3dDevice, fileName.c_str(), &texture->pTexture) ) ) {
+        delete texture;
+        return NULL;
+    }
+    return texture;
+}
+
+// Simplified level before it is built
+struct LodLevel
+{
+    std::vector<D3DXVECTOR3> vertices;
+    std::vector<Face> faces;
+    float error;
+};
+
 void Mesh::SetShaderConstants0(const D3DXMATRIX& world, const Light& light, const bool objSpace) const {
     D3DXMATRIX   normalMatrix;
     D3DXMATRIX   worldViewMatrix;
@@ -23,23 +110,21 @@ void Mesh::SetShaderConstants0(const D3DXMATRIX& world, const Light& light, cons
     D3DXMatrixMultiply(&worldViewProjMatrix, &worldViewMatrix, &projMatrix);
 
     if (objSpace) {
-        D3DXMATRIX   invTransform;
-
         // From world space to object space
-        D3DXMatrixInverse(&invTransform, NULL, &transform);
         D3DXVec4Transform(&lightPosition, &light.position, &invTransform);
+        ++counters.inversionsAvoided;
     }
     else
         D3DXVec4Transform(&lightPosition, &light.position, &world);
 
     // Setup variables
-    pLightingEffect->SetMatrix("normalMatrix", &normalMatrix);
-    pLightingEffect->SetMatrix("worldViewMatrix", &worldViewMatrix);
-    pLightingEffect->SetMatrix("worldViewProjMatrix", &worldViewProjMatrix);
-    pLightingEffect->SetVector("lightPosition", &lightPosition);
-    pLightingEffect->SetFloat("linearAttenuation", light.linearAttenuation);
-    pLightingEffect->SetFloat("lightRange", light.range);
-    pLightingEffect->SetFloat("lightRadius", light.radius);
+    Effect::SetMatrix("normalMatrix", &normalMatrix);
+    Effect::SetMatrix("worldViewMatrix", &worldViewMatrix);
+    Effect::SetMatrix("worldViewProjMatrix", &worldViewProjMatrix);
+    Effect::SetVector("lightPosition", &lightPosition);
+    Effect::SetFloat("linearAttenuation", light.linearAttenuation);
+    Effect::SetFloat("lightRange", light.range);
+    Effect::SetFloat("lightRadius", light.radius);
 }
 
 void Mesh::SetShaderConstants1(const Light& light, const D3DMATERIAL9& material, const Texture& texture ) const {
@@ -57,222 +142,143 @@ void Mesh::SetShaderConstants1(const Light& light, const D3DMATERIAL9& material,
                                light.color.w * material.Specular.a );
 
     // Setup variables
-    pLightingEffect->SetVector("diffuseProduct", &diffProduct);
-    pLightingEffect->SetVector("specularProduct", &specProduct);
+    Effect::SetVector("diffuseProduct", &diffProduct);
+    Effect::SetVector("specularProduct", &specProduct);
 
     if ( texture.Exist() ) 
-        pLightingEffect->SetTexture("textureDiffuseColor", texture->pTexture);
+        Effect::SetTexture("textureDiffuseColor", texture->pTexture);
 }
 
 
 // Setup constants for shadow technique
 void Mesh::SetShadowConstants(const D3DXMATRIX& world, const Light& light) const {
-    D3DXMATRIX   projMatrix;
     D3DXMATRIX   worldViewMatrix;
     D3DXMATRIX   worldViewProjMatrix;
-    D3DXVECTOR4  lightPosition;
-    D3DXMATRIX   invTransform;
+    D3DXMATRIX   invWorldViewProj;
+
+    // Light the volume was extracted for, so a reused one stays closed
+    D3DXVECTOR4  lightPosition(volumes[currentVolume].extractedLight, 1.0f);
 
     D3DXMatrixMultiply(&worldViewMatrix, &transform, &world);
-    pd3dDevice->GetTransform(D3DTS_PROJECTION, &projMatrix);
-    D3DXMatrixMultiply(&worldViewProjMatrix, &worldViewMatrix, &projMatrix);
+    TransformGraph::Multiply(worldViewProjMatrix, transform, viewProj);
 
-    // From world space to object space
-    D3DXMatrixInverse(&invTransform, NULL, &transform);
-    D3DXVec4Transform(&lightPosition, &light.position, &invTransform);
-    D3DXMatrixInverse(&invTransform, NULL, &worldViewProjMatrix);
+    // Light from volume, screen to object space through cached inverses
+    TransformGraph::Multiply(invWorldViewProj, invViewProj, invTransform);
+    counters.inversionsAvoided += 2;
 
     // Setup variables
-    pLightingEffect->SetMatrix("invTransform", &invTransform);
-    pLightingEffect->SetMatrix("normalMatrix", &worldViewMatrix);
-    pLightingEffect->SetMatrix("worldViewMatrix", &worldViewMatrix);
-    pLightingEffect->SetMatrix("worldViewProjMatrix", &worldViewProjMatrix);
-    pLightingEffect->SetVector("lightPosition", &lightPosition);
-    pLightingEffect->SetFloat("lightRange", light.range);
-    pLightingEffect->SetFloat("lightRadius", light.radius);
-    pLightingEffect->SetTexture("zTexture", ZTexture::Instance()->GetZTexture());
-}
-
-// Make vbo/ibo for rendering
-void Mesh::PrepareShadowVolumes() {
-    void*       copyData;
-	int      bufferSize;   
-
-	// Create vertex buffer from our device
-    bufferSize = shadowVolume.vertices.size() * sizeof(ShadowVert);
-    pd3dDevice->CreateVertexBuffer(bufferSize, 0, NULL, D3DPOOL_MANAGED, &shadowVolume.pVertexBuffer, NULL);
-	
-	shadowVolume.pVertexBuffer->Lock(0, 0, &copyData, 0);
-	memcpy(copyData, (void*)&shadowVolume.vertices[0], bufferSize);
-	shadowVolume.pVertexBuffer->Unlock();
-	
-	if (!ShadowVert::pVertexDecl)
-    {
-		// New vertex declaration
-        pd3dDevice->CreateVertexDeclaration(ShadowVert::Decl, &ShadowVert::pVertexDecl);
-    }
-    UpdateShadowVolumes();
-}
-
-// Make vbo/ibo for rendering
-void Mesh::UpdateShadowVolumes() {
-    void*       copyData;
-	int      bufferSize;
-
-    // Umbra
-	bufferSize = shadowVolume.umbraIndices.size() * sizeof(int);
-    if (bufferSize > shadowVolume.umbraIboSize)
-	{
-		if (shadowVolume.pUmbraIndexBuffer) 
-            shadowVolume.pUmbraIndexBuffer->Release();
-
-		// Create index buffer from our device
-        pd3dDevice->CreateIndexBuffer(bufferSize, 0, D3DFMT_INDEX32, D3DPOOL_MANAGED, &shadowVolume.pUmbraIndexBuffer, NULL );
-		
-		// new size
-		shadowVolume.umbraIboSize = bufferSize;
-	}
-
-	// Copying indices
-    shadowVolume.pUmbraIndexBuffer->Lock(0, 0, &copyData, 0);
-    memcpy(copyData, (void*)&shadowVolume.umbraIndices[0], bufferSize);
-    shadowVolume.pUmbraIndexBuffer->Unlock();
-	
-    // Penumbra
-    // Don't recreate ibo if it is smaller than existing
-	bufferSize = shadowVolume.penumbraIndices.size() * sizeof(int);
-    if (bufferSize > shadowVolume.penumbraIboSize) {
-		if (shadowVolume.pPenumbraIndexBuffer) 
-            shadowVolume.pPenumbraIndexBuffer->Release();
-
-		// Create index buffer from our device
-        pd3dDevice->CreateIndexBuffer(bufferSize, 0, D3DFMT_INDEX32, D3DPOOL_MANAGED, &shadowVolume.pPenumbraIndexBuffer, NULL );
-		
-		// new size
-		shadowVolume.penumbraIboSize = bufferSize;
-	}
-
-	// Copying indices
-    shadowVolume.pPenumbraIndexBuffer->Lock(0, 0, &copyData, 0);
-	memcpy(copyData, (void*)&shadowVolume.penumbraIndices[0], bufferSize);
-	shadowVolume.pPenumbraIndexBuffer->Unlock();
-}
-
-void Mesh::AddEdge(EdgeMap& edgeMap, int v0, int v1, int face) {
-	bool rev = false;
-
-	// from min to max
-	if (v0 > v1) {
-		std::swap(v0, v1);
-		rev = true;
-	}
-
-	// check whether we already have this face
-	EdgeMap::iterator i = edgeMap.find( int_pair(v0, v1) );
-	if (i != edgeMap.end()) 
-		i->second.f1 = face;
-	else {
-		// insert new edge
-		Edge edge;
-
-        if (rev) {
-		    edge.v0 = v1;
-		    edge.v1 = v0;
-        }
-        else {
-		    edge.v0 = v0;
-		    edge.v1 = v1;
-        }
-		edge.f0	= face;
-		edge.f1 = -1;
-
-		edgeMap.insert(edge_pair(int_pair(v0,v1), edge));
-	}
-}
-
-void Mesh::MakeEdges() {
-    int j = 0;
-    EdgeMap edgeMap;
-
-    // Add edge from each face
-	for (int i = 0; i<faces.size(); ++i) {
-		AddEdge(edgeMap, faces[i].v0, faces[i].v1, i);
-		AddEdge(edgeMap, faces[i].v1, faces[i].v2, i);
-		AddEdge(edgeMap, faces[i].v2, faces[i].v0, i);
-	}
-
-    // Check closed edges and copy edges to vector
-    edges.reserve(edgeMap.size());
-    for(EdgeMap::iterator i = edgeMap.begin(); i != edgeMap.end(); ++i, ++j) {
-        if (i->second.f0 == -1 || i->second.f1 == -1) {
-            edges.clear();
-            return;
-        }
-        else {
-		    // copy
-            if (faces[i->second.f0].v0 == i->second.v0 && faces[i->second.f0].v1 == i->second.v1) {
-                faces[i->second.f0].re0 = false;
-                faces[i->second.f0].e0 = j;
-            }
-            else if (faces[i->second.f0].v1 == i->second.v0 && faces[i->second.f0].v2 == i->second.v1) {
-                faces[i->second.f0].re1 = false;
-                faces[i->second.f0].e1 = j;
-            }
-            else if (faces[i->second.f0].v2 == i->second.v0 && faces[i->second.f0].v0 == i->second.v1) {
-                faces[i->second.f0].re2 = false;
-                faces[i->second.f0].e2 = j;
-            }
-
-            if (faces[i->second.f1].v0 == i->second.v1 && faces[i->second.f1].v1 == i->second.v0) {
-                faces[i->second.f1].re0 = true;
-                faces[i->second.f1].e0 = j;
-            }
-            else if (faces[i->second.f1].v1 == i->second.v1 && faces[i->second.f1].v2 == i->second.v0) {
-                faces[i->second.f1].re1 = true;
-                faces[i->second.f1].e1 = j;
-            }
-            else if (faces[i->second.f1].v2 == i->second.v1 && faces[i->second.f1].v0 == i->second.v0) {
-                faces[i->second.f1].re2 = true;
-                faces[i->second.f1].e2 = j;
-            }
-            edges.push_back(i->second);
-        }
-    }
+    Effect::SetMatrix("invTransform", &invWorldViewProj);
+    Effect::SetMatrix("normalMatrix", &worldViewMatrix);
+    Effect::SetMatrix("worldViewMatrix", &worldViewMatrix);
+    Effect::SetMatrix("worldViewProjMatrix", &worldViewProjMatrix);
+    Effect::SetVector("lightPosition", &lightPosition);
+    Effect::SetFloat("lightRange", extrusion);
+    Effect::SetFloat("lightRadius", light.radius);
+    Effect::SetTexture("zTexture", ZTexture::Instance()->GetZTexture());
 }
 
-Mesh::Mesh():pMesh(NULL) {
-    D3DXMatrixIdentity(&transform);
+MeshData::MeshData():pMesh(NULL), meshRadius(0.0f), boxCenter(0, 0, 0), boxExtent(0, 0, 0), cacheBefore(), cacheAfter() {
 }
 
-Mesh::~Mesh(void) {
+MeshData::~MeshData(void) {
     if (pMesh) 
 		pMesh->Release();
+    for(int i = 0; i<shadowLods.size(); ++i)
+        delete shadowLods[i];
+}
+
+Mesh::Mesh():shadowLod(0), currentVolume(0), extrusion(0.0f), transformVersion(1) {
+    D3DXMatrixIdentity(&transform);
+    D3DXMatrixIdentity(&invTransform);
 }
 
 // Setup mesh transformation matrix
 void Mesh::SetTransform(const D3DXMATRIX& matrix)
 {
     transform = matrix;
+    TransformGraph::InvertAffine(invTransform, transform);
+    ++counters.inversions;
+    ++transformVersion;
+}
+
+// Setup mesh transformation matrix, inverse comes with it
+void Mesh::SetTransform(const D3DXMATRIX& matrix, const D3DXMATRIX& inverse)
+{
+    transform = matrix;
+    invTransform = inverse;
+    ++transformVersion;
 }
 
 // Transform mesh transformation matrix
 void Mesh::Transform(const D3DXMATRIX& matrix)
 {
-    D3DXMatrixMultiply(&transform, &transform, &matrix);
+    D3DXMATRIX result;
+
+    TransformGraph::Multiply(result, transform, matrix);
+    SetTransform(result);
 }
 
+// Camera matrices shared by all instances in the frame
+void Mesh::SetCamera(const D3DXMATRIX& view)
+{
+    D3DXMATRIX projMatrix;
+
+    pd3dDevice->GetTransform(D3DTS_PROJECTION, &projMatrix);
+    TransformGraph::Multiply(viewProj, view, projMatrix);
+    D3DXMatrixInverse(&invViewProj, NULL, &viewProj);
+    ++counters.inversions;
+}
+
+// Volumes remember the light they were made for in object space
+const D3DXVECTOR4& Mesh::SelectLight(const Light& light, int lightIndex)
+{
+    if (lightIndex >= volumes.size()) {
+        volumes.resize(lightIndex + 1);
+        volumeLods.resize(lightIndex + 1, 0);
+    }
+    currentVolume = lightIndex;
+
+    ShadowVolume& volume = volumes[lightIndex];
+    if (volume.transformVersion == transformVersion && volume.worldLight == light.position) {
+        ++counters.lightHits;
+        return volume.objectLight;
+    }
+
+    D3DXVec4Transform(&volume.objectLight, &light.position, &invTransform);
+    volume.worldLight = light.position;
+    volume.transformVersion = transformVersion;
+    ++counters.lightMisses;
+    return volume.objectLight;
+}
+
+// Share data of the file with other instances, load it first time
 void Mesh::Load(const char* name) {
+    data = MeshStorage::Instance()->Get(name);
+    if ( !data.Exist() ) {
+        MeshData* meshData = new MeshData();
+
+        meshData->Load(name);
+        data = MeshStorage::Instance()->Add(name, meshData);
+    }
+    shadowLod = 0;
+    volumes.clear();
+    volumeLods.clear();
+}
+
+void MeshData::Load(const string& name) {
 
     ID3DXBuffer*     pD3DXMtrlBuffer;
     D3DXMATERIAL*    d3dxMaterials;
     DWORD            numMaterials;
     string           folder;
 
+    fileName = name;
+
     // Load the mesh from the specified file
-    D3DXLoadMeshFromXA(name, D3DXMESH_SYSTEMMEM, pd3dDevice, NULL, &pD3DXMtrlBuffer, NULL, &numMaterials, &pMesh);
+    D3DXLoadMeshFromXA(name.c_str(), D3DXMESH_SYSTEMMEM, pd3dDevice, NULL, &pD3DXMtrlBuffer, NULL, &numMaterials, &pMesh);
     
     // Get folder of the path
-    string path(name);
+    const string& path = name;
     int pos = path.rfind("/");
     if (pos == string::npos) {
         pos = path.rfind("\\");
@@ -296,16 +302,8 @@ void Mesh::Load(const char* name) {
         if (d3dxMaterials[i].pTextureFilename) {
             string          fullName = folder + d3dxMaterials[i].pTextureFilename;
 
-            textures[i] = TextureStorage::Instance()->Get(fullName);
-            if ( textures[i] == TextureStorage::Instance()->End() )
-            {
-                TextureData* texture = new TextureData();
-                D3DXCreateTextureFromFileA( pd3dDevice, 
-                                                 fullName.c_str(), 
-                                                 &texture->pTexture );
-                textures[i] = TextureStorage::Instance()->Add(fullName, texture);
-                
-            }
+            // Decoded on storage workers, placeholder is shown meanwhile
+            textures[i] = TextureStorage::Instance()->Load(fullName, LoadTexture);
         }
         else
         {
@@ -317,9 +315,53 @@ void Mesh::Load(const char* name) {
     pD3DXMtrlBuffer->Release();
 
     // Misc
+    OptimizeVertexCache();
     PrepareShadowGeometry();
-    if (shadowVolume.vertices.size() > 0)
-        PrepareShadowVolumes();
+}
+
+// Faces only move within runs of one material, so subsets & an attribute
+// table keep their face ranges. Vertices stay where they are.
+void MeshData::OptimizeVertexCache() {
+    char*       pData;
+    DWORD*      attributes;
+    bool        ind32 = (pMesh->GetOptions() & D3DXMESH_32BIT) != 0;
+    int         numFaces = pMesh->GetNumFaces();
+    int         numVertices = pMesh->GetNumVertices();
+    int         vertexSize = pMesh->GetNumBytesPerVertex();
+    vector<int> indices(3 * numFaces);
+    vector<int> ordered(3 * numFaces);
+    vector<int> order;
+
+    if (numFaces == 0)
+        return;
+
+    pMesh->LockIndexBuffer( 0, (LPVOID*)&pData );
+    pMesh->LockAttributeBuffer( D3DLOCK_READONLY, &attributes );
+    for(int i = 0; i<indices.size(); ++i)
+        indices[i] = ind32 ? ((DWORD*)pData)[i] : ((WORD*)pData)[i];
+    cacheBefore = VertexCache::Simulate(&indices[0], numFaces, numVertices, vertexSize);
+
+    for(int begin = 0, end; begin<numFaces; begin = end) {
+        for(end = begin + 1; end<numFaces && attributes[end] == attributes[begin]; ++end)
+            ;
+
+        VertexCache::Optimize(&indices[3 * begin], end - begin, numVertices, order);
+        for(int i = 0; i<order.size(); ++i) {
+            for(int k = 0; k<3; ++k)
+                ordered[3 * (begin + i) + k] = indices[3 * (begin + order[i]) + k];
+        }
+    }
+
+    for(int i = 0; i<ordered.size(); ++i) {
+        if (ind32)
+            ((DWORD*)pData)[i] = ordered[i];
+        else
+            ((WORD*)pData)[i] = static_cast<WORD>(ordered[i]);
+    }
+    cacheAfter = VertexCache::Simulate(&ordered[0], numFaces, numVertices, vertexSize);
+
+    pMesh->UnlockAttributeBuffer();
+    pMesh->UnlockIndexBuffer();
 }
 
 // Get normal of the plane
@@ -332,28 +374,13 @@ D3DXVECTOR3 ComputeNormal(const D3DXVECTOR3& v0, const D3DXVECTOR3& v1, const D3
     return normal;
 }
 
-bool operator < (const D3DXVECTOR3& left, const D3DXVECTOR3& right) {
-    float dx = left.x - right.x;
-    float dy = left.y - right.y;
-    float dz = left.z - right.z;
-
-    if (dx < -eps)
-        return true;
-    else if (fabs(dx) <= eps && dy < -eps)
-        return true;
-    else if (fabs(dx) <= eps && fabs(dy) < eps && dz < -eps)
-        return true;
-
-    return false;
-}
-
 // Copy vertices, etc...
-void Mesh::PrepareShadowGeometry() {
+void MeshData::PrepareShadowGeometry() {
     
-	typedef map<D3DXVECTOR3, int> VertexMap;
+    vector<D3DXVECTOR3> vertices;
+    vector<Face> faces;
     char* pData;
 	D3DVERTEXELEMENT9 decl[MAX_FVF_DECL_SIZE];
-    VertexMap vertexMap;
 	int positionStride;
 	int elemSize;
 	int size;
@@ -365,7 +392,7 @@ void Mesh::PrepareShadowGeometry() {
 	pMesh->LockVertexBuffer( D3DLOCK_READONLY, (LPVOID*)&pData );
 	
 	// Find position decl. Determine vertex size
-	positionStride = find_if( decl, decl + MAX_FVF_DECL_SIZE, bind(&D3DVERTEXELEMENT9::Usage, _1) == D3DDECLUSAGE_POSITION )->Offset;
+	positionStride = find_if( decl, decl + MAX_FVF_DECL_SIZE, boost::lambda::bind(&D3DVERTEXELEMENT9::Usage, _1) == D3DDECLUSAGE_POSITION )->Offset;
 
 	// Copy vertices
     size = pMesh->GetNumVertices();
@@ -373,7 +400,6 @@ void Mesh::PrepareShadowGeometry() {
     vertices.resize(size); 
     for(int i = 0; i<vertices.size(); ++i) {
         memcpy(&vertices[i], pData + i * elemSize + positionStride, sizeof(D3DXVECTOR3));
-        vertexMap.insert( pair<D3DXVECTOR3, int>( vertices[i], vertexMap.size() ) );
     }
 	
     pMesh->UnlockVertexBuffer();
@@ -398,37 +424,12 @@ void Mesh::PrepareShadowGeometry() {
             faces[i].v2 = *((unsigned short*)(pData += 2));
         }
         faces[i].normal = ComputeNormal(vertices[faces[i].v0], vertices[faces[i].v1], vertices[faces[i].v2]);
-
-        faces[i].v0 = vertexMap.find( vertices[faces[i].v0] )->second;
-        faces[i].v1 = vertexMap.find( vertices[faces[i].v1] )->second;
-        faces[i].v2 = vertexMap.find( vertices[faces[i].v2] )->second;
     }   
 
     pMesh->UnlockIndexBuffer();
 
-    // Reorder vertices
-    vertices.resize( vertexMap.size() );
-    for(VertexMap::iterator i = vertexMap.begin(); i != vertexMap.end(); ++i)
-        vertices[i->second] = i->first;
-
-    // Compute vertex normals
-    normals.resize( vertices.size() );
-    fill( normals.begin(), normals.end(), D3DXVECTOR3(0, 0, 0) );
-    for(int i = 0; i<faces.size(); ++i)
-    {
-        normals[ faces[i].v0 ] += faces[i].normal;
-        normals[ faces[i].v1 ] += faces[i].normal;
-        normals[ faces[i].v2 ] += faces[i].normal;
-    }
-    for(int i = 0; i<vertices.size(); ++i)
-    {
-        D3DXVec3Normalize(&normals[i], &normals[i]);
-    }
-
-    // Edges
-    MakeEdges();
-    if (edges.size() == 0)
-        return;
+    ShadowGeometry::Weld(vertices, faces);
+    ShadowGeometry::OptimizeOrder(vertices, faces);
 
     // find center of the mesh
     D3DXVECTOR3 meshCenter3 = D3DXVECTOR3(0.0, 0.0, 0.0);
@@ -445,259 +446,529 @@ void Mesh::PrepareShadowGeometry() {
         meshRadius = max( meshRadius, D3DXVec3Length( &(meshCenter3 - vertices[i]) ) );
     }
 
-	// copy each vertex twice 
-	//  first extruded/second not
-    size = edges.size();
-	shadowVolume.vertices.resize( 6 * size );
-	for(int i = 0; i<size; ++i)
-	{
-        D3DXVECTOR3 edge = vertices[ edges[i].v1 ] - vertices[ edges[i].v0 ];
-        //D3DXVec3Normalize(&edge, &edge);
-
-        // v0
-        shadowVolume.vertices[i].vertex = vertices[ edges[i].v0 ];
-        shadowVolume.vertices[i].vertNormal0 = normals[ edges[i].v0 ];
-        shadowVolume.vertices[i].vertNormal1 = normals[ edges[i].v1 ];
-        shadowVolume.vertices[i].normal = D3DXVECTOR4(faces[ edges[i].f0 ].normal, 0.0f);
-        shadowVolume.vertices[i].backNormal = faces[ edges[i].f1 ].normal;
-        shadowVolume.vertices[i].edge = D3DXVECTOR4(edge, 1.0f);
-
-		shadowVolume.vertices[i + size].vertex = vertices[ edges[i].v0 ];
-        shadowVolume.vertices[i + size].vertNormal0 = normals[ edges[i].v0 ];
-        shadowVolume.vertices[i + size].vertNormal1 = normals[ edges[i].v1 ];
-		shadowVolume.vertices[i + size].normal = D3DXVECTOR4(faces[ edges[i].f1 ].normal, 1.0f);
-		shadowVolume.vertices[i + size].backNormal = faces[ edges[i].f0 ].normal;
-        shadowVolume.vertices[i + size].edge = D3DXVECTOR4(edge, 1.0f);
-
-		shadowVolume.vertices[i + 2*size].vertex = vertices[ edges[i].v0 ];
-        shadowVolume.vertices[i + 2*size].vertNormal0 = normals[ edges[i].v0 ];
-        shadowVolume.vertices[i + 2*size].vertNormal1 = normals[ edges[i].v1 ];
-		shadowVolume.vertices[i + 2*size].normal = D3DXVECTOR4(faces[ edges[i].f1 ].normal, -1.0f);
-		shadowVolume.vertices[i + 2*size].backNormal = faces[ edges[i].f0 ].normal;
-        shadowVolume.vertices[i + 2*size].edge = D3DXVECTOR4(edge, 1.0f);
-
-        // v1
-		shadowVolume.vertices[i + 3*size].vertex = vertices[ edges[i].v1 ];
-        shadowVolume.vertices[i + 3*size].vertNormal0 = normals[ edges[i].v1 ];
-        shadowVolume.vertices[i + 3*size].vertNormal1 = normals[ edges[i].v0 ];
-		shadowVolume.vertices[i + 3*size].normal = D3DXVECTOR4(faces[ edges[i].f0 ].normal, 0.0f);
-		shadowVolume.vertices[i + 3*size].backNormal = faces[ edges[i].f1 ].normal;
-        shadowVolume.vertices[i + 3*size].edge = D3DXVECTOR4(-edge, -1.0f);
-
-		shadowVolume.vertices[i + 4*size].vertex = vertices[ edges[i].v1 ];
-        shadowVolume.vertices[i + 4*size].vertNormal0 = normals[ edges[i].v1 ];
-        shadowVolume.vertices[i + 4*size].vertNormal1 = normals[ edges[i].v0 ];
-		shadowVolume.vertices[i + 4*size].normal = D3DXVECTOR4(faces[ edges[i].f1 ].normal, 1.0f);
-		shadowVolume.vertices[i + 4*size].backNormal = faces[ edges[i].f0 ].normal;
-        shadowVolume.vertices[i + 4*size].edge = D3DXVECTOR4(-edge, -1.0f);
-
-		shadowVolume.vertices[i + 5*size].vertex = vertices[ edges[i].v1 ];
-        shadowVolume.vertices[i + 5*size].vertNormal0 = normals[ edges[i].v1 ];
-        shadowVolume.vertices[i + 5*size].vertNormal1 = normals[ edges[i].v0 ];
-		shadowVolume.vertices[i + 5*size].normal = D3DXVECTOR4(faces[ edges[i].f1 ].normal, -1.0f);
-		shadowVolume.vertices[i + 5*size].backNormal = faces[ edges[i].f0 ].normal;
-        shadowVolume.vertices[i + 5*size].edge = D3DXVECTOR4(-edge, -1.0f);
-	}
-
-    // make umbra
-    shadowVolume.umbraIndices.resize( faces.size()*3 + edges.size()*6 );
-    // add faces
-	for(int i = 0; i<faces.size(); ++i)
-	{
-        if ( faces[i].re0 )
-            shadowVolume.umbraIndices[i*3] = faces[i].e0 + 4*size;
-        else
-            shadowVolume.umbraIndices[i*3] = faces[i].e0;
- 
-        if ( faces[i].re1 )
-            shadowVolume.umbraIndices[i*3 + 1] = faces[i].e1 + 4*size;
-        else
-            shadowVolume.umbraIndices[i*3 + 1] = faces[i].e1;
+    // bounding box
+    D3DXVECTOR3 boxMin = vertices[0];
+    D3DXVECTOR3 boxMax = vertices[0];
+    for(int i = 1; i<vertices.size(); ++i)
+    {
+        D3DXVec3Minimize(&boxMin, &boxMin, &vertices[i]);
+        D3DXVec3Maximize(&boxMax, &boxMax, &vertices[i]);
+    }
+    boxCenter = (boxMin + boxMax) * 0.5f;
+    boxExtent = (boxMax - boxMin) * 0.5f;
 
-        if ( faces[i].re2 )
-            shadowVolume.umbraIndices[i*3 + 2] = faces[i].e2 + 4*size;
-        else
-            shadowVolume.umbraIndices[i*3 + 2] = faces[i].e2;
+    // Full resolution shadow caster, sources of all levels go to the page
+    // file when streaming
+    ofstream page;
+
+    if (ShadowStreamer::budget > 0) {
+        pageFile = fileName + ".page";
+        page.open(pageFile.c_str(), ios::binary);
     }
+    if ( !AddShadowLod(vertices, faces, 0.0f, page.is_open() ? &page : NULL) )
+        return;
+    MakeShadowLods(vertices, faces, page.is_open() ? &page : NULL);
+
+    // Proxy stays, finer levels wait for the streamer
+    if ( page.is_open() ) {
+        page.close();
+        for(int i = 0; i + 1<shadowLods.size(); ++i) {
+            if (pages[i].offset >= 0) {
+                delete shadowLods[i];
+                shadowLods[i] = NULL;
+            }
+        }
+    }
+}
+
+// Build next shadow level, its source goes to page if it is set
+bool MeshData::AddShadowLod(const vector<D3DXVECTOR3>& vertices, const vector<Face>& faces, float error, ostream* page) {
+    ShadowGeometry* geometry = new ShadowGeometry();
+    MemoryReport    report;
+    ShadowPage      level;
 
-    InitShadowForGPU();
+    if ( !geometry->Build(vertices, faces, error) ) {
+        delete geometry;
+        return false;
+    }
+    geometry->AddMemoryUsage(report, fileName);
+
+    level.error = error;
+    level.bytes = report.GetTotal().GetTotal();
+    level.offset = page ? ShadowStreamer::WritePage(*page, vertices, faces) : -1;
+    level.loading = false;
+
+    shadowLods.push_back(geometry);
+    pages.push_back(level);
+    return true;
 }
 
-void Mesh::AddEdgeToVolume(const int i)
-{
-    int size = edges.size();
-    int j    = shadowVolume.umbraIndices.size();
-    
-    shadowVolume.umbraIndices.resize(j+6);
+// FNV-1a over bytes
+static unsigned int HashBytes(unsigned int hash, const void* data, size_t size) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
 
-    // front
-    shadowVolume.umbraIndices[j] = i + 3*size;
-    shadowVolume.umbraIndices[j+1] = i;
-    shadowVolume.umbraIndices[j+2] = i + 5*size;
+    for(size_t i = 0; i<size; ++i)
+        hash = (hash ^ bytes[i]) * 16777619U;
+    return hash;
+}
 
-    shadowVolume.umbraIndices[j+3] = i + 5*size;
-    shadowVolume.umbraIndices[j+4] = i;
-    shadowVolume.umbraIndices[j+5] = i + 2*size;
+// Positions & face indices, an edited mesh of the same size gets a new chain
+static unsigned int HashSource(const vector<D3DXVECTOR3>& vertices, const vector<Face>& faces) {
+    unsigned int hash = HashBytes(2166136261U, &vertices[0], vertices.size() * sizeof(D3DXVECTOR3));
 
-    j = shadowVolume.penumbraIndices.size();
-    
-    
-    shadowVolume.penumbraIndices.resize(j+24);
+    for(int i = 0; i<faces.size(); ++i) {
+        int ids[3] = { faces[i].v0, faces[i].v1, faces[i].v2 };
+        hash = HashBytes(hash, ids, sizeof(ids));
+    }
+    return hash;
+}
+
+// Load simplified levels from file next to the mesh
+static bool LoadShadowLods(const string& fileName, const vector<D3DXVECTOR3>& vertices, const vector<Face>& faces, vector<LodLevel>& levels) {
+    ifstream     file(fileName.c_str(), ios::binary);
+    char         magic[4];
+    int          header[4];
+    unsigned int hash;
+    int          numVertices = vertices.size();
+    int          numFaces = faces.size();
+
+    if (!file)
+        return false;
+
+    // Check that file was made from the same mesh
+    file.read(magic, 4);
+    file.read((char*)header, sizeof(header));
+    file.read((char*)&hash, sizeof(hash));
+    if ( !file || memcmp(magic, "SLOD", 4) != 0 || header[0] != lodFileVersion || header[1] != numVertices || header[2] != numFaces ||
+         header[3] < 0 || header[3] >= maxShadowLods || hash != HashSource(vertices, faces) )
+        return false;
+
+    levels.resize(header[3]);
+    for(int i = 0; i<levels.size(); ++i) {
+        LodLevel& level = levels[i];
+        int       size;
+
+        file.read((char*)&level.error, sizeof(float));
+        file.read((char*)&size, sizeof(int));
+        if (!file || size <= 0 || size > numVertices)
+            return false;
+        level.vertices.resize(size);
+        file.read((char*)&level.vertices[0], size * sizeof(D3DXVECTOR3));
+
+        file.read((char*)&size, sizeof(int));
+        if (!file || size <= 0 || size > numFaces)
+            return false;
+        level.faces.resize(size);
+        for(int j = 0; j<size; ++j) {
+            Face& face = level.faces[j];
+            int   ids[3];
+
+            file.read((char*)ids, sizeof(ids));
+            if ( !file || 
+                 ids[0] < 0 || ids[0] >= level.vertices.size() || 
+                 ids[1] < 0 || ids[1] >= level.vertices.size() || 
+                 ids[2] < 0 || ids[2] >= level.vertices.size() )
+                return false;
+
+            face.v0 = ids[0];
+            face.v1 = ids[1];
+            face.v2 = ids[2];
+            face.normal = ComputeNormal(level.vertices[face.v0], level.vertices[face.v1], level.vertices[face.v2]);
+        }
+    }
 
-    // inner
-    shadowVolume.penumbraIndices[j] = i + 3*size;
-    shadowVolume.penumbraIndices[j+1] = i;
-    shadowVolume.penumbraIndices[j+2] = i + size;
+    return true;
+}
 
-    shadowVolume.penumbraIndices[j+3] = i + size;
-    shadowVolume.penumbraIndices[j+4] = i + 4*size;
-    shadowVolume.penumbraIndices[j+5] = i + 3*size;
+// Store simplified levels, so next load can skip simplification
+static void SaveShadowLods(const string& fileName, const vector<D3DXVECTOR3>& vertices, const vector<Face>& faces, const vector<LodLevel>& levels) {
+    ofstream     file(fileName.c_str(), ios::binary);
+    int          header[4] = { lodFileVersion, (int)vertices.size(), (int)faces.size(), (int)levels.size() };
+    unsigned int hash = HashSource(vertices, faces);
 
-    // left
-    shadowVolume.penumbraIndices[j+6] = i + size;
-    shadowVolume.penumbraIndices[j+7] = i;
-    shadowVolume.penumbraIndices[j+8] = i + 2*size;
+    if (!file)
+        return;
 
-    // right
-    shadowVolume.penumbraIndices[j+9] = i + 5*size;
-    shadowVolume.penumbraIndices[j+10] = i + 3*size;
-    shadowVolume.penumbraIndices[j+11] = i + 4*size;
+    file.write("SLOD", 4);
+    file.write((const char*)header, sizeof(header));
+    file.write((const char*)&hash, sizeof(hash));
+    for(int i = 0; i<levels.size(); ++i) {
+        const LodLevel& level = levels[i];
+        int             size = level.vertices.size();
+
+        file.write((const char*)&level.error, sizeof(float));
+        file.write((const char*)&size, sizeof(int));
+        file.write((const char*)&level.vertices[0], size * sizeof(D3DXVECTOR3));
+
+        size = level.faces.size();
+        file.write((const char*)&size, sizeof(int));
+        for(int j = 0; j<size; ++j) {
+            int ids[3] = { level.faces[j].v0, level.faces[j].v1, level.faces[j].v2 };
+            file.write((const char*)ids, sizeof(ids));
+        }
+    }
+}
 
-    // front
-    shadowVolume.penumbraIndices[j+12] = i;
-    shadowVolume.penumbraIndices[j+13] = i + 3*size;
-    shadowVolume.penumbraIndices[j+14] = i + 5*size;
+// Load or generate simplified shadow casters
+void MeshData::MakeShadowLods(const vector<D3DXVECTOR3>& vertices, const vector<Face>& faces, ostream* page) {
+    string           lodName = fileName + ".lod";
+    vector<LodLevel> levels;
 
-    shadowVolume.penumbraIndices[j+15] = i + 5*size;
-    shadowVolume.penumbraIndices[j+16] = i + 2*size;
-    shadowVolume.penumbraIndices[j+17] = i;
+    // Prebuilt chain is used when it matches the mesh
+    if ( !LoadShadowLods(lodName, vertices, faces, levels) ) {
+        Simplifier  simplifier(vertices, faces);
+        int         target = faces.size();
 
-    
-	// back
-	shadowVolume.penumbraIndices[j + 18] = i + size;
-	shadowVolume.penumbraIndices[j + 19] = i + 2 * size;
-	shadowVolume.penumbraIndices[j + 20] = i + 4 * size;
-
-	shadowVolume.penumbraIndices[j + 21] = i + 4 * size;
-	shadowVolume.penumbraIndices[j + 22] = i + 2 * size;
-	shadowVolume.penumbraIndices[j + 23] = i + 5 * size;
-    
+        levels.clear();
+        for(int i = 1; i<maxShadowLods; ++i) {
+            int previous = simplifier.GetNumFaces();
+
+            target = static_cast<int>(target * lodReduction);
+            if ( target < minLodFaces || !simplifier.Simplify(target) )
+                break;
+
+            // Stuck on topology constraints
+            if (simplifier.GetNumFaces() > previous * 0.9f)
+                break;
+
+            levels.push_back( LodLevel() );
+            simplifier.GetResult(levels.back().vertices, levels.back().faces);
+            levels.back().error = simplifier.GetError();
+        }
+
+        SaveShadowLods(lodName, vertices, faces, levels);
+    }
+
+    for(int i = 0; i<levels.size(); ++i) {
+        ShadowGeometry::OptimizeOrder(levels[i].vertices, levels[i].faces);
+        if ( !AddShadowLod(levels[i].vertices, levels[i].faces, levels[i].error, page) )
+            break;
+    }
 }
 
-// Make penumbra for rendering fully on gpu
-void Mesh::InitShadowForGPU() {
-    int size = edges.size();
+// Largest axis scale of the transform
+float Mesh::GetScale() const {
+    float scale = max( D3DXVec3Length( (D3DXVECTOR3*)&transform._11 ), D3DXVec3Length( (D3DXVECTOR3*)&transform._21 ) );
+    return max( scale, D3DXVec3Length( (D3DXVECTOR3*)&transform._31 ) );
+}
 
-    // add edges
-    shadowVolume.umbraIndices.resize( faces.size()*3 + size*6 );
-    for(int i = 0; i<edges.size(); ++i)
-	{   
-        int j = faces.size()*3 + i*6;
+// Choose coarsest shadow level which error is not visible
+int Mesh::FindShadowLod(const D3DXVECTOR3& eyePosition, const Light& light) const {
+    D3DXVECTOR4 center;
+    float       scale;
+    float       distance;
+    float       tolerance;
+    int         level = 0;
+
+    const vector<ShadowPage>& pages = data->pages;
+
+    if ( !lodSettings.enabled || pages.size() < 2 )
+        return 0;
+
+    scale = GetScale();
+    D3DXVec4Transform(&center, &data->meshCenter, &transform);
+    distance = D3DXVec3Length( &(D3DXVECTOR3(center.x, center.y, center.z) - eyePosition) ) - data->meshRadius * scale;
+    distance = max(distance, 0.0f);
+
+    // Bigger lights blur more details away
+    tolerance = (distance * lodSettings.distanceError + light.radius * lodSettings.radiusError) * lodSettings.scale / scale;
+    while ( level + 1 < pages.size() && pages[level + 1].error <= tolerance )
+        ++level;
+    return level;
+}
 
-        shadowVolume.umbraIndices[j] = i + 3*size; // 3 0 5
-        shadowVolume.umbraIndices[j+1] = i;
-        shadowVolume.umbraIndices[j+2] = i + 5*size;
+// Paged out levels fall back to coarser ones, the last is always resident
+void Mesh::SelectShadowLod(const D3DXVECTOR3& eyePosition, const Light& light) {
+    shadowLod = FindShadowLod(eyePosition, light);
+    while ( !data->shadowLods[shadowLod] )
+        ++shadowLod;
+}
+
+// Sample light around the mesh for reports
+D3DXVECTOR3 MeshData::ReportLightPosition(int sample, int numSamples) const {
+    float       yaw = 2.0f * D3DX_PI * sample / numSamples;
+    float       pitch = D3DX_PI * ( (sample * 7) % numSamples ) / numSamples - D3DX_PI / 2;
+    D3DXVECTOR3 lightPos( cosf(yaw) * cosf(pitch), sinf(pitch), sinf(yaw) * cosf(pitch) );
 
-        // to extrude
-        shadowVolume.umbraIndices[j+3] = i + 5*size;//5 0 2
-        shadowVolume.umbraIndices[j+4] = i;
-        shadowVolume.umbraIndices[j+5] = i + 2*size;
+    return lightPos * (3.0f * meshRadius) + D3DXVECTOR3(meshCenter.x, meshCenter.y, meshCenter.z);
+}
+
+// Edge count, silhouette extraction time & merging savings of each shadow level
+void MeshData::WriteShadowLodReport(ostream& out) const {
+    const int      numSamples = 64;
+    LARGE_INTEGER  frequency;
+    LARGE_INTEGER  start;
+    LARGE_INTEGER  end;
+    ShadowVolume   volume;
+
+    out << fileName << endl;
+    out << "  vertex cache: ACMR " << cacheBefore.GetAcmr() << " -> " << cacheAfter.GetAcmr()
+        << ", ATVR " << cacheBefore.GetAtvr() << " -> " << cacheAfter.GetAtvr() << endl;
+    if (shadowLods.empty()) {
+        out << "  not closed, no shadow" << endl;
+        return;
     }
 
-    // make penumbra
-    shadowVolume.penumbraIndices.resize( size*24 );
-	for(int i = 0; i<edges.size(); ++i)
-	{
-        int j = i*24;
+    QueryPerformanceFrequency(&frequency);
+    for(int i = 0; i<shadowLods.size(); ++i) {
+        const ShadowGeometry* geometry = shadowLods[i];
 
-        // inner
-        shadowVolume.penumbraIndices[j] = i + 3*size;
-        shadowVolume.penumbraIndices[j+1] = i;
-        shadowVolume.penumbraIndices[j+2] = i + size;
+        if (!geometry) {
+            out << "  lod " << i << ": paged out, " << pages[i].bytes / 1024 << " KB, error " << pages[i].error << endl;
+            continue;
+        }
 
-        shadowVolume.penumbraIndices[j+3] = i + size;
-        shadowVolume.penumbraIndices[j+4] = i + 4*size;
-        shadowVolume.penumbraIndices[j+5] = i + 3*size;
+        // Lights around the mesh
+        QueryPerformanceCounter(&start);
+        for(int j = 0; j<numSamples; ++j)
+            geometry->ExtractSilhouette( ReportLightPosition(j, numSamples), volume );
+        QueryPerformanceCounter(&end);
+
+        out << "  lod " << i 
+            << ": faces " << geometry->GetFaceCount() 
+            << ", edges " << geometry->GetEdgeCount() 
+            << " (" << geometry->GetEdgeClasses().flat << " flat, " << geometry->GetEdgeClasses().prunedBytes / 1024 << " KB saved)"
+            << ", error " << geometry->GetError() 
+            << ", silhouette " << 1e6 * (end.QuadPart - start.QuadPart) / frequency.QuadPart / numSamples << " us"
+            << ", cap fetch lines " << geometry->GetCapCacheStats().GetLinesPerTriangle() << " per triangle" << endl;
+
+        // Merged silhouette against the per edge list volumes
+        int   edges = 0, loops = 0, wedges = 0, indices = 0;
+        float mergeError = 0.0f;
+
+        for(int j = 0; j<numSamples; ++j) {
+            D3DXVECTOR3 lightPos = ReportLightPosition(j, numSamples);
+
+            geometry->ExtractSilhouette(lightPos, volume);
+
+            const SilhouetteStats& stats = volume.stats;
+            edges += stats.edges;
+            loops += stats.loops;
+            wedges += stats.wedges;
+            indices += stats.umbraIndices + stats.penumbraIndices;
+            mergeError += geometry->CompareMergedUmbra(volume, lightPos, 128);
+        }
 
-        // left
-        shadowVolume.penumbraIndices[j+6] = i + size;
-        shadowVolume.penumbraIndices[j+7] = i;
-        shadowVolume.penumbraIndices[j+8] = i + 2*size;
+        // Report lights are no use to the scene & would skew the cache stats
+        geometry->ClearSilhouetteCache();
 
-        // right
-        shadowVolume.penumbraIndices[j+9] = i + 5*size;
-        shadowVolume.penumbraIndices[j+10] = i + 3*size;
-        shadowVolume.penumbraIndices[j+11] = i + 4*size;
+        out << "    silhouette edges " << (float)edges / numSamples
+            << ", loops " << (float)loops / numSamples
+            << ", wedges " << (float)wedges / numSamples
+            << ", side indices " << (float)indices / numSamples << " (per edge list " << 30.0f * edges / numSamples << ")"
+            << ", wedge chord error " << 100.0f * mergeError / numSamples << "%" << endl;
+    }
+}
 
-        // front
-        shadowVolume.penumbraIndices[j+12] = i;
-        shadowVolume.penumbraIndices[j+13] = i + 3*size;
-        shadowVolume.penumbraIndices[j+14] = i + 5*size;
+// Receivers are tested against the cone holding umbra & penumbra in world
+// space. Its apex is where inner tangents of light & caster spheres cross.
+// Distances are taken in object space, where the shader extrudes, with the
+// light radius & range scaled there too. A reused volume is clipped for the
+// light it was extracted for, which moves with the caster.
+bool Mesh::ClipShadowVolume(const Light& light, int lightIndex, const vector<Bounds>& receivers, bool reuse) {
+    D3DXVECTOR3 lightPos;
+    D3DXVECTOR3 objectLight;
+    D3DXVECTOR3 center, axis, apex;
+    Bounds      bounds;
+    float       radius, distance, sine, cosine, tangent, length;
+    float       farthest = 0.0f;
+    float       scale = GetScale();
+    float       objectRadius = light.radius / scale;
+    float       objectRange = light.range / scale;
+    bool        shadowed = false;
+
+    extrusion = objectRange;
+    if (!clipExtrusion)
+        return true;
+
+    if (reuse) {
+        objectLight = volumes[lightIndex].extractedLight;
+        D3DXVec3TransformCoord(&lightPos, &objectLight, &transform);
+    }
+    else {
+        const D3DXVECTOR4& tmp = SelectLight(light, lightIndex);
+        objectLight = D3DXVECTOR3(tmp.x, tmp.y, tmp.z);
+        lightPos = D3DXVECTOR3(light.position.x, light.position.y, light.position.z);
+        ++counters.inversionsAvoided;
+    }
+
+    // World space cone
+    GetBounds(bounds);
+    center = D3DXVECTOR3(bounds.min[0] + bounds.max[0], bounds.min[1] + bounds.max[1], bounds.min[2] + bounds.max[2]) * 0.5f;
+    radius = D3DXVec3Length( &(D3DXVECTOR3(bounds.max[0], bounds.max[1], bounds.max[2]) - center) );
+    axis = center - lightPos;
+    distance = D3DXVec3Length(&axis);
+    sine = (radius + light.radius) / distance;
+    if (sine > maxClipSine)
+        return true;
+    cosine = sqrt(1.0f - sine * sine);
+    tangent = sine / cosine;
+    axis /= distance;
+    apex = lightPos + axis * (distance * light.radius / (light.radius + radius));
+    length = light.range + D3DXVec3Length( &(apex - lightPos) );
+
+    // Caster itself, so its vertices never extrude towards the light
+    for(int k = 0; k<8; ++k) {
+        D3DXVECTOR3 corner( data->boxCenter.x + (k & 1 ? data->boxExtent.x : -data->boxExtent.x),
+                            data->boxCenter.y + (k & 2 ? data->boxExtent.y : -data->boxExtent.y),
+                            data->boxCenter.z + (k & 4 ? data->boxExtent.z : -data->boxExtent.z) );
+
+        farthest = max( farthest, D3DXVec3LengthSq( &(corner - objectLight) ) );
+    }
+
+    for(int i = 0; i<receivers.size(); ++i) {
+        const Bounds& receiver = receivers[i];
+        D3DXVECTOR3   receiverMin(receiver.min[0], receiver.min[1], receiver.min[2]);
+        D3DXVECTOR3   receiverMax(receiver.max[0], receiver.max[1], receiver.max[2]);
+        D3DXVECTOR3   toReceiver = (receiverMin + receiverMax) * 0.5f - apex;
+        float         along = D3DXVec3Dot(&toReceiver, &axis);
+        float         across = D3DXVec3Length( &(toReceiver - axis * along) );
+
+        // Bounding sphere of receiver misses the cone
+        if (across * cosine - along * sine > D3DXVec3Length( &(receiverMax - receiverMin) ) * 0.5f)
+            continue;
+
+        // Cut receiver box to the box of the cone between the nearest and
+        // farthest point of it along the axis. Large receivers like the
+        // ground keep only the part around the shadow.
+        bool inside = true;
+        for(int pass = 0; pass<clipPasses && inside; ++pass) {
+            float nearest = FLT_MAX;
+            float farthestAlong = -FLT_MAX;
+
+            for(int k = 0; k<8; ++k) {
+                D3DXVECTOR3 corner( k & 1 ? receiverMax.x : receiverMin.x,
+                                    k & 2 ? receiverMax.y : receiverMin.y,
+                                    k & 4 ? receiverMax.z : receiverMin.z );
+
+                along = D3DXVec3Dot( &(corner - apex), &axis );
+                nearest = min(nearest, along);
+                farthestAlong = max(farthestAlong, along);
+            }
+            nearest = max(nearest, 0.0f);
+            farthestAlong = min(farthestAlong, length);
 
-        shadowVolume.penumbraIndices[j+15] = i + 5*size;
-        shadowVolume.penumbraIndices[j+16] = i + 2*size;
-        shadowVolume.penumbraIndices[j+17] = i;
+            for(int j = 0; j<3; ++j) {
+                float spread = tangent * sqrt( max(1.0f - axis[j] * axis[j], 0.0f) );
+                float low = apex[j] + min( (axis[j] - spread) * nearest, (axis[j] - spread) * farthestAlong );
+                float high = apex[j] + max( (axis[j] + spread) * nearest, (axis[j] + spread) * farthestAlong );
 
-        // back
-        shadowVolume.penumbraIndices[j+18] = i + size;
-        shadowVolume.penumbraIndices[j+19] = i + 2*size;
-        shadowVolume.penumbraIndices[j+20] = i + 4*size;
+                receiverMin[j] = max(receiverMin[j], low);
+                receiverMax[j] = min(receiverMax[j], high);
+                inside = inside && receiverMin[j] <= receiverMax[j] && nearest <= farthestAlong;
+            }
+        }
+        if (!inside)
+            continue;
+
+        // Farthest corner in object space, box stays convex under transform
+        shadowed = true;
+        for(int k = 0; k<8; ++k) {
+            D3DXVECTOR3 corner( k & 1 ? receiverMax.x : receiverMin.x,
+                                k & 2 ? receiverMax.y : receiverMin.y,
+                                k & 4 ? receiverMax.z : receiverMin.z );
+
+            D3DXVec3TransformCoord(&corner, &corner, &invTransform);
+            farthest = max( farthest, D3DXVec3LengthSq( &(corner - objectLight) ) );
+        }
+    }
 
-        shadowVolume.penumbraIndices[j+21] = i + 4*size;
-        shadowVolume.penumbraIndices[j+22] = i + 2*size;
-        shadowVolume.penumbraIndices[j+23] = i + 5*size;
+    if (!shadowed) {
+        extrusion = 0.0f;
+        return false;
     }
 
-    UpdateShadowVolumes();
+    // Far cap spans the object space cone, its faces cut inside the extrusion
+    // sphere. Penumbra extrudes from points up to the light radius away.
+    distance = D3DXVec3Length( &(D3DXVECTOR3(data->meshCenter.x, data->meshCenter.y, data->meshCenter.z) - objectLight) );
+    sine = (data->meshRadius + objectRadius) / distance;
+    if (sine > maxClipSine)
+        return true;
+    extrusion = min( objectRange, sqrt(farthest) / sqrt(1.0f - sine * sine) + objectRadius );
+
+    return true;
 }
 
 // Compute volumes to render shadows
-void Mesh::ComputeShadowVolumes(const Light& light) {  
-    D3DXMATRIX      invTransform;
-    D3DXVECTOR3     lightPos;
-    D3DXVECTOR4     tmp;
+void Mesh::ComputeShadowVolumes(const Light& light, int lightIndex) {  
+    // From world space to object space
+    const D3DXVECTOR4& tmp = SelectLight(light, lightIndex);
+    ++counters.inversionsAvoided;
+    data->shadowLods[shadowLod]->ExtractSilhouette( D3DXVECTOR3(tmp.x, tmp.y, tmp.z), volumes[lightIndex] );
+    volumeLods[lightIndex] = shadowLod;
+
+    const SilhouetteStats& stats = volumes[lightIndex].stats;
+    frameCounters->Add(shadowVolumes, 1);
+    frameCounters->Add(silhouetteEdges, stats.edges);
+    frameCounters->Max(maxSilhouetteEdges, stats.edges);
+}
 
-    D3DXMatrixInverse(&invTransform, NULL, &transform);
-    D3DXVec4Transform(&tmp, &light.position, &invTransform);
-    lightPos = D3DXVECTOR3(tmp.x, tmp.y, tmp.z);
+// Volume of light from an earlier frame with the level it was extracted from
+bool Mesh::ReuseShadowVolume(int lightIndex) {
+    if ( lightIndex >= volumes.size() || volumes[lightIndex].id == 0 || !data->shadowLods[ volumeLods[lightIndex] ] )
+        return false;
 
-    shadowVolume.silhouettePlane = D3DXVECTOR4(lightPos, 0.0f);
-    D3DXVec4Normalize(&shadowVolume.silhouettePlane, &shadowVolume.silhouettePlane);
-    shadowVolume.silhouettePlane.w = -D3DXVec4Dot(&shadowVolume.silhouettePlane, &light.position);
+    currentVolume = lightIndex;
+    shadowLod = volumeLods[lightIndex];
+    return true;
+}
 
-    // From world space to object space
-    D3DXMatrixInverse(&invTransform, NULL, &transform);
-    D3DXVec4Transform(&tmp, &light.position, &invTransform);
-    lightPos = D3DXVECTOR3(tmp.x, tmp.y, tmp.z);
+// Screen area of umbra sides of current volume
+float Mesh::GetUmbraArea(const D3DXMATRIX& world, const Light& light, float distance) const {
+    D3DXMATRIX    worldViewProjMatrix;
+    D3DVIEWPORT9  viewport;
 
-    
-        vector<bool> frontFace;
-        int offs = vertices.size();
-
-	    // Check front or back faces
-        shadowVolume.umbraIndices.resize( faces.size() * 3 );
-        shadowVolume.penumbraIndices.clear();
-        frontFace.resize(faces.size());
-	    for(int i=0; i<faces.size(); ++i) {
-		    frontFace[i] = D3DXVec3Dot(&faces[i].normal, &(lightPos - vertices[faces[i].v0])) > 0.0f;
-        }
+    TransformGraph::Multiply(worldViewProjMatrix, transform, viewProj);
+    pd3dDevice->GetViewport(&viewport);
+    ++counters.inversionsAvoided;
 
-	    // Add silhouette indices
-	    for(int i = 0; i<edges.size(); ++i) {
-		    Edge edge = edges[i];
-            Face f0 = faces[edge.f0];
-            Face f1 = faces[edge.f1];
+    return data->shadowLods[shadowLod]->GetUmbraArea( volumes[currentVolume], volumes[currentVolume].extractedLight,
+                                                      distance, worldViewProjMatrix, static_cast<float>(viewport.Width), static_cast<float>(viewport.Height) );
+}
 
-		    // Check silhouette edge
-		    if (!frontFace[edge.f0] && frontFace[edge.f1]) {
-                AddEdgeToVolume(i);
-            }
-            else if (frontFace[edge.f0] && !frontFace[edge.f1]) {
-                AddEdgeToVolume(i);
-            }
-	    }
-        UpdateShadowVolumes();
-    
+// World space box of the instance
+void Mesh::GetBounds(Bounds& bounds) const {
+    D3DXVECTOR3 center;
+
+    // Transformed box, extents along world axes
+    D3DXVec3TransformCoord(&center, &data->boxCenter, &transform);
+    for(int i = 0; i<3; ++i) {
+        float extent = fabs(transform.m[0][i]) * data->boxExtent.x +
+                       fabs(transform.m[1][i]) * data->boxExtent.y +
+                       fabs(transform.m[2][i]) * data->boxExtent.z;
+
+        bounds.min[i] = center[i] - extent;
+        bounds.max[i] = center[i] + extent;
+    }
+}
+
+// Triangles as drawn, for ray tracing
+void Mesh::GetTriangles(vector<float>& triangles) const {
+    LPD3DXMESH        pMesh = data->pMesh;
+    char*             pVertices;
+    char*             pIndices;
+    D3DVERTEXELEMENT9 decl[MAX_FVF_DECL_SIZE];
+    int               positionOffset;
+    int               elemSize = pMesh->GetNumBytesPerVertex();
+    bool              ind32 = (pMesh->GetOptions() & D3DXMESH_32BIT) != 0;
+
+    pMesh->GetDeclaration(decl);
+    positionOffset = find_if( decl, decl + MAX_FVF_DECL_SIZE, boost::lambda::bind(&D3DVERTEXELEMENT9::Usage, _1) == D3DDECLUSAGE_POSITION )->Offset;
+
+    pMesh->LockVertexBuffer( D3DLOCK_READONLY, (LPVOID*)&pVertices );
+    pMesh->LockIndexBuffer( D3DLOCK_READONLY, (LPVOID*)&pIndices );
+    for(int i = 0; i<3 * pMesh->GetNumFaces(); ++i) {
+        int         index = ind32 ? ((DWORD*)pIndices)[i] : ((WORD*)pIndices)[i];
+        D3DXVECTOR3 position;
+
+        memcpy(&position, pVertices + index * elemSize + positionOffset, sizeof(D3DXVECTOR3));
+        D3DXVec3TransformCoord(&position, &position, &transform);
+        triangles.push_back(position.x);
+        triangles.push_back(position.y);
+        triangles.push_back(position.z);
+    }
+    pMesh->UnlockIndexBuffer();
+    pMesh->UnlockVertexBuffer();
 }
 
 // Render ambient part
@@ -706,20 +977,20 @@ void Mesh::RenderAmbient(const D3DXMATRIX& world) const {
 
     // World transform
     D3DXMatrixMultiply(&result, &transform, &world);
-    pd3dDevice->SetTransform(D3DTS_WORLD, &result);
+    Device::SetTransform(D3DTS_WORLD, &result);
 
     // Render subsets
-    for(int i = 0; i<materials.size(); ++i)
+    for(int i = 0; i<data->materials.size(); ++i)
     {
-        pd3dDevice->SetMaterial(&materials[i]);
+        Device::SetMaterial(&data->materials[i]);
 
-        if ( textures[i] != TextureStorage::Instance()->End() )
-            pd3dDevice->SetTexture(0, textures[i]->pTexture);
+        if ( data->textures[i].Exist() )
+            Device::SetTexture(0, data->textures[i]->pTexture);
         else
-            pd3dDevice->SetTexture(0, 0);
+            Device::SetTexture(0, 0);
 
 
-        pMesh->DrawSubset(i);
+        Device::DrawSubset(data->pMesh, i);
     }
 }
 
@@ -735,20 +1006,24 @@ void Mesh::RenderZF(const D3DXMATRIX& world) const {
     D3DXMatrixMultiply(&worldViewProjMatrix, &worldViewMatrix, &projMatrix);
 
     // Setup variables
-    pLightingEffect->SetMatrix("projMatrix", &projMatrix);
-    pLightingEffect->SetMatrix("worldViewMatrix", &worldViewMatrix);
-    pLightingEffect->SetMatrix("worldViewProjMatrix", &worldViewProjMatrix);
+    Effect::SetMatrix("projMatrix", &projMatrix);
+    Effect::SetMatrix("worldViewMatrix", &worldViewMatrix);
+    Effect::SetMatrix("worldViewProjMatrix", &worldViewProjMatrix);
 
     // Render subsets
-    pLightingEffect->BeginPass(0);
-    for(int i = 0; i<materials.size(); ++i)
-        pMesh->DrawSubset(i);
-    pLightingEffect->EndPass();
+    Effect::BeginPass(0);
+    for(int i = 0; i<data->materials.size(); ++i)
+        Device::DrawSubset(data->pMesh, i);
+    Effect::EndPass();
 }
 
 // Check when mesh faces are closed
+bool MeshData::IsClosed() const {
+    return !shadowLods.empty();
+}
+
 bool Mesh::IsClosed() const {
-    return edges.size() > 0;
+    return data.Exist() && data->IsClosed();
 }
 
 // Render
@@ -756,12 +1031,12 @@ void Mesh::Render(const D3DXMATRIX& world, const Light& light) const {
     SetShaderConstants0(world, light);
 
     // Render subsets
-    for(int i = 0; i<materials.size(); ++i) {
-        if (!textures[i].Exist()) {
-            SetShaderConstants1(light, materials[i], textures[i]);
-            pLightingEffect->BeginPass(0);
-            pMesh->DrawSubset(i);
-            pLightingEffect->EndPass();
+    for(int i = 0; i<data->materials.size(); ++i) {
+        if (!data->textures[i].Exist()) {
+            SetShaderConstants1(light, data->materials[i], data->textures[i]);
+            Effect::BeginPass(0);
+            Device::DrawSubset(data->pMesh, i);
+            Effect::EndPass();
         }
     }
  }
@@ -769,47 +1044,116 @@ void Mesh::Render(const D3DXMATRIX& world, const Light& light) const {
 // Render
 void Mesh::RenderTextured(const D3DXMATRIX& world, const Light& light) const {
     // Render subsets
-    for(int i = 0; i<materials.size(); ++i) {
-        if (textures[i].Exist()) {
-            SetShaderConstants1(light, materials[i], textures[i]);
-            pLightingEffect->BeginPass(1);
-            pMesh->DrawSubset(i);
-            pLightingEffect->EndPass();
+    for(int i = 0; i<data->materials.size(); ++i) {
+        if (data->textures[i].Exist()) {
+            SetShaderConstants1(light, data->materials[i], data->textures[i]);
+            Effect::BeginPass(1);
+            Device::DrawSubset(data->pMesh, i);
+            Effect::EndPass();
         }
     }
  }
 
 // Render umbra volume
 void Mesh::RenderUmbra(int pass) const {
-    // Set source
-    pd3dDevice->SetVertexDeclaration(ShadowVert::pVertexDecl);
-	pd3dDevice->SetStreamSource(0, shadowVolume.pVertexBuffer, 0, sizeof(ShadowVert));
-	pd3dDevice->SetIndices(shadowVolume.pUmbraIndexBuffer);
-
-    // draw
-    pLightingEffect->BeginPass(pass);
-	pd3dDevice->DrawIndexedPrimitive(D3DPT_TRIANGLELIST, 0, 0, shadowVolume.vertices.size(), 0, shadowVolume.umbraIndices.size()/3);
-    pLightingEffect->EndPass();
+    data->shadowLods[shadowLod]->RenderUmbra(volumes[currentVolume], pass);
 }
 
 // Render penumbra volume
-void Mesh::RenderPenumbra(int pass) const
-{
-    // Set source
-    pd3dDevice->SetVertexDeclaration(ShadowVert::pVertexDecl);
-	pd3dDevice->SetStreamSource(0, shadowVolume.pVertexBuffer, 0, sizeof(ShadowVert));
-	pd3dDevice->SetIndices(shadowVolume.pPenumbraIndexBuffer);
+void Mesh::RenderPenumbra(int pass) const {
+    data->shadowLods[shadowLod]->RenderPenumbra(volumes[currentVolume], pass);
+}
 
-    // draw
-    pLightingEffect->BeginPass(pass);
-	pd3dDevice->DrawIndexedPrimitive( D3DPT_TRIANGLELIST, 0, 0, shadowVolume.vertices.size(), 0, shadowVolume.penumbraIndices.size()/3 );
-    pLightingEffect->EndPass();
+// Add mesh, shadow levels & textures to report
+void MeshData::AddMemoryUsage(MemoryReport& report, set<const void*>& counted) const {
+    MemoryUsage  usage;
+
+    if (pMesh) {
+        LPDIRECT3DVERTEXBUFFER9 pVertexBuffer;
+        LPDIRECT3DINDEXBUFFER9  pIndexBuffer;
+
+        pMesh->GetVertexBuffer(&pVertexBuffer);
+        pMesh->GetIndexBuffer(&pIndexBuffer);
+        usage += MemoryReport::Of(pVertexBuffer);
+        usage += MemoryReport::Of(pIndexBuffer);
+        pVertexBuffer->Release();
+        pIndexBuffer->Release();
+    }
+    usage += MemoryReport::Of(materials);
+    usage += MemoryReport::Of(textures);
+    report.Add(fileName, "mesh", usage);
+
+    for(int i = 0; i<shadowLods.size(); ++i) {
+        ostringstream owner;
+
+        owner << fileName << " lod " << i;
+        if (shadowLods[i])
+            shadowLods[i]->AddMemoryUsage(report, owner.str());
+    }
+
+    // Shared textures are counted by the first mesh
+    for(int i = 0; i<textures.size(); ++i) {
+        if ( textures[i].Exist() && counted.insert( textures[i].GetObject() ).second )
+            report.Add(textures[i].GetKey(), "textures", MemoryReport::Of( textures[i]->pTexture ));
+    }
 }
 
-// Release mesh resources
+// Add shadow volumes of instance and shared data not counted yet to report
+void Mesh::AddMemoryUsage(MemoryReport& report, set<const void*>& counted) const {
+    MemoryUsage  usage;
+
+    if ( !data.Exist() )
+        return;
+
+    usage.cpu = sizeof(Mesh) + volumes.capacity() * sizeof(ShadowVolume) + volumeLods.capacity() * sizeof(int);
+    for(int i = 0; i<volumes.size(); ++i) {
+        const ShadowVolume& volume = volumes[i];
+
+        usage += MemoryReport::Of(volume.umbraIndices);
+        usage += MemoryReport::Of(volume.penumbraIndices);
+        usage += MemoryReport::Of(volume.wedgeVertices);
+        usage += MemoryReport::Of(volume.silhouette);
+        usage += MemoryReport::Of(volume.loopEdges);
+        usage += MemoryReport::Of(volume.loopStarts);
+        usage += MemoryReport::Of(volume.loopCorners);
+    }
+    report.Add(data->fileName, "instances", usage);
+
+    // Shared data is counted by the first instance
+    if ( counted.insert( data.GetObject() ).second )
+        data->AddMemoryUsage(report, counted);
+}
+
+// Add silhouette caches of shared data not counted yet
+void Mesh::AddSilhouetteCacheStats(SilhouetteCacheStats& stats, set<const void*>& counted) const {
+    if ( !data.Exist() || !counted.insert( data.GetObject() ).second )
+        return;
+
+    for(int i = 0; i<data->shadowLods.size(); ++i) {
+        if ( !data->shadowLods[i] )
+            continue;
+
+        const SilhouetteCacheStats& lod = data->shadowLods[i]->GetSilhouetteCacheStats();
+
+        stats.hits += lod.hits;
+        stats.misses += lod.misses;
+        stats.evictions += lod.evictions;
+        stats.entries += lod.entries;
+        stats.bytes += lod.bytes;
+        stats.secondsSaved += lod.secondsSaved;
+    }
+}
+
+// Shadow level report of the shared data
+void Mesh::WriteShadowLodReport(ostream& out) const {
+    if ( data.Exist() )
+        data->WriteShadowLodReport(out);
+}
+
+// Release reference to shared data
 void Mesh::Clear()
 {
-    textures.clear();
-    if (pMesh) pMesh->Release();
-    pMesh = NULL;
-}
\ No newline at end of file
+    data.Destroy();
+    volumes.clear();
+    volumeLods.clear();
+}
@@ -1,56 +1,185 @@
 #pragma once
 #include "ZTexture.h"
+#include "ShadowGeometry.h"
+#include "Bvh.h"
+#include <string>
+#include <iosfwd>
+#include <set>
 
-class Mesh {
+// Shadow caster level of detail selection
+struct ShadowLodSettings
+{
+	bool  enabled;
+	float distanceError; // allowed error per unit of camera distance
+	float radiusError;   // allowed error per unit of light radius
+	float scale;         // multiplies both, raised by the quality controller
+};
+
+// Shadow level of MeshData as ShadowStreamer pages it
+struct ShadowPage
+{
+	float     error;    // object space simplification error
+	size_t    bytes;    // CPU arrays & buffers while resident
+	long long offset;   // source in the page file, -1 if there is none
+	bool      loading;
+};
+
+// Matrix work of mesh instances since last reset
+struct TransformCounters
+{
+	int inversions;         // matrices inverted
+	int inversionsAvoided;  // cached inverse used where one was computed before
+	int lightHits;          // object space light reused
+	int lightMisses;        // object space light transformed
+};
+
+//-----------------------------------------------------------------------------
+// MeshData class
+// D3DX mesh, materials, textures & shadow caster levels loaded from one file.
+// Shared by all mesh instances of the file through MeshStorage, read only
+// after Load except for the shadow levels ShadowStreamer pages on the render
+// thread.
+//-----------------------------------------------------------------------------
+class MeshData {
 private:
+    friend class Mesh;
+    friend class ShadowStreamer;
+
     LPD3DXMESH pMesh;
     D3DXVECTOR4 meshCenter;
     float meshRadius;
+    D3DXVECTOR3 boxCenter; // object space bounding box
+    D3DXVECTOR3 boxExtent;
     std::vector<D3DMATERIAL9> materials;
     std::vector<Texture> textures;
 
-    // Shadow data
-    std::vector<D3DXVECTOR3> vertices;
-    std::vector<D3DXVECTOR3> normals;
-    std::vector<Face> faces;
-    std::vector<Edge> edges;
-    ShadowVolume shadowVolume;
+    std::string fileName;
 
-    D3DXMATRIX transform;
+    // Post-transform cache of the drawn mesh in file & optimized order
+    VertexCacheStats cacheBefore;
+    VertexCacheStats cacheAfter;
 
-    // Setup shader variables
-    void    SetShaderConstants0(const D3DXMATRIX& world, const Light& light, const bool objSpace = false) const;
-    void    SetShaderConstants1(const Light& light, const D3DMATERIAL9& material, const Texture& texture) const;
-
-    // Make vbo/ibo for rendering
-    void PrepareShadowVolumes();
+    // Shadow data, level 0 is full resolution. When streaming, levels before
+    // the last are NULL while they are paged out, the last is the proxy.
+    mutable std::vector<ShadowGeometry*> shadowLods;
+    mutable std::vector<ShadowPage> pages; // per level
+    std::string pageFile;                  // sources of the paged levels
 
-    // Make vbo/ibo for rendering
-    void UpdateShadowVolumes();
+    // Reorder triangles of each material for the vertex cache
+    void OptimizeVertexCache();
 
 	// Copy vertices, etc...
 	void PrepareShadowGeometry();
 
-    // Add edge if it is unique
-    void AddEdge(EdgeMap& edgeMap, int v0, int v1, int face);
+    // Build next shadow level, its source goes to page if it is set.
+    // Returns false if the mesh is not closed.
+    bool AddShadowLod(const std::vector<D3DXVECTOR3>& vertices, const std::vector<Face>& faces, float error, std::ostream* page);
+
+    // Load or generate simplified shadow casters
+    void MakeShadowLods(const std::vector<D3DXVECTOR3>& vertices, const std::vector<Face>& faces, std::ostream* page);
 
-    // Find mesh edges
-    void MakeEdges();
+    // Sample light around the mesh for reports
+    D3DXVECTOR3 ReportLightPosition(int sample, int numSamples) const;
 
-    // Add edge to penumbra & umbra volume
-    void AddEdgeToVolume(const int i);
+    MeshData(const MeshData&);
+    MeshData& operator = (const MeshData&);
 
 public:
+    MeshData();
+    ~MeshData(void);
+
+    void Load(const std::string& name);
+    bool IsClosed() const;
+
+    // Edge count, silhouette extraction time & merging savings of each shadow level
+    void WriteShadowLodReport(std::ostream& out) const;
+
+    // Add mesh, shadow levels & textures to report
+    void AddMemoryUsage(MemoryReport& report, std::set<const void*>& counted) const;
+};
+
+typedef Utils::Storage<MeshData, std::string> MeshStorage;
+typedef MeshStorage::handle MeshAsset;
+
+//-----------------------------------------------------------------------------
+// Mesh class
+// Instance of shared mesh data: transform, chosen shadow level and the
+// shadow volume of each light. Cheap to copy.
+//-----------------------------------------------------------------------------
+class Mesh {
+private:
+    MeshAsset data;
+    int shadowLod;
+
+    // Silhouette per light, current one is used for rendering
+    std::vector<ShadowVolume> volumes;
+    std::vector<int> volumeLods; // shadow level each volume was extracted from
+    int currentVolume;
+
+    // Object space distance from light volumes of current light are
+    // extruded to, 0 if they shadow nothing
+    float extrusion;
+
+    D3DXMATRIX transform;
+    D3DXMATRIX invTransform;
+    unsigned int transformVersion; // changes with transform
+
+    // Camera of the frame, see SetCamera
+    static D3DXMATRIX viewProj;
+    static D3DXMATRIX invViewProj;
+
+    // Largest axis scale of the transform
+    float   GetScale() const;
+
+    // Select volume of light & update its object space light if stale
+    const D3DXVECTOR4& SelectLight(const Light& light, int lightIndex);
+
+    // Setup shader variables
+    void    SetShaderConstants0(const D3DXMATRIX& world, const Light& light, const bool objSpace = false) const;
+    void    SetShaderConstants1(const Light& light, const D3DMATERIAL9& material, const Texture& texture) const;
+
+public:
+    static ShadowLodSettings lodSettings;
+    static TransformCounters counters;
+
+    // Extrude only as far as receivers of the shadow, otherwise to light range
+    static bool clipExtrusion;
+
     Mesh();
-    ~Mesh(void);
 
     void SetTransform(const D3DXMATRIX& matrix);
+    // Set transform with its known inverse
+    void SetTransform(const D3DXMATRIX& matrix, const D3DXMATRIX& inverse);
+    const D3DXMATRIX& GetTransform() const { return transform; }
+    // View of the frame, before any shadow work
+    static void SetCamera(const D3DXMATRIX& view);
     void SetShadowConstants(const D3DXMATRIX& world, const Light& light) const;
     void Transform(const D3DXMATRIX& matrix);
+    // Share data of the file with other instances, load it first time
     void Load(const char* name);
-    void InitShadowForGPU();
-    void ComputeShadowVolumes(const Light& light);
+    // Coarsest shadow level whose error is not visible, resident or not
+    int FindShadowLod(const D3DXVECTOR3& eyePosition, const Light& light) const;
+    // Found level, or the next coarser one that is resident
+    void SelectShadowLod(const D3DXVECTOR3& eyePosition, const Light& light);
+    // Extrusion of next volumes from world space boxes of visible receivers
+    // in light range. Returns false if none of them can be in the shadow.
+    // Set reuse after ReuseShadowVolume succeeded.
+    bool ClipShadowVolume(const Light& light, int lightIndex, const std::vector<Bounds>& receivers, bool reuse);
+    void ComputeShadowVolumes(const Light& light, int lightIndex);
+    // Keep volume of light from an earlier frame instead of computing it,
+    // false if there is none. It is drawn from the light it was extracted
+    // for, so it stays closed after the light or caster moved.
+    bool ReuseShadowVolume(int lightIndex);
+    float GetExtrusion() const { return extrusion; }
+    // Screen area of umbra sides of current volume extruded to distance
+    float GetUmbraArea(const D3DXMATRIX& world, const Light& light, float distance) const;
     bool IsClosed() const;
+    // Shared data, NULL before Load
+    const MeshData* GetData() const { return data.Exist() ? data.GetObject() : NULL; }
+    // World space box of the instance
+    void GetBounds(Bounds& bounds) const;
+    // Append world space triangles of the render mesh, 9 floats each
+    void GetTriangles(std::vector<float>& triangles) const;
     void RenderAmbient(const D3DXMATRIX& world) const;
     void RenderZF(const D3DXMATRIX& world) const;
     // Render textured part
@@ -60,4 +189,13 @@ public:
     void RenderUmbra(int pass) const;
     void RenderPenumbra(int pass) const;
     void Clear();
+
+    // Shadow level report of the shared data
+    void WriteShadowLodReport(std::ostream& out) const;
+
+    // Add shadow volumes of instance and shared data not counted yet to report
+    void AddMemoryUsage(MemoryReport& report, std::set<const void*>& counted) const;
+
+    // Add silhouette caches of shared data not counted yet
+    void AddSilhouetteCacheStats(SilhouetteCacheStats& stats, std::set<const void*>& counted) const;
 };
@@ -0,0 +1,135 @@
+#include "MeshFile.h"
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+
+using namespace std;
+
+// Next number of text from pos on, separators are ; , & blanks
+static bool NextNumber(const string& text, size_t& pos, double& value) {
+    while (pos < text.size() && !isdigit(text[pos]) && text[pos] != '-' && text[pos] != '+' && text[pos] != '.')
+        ++pos;
+    if (pos >= text.size())
+        return false;
+
+    char* end;
+    value = strtod(text.c_str() + pos, &end);
+    pos = end - text.c_str();
+    return true;
+}
+
+// Mesh block at pos, not the template or MeshNormals etc. Sets open to its brace.
+static bool IsMeshBlock(const string& text, size_t pos, size_t& open) {
+    open = text.find('{', pos);
+    if (open == string::npos)
+        return false;
+    if (pos > 0 && !isspace(text[pos - 1]))
+        return false;
+    if (pos + 4 < text.size() && !isspace(text[pos + 4]) && text[pos + 4] != '{')
+        return false;
+    if (pos >= 9 && text.compare(pos - 9, 8, "template") == 0)
+        return false;
+
+    // Optional name only
+    for(size_t i = pos + 4; i<open; ++i) {
+        if (!isalnum(text[i]) && text[i] != '_' && !isspace(text[i]))
+            return false;
+    }
+    return true;
+}
+
+void MeshFile::Clear() {
+    vertices.clear();
+    faces.clear();
+    texcoords.clear();
+}
+
+bool MeshFile::Load(const string& fileName) {
+    ifstream file(fileName.c_str(), ios::binary);
+    string   text;
+    size_t   open;
+    bool     textured = true;
+
+    Clear();
+    if (!file)
+        return false;
+    text.assign( istreambuf_iterator<char>(file), istreambuf_iterator<char>() );
+    if (text.size() < 16 || text.compare(8, 3, "txt") != 0)
+        return false;
+
+    for(size_t start = text.find("Mesh"); start != string::npos; start = text.find("Mesh", start + 4)) {
+        if ( !IsMeshBlock(text, start, open) )
+            continue;
+
+        size_t pos = open + 1;
+        int    first = vertices.size();
+        double count, value[3];
+
+        if ( !NextNumber(text, pos, count) )
+            return false;
+        for(int i = 0; i<static_cast<int>(count); ++i) {
+            for(int j = 0; j<3; ++j) {
+                if ( !NextNumber(text, pos, value[j]) )
+                    return false;
+            }
+            vertices.push_back( D3DXVECTOR3( static_cast<float>(value[0]), static_cast<float>(value[1]), static_cast<float>(value[2]) ) );
+        }
+
+        if ( !NextNumber(text, pos, count) )
+            return false;
+        for(int i = 0; i<static_cast<int>(count); ++i) {
+            vector<int> polygon;
+            double      corners, index;
+
+            if ( !NextNumber(text, pos, corners) )
+                return false;
+            for(int j = 0; j<static_cast<int>(corners); ++j) {
+                if ( !NextNumber(text, pos, index) || index < 0 || first + index >= vertices.size() )
+                    return false;
+                polygon.push_back( first + static_cast<int>(index) );
+            }
+
+            // Fan, normal from the unwelded positions like MeshData
+            for(int j = 1; j+1<(int)polygon.size(); ++j) {
+                Face        face = Face();
+                D3DXVECTOR3 e1, e2;
+
+                face.v0 = polygon[0];
+                face.v1 = polygon[j];
+                face.v2 = polygon[j + 1];
+                e1 = vertices[face.v1] - vertices[face.v0];
+                e2 = vertices[face.v2] - vertices[face.v0];
+                D3DXVec3Cross(&face.normal, &e1, &e2);
+                D3DXVec3Normalize(&face.normal, &face.normal);
+                faces.push_back(face);
+            }
+        }
+
+        // Texture coordinates of the block come before the next one
+        size_t coords = text.find("MeshTextureCoords", pos);
+        size_t next = pos;
+        while ( (next = text.find("Mesh", next)) != string::npos && !IsMeshBlock(text, next, open) )
+            next += 4;
+        if (coords != string::npos && coords < next && textured) {
+            pos = text.find('{', coords) + 1;
+            if ( !NextNumber(text, pos, count) )
+                return false;
+            textured = static_cast<int>(count) == static_cast<int>(vertices.size() - first);
+            for(int i = 0; textured && i<static_cast<int>(count); ++i) {
+                for(int j = 0; j<2; ++j) {
+                    if ( !NextNumber(text, pos, value[j]) )
+                        return false;
+                }
+                texcoords.push_back( D3DXVECTOR2( static_cast<float>(value[0]), static_cast<float>(value[1]) ) );
+            }
+        }
+        else
+            textured = false;
+        start = pos;
+    }
+
+    if (!textured)
+        texcoords.clear();
+    return !faces.empty();
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include "ShadowTypes.h"
+#include <string>
+
+//-----------------------------------------------------------------------------
+// MeshFile class
+// Positions & triangles of a text .x file read without D3DX, for tools that
+// run without a device. Mesh blocks are merged and polygons split into fans.
+// Frame transforms & normals are skipped, so seams stay unwelded like in a
+// loaded D3DX mesh. Texture coordinates are kept when every block has them.
+//-----------------------------------------------------------------------------
+class MeshFile
+{
+public:
+    std::vector<D3DXVECTOR3> vertices;
+    std::vector<Face>        faces;     // indices into vertices, normals set
+    std::vector<D3DXVECTOR2> texcoords; // per vertex, empty without
+
+    // Returns false if file is missing, binary or has no mesh
+    bool Load(const std::string& fileName);
+
+    void Clear();
+};
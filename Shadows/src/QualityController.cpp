@@ -0,0 +1,149 @@
+#include "QualityController.h"
+#include <algorithm>
+#include <cfloat>
+#include <ostream>
+
+using namespace std;
+
+float QualityController::smoothing = 0.1f;
+float QualityController::degradeMargin = 0.05f;
+float QualityController::restoreMargin = 0.2f;
+int QualityController::holdFrames = 15;
+int QualityController::restoreFrames = 60;
+int QualityController::maxBackoff = 8;
+float QualityController::fillCoverage = 0.5f;
+int QualityController::maxSteps[NumKnobs] = { 4, 8, 3, 3 };
+float QualityController::penumbraDistances[] = { 2.0f, 1.5f, 1.0f, 0.5f };
+
+// Knobs tried first to last, by bottleneck
+static const QualityController::Knob fillOrder[] = { QualityController::PenumbraDistance, QualityController::HardLights,
+                                                     QualityController::CasterLod, QualityController::UpdateInterval };
+static const QualityController::Knob cpuOrder[] = { QualityController::UpdateInterval, QualityController::CasterLod,
+                                                    QualityController::PenumbraDistance, QualityController::HardLights };
+
+QualitySettings::QualitySettings() : lodScale(1.0f), penumbraDistance(FLT_MAX), updateInterval(1), hardLights(0) {
+}
+
+QualityController::QualityController() : budgetMs(1000.0f / 60.0f), enabled(false), smoothedMs(0.0f), frame(0), lastChange(0),
+                                         calmFrames(0), exhausted(false), log(NULL) {
+    Enable(false);
+}
+
+void QualityController::SetBudget(float ms) {
+    budgetMs = ms;
+    if (enabled && log)
+        *log << "frame " << frame << ": budget " << budgetMs << " ms" << endl;
+}
+
+// Switching off returns to full quality
+void QualityController::Enable(bool on) {
+    enabled = on;
+    lastChange = frame;
+    calmFrames = 0;
+    exhausted = false;
+    degraded.clear();
+    for(int i = 0; i<NumKnobs; ++i) {
+        steps[i] = 0;
+        restoreWait[i] = restoreFrames;
+        restoredAt[i] = 0;
+    }
+    Apply();
+
+    if (log && frame > 0)
+        *log << "frame " << frame << ": " << (on ? "enabled, budget " : "disabled at ") << budgetMs << " ms, full quality" << endl;
+}
+
+// Measure a frame & move at most one knob one step
+bool QualityController::Update(const FrameTimings& timings) {
+    ++frame;
+    smoothedMs = frame == 1 ? timings.frameMs : smoothedMs + (timings.frameMs - smoothedMs) * smoothing;
+    if (!enabled)
+        return false;
+
+    calmFrames = smoothedMs < budgetMs * (1.0f - restoreMargin) ? calmFrames + 1 : 0;
+    if ( frame - lastChange < (unsigned int)holdFrames )
+        return false;
+
+    if (smoothedMs > budgetMs * (1.0f + degradeMargin))
+        return Degrade(timings);
+    exhausted = false;
+    if ( !degraded.empty() && calmFrames >= restoreWait[ degraded.back() ] ) {
+        Restore(timings);
+        return true;
+    }
+    return false;
+}
+
+// Degrade one knob for the bottleneck, false if none is left
+bool QualityController::Degrade(const FrameTimings& timings) {
+    bool        fillBound = timings.coverage > fillCoverage || smoothedMs - timings.cpuMs > timings.cpuMs;
+    const Knob* order = fillBound ? fillOrder : cpuOrder;
+
+    for(int i = 0; i<NumKnobs; ++i) {
+        Knob knob = order[i];
+        int  limit = knob == HardLights ? min( maxSteps[knob], timings.lights - 1 ) : maxSteps[knob];
+
+        if (steps[knob] >= limit)
+            continue;
+
+        // Degraded again soon after it was restored, wait longer next time
+        if ( restoredAt[knob] > 0 && frame - restoredAt[knob] < (unsigned int)restoreWait[knob] )
+            restoreWait[knob] = min( restoreWait[knob] * 2, restoreFrames * maxBackoff );
+
+        ++steps[knob];
+        degraded.push_back(knob);
+        Apply();
+        Log(timings, fillBound ? "fill bound" : "cpu bound", knob, steps[knob] - 1);
+        lastChange = frame;
+        calmFrames = 0;
+        return true;
+    }
+
+    if (!exhausted && log)
+        *log << "frame " << frame << ": " << smoothedMs << " ms over " << budgetMs << " ms budget at lowest quality" << endl;
+    exhausted = true;
+    return false;
+}
+
+// Undo the last step
+void QualityController::Restore(const FrameTimings& timings) {
+    Knob knob = degraded.back();
+
+    degraded.pop_back();
+    --steps[knob];
+    restoredAt[knob] = frame;
+    Apply();
+    Log(timings, "under budget", knob, steps[knob] + 1);
+    lastChange = frame;
+    calmFrames = 0;
+}
+
+// Settings from steps
+void QualityController::Apply() {
+    settings.lodScale = static_cast<float>(1 << steps[CasterLod]);
+    settings.penumbraDistance = steps[PenumbraDistance] > 0 ? penumbraDistances[ steps[PenumbraDistance] - 1 ] : FLT_MAX;
+    settings.updateInterval = 1 << steps[UpdateInterval];
+    settings.hardLights = steps[HardLights];
+}
+
+void QualityController::Log(const FrameTimings& timings, const char* reason, Knob knob, int from) {
+    if (!log)
+        return;
+
+    *log << "frame " << frame << ": " << smoothedMs << " ms for " << budgetMs << " ms budget, " << reason
+         << " (frame " << timings.frameMs << " ms, cpu " << timings.cpuMs << " ms, shadows " << timings.shadowMs
+         << " ms, coverage " << timings.coverage << ", " << timings.lights << " lights): "
+         << GetKnobName(knob) << " " << from << " -> " << steps[knob]
+         << "; lod x" << settings.lodScale << ", penumbra to ";
+    if (settings.penumbraDistance < FLT_MAX)
+        *log << settings.penumbraDistance << " camera distances";
+    else
+        *log << "any distance";
+    *log << ", update every " << settings.updateInterval << " frames, " << settings.hardLights << " hard lights"
+         << ", restore after " << restoreWait[knob] << " calm frames" << endl;
+}
+
+const char* QualityController::GetKnobName(Knob knob) {
+    static const char* names[NumKnobs] = { "penumbra distance", "hard lights", "caster lod", "update interval" };
+    return names[knob];
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include <iosfwd>
+#include <vector>
+
+// Shadow quality knobs for the renderer, full quality by default
+struct QualitySettings
+{
+    float lodScale;         // multiplies shadow caster LOD errors
+    float penumbraDistance; // casters farther from the eye, in camera distances, draw umbra only
+    int   updateInterval;   // frames between silhouette updates of each light
+    int   hardLights;       // last lights drawn draw umbra only
+
+    QualitySettings();
+};
+
+// Measurements of one frame
+struct FrameTimings
+{
+    float frameMs;      // start to start, Present included
+    float cpuMs;        // render thread without waiting in Present
+    float shadowMs;     // silhouettes, volumes & their draw calls of all lights
+    float coverage;     // umbra sides on screen per pixel, latest estimate
+    int   lights;       // lights drawn
+};
+
+//-----------------------------------------------------------------------------
+// QualityController class
+// Holds a frame time budget by moving shadow quality knobs one step at a
+// time. An over budget frame degrades the knob that helps its bottleneck
+// most: wedges & hard lights when waiting for fill, caster levels & update
+// rate when the render thread is busy. Restoring undoes the last step first.
+// Frame times are smoothed, a step needs more than a margin over or under
+// the budget, every step is held for a while, and a knob degraded again
+// soon after it was restored waits twice as long the next time. Every
+// decision is logged with the measurements that led to it.
+//-----------------------------------------------------------------------------
+class QualityController
+{
+public:
+    enum Knob { PenumbraDistance, HardLights, CasterLod, UpdateInterval, NumKnobs };
+
+private:
+    float               budgetMs;
+    bool                enabled;
+    float               smoothedMs;
+    unsigned int        frame;
+    unsigned int        lastChange;             // frame of last step
+    int                 calmFrames;             // frames in a row under the restore threshold
+    bool                exhausted;              // over budget with every knob at its last step
+    int                 steps[NumKnobs];
+    int                 restoreWait[NumKnobs];  // calm frames before restoring the knob
+    unsigned int        restoredAt[NumKnobs];   // 0 if never restored
+    std::vector<Knob>   degraded;               // restored last first
+    QualitySettings     settings;
+    std::ostream*       log;
+
+    // Degrade one knob for the bottleneck, false if none is left
+    bool Degrade(const FrameTimings& timings);
+    void Restore(const FrameTimings& timings);
+
+    // Settings from steps
+    void Apply();
+
+    void Log(const FrameTimings& timings, const char* reason, Knob knob, int from);
+
+public:
+    // Weight of the newest frame in the smoothed frame time
+    static float smoothing;
+    // Smoothed time over budget by this fraction degrades, under it by this restores
+    static float degradeMargin;
+    static float restoreMargin;
+    // Frames after a step before the next one
+    static int   holdFrames;
+    // Calm frames before a restore, doubled up to maxBackoff times per oscillating knob
+    static int   restoreFrames;
+    static int   maxBackoff;
+    // Umbra side coverage from which a frame counts as fill bound
+    static float fillCoverage;
+    // Steps of each knob
+    static int   maxSteps[NumKnobs];
+    // Penumbra distance of each step after the first, in camera distances
+    static float penumbraDistances[];
+
+    QualityController();
+
+    // Target frame time
+    void SetBudget(float ms);
+    float GetBudget() const { return budgetMs; }
+
+    // Switching off returns to full quality
+    void Enable(bool on);
+    bool IsEnabled() const { return enabled; }
+
+    // Decisions are written here, NULL for none
+    void SetLog(std::ostream* stream) { log = stream; }
+
+    // Measure a frame & move at most one knob one step, true if settings changed
+    bool Update(const FrameTimings& timings);
+
+    const QualitySettings& GetSettings() const { return settings; }
+    int GetStep(Knob knob) const { return steps[knob]; }
+    // Steps taken from full quality over all knobs
+    int GetTotalSteps() const { return static_cast<int>( degraded.size() ); }
+    float GetSmoothedMs() const { return smoothedMs; }
+
+    static const char* GetKnobName(Knob knob);
+};
@@ -0,0 +1,237 @@
+#pragma once
+#include "Global.h"
+#include "FrameCapture.h"
+
+//-----------------------------------------------------------------------------
+// Device & effect calls of a frame
+// Forward to pd3dDevice & pLightingEffect and record into FrameCapture
+// while it records on this thread. Calls made once at startup, creation &
+// read backs go to the device directly.
+//-----------------------------------------------------------------------------
+
+// Capture recording on this thread, else NULL
+inline FrameCapture* CaptureRecording() {
+    FrameCapture* capture = FrameCapture::Instance();
+    return capture->IsRecording() ? capture : NULL;
+}
+
+namespace Device
+{
+    // Stage of the frame, recorded only
+    inline void Marker(const char* name) {
+        if (FrameCapture* capture = CaptureRecording())
+            capture->RecordName(CaptureMarker, name);
+    }
+
+    // Whole target
+    inline HRESULT Clear(DWORD flags, D3DCOLOR color, float z, DWORD stencil) {
+        if (FrameCapture* capture = CaptureRecording())
+            capture->RecordData(CaptureClear, &z, sizeof(z), flags, color, stencil);
+        return pd3dDevice->Clear(0, NULL, flags, color, z, stencil);
+    }
+
+    inline HRESULT BeginScene() {
+        if (FrameCapture* capture = CaptureRecording())
+            capture->Record(CaptureBeginScene);
+        return pd3dDevice->BeginScene();
+    }
+
+    inline HRESULT EndScene() {
+        if (FrameCapture* capture = CaptureRecording())
+            capture->Record(CaptureEndScene);
+        return pd3dDevice->EndScene();
+    }
+
+    // Whole back buffer
+    inline HRESULT Present() {
+        if (FrameCapture* capture = CaptureRecording())
+            capture->Record(CapturePresent);
+        return pd3dDevice->Present(NULL, NULL, NULL, NULL);
+    }
+
+    inline HRESULT SetRenderState(D3DRENDERSTATETYPE state, DWORD value) {
+        if (FrameCapture* capture = CaptureRecording())
+            capture->Record(CaptureRenderState, state, value);
+        return pd3dDevice->SetRenderState(state, value);
+    }
+
+    inline HRESULT SetSamplerState(DWORD sampler, D3DSAMPLERSTATETYPE type, DWORD value) {
+        if (FrameCapture* capture = CaptureRecording())
+            capture->Record(CaptureSamplerState, sampler, type, value);
+        return pd3dDevice->SetSamplerState(sampler, type, value);
+    }
+
+    inline HRESULT SetTransform(D3DTRANSFORMSTATETYPE type, const D3DXMATRIX* matrix) {
+        if (FrameCapture* capture = CaptureRecording())
+            capture->RecordData(CaptureTransform, matrix, sizeof(D3DMATRIX), type);
+        return pd3dDevice->SetTransform(type, matrix);
+    }
+
+    inline HRESULT SetMaterial(const D3DMATERIAL9* material) {
+        if (FrameCapture* capture = CaptureRecording())
+            capture->RecordData(CaptureMaterial, material, sizeof(D3DMATERIAL9));
+        return pd3dDevice->SetMaterial(material);
+    }
+
+    inline HRESULT SetTexture(DWORD stage, IDirect3DBaseTexture9* texture) {
+        if (FrameCapture* capture = CaptureRecording())
+            capture->Record(CaptureTexture, stage, capture->GetId(texture));
+        return pd3dDevice->SetTexture(stage, texture);
+    }
+
+    inline HRESULT SetRenderTarget(DWORD index, IDirect3DSurface9* surface) {
+        if (FrameCapture* capture = CaptureRecording())
+            capture->Record(CaptureRenderTarget, index, capture->GetId(surface));
+        return pd3dDevice->SetRenderTarget(index, surface);
+    }
+
+    inline HRESULT SetStreamSource(UINT stream, IDirect3DVertexBuffer9* buffer, UINT offset, UINT stride) {
+        if (FrameCapture* capture = CaptureRecording())
+            capture->Record(CaptureStreamSource, stream, capture->GetId(buffer), offset, stride);
+        return pd3dDevice->SetStreamSource(stream, buffer, offset, stride);
+    }
+
+    // Instancing: D3DSTREAMSOURCE_INDEXEDDATA | instances on the template
+    // stream, D3DSTREAMSOURCE_INSTANCEDATA | 1 on the per instance one, 1 for
+    // neither
+    inline HRESULT SetStreamSourceFreq(UINT stream, UINT setting) {
+        if (FrameCapture* capture = CaptureRecording())
+            capture->Record(CaptureStreamSourceFreq, stream, setting);
+        return pd3dDevice->SetStreamSourceFreq(stream, setting);
+    }
+
+    inline HRESULT SetIndices(IDirect3DIndexBuffer9* buffer) {
+        if (FrameCapture* capture = CaptureRecording())
+            capture->Record(CaptureIndices, capture->GetId(buffer));
+        return pd3dDevice->SetIndices(buffer);
+    }
+
+    inline HRESULT SetVertexDeclaration(IDirect3DVertexDeclaration9* declaration) {
+        if (FrameCapture* capture = CaptureRecording())
+            capture->Record(CaptureVertexDeclaration, capture->GetId(declaration));
+        return pd3dDevice->SetVertexDeclaration(declaration);
+    }
+
+    inline HRESULT SetFVF(DWORD fvf) {
+        if (FrameCapture* capture = CaptureRecording())
+            capture->Record(CaptureFvf, fvf);
+        return pd3dDevice->SetFVF(fvf);
+    }
+
+    // Contents are recorded at unlock, size 0 locks the rest of the buffer
+    inline HRESULT Lock(IDirect3DVertexBuffer9* buffer, UINT offset, UINT size, void** data, DWORD flags) {
+        HRESULT result = buffer->Lock(offset, size, data, flags);
+
+        if (FrameCapture* capture = CaptureRecording()) {
+            D3DVERTEXBUFFER_DESC desc;
+
+            if (size == 0 && SUCCEEDED( buffer->GetDesc(&desc) ))
+                size = desc.Size - offset;
+            if ( SUCCEEDED(result) )
+                capture->Locked(buffer, *data, offset, size, flags);
+        }
+        return result;
+    }
+
+    inline HRESULT Unlock(IDirect3DVertexBuffer9* buffer) {
+        if (FrameCapture* capture = CaptureRecording())
+            capture->Unlocked(CaptureVertexUpload, buffer);
+        return buffer->Unlock();
+    }
+
+    inline HRESULT Lock(IDirect3DIndexBuffer9* buffer, UINT offset, UINT size, void** data, DWORD flags) {
+        HRESULT result = buffer->Lock(offset, size, data, flags);
+
+        if (FrameCapture* capture = CaptureRecording()) {
+            D3DINDEXBUFFER_DESC desc;
+
+            if (size == 0 && SUCCEEDED( buffer->GetDesc(&desc) ))
+                size = desc.Size - offset;
+            if ( SUCCEEDED(result) )
+                capture->Locked(buffer, *data, offset, size, flags);
+        }
+        return result;
+    }
+
+    inline HRESULT Unlock(IDirect3DIndexBuffer9* buffer) {
+        if (FrameCapture* capture = CaptureRecording())
+            capture->Unlocked(CaptureIndexUpload, buffer);
+        return buffer->Unlock();
+    }
+
+    inline HRESULT DrawPrimitive(D3DPRIMITIVETYPE type, UINT start, UINT count) {
+        if (FrameCapture* capture = CaptureRecording())
+            capture->Record(CaptureDraw, type, start, count);
+        return pd3dDevice->DrawPrimitive(type, start, count);
+    }
+
+    inline HRESULT DrawIndexedPrimitive(D3DPRIMITIVETYPE type, int base, UINT minIndex, UINT vertices, UINT start, UINT count) {
+        if (FrameCapture* capture = CaptureRecording())
+            capture->Record(CaptureDrawIndexed, type, base, minIndex, vertices, start, count);
+        return pd3dDevice->DrawIndexedPrimitive(type, base, minIndex, vertices, start, count);
+    }
+
+    inline HRESULT DrawSubset(ID3DXMesh* mesh, DWORD subset) {
+        if (FrameCapture* capture = CaptureRecording())
+            capture->Record(CaptureDrawSubset, capture->GetId(mesh), subset);
+        return mesh->DrawSubset(subset);
+    }
+}
+
+namespace Effect
+{
+    inline HRESULT SetTechnique(const char* technique) {
+        if (FrameCapture* capture = CaptureRecording())
+            capture->RecordName(CaptureTechnique, technique);
+        return pLightingEffect->SetTechnique(technique);
+    }
+
+    // Passes of the technique to passes
+    inline HRESULT Begin(UINT* passes) {
+        if (FrameCapture* capture = CaptureRecording())
+            capture->Record(CaptureEffectBegin);
+        return pLightingEffect->Begin(passes, 0);
+    }
+
+    inline HRESULT End() {
+        if (FrameCapture* capture = CaptureRecording())
+            capture->Record(CaptureEffectEnd);
+        return pLightingEffect->End();
+    }
+
+    inline HRESULT BeginPass(UINT pass) {
+        if (FrameCapture* capture = CaptureRecording())
+            capture->Record(CaptureBeginPass, pass);
+        return pLightingEffect->BeginPass(pass);
+    }
+
+    inline HRESULT EndPass() {
+        if (FrameCapture* capture = CaptureRecording())
+            capture->Record(CaptureEndPass);
+        return pLightingEffect->EndPass();
+    }
+
+    inline HRESULT SetMatrix(const char* parameter, const D3DXMATRIX* matrix) {
+        if (FrameCapture* capture = CaptureRecording())
+            capture->RecordName(CaptureEffectValue, parameter, matrix, sizeof(D3DMATRIX));
+        return pLightingEffect->SetMatrix(parameter, matrix);
+    }
+
+    inline HRESULT SetVector(const char* parameter, const D3DXVECTOR4* vector) {
+        if (FrameCapture* capture = CaptureRecording())
+            capture->RecordName(CaptureEffectValue, parameter, vector, sizeof(D3DXVECTOR4));
+        return pLightingEffect->SetVector(parameter, vector);
+    }
+
+    inline HRESULT SetFloat(const char* parameter, float value) {
+        if (FrameCapture* capture = CaptureRecording())
+            capture->RecordName(CaptureEffectValue, parameter, &value, sizeof(value));
+        return pLightingEffect->SetFloat(parameter, value);
+    }
+
+    inline HRESULT SetTexture(const char* parameter, IDirect3DBaseTexture9* texture) {
+        if (FrameCapture* capture = CaptureRecording())
+            capture->RecordName(CaptureEffectTexture, parameter, NULL, 0, capture->GetId(texture));
+        return pLightingEffect->SetTexture(parameter, texture);
+    }
+}
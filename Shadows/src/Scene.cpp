@@ -0,0 +1,508 @@
+#include "Scene.h"
+#include <stdexcept>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <cmath>
+
+using namespace std;
+
+StressSceneSettings Scene::stressSettings = { 1000, 16, 200, 20000, 8, 6.0f, 0.25f, 1 };
+
+// Tokens of one scene file line
+class LineReader {
+private:
+    const char*   p;
+    const char*   end;
+    const string& fileName;
+    int           line;
+
+    void Skip() {
+        while (p < end && isspace((unsigned char)*p))
+            ++p;
+    }
+
+public:
+    LineReader(const char* begin, const char* end, const string& fileName, int line) : p(begin), end(end), fileName(fileName), line(line) {}
+
+    // Nothing but spaces or comment left
+    bool AtEnd() {
+        Skip();
+        return p == end || *p == '#';
+    }
+
+    string Word() {
+        const char* start;
+
+        if (AtEnd())
+            Fail("unexpected end of line");
+        start = p;
+        while (p < end && !isspace((unsigned char)*p))
+            ++p;
+        return string(start, p);
+    }
+
+    // Rest of line without trailing spaces, paths may contain spaces
+    string Rest() {
+        const char* last = end;
+
+        if (AtEnd())
+            Fail("expected path");
+        while (last > p && isspace((unsigned char)last[-1]))
+            --last;
+
+        string rest(p, last);
+        p = end;
+        return rest;
+    }
+
+    float Number() {
+        char* next;
+        float value;
+
+        if (AtEnd())
+            Fail("expected number");
+        value = strtof(p, &next);
+        if (next == p || next > end)
+            Fail("expected number");
+        p = next;
+        return value;
+    }
+
+    // Index of already declared item
+    int Index(int size, const char* what) {
+        char* next;
+        long  value;
+
+        if (AtEnd())
+            Fail(string("expected ") + what);
+        value = strtol(p, &next, 10);
+        if (next == p || next > end || value < 0 || value >= size)
+            Fail(string("unknown ") + what);
+        p = next;
+        return static_cast<int>(value);
+    }
+
+    void Fail(const string& message) const {
+        ostringstream error;
+
+        error << fileName << "(" << line << "): " << message;
+        throw runtime_error(error.str());
+    }
+};
+
+Scene::Scene() {
+    Clear();
+}
+
+void Scene::Clear() {
+    folder.clear();
+    meshes.clear();
+    lightMesh.clear();
+    instances.clear();
+    lights.clear();
+    animations.clear();
+    cameraYaw = 0.0f;
+    cameraPitch = 0.5f;
+    cameraRadius = 60.0f;
+}
+
+// Parse scene file
+void Scene::Load(const string& fileName) {
+    ifstream    file(fileName.c_str(), ios::binary);
+    string      text;
+    const char* p;
+    int         line = 1;
+
+    if (!file)
+        throw runtime_error("Can't open scene " + fileName);
+
+    // Whole file at once, then scan lines in place
+    text.assign( istreambuf_iterator<char>(file), istreambuf_iterator<char>() );
+    Clear();
+
+    size_t pos = fileName.find_last_of("/\\");
+    if (pos != string::npos)
+        folder = fileName.substr(0, pos + 1);
+
+    for(p = text.c_str(); *p; ++line) {
+        const char* lineEnd = strchr(p, '\n');
+        LineReader  reader(p, lineEnd ? lineEnd : p + strlen(p), fileName, line);
+
+        p = lineEnd ? lineEnd + 1 : p + strlen(p);
+        if (reader.AtEnd())
+            continue;
+
+        string keyword = reader.Word();
+        if (keyword == "mesh")
+            meshes.push_back( reader.Rest() );
+        else if (keyword == "lightmesh")
+            lightMesh = reader.Rest();
+        else if (keyword == "camera") {
+            cameraYaw = reader.Number();
+            cameraPitch = reader.Number();
+            cameraRadius = reader.Number();
+        }
+        else if (keyword == "instance") {
+            SceneInstance instance;
+
+            instance.mesh = reader.Index(meshes.size(), "mesh");
+            instance.parent = -1;
+            D3DXMatrixIdentity(&instance.transform);
+
+            // Same order as Mesh::Transform calls
+            while (!reader.AtEnd()) {
+                string     op = reader.Word();
+                D3DXMATRIX matrix;
+
+                if (op == "t") {
+                    float x = reader.Number();
+                    float y = reader.Number();
+                    D3DXMatrixTranslation(&matrix, x, y, reader.Number());
+                }
+                else if (op == "rx")
+                    D3DXMatrixRotationX(&matrix, D3DXToRadian( reader.Number() ));
+                else if (op == "ry")
+                    D3DXMatrixRotationY(&matrix, D3DXToRadian( reader.Number() ));
+                else if (op == "rz")
+                    D3DXMatrixRotationZ(&matrix, D3DXToRadian( reader.Number() ));
+                else if (op == "s") {
+                    float scale = reader.Number();
+                    D3DXMatrixScaling(&matrix, scale, scale, scale);
+                }
+                else if (op == "m") {
+                    D3DXMatrixIdentity(&matrix);
+                    for(int i = 0; i<4; ++i)
+                        for(int j = 0; j<3; ++j)
+                            matrix.m[i][j] = reader.Number();
+                }
+                else
+                    reader.Fail("unknown transform " + op);
+
+                D3DXMatrixMultiply(&instance.transform, &instance.transform, &matrix);
+            }
+            instances.push_back(instance);
+        }
+        else if (keyword == "light") {
+            Light light;
+
+            light.position.x = reader.Number();
+            light.position.y = reader.Number();
+            light.position.z = reader.Number();
+            light.position.w = 1.0f;
+            light.color.x = reader.Number();
+            light.color.y = reader.Number();
+            light.color.z = reader.Number();
+            light.color.w = 1.0f;
+            light.radius = reader.Number();
+            light.range = reader.Number();
+            light.linearAttenuation = reader.Number();
+            lights.push_back(light);
+        }
+        else if (keyword == "attach") {
+            int instance = reader.Index(instances.size(), "instance");
+            int parent = reader.Index(instance, "parent");
+
+            instances[instance].parent = parent;
+        }
+        else if (keyword == "spin") {
+            SceneAnimation animation;
+
+            animation.instance = reader.Index(instances.size(), "instance");
+            animation.speed = reader.Number();
+            animations.push_back(animation);
+        }
+        else
+            reader.Fail("unknown keyword " + keyword);
+
+        if (!reader.AtEnd())
+            reader.Fail("extra values");
+    }
+}
+
+// Write scene, instances as matrices
+bool Scene::Save(const string& fileName) const {
+    ofstream file(fileName.c_str());
+
+    if (!file)
+        return false;
+
+    file << "# " << meshes.size() << " meshes, " << instances.size() << " instances, " << lights.size() << " lights" << endl;
+    file << "camera " << cameraYaw << " " << cameraPitch << " " << cameraRadius << endl;
+    for(int i = 0; i<(int)meshes.size(); ++i)
+        file << "mesh " << meshes[i] << endl;
+    if (!lightMesh.empty())
+        file << "lightmesh " << lightMesh << endl;
+
+    for(int i = 0; i<(int)instances.size(); ++i) {
+        const D3DXMATRIX& m = instances[i].transform;
+
+        file << "instance " << instances[i].mesh << " m";
+        for(int j = 0; j<4; ++j)
+            file << " " << m.m[j][0] << " " << m.m[j][1] << " " << m.m[j][2];
+        file << endl;
+    }
+
+    for(int i = 0; i<(int)instances.size(); ++i) {
+        if (instances[i].parent >= 0)
+            file << "attach " << i << " " << instances[i].parent << endl;
+    }
+
+    for(int i = 0; i<(int)lights.size(); ++i) {
+        const Light& light = lights[i];
+
+        file << "light " << light.position.x << " " << light.position.y << " " << light.position.z
+             << "  " << light.color.x << " " << light.color.y << " " << light.color.z
+             << "  " << light.radius << " " << light.range << " " << light.linearAttenuation << endl;
+    }
+
+    for(int i = 0; i<(int)animations.size(); ++i)
+        file << "spin " << animations[i].instance << " " << animations[i].speed << endl;
+
+    return !file.fail();
+}
+
+// World transform of each instance as placed in the file
+void Scene::GetWorldTransforms(vector<D3DXMATRIX>& world) const {
+    world.resize( instances.size() );
+    for(int i = 0; i<(int)instances.size(); ++i) {
+        if (instances[i].parent >= 0)
+            D3DXMatrixMultiply(&world[i], &instances[i].transform, &world[ instances[i].parent ]);
+        else
+            world[i] = instances[i].transform;
+    }
+}
+
+// Parents are earlier instances, so one pass sees them first
+void Scene::GetStaticInstances(vector<char>& isStatic) const {
+    isStatic.assign(instances.size(), 1);
+    for(int i = 0; i<(int)animations.size(); ++i)
+        isStatic[ animations[i].instance ] = 0;
+    for(int i = 0; i<(int)instances.size(); ++i) {
+        if (instances[i].parent >= 0 && !isStatic[ instances[i].parent ])
+            isStatic[i] = 0;
+    }
+}
+
+// FNV-1a over bytes
+static unsigned int HashBytes(unsigned int hash, const void* data, size_t size) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+
+    for(size_t i = 0; i<size; ++i)
+        hash = (hash ^ bytes[i]) * 16777619U;
+    return hash;
+}
+
+unsigned int Scene::GetStaticKey() const {
+    vector<D3DXMATRIX> world;
+    vector<char>       isStatic;
+    unsigned int       hash = 2166136261U;
+    int                count = instances.size();
+
+    GetWorldTransforms(world);
+    GetStaticInstances(isStatic);
+    hash = HashBytes(hash, &count, sizeof(count));
+    for(int i = 0; i<(int)instances.size(); ++i) {
+        const string& mesh = meshes[ instances[i].mesh ];
+
+        hash = HashBytes(hash, &isStatic[i], 1);
+        if (!isStatic[i])
+            continue;
+        hash = HashBytes(hash, mesh.c_str(), mesh.size() + 1);
+        hash = HashBytes(hash, world[i].m, sizeof(world[i].m));
+    }
+    return hash;
+}
+
+// Uniform in [0, 1), xorshift so scenes are the same everywhere
+static float Random(unsigned int& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return (state & 0xFFFFFF) / 16777216.0f;
+}
+
+// Components in [low, 1), drawn in fixed order
+static D3DXCOLOR RandomColor(unsigned int& state, float low) {
+    float r = low + (1.0f - low) * Random(state);
+    float g = low + (1.0f - low) * Random(state);
+    float b = low + (1.0f - low) * Random(state);
+
+    return D3DXCOLOR(r, g, b, 1.0f);
+}
+
+// Write indexed triangle mesh with smooth normals & one material as text .x file
+static bool WriteXMesh(const string& fileName, const vector<D3DXVECTOR3>& positions, const vector<D3DXVECTOR3>& normals, const vector<int>& indices, const D3DXCOLOR& color) {
+    ofstream file(fileName.c_str());
+    int      faces = indices.size() / 3;
+
+    if (!file)
+        return false;
+
+    file << "xof 0303txt 0032" << endl << endl << "Mesh {" << endl;
+    file << " " << positions.size() << ";" << endl;
+    for(int i = 0; i<(int)positions.size(); ++i)
+        file << " " << positions[i].x << ";" << positions[i].y << ";" << positions[i].z << ";" << (i+1 < (int)positions.size() ? "," : ";") << endl;
+    file << " " << faces << ";" << endl;
+    for(int i = 0; i<faces; ++i)
+        file << " 3;" << indices[i*3] << "," << indices[i*3+1] << "," << indices[i*3+2] << ";" << (i+1 < faces ? "," : ";") << endl;
+
+    file << " MeshNormals {" << endl << "  " << normals.size() << ";" << endl;
+    for(int i = 0; i<(int)normals.size(); ++i)
+        file << "  " << normals[i].x << ";" << normals[i].y << ";" << normals[i].z << ";" << (i+1 < (int)normals.size() ? "," : ";") << endl;
+    file << "  " << faces << ";" << endl;
+    for(int i = 0; i<faces; ++i)
+        file << "  3;" << indices[i*3] << "," << indices[i*3+1] << "," << indices[i*3+2] << ";" << (i+1 < faces ? "," : ";") << endl;
+    file << " }" << endl;
+
+    file << " MeshMaterialList {" << endl << "  1;" << endl << "  " << faces << ";" << endl;
+    for(int i = 0; i<faces; ++i)
+        file << "  0" << (i+1 < faces ? "," : ";") << endl;
+    file << "  Material {" << endl
+         << "   " << color.r << ";" << color.g << ";" << color.b << ";1.0;;" << endl
+         << "   20.0;" << endl
+         << "   0.3;0.3;0.3;;" << endl
+         << "   0.0;0.0;0.0;;" << endl
+         << "  }" << endl << " }" << endl << "}" << endl;
+
+    return !file.fail();
+}
+
+// Closed torus around Y axis, 4*sides*sides faces
+static bool WriteTorus(const string& fileName, int sides, float majorRadius, float minorRadius, const D3DXCOLOR& color) {
+    int                 rings = 2 * sides;
+    vector<D3DXVECTOR3> positions, normals;
+    vector<int>         indices;
+
+    for(int i = 0; i<rings; ++i) {
+        float u = 2.0f * D3DX_PI * i / rings;
+
+        for(int j = 0; j<sides; ++j) {
+            float       v = 2.0f * D3DX_PI * j / sides;
+            D3DXVECTOR3 normal( cosf(v) * cosf(u), sinf(v), cosf(v) * sinf(u) );
+
+            positions.push_back( D3DXVECTOR3(majorRadius * cosf(u), 0.0f, majorRadius * sinf(u)) + normal * minorRadius );
+            normals.push_back(normal);
+        }
+    }
+
+    // Two clockwise triangles per quad
+    for(int i = 0; i<rings; ++i) {
+        for(int j = 0; j<sides; ++j) {
+            int a = i * sides + j;
+            int b = ((i + 1) % rings) * sides + j;
+            int c = ((i + 1) % rings) * sides + (j + 1) % sides;
+            int d = i * sides + (j + 1) % sides;
+
+            indices.push_back(a); indices.push_back(c); indices.push_back(b);
+            indices.push_back(a); indices.push_back(d); indices.push_back(c);
+        }
+    }
+
+    return WriteXMesh(fileName, positions, normals, indices, color);
+}
+
+// Square receiver at y = 0
+static bool WriteGround(const string& fileName, float halfSize) {
+    vector<D3DXVECTOR3> positions, normals(4, D3DXVECTOR3(0.0f, 1.0f, 0.0f));
+    vector<int>         indices;
+    const int           quad[6] = { 0, 1, 2, 0, 2, 3 };
+
+    positions.push_back( D3DXVECTOR3(-halfSize, 0.0f, -halfSize) );
+    positions.push_back( D3DXVECTOR3(-halfSize, 0.0f,  halfSize) );
+    positions.push_back( D3DXVECTOR3( halfSize, 0.0f,  halfSize) );
+    positions.push_back( D3DXVECTOR3( halfSize, 0.0f, -halfSize) );
+    indices.assign(quad, quad + 6);
+
+    return WriteXMesh(fileName, positions, normals, indices, D3DXCOLOR(0.8f, 0.8f, 0.8f, 1.0f));
+}
+
+// Fill with stress scene, caster & ground meshes are written to folder
+void Scene::Generate(const StressSceneSettings& settings, const string& outFolder) {
+    unsigned int state = settings.seed ? settings.seed : 1;
+    int          variants = max(settings.meshVariants, 1);
+    int          side = static_cast<int>( ceilf( sqrtf( static_cast<float>(settings.casters) ) ) );
+    float        halfSize = 0.5f * side * settings.spacing + settings.spacing;
+
+    Clear();
+    folder = outFolder;
+
+    // Caster meshes from coarse to fine, face counts spread evenly on log scale
+    for(int i = 0; i<variants; ++i) {
+        float       t = variants > 1 ? static_cast<float>(i) / (variants - 1) : 0.0f;
+        float       faces = settings.minFaces * powf( static_cast<float>(settings.maxFaces) / settings.minFaces, t );
+        int         sides = max( static_cast<int>( sqrtf(faces / 4.0f) + 0.5f ), 3 );
+        D3DXCOLOR   color = RandomColor(state, 0.4f);
+        ostringstream name;
+
+        name << "stress_torus_" << 4 * sides * sides << ".x";
+        if ( !WriteTorus(folder + name.str(), sides, 1.5f, 0.5f, color) )
+            throw runtime_error("Can't write " + folder + name.str());
+        meshes.push_back( name.str() );
+    }
+
+    if ( !WriteGround(folder + "stress_ground.x", halfSize) )
+        throw runtime_error("Can't write " + folder + "stress_ground.x");
+    meshes.push_back("stress_ground.x");
+    if ( ifstream( (folder + "light.x").c_str() ) )
+        lightMesh = "light.x";
+
+    // Casters on a grid, randomly turned & scaled
+    for(int i = 0; i<settings.casters; ++i) {
+        SceneInstance instance;
+        D3DXMATRIX    matrix;
+        float         scale = 0.7f + 0.6f * Random(state);
+
+        instance.mesh = static_cast<int>( Random(state) * variants );
+        instance.parent = -1;
+        D3DXMatrixRotationX(&instance.transform, 2.0f * D3DX_PI * Random(state));
+        D3DXMatrixRotationY(&matrix, 2.0f * D3DX_PI * Random(state));
+        D3DXMatrixMultiply(&instance.transform, &instance.transform, &matrix);
+        D3DXMatrixScaling(&matrix, scale, scale, scale);
+        D3DXMatrixMultiply(&instance.transform, &instance.transform, &matrix);
+        float         height = 2.0f + 2.0f * Random(state);
+
+        D3DXMatrixTranslation(&matrix, ( i % side - 0.5f * (side - 1) ) * settings.spacing, height, ( i / side - 0.5f * (side - 1) ) * settings.spacing);
+        D3DXMatrixMultiply(&instance.transform, &instance.transform, &matrix);
+        instances.push_back(instance);
+
+        if ( Random(state) < settings.animated ) {
+            SceneAnimation animation;
+            float          speed = 0.05f + 0.25f * Random(state);
+
+            animation.instance = i;
+            animation.speed = Random(state) < 0.5f ? -speed : speed;
+            animations.push_back(animation);
+        }
+    }
+
+    // Ground, not closed so it only receives
+    SceneInstance ground;
+    ground.mesh = variants;
+    ground.parent = -1;
+    D3DXMatrixIdentity(&ground.transform);
+    instances.push_back(ground);
+
+    // Lights above the grid, ranges cover a few casters each
+    for(int i = 0; i<settings.lights; ++i) {
+        Light     light;
+        float     x = (2.0f * Random(state) - 1.0f) * (halfSize - settings.spacing);
+        float     y = 8.0f + 6.0f * Random(state);
+        float     z = (2.0f * Random(state) - 1.0f) * (halfSize - settings.spacing);
+        D3DXCOLOR color = RandomColor(state, 0.3f);
+
+        light.position = D3DXVECTOR4(x, y, z, 1.0f);
+        light.color = D3DXVECTOR4(color.r, color.g, color.b, 1.0f);
+        light.radius = 0.3f + 1.2f * Random(state);
+        light.range = settings.spacing * (3.0f + 5.0f * Random(state));
+        light.linearAttenuation = 0.03f;
+        lights.push_back(light);
+    }
+
+    cameraYaw = 0.0f;
+    cameraPitch = 0.6f;
+    cameraRadius = 20.0f + 1.5f * halfSize;
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include "ScreenQuad.h"
+#include <string>
+#include <vector>
+
+// Placed mesh of the scene
+struct SceneInstance
+{
+    int         mesh;       // index into meshes
+    int         parent;     // earlier instance or -1
+    D3DXMATRIX  transform;  // relative to parent
+};
+
+// Instance rotating around Y axis of its parent
+struct SceneAnimation
+{
+    int   instance;
+    float speed;    // radians per second
+};
+
+// Procedural stress scene: torus casters in a grid over a ground plane
+struct StressSceneSettings
+{
+    int   casters;
+    int   lights;
+    int   minFaces;     // face count range of generated casters
+    int   maxFaces;
+    int   meshVariants; // distinct caster meshes
+    float spacing;      // distance between neighbour casters
+    float animated;     // fraction of spinning casters
+    unsigned int seed;
+};
+
+//-----------------------------------------------------------------------------
+// Scene class
+// Assets, instances, lights & animations of a scene file. Text format, one
+// record per line, '#' starts a comment, angles are in degrees:
+//   camera <yaw> <pitch> <radius>
+//   mesh <path>                    paths are relative to the scene file
+//   lightmesh <path>               sphere drawn at lights
+//   instance <mesh> <ops>          ops applied in order: t x y z, rx a, ry a,
+//                                  rz a, s k, m <4x3 matrix rows>
+//   light <x y z> <r g b> <radius> <range> <linear attenuation>
+//   attach <instance> <parent>     parent is an earlier instance, transform
+//                                  of instance becomes relative to it
+//   spin <instance> <radians per second>
+//-----------------------------------------------------------------------------
+class Scene
+{
+public:
+    std::string                 folder;     // folder of the scene file
+    std::vector<std::string>    meshes;     // as written in the file
+    std::string                 lightMesh;
+    std::vector<SceneInstance>  instances;
+    std::vector<Light>          lights;
+    std::vector<SceneAnimation> animations;
+    float                       cameraYaw;
+    float                       cameraPitch;
+    float                       cameraRadius;
+
+    static StressSceneSettings  stressSettings;
+
+    Scene();
+
+    void Clear();
+
+    // Parse scene file. Throws runtime_error with file & line on bad input.
+    void Load(const std::string& fileName);
+
+    // Write scene, instances as matrices
+    bool Save(const std::string& fileName) const;
+
+    // Fill with stress scene, caster & ground meshes are written to folder
+    void Generate(const StressSceneSettings& settings, const std::string& outFolder);
+
+    // Asset path usable for loading
+    std::string GetPath(const std::string& asset) const { return folder + asset; }
+
+    // World transform of each instance as placed in the file
+    void GetWorldTransforms(std::vector<D3DXMATRIX>& world) const;
+
+    // Instances that never move: neither they nor a parent spin
+    void GetStaticInstances(std::vector<char>& isStatic) const;
+
+    // Hash of meshes & placement of static instances, changes when a bake
+    // of the scene goes stale
+    unsigned int GetStaticKey() const;
+};
@@ -1,11 +1,12 @@
 #include "ScreenQuad.h"
+#include "RenderCalls.h"
 #include <string>
 #include <stdexcept>
 #include <iostream>
 
 using namespace std;
 
-const D3DVERTEXELEMENT9 ShadowVert::Decl[7] =
+const D3DVERTEXELEMENT9 ShadowVertFormat::Decl[7] =
 {
 	{ 0, 0,  D3DDECLTYPE_FLOAT3, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_POSITION, 0 },
 	{ 0, 12, D3DDECLTYPE_FLOAT3, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 0 },
@@ -15,7 +16,17 @@ const D3DVERTEXELEMENT9 ShadowVert::Decl[7] =
 	{ 0, 64, D3DDECLTYPE_FLOAT4, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 3 },
 	D3DDECL_END()
 };
-LPDIRECT3DVERTEXDECLARATION9 ShadowVert::pVertexDecl = NULL;
+LPDIRECT3DVERTEXDECLARATION9 ShadowVertFormat::pVertexDecl = NULL;
+
+const D3DVERTEXELEMENT9 EdgeInstanceFormat::Decl[3] =
+{
+	{ 0, 0, D3DDECLTYPE_FLOAT4, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 0 },
+	{ 1, 0, D3DDECLTYPE_UBYTE4, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 1 },
+	D3DDECL_END()
+};
+LPDIRECT3DVERTEXDECLARATION9 EdgeInstanceFormat::pVertexDecl = NULL;
+IDirect3DVertexBuffer9*      EdgeInstanceFormat::pCornerBuffer = NULL;
+IDirect3DIndexBuffer9*       EdgeInstanceFormat::pIndexBuffer = NULL;
 
 ScreenQuad* ScreenQuad::instance;
 
@@ -50,12 +61,12 @@ void ScreenQuad::Init() {
 };
 
 void ScreenQuad::Render() {
-	pd3dDevice->SetStreamSource(0, pVertexBuffer, 0, sizeof(D3DXVECTOR3));
-	pd3dDevice->SetFVF(D3DFVF_XYZ);
+	Device::SetStreamSource(0, pVertexBuffer, 0, sizeof(D3DXVECTOR3));
+	Device::SetFVF(D3DFVF_XYZ);
 
-	pLightingEffect->BeginPass(0);
-	pd3dDevice->DrawPrimitive(D3DPT_TRIANGLELIST, 0, 2);
-	pLightingEffect->EndPass();
+	Effect::BeginPass(0);
+	Device::DrawPrimitive(D3DPT_TRIANGLELIST, 0, 2);
+	Effect::EndPass();
 }
 
 void ScreenQuad::Free() {
@@ -1,6 +1,7 @@
 #pragma once
 #include "Global.h"
 #include "Storage.h"
+#include "ShadowTypes.h"
 #include <vector>
 #include <assert.h>
 #include <algorithm>
@@ -32,64 +33,73 @@ struct TextureData
 typedef Utils::Storage<TextureData, std::string> TextureStorage;
 typedef TextureStorage::handle Texture;
 
-struct ShadowVert
+// Vertex declaration of ShadowVert
+struct ShadowVertFormat
 {
-	D3DXVECTOR3 vertex;
-	D3DXVECTOR3 vertNormal0;
-	D3DXVECTOR3 vertNormal1;
-	D3DXVECTOR4 normal;
-	D3DXVECTOR3 backNormal;
-	D3DXVECTOR4 edge;
-
 	const static D3DVERTEXELEMENT9 Decl[7];
 	static LPDIRECT3DVERTEXDECLARATION9 pVertexDecl;
 };
 
-struct Face
-{
-	int v0, v1, v2;
-	bool re0, re1, re2;
-	int e0, e1, e2;
-	D3DXVECTOR3 normal;
-};
-
-struct Edge
+// Vertex declaration of edge instances: the corner of the template from
+// stream 0, the edge id of the instance from stream 1 as 4 bytes, low
+// first. Template buffers are shared by every geometry.
+struct EdgeInstanceFormat
 {
-	int v0, v1;
-	int f0, f1;
+	const static D3DVERTEXELEMENT9 Decl[3];
+	static LPDIRECT3DVERTEXDECLARATION9 pVertexDecl;
+	static IDirect3DVertexBuffer9* pCornerBuffer; // ShadowMesh::edgeCorners
+	static IDirect3DIndexBuffer9*  pIndexBuffer;  // umbra side, then wedge
 };
-typedef std::pair<int, int>	int_pair;
-typedef std::pair<int_pair, Edge> edge_pair;
-typedef std::map<int_pair, Edge> EdgeMap;
 
-struct ShadowVolume
+// Shadow buffers of a geometry, shared by its instances. Index buffers hold
+// the volume uploaded last.
+struct ShadowBuffers
 {
-	std::vector<ShadowVert> vertices;
-	std::vector<int> umbraIndices;
-	std::vector<int> penumbraIndices;
-
 	IDirect3DVertexBuffer9* pVertexBuffer;
-	IDirect3DIndexBuffer9*  pUmbraIndexBuffer;
+	IDirect3DIndexBuffer9*  pCapIndexBuffer;   // umbra caps, made once at load
+	IDirect3DIndexBuffer9*  pUmbraIndexBuffer; // silhouette sides of the last volume
 	IDirect3DIndexBuffer9*  pPenumbraIndexBuffer;
-	D3DXVECTOR4 silhouettePlane; // plane containing silhouette
-	D3DXVECTOR4 silhouetteCenter; // center of the silhouette
+	IDirect3DVertexBuffer9* pWedgeVertexBuffer;
+	IDirect3DIndexBuffer9*  pWedgeIndexBuffer;
+	IDirect3DTexture9*      pEdgeTexture;   // edge records, NULL if not drawn instanced
+	IDirect3DVertexBuffer9* pEdgeIdBuffer;  // silhouette edge ids, one per instance
 	int penumbraIboSize;
 	int umbraIboSize;
+	int wedgeVboSize;
+	int wedgeIboSize;
+	int edgeIdVboSize;
+	unsigned int uploaded; // id of the volume in the buffers
+	unsigned int uploadedIds; // id of the volume in the edge id buffer
 
-	ShadowVolume() :
+	ShadowBuffers() :
 		pVertexBuffer(NULL),
+		pCapIndexBuffer(NULL),
 		pUmbraIndexBuffer(NULL),
 		pPenumbraIndexBuffer(NULL),
+		pWedgeVertexBuffer(NULL),
+		pWedgeIndexBuffer(NULL),
+		pEdgeTexture(NULL),
+		pEdgeIdBuffer(NULL),
 		penumbraIboSize(0),
-		umbraIboSize(0)
+		umbraIboSize(0),
+		wedgeVboSize(0),
+		wedgeIboSize(0),
+		edgeIdVboSize(0),
+		uploaded(0),
+		uploadedIds(0)
 	{
 	}
 
-	~ShadowVolume()
+	~ShadowBuffers()
 	{
 		if (pVertexBuffer) pVertexBuffer->Release();
+		if (pCapIndexBuffer) pCapIndexBuffer->Release();
 		if (pUmbraIndexBuffer) pUmbraIndexBuffer->Release();
 		if (pPenumbraIndexBuffer) pPenumbraIndexBuffer->Release();
+		if (pWedgeVertexBuffer) pWedgeVertexBuffer->Release();
+		if (pWedgeIndexBuffer) pWedgeIndexBuffer->Release();
+		if (pEdgeTexture) pEdgeTexture->Release();
+		if (pEdgeIdBuffer) pEdgeIdBuffer->Release();
 	}
 };
 
@@ -0,0 +1,388 @@
+#include "ShadowGeometry.h"
+#include "RenderCalls.h"
+#include "MemoryReport.h"
+#include "CounterRegistry.h"
+#include <chrono>
+
+using namespace std;
+
+bool ShadowGeometry::releaseCpuCopies = false;
+int  ShadowGeometry::edgeTextureRows = 0;
+bool ShadowGeometry::instancedEdges = false;
+
+// Passes of the Shadow technique after P0 & P1 draw them instanced
+static const int instancedPasses = 2;
+
+// Shadow workload of the frame
+static CounterRegistry* frameCounters = CounterRegistry::Instance();
+static const int umbraTriangles = frameCounters->Register("umbra triangles");
+static const int penumbraTriangles = frameCounters->Register("penumbra triangles");
+static const int indexBytes = frameCounters->Register("index bytes uploaded");
+static const int capBytesSaved = frameCounters->Register("cap index bytes saved");
+static const int vertexBytes = frameCounters->Register("vertex bytes uploaded");
+static const int edgeIdBytes = frameCounters->Register("edge id bytes uploaded");
+static const int edgeInstances = frameCounters->Register("edge instances");
+static const int drawCalls = frameCounters->Register("shadow draw calls");
+static const int passes = frameCounters->Register("shadow passes");
+
+// Make vbo/ibo for rendering
+void ShadowGeometry::PrepareShadowVolumes() {
+    void*       copyData;
+    int         bufferSize;
+
+    // Create vertex buffer from our device
+    // Without CPU copies there is no use for the managed mirror either
+    bufferSize = shadowVertices.size() * sizeof(ShadowVert);
+    if (releaseCpuCopies)
+        pd3dDevice->CreateVertexBuffer(bufferSize, D3DUSAGE_WRITEONLY, 0, D3DPOOL_DEFAULT, &buffers.pVertexBuffer, NULL);
+    else
+        pd3dDevice->CreateVertexBuffer(bufferSize, 0, 0, D3DPOOL_MANAGED, &buffers.pVertexBuffer, NULL);
+
+    Device::Lock(buffers.pVertexBuffer, 0, bufferSize, &copyData, 0);
+    memcpy(copyData, (void*)&shadowVertices[0], bufferSize);
+    Device::Unlock(buffers.pVertexBuffer);
+
+    // Caps are the same for every light, drawn from here
+    bufferSize = capIndices.size() * sizeof(int);
+    if (bufferSize > 0) {
+        pd3dDevice->CreateIndexBuffer(bufferSize, D3DUSAGE_WRITEONLY, D3DFMT_INDEX32, D3DPOOL_MANAGED, &buffers.pCapIndexBuffer, NULL);
+        Device::Lock(buffers.pCapIndexBuffer, 0, bufferSize, &copyData, 0);
+        memcpy(copyData, (void*)&capIndices[0], bufferSize);
+        Device::Unlock(buffers.pCapIndexBuffer);
+    }
+	
+	if (!ShadowVertFormat::pVertexDecl)
+    {
+		// New vertex declaration
+        pd3dDevice->CreateVertexDeclaration(ShadowVertFormat::Decl, &ShadowVertFormat::pVertexDecl);
+    }
+
+    PrepareEdgeInstances();
+}
+
+// Records of the silhouette candidates into a float texture, edgesPerRow
+// edges of 6 texels per row, so the low byte of an edge id is its column.
+// The template is made with the first texture.
+void ShadowGeometry::PrepareEdgeInstances() {
+    int            rows = (silhouetteEdges + edgesPerRow - 1) / edgesPerRow;
+    D3DLOCKED_RECT rect;
+
+    if (rows == 0 || rows > edgeTextureRows)
+        return;
+
+    if (!EdgeInstanceFormat::pVertexDecl) {
+        void* copyData;
+        int*  indices;
+
+        pd3dDevice->CreateVertexDeclaration(EdgeInstanceFormat::Decl, &EdgeInstanceFormat::pVertexDecl);
+
+        pd3dDevice->CreateVertexBuffer(sizeof(edgeCorners), D3DUSAGE_WRITEONLY, 0, D3DPOOL_MANAGED, &EdgeInstanceFormat::pCornerBuffer, NULL);
+        Device::Lock(EdgeInstanceFormat::pCornerBuffer, 0, sizeof(edgeCorners), &copyData, 0);
+        memcpy(copyData, edgeCorners, sizeof(edgeCorners));
+        Device::Unlock(EdgeInstanceFormat::pCornerBuffer);
+
+        pd3dDevice->CreateIndexBuffer(sizeof(umbraPattern) + sizeof(wedgePattern), D3DUSAGE_WRITEONLY, D3DFMT_INDEX32, D3DPOOL_MANAGED,
+                                      &EdgeInstanceFormat::pIndexBuffer, NULL);
+        Device::Lock(EdgeInstanceFormat::pIndexBuffer, 0, sizeof(umbraPattern) + sizeof(wedgePattern), (void**)&indices, 0);
+        memcpy(indices, umbraPattern, sizeof(umbraPattern));
+        memcpy(indices + 6, wedgePattern, sizeof(wedgePattern));
+        Device::Unlock(EdgeInstanceFormat::pIndexBuffer);
+    }
+
+    if ( FAILED( pd3dDevice->CreateTexture(edgesPerRow * edgeRecordSize, rows, 1, 0, D3DFMT_A32B32G32R32F, D3DPOOL_MANAGED, &buffers.pEdgeTexture, NULL) ) ) {
+        buffers.pEdgeTexture = NULL;
+        return;
+    }
+    buffers.pEdgeTexture->LockRect(0, &rect, NULL, 0);
+    for(int i = 0; i<silhouetteEdges; ++i)
+        GetEdgeRecord( i, (D3DXVECTOR4*)( (char*)rect.pBits + (i / edgesPerRow) * rect.Pitch ) + (i % edgesPerRow) * edgeRecordSize );
+    buffers.pEdgeTexture->UnlockRect(0);
+}
+
+// Upload volume indices unless they are in the buffers already
+void ShadowGeometry::UpdateShadowVolumes(const ShadowVolume& volume) const {
+    void*       copyData;
+	int      bufferSize;
+
+    if (buffers.uploaded == volume.id)
+        return;
+    buffers.uploaded = volume.id;
+
+    // Umbra sides, caps are in their own buffer since load
+	bufferSize = volume.umbraIndices.size() * sizeof(int);
+    frameCounters->Add(capBytesSaved, capIndexCount * sizeof(int));
+    if (bufferSize > buffers.umbraIboSize)
+	{
+		if (buffers.pUmbraIndexBuffer) 
+            buffers.pUmbraIndexBuffer->Release();
+
+		// Create index buffer from our device
+        pd3dDevice->CreateIndexBuffer(bufferSize, 0, D3DFMT_INDEX32, D3DPOOL_MANAGED, &buffers.pUmbraIndexBuffer, NULL );
+		
+		// new size
+		buffers.umbraIboSize = bufferSize;
+	}
+
+	// Copying indices
+    if (bufferSize > 0) {
+        Device::Lock(buffers.pUmbraIndexBuffer, 0, bufferSize, &copyData, 0);
+        memcpy(copyData, (void*)&volume.umbraIndices[0], bufferSize);
+        Device::Unlock(buffers.pUmbraIndexBuffer);
+        frameCounters->Add(indexBytes, bufferSize);
+    }
+	
+    // Penumbra
+    // Don't recreate ibo if it is smaller than existing
+	bufferSize = volume.penumbraIndices.size() * sizeof(int);
+    if (bufferSize > buffers.penumbraIboSize) {
+		if (buffers.pPenumbraIndexBuffer) 
+            buffers.pPenumbraIndexBuffer->Release();
+
+		// Create index buffer from our device
+        pd3dDevice->CreateIndexBuffer(bufferSize, 0, D3DFMT_INDEX32, D3DPOOL_MANAGED, &buffers.pPenumbraIndexBuffer, NULL );
+		
+		// new size
+		buffers.penumbraIboSize = bufferSize;
+	}
+
+	// Copying indices
+    if (bufferSize > 0) {
+        Device::Lock(buffers.pPenumbraIndexBuffer, 0, bufferSize, &copyData, 0);
+	    memcpy(copyData, (void*)&volume.penumbraIndices[0], bufferSize);
+	    Device::Unlock(buffers.pPenumbraIndexBuffer);
+        frameCounters->Add(indexBytes, bufferSize);
+    }
+
+    // Merged wedges
+    bufferSize = volume.wedgeVertices.size() * sizeof(ShadowVert);
+    if (bufferSize == 0)
+        return;
+
+    if (bufferSize > buffers.wedgeVboSize) {
+        int wedges = volume.wedgeVertices.size() / 6;
+        int* indices;
+
+        if (buffers.pWedgeVertexBuffer) 
+            buffers.pWedgeVertexBuffer->Release();
+        if (buffers.pWedgeIndexBuffer) 
+            buffers.pWedgeIndexBuffer->Release();
+
+        // Rewritten every frame
+        pd3dDevice->CreateVertexBuffer(bufferSize, D3DUSAGE_DYNAMIC | D3DUSAGE_WRITEONLY, 0, D3DPOOL_DEFAULT, &buffers.pWedgeVertexBuffer, NULL);
+        buffers.wedgeVboSize = bufferSize;
+
+        // Same topology for every wedge
+        buffers.wedgeIboSize = wedges * 24 * sizeof(int);
+        pd3dDevice->CreateIndexBuffer(buffers.wedgeIboSize, 0, D3DFMT_INDEX32, D3DPOOL_MANAGED, &buffers.pWedgeIndexBuffer, NULL );
+        Device::Lock(buffers.pWedgeIndexBuffer, 0, buffers.wedgeIboSize, (void**)&indices, 0);
+        for(int i = 0; i<wedges; ++i)
+            for(int j = 0; j<24; ++j)
+                indices[i*24 + j] = i*6 + ShadowMesh::wedgePattern[j];
+        Device::Unlock(buffers.pWedgeIndexBuffer);
+        frameCounters->Add(indexBytes, buffers.wedgeIboSize);
+    }
+
+    Device::Lock(buffers.pWedgeVertexBuffer, 0, bufferSize, &copyData, D3DLOCK_DISCARD);
+    memcpy(copyData, (void*)&volume.wedgeVertices[0], bufferSize);
+    Device::Unlock(buffers.pWedgeVertexBuffer);
+    frameCounters->Add(vertexBytes, bufferSize);
+}
+
+// Upload edge ids of the silhouette, 4 bytes per edge
+void ShadowGeometry::UpdateEdgeIds(const ShadowVolume& volume) const {
+    unsigned int* ids;
+    int           bufferSize;
+
+    if (buffers.uploadedIds == volume.id)
+        return;
+    buffers.uploadedIds = volume.id;
+
+    bufferSize = volume.silhouette.size() * sizeof(unsigned int);
+    if (bufferSize == 0)
+        return;
+
+    // Rewritten every frame
+    if (bufferSize > buffers.edgeIdVboSize) {
+        if (buffers.pEdgeIdBuffer)
+            buffers.pEdgeIdBuffer->Release();
+        pd3dDevice->CreateVertexBuffer(bufferSize, D3DUSAGE_DYNAMIC | D3DUSAGE_WRITEONLY, 0, D3DPOOL_DEFAULT, &buffers.pEdgeIdBuffer, NULL);
+        buffers.edgeIdVboSize = bufferSize;
+    }
+
+    Device::Lock(buffers.pEdgeIdBuffer, 0, bufferSize, (void**)&ids, D3DLOCK_DISCARD);
+    for(int i = 0; i<(int)volume.silhouette.size(); ++i)
+        ids[i] = volume.silhouette[i].edge;
+    Device::Unlock(buffers.pEdgeIdBuffer);
+    frameCounters->Add(edgeIdBytes, bufferSize);
+}
+
+// Template corners once per instance & an edge id per instance, the edge
+// texture for the vertex shader. 0 count restores plain indexed drawing.
+void ShadowGeometry::SetEdgeInstances(int count) const {
+    if (count == 0) {
+        Device::SetStreamSourceFreq(0, 1);
+        Device::SetStreamSourceFreq(1, 1);
+        return;
+    }
+
+    int         rows = (silhouetteEdges + edgesPerRow - 1) / edgesPerRow;
+    D3DXVECTOR4 texelSize(1.0f / (edgesPerRow * edgeRecordSize), 1.0f / rows, 0.0f, 0.0f);
+
+    Effect::SetTexture("edgeTexture", buffers.pEdgeTexture);
+    Effect::SetVector("edgeTexelSize", &texelSize);
+    Device::SetVertexDeclaration(EdgeInstanceFormat::pVertexDecl);
+    Device::SetStreamSource(0, EdgeInstanceFormat::pCornerBuffer, 0, sizeof(edgeCorners[0]));
+    Device::SetStreamSourceFreq(0, D3DSTREAMSOURCE_INDEXEDDATA | count);
+    Device::SetStreamSource(1, buffers.pEdgeIdBuffer, 0, sizeof(unsigned int));
+    Device::SetStreamSourceFreq(1, D3DSTREAMSOURCE_INSTANCEDATA | 1);
+    Device::SetIndices(EdgeInstanceFormat::pIndexBuffer);
+    frameCounters->Add(edgeInstances, count);
+}
+
+// Setup from welded vertices & faces, then upload
+bool ShadowGeometry::Build(const vector<D3DXVECTOR3>& meshVertices, const vector<Face>& meshFaces, float meshError) {
+    if ( !ShadowMesh::Build(meshVertices, meshFaces, meshError) )
+        return false;
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    PrepareShadowVolumes();
+    buildTimes.upload = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    if (releaseCpuCopies)
+        ReleaseCpuCopies();
+
+    return true;
+}
+
+// Render umbra volume
+void ShadowGeometry::RenderUmbra(const ShadowVolume& volume, int pass) const {
+    int  caps = capIndexCount;
+    int  sides = volume.umbraIndices.size();
+    int  edges = volume.silhouette.size();
+    bool instanced = DrawsInstanced();
+
+    if (instanced)
+        UpdateEdgeIds(volume);
+    else
+        UpdateShadowVolumes(volume);
+
+    // Set source
+    Device::SetVertexDeclaration(ShadowVertFormat::pVertexDecl);
+	Device::SetStreamSource(0, buffers.pVertexBuffer, 0, sizeof(ShadowVert));
+	Device::SetIndices(buffers.pCapIndexBuffer);
+
+    // draw caps, then sides
+    Effect::BeginPass(pass);
+    if (caps > 0) {
+	    Device::DrawIndexedPrimitive(D3DPT_TRIANGLELIST, 0, 0, GetShadowVertexCount(), 0, caps/3);
+        frameCounters->Add(umbraTriangles, caps/3);
+        frameCounters->Add(drawCalls, 1);
+    }
+
+    // Sides are instances below when drawn instanced
+    if (!instanced) {
+        Device::SetIndices(buffers.pUmbraIndexBuffer);
+        if (volume.sideStrip && sides >= 3) {
+            Device::DrawIndexedPrimitive(D3DPT_TRIANGLESTRIP, 0, 0, GetShadowVertexCount(), 0, sides - 2);
+            frameCounters->Add(umbraTriangles, sides - 2);
+            frameCounters->Add(drawCalls, 1);
+        }
+        else if (!volume.sideStrip && sides > 0) {
+            Device::DrawIndexedPrimitive(D3DPT_TRIANGLELIST, 0, 0, GetShadowVertexCount(), 0, sides/3);
+            frameCounters->Add(umbraTriangles, sides/3);
+            frameCounters->Add(drawCalls, 1);
+        }
+    }
+    Effect::EndPass();
+    frameCounters->Add(passes, 1);
+
+    // One side quad per silhouette edge
+    if (instanced && edges > 0) {
+        SetEdgeInstances(edges);
+        Effect::BeginPass(pass + instancedPasses);
+        Device::DrawIndexedPrimitive(D3DPT_TRIANGLELIST, 0, 0, 6, 0, 2);
+        Effect::EndPass();
+        SetEdgeInstances(0);
+        frameCounters->Add(umbraTriangles, 2*edges);
+        frameCounters->Add(drawCalls, 1);
+        frameCounters->Add(passes, 1);
+    }
+}
+
+// Render penumbra volume
+void ShadowGeometry::RenderPenumbra(const ShadowVolume& volume, int pass) const
+{
+    int wedges = volume.wedgeVertices.size() / 6;
+
+    // One wedge per silhouette edge, after the side quad of the template
+    if ( DrawsInstanced() ) {
+        int edges = volume.silhouette.size();
+
+        UpdateEdgeIds(volume);
+        if (edges > 0) {
+            SetEdgeInstances(edges);
+            Effect::BeginPass(pass + instancedPasses);
+            Device::DrawIndexedPrimitive(D3DPT_TRIANGLELIST, 0, 0, 6, 6, 8);
+            Effect::EndPass();
+            SetEdgeInstances(0);
+            frameCounters->Add(penumbraTriangles, 8*edges);
+            frameCounters->Add(drawCalls, 1);
+            frameCounters->Add(passes, 1);
+        }
+        return;
+    }
+
+    UpdateShadowVolumes(volume);
+
+    // Set source
+    Device::SetVertexDeclaration(ShadowVertFormat::pVertexDecl);
+	Device::SetStreamSource(0, buffers.pVertexBuffer, 0, sizeof(ShadowVert));
+	Device::SetIndices(buffers.pPenumbraIndexBuffer);
+
+    // draw single edge wedges, then merged ones
+    Effect::BeginPass(pass);
+    if (!volume.penumbraIndices.empty()) {
+	    Device::DrawIndexedPrimitive( D3DPT_TRIANGLELIST, 0, 0, GetShadowVertexCount(), 0, volume.penumbraIndices.size()/3 );
+        frameCounters->Add(penumbraTriangles, volume.penumbraIndices.size()/3);
+        frameCounters->Add(drawCalls, 1);
+    }
+    if (wedges > 0) {
+        Device::SetStreamSource(0, buffers.pWedgeVertexBuffer, 0, sizeof(ShadowVert));
+        Device::SetIndices(buffers.pWedgeIndexBuffer);
+        Device::DrawIndexedPrimitive( D3DPT_TRIANGLELIST, 0, 0, wedges*6, 0, wedges*8 );
+        frameCounters->Add(penumbraTriangles, wedges*8);
+        frameCounters->Add(drawCalls, 1);
+    }
+    Effect::EndPass();
+    frameCounters->Add(passes, 1);
+}
+
+// Add CPU arrays & buffers to report
+void ShadowGeometry::AddMemoryUsage(MemoryReport& report, const string& owner) const {
+    MemoryUsage arrays;
+    MemoryUsage buffersUsage;
+
+    arrays += MemoryReport::Of(vertices);
+    arrays += MemoryReport::Of(normals);
+    arrays += MemoryReport::Of(faces);
+    arrays += MemoryReport::Of(facePlanes);
+    arrays += MemoryReport::Of(edges);
+    arrays += MemoryReport::Of(shadowVertices);
+    arrays += MemoryReport::Of(capIndices);
+    arrays += MemoryReport::Of(firstOut);
+    report.Add(owner, "shadow arrays", arrays);
+
+    buffersUsage += MemoryReport::Of(buffers.pVertexBuffer);
+    buffersUsage += MemoryReport::Of(buffers.pWedgeVertexBuffer);
+    buffersUsage += MemoryReport::Of(buffers.pEdgeIdBuffer);
+    report.Add(owner, "shadow vertex buffers", buffersUsage);
+
+    buffersUsage = MemoryReport::Of(buffers.pCapIndexBuffer);
+    buffersUsage += MemoryReport::Of(buffers.pUmbraIndexBuffer);
+    buffersUsage += MemoryReport::Of(buffers.pPenumbraIndexBuffer);
+    buffersUsage += MemoryReport::Of(buffers.pWedgeIndexBuffer);
+    report.Add(owner, "shadow index buffers", buffersUsage);
+
+    if (buffers.pEdgeTexture)
+        report.Add(owner, "shadow edge textures", MemoryReport::Of(buffers.pEdgeTexture));
+}
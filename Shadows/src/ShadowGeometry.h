@@ -0,0 +1,61 @@
+#pragma once
+#include "ScreenQuad.h"
+#include "ShadowMesh.h"
+
+class MemoryReport;
+
+//-----------------------------------------------------------------------------
+// ShadowGeometry class
+// ShadowMesh of one shadow caster level of detail with its device buffers.
+// MeshData keeps a chain of them, level 0 is full resolution. Instances
+// share it, volumes are uploaded when they are drawn.
+//-----------------------------------------------------------------------------
+class ShadowGeometry : public ShadowMesh {
+private:
+    // Volume of the last render, shared by all instances
+    mutable ShadowBuffers buffers;
+
+    // Make vbo/ibo for rendering
+    void PrepareShadowVolumes();
+
+    // Upload volume indices unless they are in the buffers already
+    void UpdateShadowVolumes(const ShadowVolume& volume) const;
+
+    // Edge texture of the silhouette candidates & the shared edge template
+    void PrepareEdgeInstances();
+
+    // Upload silhouette edge ids of volume unless they are there already
+    void UpdateEdgeIds(const ShadowVolume& volume) const;
+
+    // Bind template & edge ids for count instances, or unbind with 0
+    void SetEdgeInstances(int count) const;
+
+    // Instanced draws are on & this geometry has its edge texture
+    bool DrawsInstanced() const { return instancedEdges && buffers.pEdgeTexture; }
+
+public:
+    // Drop faces, shadow vertices & cap indices after upload, no managed
+    // mirror of the shadow vertex buffer. Read when geometry is built.
+    static bool releaseCpuCopies;
+
+    // Rows of edgesPerRow records the edge texture of a geometry may have,
+    // from the device caps. 0 makes none, so nothing draws instanced. Read
+    // when geometry is built.
+    static int edgeTextureRows;
+    static const int edgesPerRow = 256;
+
+    // Draw silhouettes as instances of one edge template the vertex shader
+    // expands from the edge texture, uploading only the silhouette edge ids.
+    // Geometry without an edge texture draws the indexed lists.
+    static bool instancedEdges;
+
+    // ShadowMesh::Build, then upload of the shadow vertices
+    bool Build(const std::vector<D3DXVECTOR3>& meshVertices, const std::vector<Face>& meshFaces, float meshError);
+
+    // Render volume extracted from this geometry, uploads it when needed
+    void RenderUmbra(const ShadowVolume& volume, int pass) const;
+    void RenderPenumbra(const ShadowVolume& volume, int pass) const;
+
+    // Add CPU arrays & buffers to report
+    void AddMemoryUsage(MemoryReport& report, const std::string& owner) const;
+};
@@ -0,0 +1,132 @@
+#include "ShadowMath.h"
+
+#ifndef _WIN32
+
+#include <algorithm>
+
+using namespace std;
+
+float D3DXVec3Dot(const D3DXVECTOR3* pV1, const D3DXVECTOR3* pV2) {
+    return pV1->x * pV2->x + pV1->y * pV2->y + pV1->z * pV2->z;
+}
+
+D3DXVECTOR3* D3DXVec3Cross(D3DXVECTOR3* pOut, const D3DXVECTOR3* pV1, const D3DXVECTOR3* pV2) {
+    *pOut = D3DXVECTOR3( pV1->y * pV2->z - pV1->z * pV2->y,
+                         pV1->z * pV2->x - pV1->x * pV2->z,
+                         pV1->x * pV2->y - pV1->y * pV2->x );
+    return pOut;
+}
+
+float D3DXVec3Length(const D3DXVECTOR3* pV) {
+    return sqrt( D3DXVec3Dot(pV, pV) );
+}
+
+// Zero vector stays zero like D3DX
+D3DXVECTOR3* D3DXVec3Normalize(D3DXVECTOR3* pOut, const D3DXVECTOR3* pV) {
+    float length = D3DXVec3Length(pV);
+
+    *pOut = length > 0.0f ? *pV / length : D3DXVECTOR3(0.0f, 0.0f, 0.0f);
+    return pOut;
+}
+
+D3DXVECTOR3* D3DXVec3Minimize(D3DXVECTOR3* pOut, const D3DXVECTOR3* pV1, const D3DXVECTOR3* pV2) {
+    *pOut = D3DXVECTOR3( min(pV1->x, pV2->x), min(pV1->y, pV2->y), min(pV1->z, pV2->z) );
+    return pOut;
+}
+
+D3DXVECTOR3* D3DXVec3Maximize(D3DXVECTOR3* pOut, const D3DXVECTOR3* pV1, const D3DXVECTOR3* pV2) {
+    *pOut = D3DXVECTOR3( max(pV1->x, pV2->x), max(pV1->y, pV2->y), max(pV1->z, pV2->z) );
+    return pOut;
+}
+
+// Row vector (x, y, z, 1) times matrix
+D3DXVECTOR4* D3DXVec3Transform(D3DXVECTOR4* pOut, const D3DXVECTOR3* pV, const D3DXMATRIX* pM) {
+    D3DXVECTOR4 result;
+
+    for(int i = 0; i<4; ++i)
+        result[i] = pV->x * pM->m[0][i] + pV->y * pM->m[1][i] + pV->z * pM->m[2][i] + pM->m[3][i];
+    *pOut = result;
+    return pOut;
+}
+
+D3DXVECTOR2* D3DXVec2Minimize(D3DXVECTOR2* pOut, const D3DXVECTOR2* pV1, const D3DXVECTOR2* pV2) {
+    *pOut = D3DXVECTOR2( min(pV1->x, pV2->x), min(pV1->y, pV2->y) );
+    return pOut;
+}
+
+D3DXVECTOR2* D3DXVec2Maximize(D3DXVECTOR2* pOut, const D3DXVECTOR2* pV1, const D3DXVECTOR2* pV2) {
+    *pOut = D3DXVECTOR2( max(pV1->x, pV2->x), max(pV1->y, pV2->y) );
+    return pOut;
+}
+
+float D3DXVec4Dot(const D3DXVECTOR4* pV1, const D3DXVECTOR4* pV2) {
+    return pV1->x * pV2->x + pV1->y * pV2->y + pV1->z * pV2->z + pV1->w * pV2->w;
+}
+
+D3DXVECTOR4* D3DXVec4Normalize(D3DXVECTOR4* pOut, const D3DXVECTOR4* pV) {
+    float length = sqrt( D3DXVec4Dot(pV, pV) );
+
+    *pOut = length > 0.0f ? *pV / length : D3DXVECTOR4(0.0f, 0.0f, 0.0f, 0.0f);
+    return pOut;
+}
+
+D3DXMATRIX* D3DXMatrixIdentity(D3DXMATRIX* pOut) {
+    memset(pOut->m, 0, sizeof(pOut->m));
+    pOut->_11 = pOut->_22 = pOut->_33 = pOut->_44 = 1.0f;
+    return pOut;
+}
+
+// pM1 then pM2, row vectors like D3DX
+D3DXMATRIX* D3DXMatrixMultiply(D3DXMATRIX* pOut, const D3DXMATRIX* pM1, const D3DXMATRIX* pM2) {
+    D3DXMATRIX result;
+
+    for(int i = 0; i<4; ++i) {
+        for(int j = 0; j<4; ++j)
+            result.m[i][j] = pM1->m[i][0] * pM2->m[0][j] + pM1->m[i][1] * pM2->m[1][j] + pM1->m[i][2] * pM2->m[2][j] + pM1->m[i][3] * pM2->m[3][j];
+    }
+    *pOut = result;
+    return pOut;
+}
+
+D3DXMATRIX* D3DXMatrixTranslation(D3DXMATRIX* pOut, float x, float y, float z) {
+    D3DXMatrixIdentity(pOut);
+    pOut->_41 = x;
+    pOut->_42 = y;
+    pOut->_43 = z;
+    return pOut;
+}
+
+D3DXMATRIX* D3DXMatrixScaling(D3DXMATRIX* pOut, float sx, float sy, float sz) {
+    D3DXMatrixIdentity(pOut);
+    pOut->_11 = sx;
+    pOut->_22 = sy;
+    pOut->_33 = sz;
+    return pOut;
+}
+
+// Left handed rotations like D3DX
+D3DXMATRIX* D3DXMatrixRotationX(D3DXMATRIX* pOut, float angle) {
+    D3DXMatrixIdentity(pOut);
+    pOut->_22 = pOut->_33 = cos(angle);
+    pOut->_23 = sin(angle);
+    pOut->_32 = -sin(angle);
+    return pOut;
+}
+
+D3DXMATRIX* D3DXMatrixRotationY(D3DXMATRIX* pOut, float angle) {
+    D3DXMatrixIdentity(pOut);
+    pOut->_11 = pOut->_33 = cos(angle);
+    pOut->_13 = -sin(angle);
+    pOut->_31 = sin(angle);
+    return pOut;
+}
+
+D3DXMATRIX* D3DXMatrixRotationZ(D3DXMATRIX* pOut, float angle) {
+    D3DXMatrixIdentity(pOut);
+    pOut->_11 = pOut->_22 = cos(angle);
+    pOut->_12 = sin(angle);
+    pOut->_21 = -sin(angle);
+    return pOut;
+}
+
+#endif
@@ -0,0 +1,148 @@
+#pragma once
+// Vector math of the shadow geometry library. Windows builds take it from
+// D3DX, elsewhere the subset the library & its tools use is implemented here
+// under the same names, so there is no graphics API below the library on either.
+
+// Positions closer than this are the same, see Global.h
+#ifndef eps
+#define eps 0.0001f
+#endif
+
+#ifdef _WIN32
+
+#include <windows.h>
+#include <d3dx9.h>
+
+#else
+
+#include <cstring>
+#include <math.h>
+
+#define D3DX_PI 3.141592654f
+#define D3DXToRadian(degree) ((degree) * (D3DX_PI / 180.0f))
+
+struct D3DVECTOR
+{
+    float x, y, z;
+};
+
+struct D3DMATRIX
+{
+    union {
+        struct {
+            float _11, _12, _13, _14;
+            float _21, _22, _23, _24;
+            float _31, _32, _33, _34;
+            float _41, _42, _43, _44;
+        };
+        float m[4][4];
+    };
+};
+
+struct D3DXVECTOR2
+{
+    float x, y;
+
+    D3DXVECTOR2() {}
+    D3DXVECTOR2(float x, float y) : x(x), y(y) {}
+
+    D3DXVECTOR2 operator + (const D3DXVECTOR2& v) const { return D3DXVECTOR2(x + v.x, y + v.y); }
+    D3DXVECTOR2 operator - (const D3DXVECTOR2& v) const { return D3DXVECTOR2(x - v.x, y - v.y); }
+    D3DXVECTOR2 operator * (float s) const { return D3DXVECTOR2(x * s, y * s); }
+    D3DXVECTOR2 operator / (float s) const { return D3DXVECTOR2(x / s, y / s); }
+};
+
+struct D3DXVECTOR3 : D3DVECTOR
+{
+    D3DXVECTOR3() {}
+    D3DXVECTOR3(float x, float y, float z) { this->x = x; this->y = y; this->z = z; }
+    D3DXVECTOR3(const D3DVECTOR& v) { x = v.x; y = v.y; z = v.z; }
+    D3DXVECTOR3(const float* p) { x = p[0]; y = p[1]; z = p[2]; }
+
+    operator float* () { return &x; }
+    operator const float* () const { return &x; }
+
+    D3DXVECTOR3& operator += (const D3DXVECTOR3& v) { x += v.x; y += v.y; z += v.z; return *this; }
+    D3DXVECTOR3& operator -= (const D3DXVECTOR3& v) { x -= v.x; y -= v.y; z -= v.z; return *this; }
+    D3DXVECTOR3& operator *= (float s) { x *= s; y *= s; z *= s; return *this; }
+    D3DXVECTOR3& operator /= (float s) { x /= s; y /= s; z /= s; return *this; }
+
+    D3DXVECTOR3 operator + () const { return *this; }
+    D3DXVECTOR3 operator - () const { return D3DXVECTOR3(-x, -y, -z); }
+    D3DXVECTOR3 operator + (const D3DXVECTOR3& v) const { return D3DXVECTOR3(x + v.x, y + v.y, z + v.z); }
+    D3DXVECTOR3 operator - (const D3DXVECTOR3& v) const { return D3DXVECTOR3(x - v.x, y - v.y, z - v.z); }
+    D3DXVECTOR3 operator * (float s) const { return D3DXVECTOR3(x * s, y * s, z * s); }
+    D3DXVECTOR3 operator / (float s) const { return D3DXVECTOR3(x / s, y / s, z / s); }
+    friend D3DXVECTOR3 operator * (float s, const D3DXVECTOR3& v) { return v * s; }
+
+    bool operator == (const D3DXVECTOR3& v) const { return x == v.x && y == v.y && z == v.z; }
+    bool operator != (const D3DXVECTOR3& v) const { return !(*this == v); }
+};
+
+struct D3DXVECTOR4
+{
+    float x, y, z, w;
+
+    D3DXVECTOR4() {}
+    D3DXVECTOR4(float x, float y, float z, float w) : x(x), y(y), z(z), w(w) {}
+    D3DXVECTOR4(const D3DVECTOR& v, float w) : x(v.x), y(v.y), z(v.z), w(w) {}
+    D3DXVECTOR4(const float* p) : x(p[0]), y(p[1]), z(p[2]), w(p[3]) {}
+
+    operator float* () { return &x; }
+    operator const float* () const { return &x; }
+
+    D3DXVECTOR4& operator += (const D3DXVECTOR4& v) { x += v.x; y += v.y; z += v.z; w += v.w; return *this; }
+    D3DXVECTOR4& operator -= (const D3DXVECTOR4& v) { x -= v.x; y -= v.y; z -= v.z; w -= v.w; return *this; }
+    D3DXVECTOR4& operator *= (float s) { x *= s; y *= s; z *= s; w *= s; return *this; }
+    D3DXVECTOR4& operator /= (float s) { x /= s; y /= s; z /= s; w /= s; return *this; }
+
+    D3DXVECTOR4 operator - () const { return D3DXVECTOR4(-x, -y, -z, -w); }
+    D3DXVECTOR4 operator + (const D3DXVECTOR4& v) const { return D3DXVECTOR4(x + v.x, y + v.y, z + v.z, w + v.w); }
+    D3DXVECTOR4 operator - (const D3DXVECTOR4& v) const { return D3DXVECTOR4(x - v.x, y - v.y, z - v.z, w - v.w); }
+    D3DXVECTOR4 operator * (float s) const { return D3DXVECTOR4(x * s, y * s, z * s, w * s); }
+    D3DXVECTOR4 operator / (float s) const { return D3DXVECTOR4(x / s, y / s, z / s, w / s); }
+
+    bool operator == (const D3DXVECTOR4& v) const { return x == v.x && y == v.y && z == v.z && w == v.w; }
+    bool operator != (const D3DXVECTOR4& v) const { return !(*this == v); }
+};
+
+struct D3DXMATRIX : D3DMATRIX
+{
+    D3DXMATRIX() {}
+    D3DXMATRIX(const float* p) { memcpy(m, p, sizeof(m)); }
+
+    float& operator () (unsigned int row, unsigned int column) { return m[row][column]; }
+    float operator () (unsigned int row, unsigned int column) const { return m[row][column]; }
+    operator float* () { return &_11; }
+    operator const float* () const { return &_11; }
+};
+
+// Color of generated meshes, see Scene
+struct D3DXCOLOR
+{
+    float r, g, b, a;
+
+    D3DXCOLOR() {}
+    D3DXCOLOR(float r, float g, float b, float a) : r(r), g(g), b(b), a(a) {}
+};
+
+float        D3DXVec3Dot(const D3DXVECTOR3* pV1, const D3DXVECTOR3* pV2);
+D3DXVECTOR3* D3DXVec3Cross(D3DXVECTOR3* pOut, const D3DXVECTOR3* pV1, const D3DXVECTOR3* pV2);
+float        D3DXVec3Length(const D3DXVECTOR3* pV);
+D3DXVECTOR3* D3DXVec3Normalize(D3DXVECTOR3* pOut, const D3DXVECTOR3* pV);
+D3DXVECTOR3* D3DXVec3Minimize(D3DXVECTOR3* pOut, const D3DXVECTOR3* pV1, const D3DXVECTOR3* pV2);
+D3DXVECTOR3* D3DXVec3Maximize(D3DXVECTOR3* pOut, const D3DXVECTOR3* pV1, const D3DXVECTOR3* pV2);
+D3DXVECTOR4* D3DXVec3Transform(D3DXVECTOR4* pOut, const D3DXVECTOR3* pV, const D3DXMATRIX* pM);
+D3DXVECTOR2* D3DXVec2Minimize(D3DXVECTOR2* pOut, const D3DXVECTOR2* pV1, const D3DXVECTOR2* pV2);
+D3DXVECTOR2* D3DXVec2Maximize(D3DXVECTOR2* pOut, const D3DXVECTOR2* pV1, const D3DXVECTOR2* pV2);
+float        D3DXVec4Dot(const D3DXVECTOR4* pV1, const D3DXVECTOR4* pV2);
+D3DXVECTOR4* D3DXVec4Normalize(D3DXVECTOR4* pOut, const D3DXVECTOR4* pV);
+D3DXMATRIX*  D3DXMatrixIdentity(D3DXMATRIX* pOut);
+D3DXMATRIX*  D3DXMatrixMultiply(D3DXMATRIX* pOut, const D3DXMATRIX* pM1, const D3DXMATRIX* pM2);
+D3DXMATRIX*  D3DXMatrixTranslation(D3DXMATRIX* pOut, float x, float y, float z);
+D3DXMATRIX*  D3DXMatrixScaling(D3DXMATRIX* pOut, float sx, float sy, float sz);
+D3DXMATRIX*  D3DXMatrixRotationX(D3DXMATRIX* pOut, float angle);
+D3DXMATRIX*  D3DXMatrixRotationY(D3DXMATRIX* pOut, float angle);
+D3DXMATRIX*  D3DXMatrixRotationZ(D3DXMATRIX* pOut, float angle);
+
+#endif
@@ -0,0 +1,975 @@
+#include "ShadowMesh.h"
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <map>
+#include <unordered_map>
+
+using namespace std;
+
+// Penumbra wedge triangles over its 6 vertices: v0 unextruded, outer, inner, v1 ...
+const int ShadowMesh::wedgePattern[24] = { 3, 0, 1,  1, 4, 3,  1, 0, 2,  5, 3, 4,  0, 3, 5,  5, 2, 0,  1, 2, 4,  4, 2, 5 };
+
+// Umbra side quad of one edge: unextruded & extruded along the edge
+const int ShadowMesh::umbraPattern[6] = { 3, 0, 5,  5, 0, 2 };
+
+// Corners as Build makes them: end, face of the normal, normal w, edge w
+const float ShadowMesh::edgeCorners[6][4] = {
+    { 0.0f, 0.0f,  0.0f,  1.0f },
+    { 0.0f, 1.0f,  1.0f,  1.0f },
+    { 0.0f, 1.0f, -1.0f,  1.0f },
+    { 1.0f, 0.0f,  0.0f, -1.0f },
+    { 1.0f, 1.0f,  1.0f, -1.0f },
+    { 1.0f, 1.0f, -1.0f, -1.0f }
+};
+
+float ShadowMesh::mergeAngle = 3.0f * D3DX_PI / 180.0f;
+float ShadowMesh::flatAngle = 0.05f * D3DX_PI / 180.0f;
+
+// Last extraction id, 0 marks a volume never extracted. Meshes may extract
+// on several threads at once.
+static atomic<unsigned int> extractions(0);
+
+ShadowMesh::ShadowMesh() : silhouetteEdges(0), capIndexCount(0), capCacheStats(), error(0.0f) {
+    memset(&buildTimes, 0, sizeof(buildTimes));
+    memset(&edgeClasses, 0, sizeof(edgeClasses));
+}
+
+typedef chrono::steady_clock BuildClock;
+
+static double Seconds(BuildClock::time_point start) {
+    return chrono::duration<double>(BuildClock::now() - start).count();
+}
+
+// Cube of 2 eps on a side. Vertices within eps of a point are in its cell
+// or the neighbours towards the nearer faces, 8 cells at most.
+struct WeldCell
+{
+    long long x, y, z;
+
+    bool operator == (const WeldCell& cell) const {
+        return x == cell.x && y == cell.y && z == cell.z;
+    }
+};
+
+struct WeldCellHash
+{
+    size_t operator () (const WeldCell& cell) const {
+        return static_cast<size_t>(cell.x * 73856093LL ^ cell.y * 19349663LL ^ cell.z * 83492791LL);
+    }
+};
+
+// Merge vertices closer than eps on every axis into the first of them. A
+// grid keeps the merge the same whatever the order of the tests, which an
+// ordering with an eps tolerance can't.
+void ShadowMesh::Weld(vector<D3DXVECTOR3>& vertices, vector<Face>& faces) {
+    typedef unordered_map<WeldCell, int, WeldCellHash> CellMap;
+    CellMap             cells;          // last welded vertex of each cell
+    vector<int>         next;           // previous welded vertex of the same cell
+    vector<D3DXVECTOR3> welded;
+    vector<int>         remap( vertices.size() );
+
+    cells.reserve( vertices.size() );
+    for(int i = 0; i<(int)vertices.size(); ++i) {
+        const D3DXVECTOR3& p = vertices[i];
+        D3DXVECTOR3        scaled = p / (2.0f * eps);
+        WeldCell           cell = { (long long)floor(scaled.x), (long long)floor(scaled.y), (long long)floor(scaled.z) };
+        WeldCell           side = { scaled.x - cell.x < 0.5f ? -1 : 1, scaled.y - cell.y < 0.5f ? -1 : 1, scaled.z - cell.z < 0.5f ? -1 : 1 };
+        int                match = -1;
+
+        for(int n = 0; n<8 && match == -1; ++n) {
+            WeldCell                around = { cell.x + (n & 1) * side.x, cell.y + (n >> 1 & 1) * side.y, cell.z + (n >> 2) * side.z };
+            CellMap::const_iterator found = cells.find(around);
+
+            for(int j = found == cells.end() ? -1 : found->second; j != -1 && match == -1; j = next[j]) {
+                if (fabs(welded[j].x - p.x) <= eps && fabs(welded[j].y - p.y) <= eps && fabs(welded[j].z - p.z) <= eps)
+                    match = j;
+            }
+        }
+
+        if (match == -1) {
+            CellMap::iterator first = cells.insert( CellMap::value_type(cell, -1) ).first;
+
+            match = welded.size();
+            welded.push_back(p);
+            next.push_back(first->second);
+            first->second = match;
+        }
+        remap[i] = match;
+    }
+
+    for(int i = 0; i<(int)faces.size(); ++i) {
+        faces[i].v0 = remap[ faces[i].v0 ];
+        faces[i].v1 = remap[ faces[i].v1 ];
+        faces[i].v2 = remap[ faces[i].v2 ];
+    }
+    vertices.swap(welded);
+}
+
+// Faces in cache order, vertices in first use order
+void ShadowMesh::OptimizeOrder(vector<D3DXVECTOR3>& vertices, vector<Face>& faces) {
+    vector<int> indices( 3 * faces.size() );
+    vector<int> order, remap;
+
+    if ( faces.empty() )
+        return;
+    for(int i = 0; i<(int)faces.size(); ++i) {
+        indices[3*i] = faces[i].v0;
+        indices[3*i + 1] = faces[i].v1;
+        indices[3*i + 2] = faces[i].v2;
+    }
+
+    VertexCache::Optimize(&indices[0], faces.size(), vertices.size(), order);
+    vector<Face> ordered( faces.size() );
+    for(int i = 0; i<(int)order.size(); ++i) {
+        ordered[i] = faces[ order[i] ];
+        indices[3*i] = ordered[i].v0;
+        indices[3*i + 1] = ordered[i].v1;
+        indices[3*i + 2] = ordered[i].v2;
+    }
+    faces.swap(ordered);
+
+    VertexCache::FirstUseOrder(&indices[0], faces.size(), vertices.size(), remap);
+    vector<D3DXVECTOR3> renumbered( vertices.size() );
+    for(int v = 0; v<(int)vertices.size(); ++v)
+        renumbered[ remap[v] ] = vertices[v];
+    vertices.swap(renumbered);
+    for(int i = 0; i<(int)faces.size(); ++i) {
+        faces[i].v0 = remap[ faces[i].v0 ];
+        faces[i].v1 = remap[ faces[i].v1 ];
+        faces[i].v2 = remap[ faces[i].v2 ];
+    }
+}
+
+void ShadowMesh::AddEdge(EdgeMap& edgeMap, int v0, int v1, int face) {
+	bool rev = false;
+
+	// from min to max
+	if (v0 > v1) {
+		std::swap(v0, v1);
+		rev = true;
+	}
+
+	// check whether we already have this face
+	EdgeMap::iterator i = edgeMap.find( int_pair(v0, v1) );
+	if (i != edgeMap.end()) 
+		i->second.f1 = face;
+	else {
+		// insert new edge
+		Edge edge;
+
+        if (rev) {
+		    edge.v0 = v1;
+		    edge.v1 = v0;
+        }
+        else {
+		    edge.v0 = v0;
+		    edge.v1 = v1;
+        }
+		edge.f0	= face;
+		edge.f1 = -1;
+
+		edgeMap.insert(edge_pair(int_pair(v0,v1), edge));
+	}
+}
+
+void ShadowMesh::MakeEdges() {
+    int j = 0;
+    EdgeMap edgeMap;
+
+    // Add edge from each face
+	for (int i = 0; i<(int)faces.size(); ++i) {
+		AddEdge(edgeMap, faces[i].v0, faces[i].v1, i);
+		AddEdge(edgeMap, faces[i].v1, faces[i].v2, i);
+		AddEdge(edgeMap, faces[i].v2, faces[i].v0, i);
+	}
+
+    // Check closed edges and copy edges to vector
+    edges.reserve(edgeMap.size());
+    for(EdgeMap::iterator i = edgeMap.begin(); i != edgeMap.end(); ++i, ++j) {
+        if (i->second.f0 == -1 || i->second.f1 == -1) {
+            edges.clear();
+            return;
+        }
+        else {
+		    // copy
+            if (faces[i->second.f0].v0 == i->second.v0 && faces[i->second.f0].v1 == i->second.v1) {
+                faces[i->second.f0].re0 = false;
+                faces[i->second.f0].e0 = j;
+            }
+            else if (faces[i->second.f0].v1 == i->second.v0 && faces[i->second.f0].v2 == i->second.v1) {
+                faces[i->second.f0].re1 = false;
+                faces[i->second.f0].e1 = j;
+            }
+            else if (faces[i->second.f0].v2 == i->second.v0 && faces[i->second.f0].v0 == i->second.v1) {
+                faces[i->second.f0].re2 = false;
+                faces[i->second.f0].e2 = j;
+            }
+
+            if (faces[i->second.f1].v0 == i->second.v1 && faces[i->second.f1].v1 == i->second.v0) {
+                faces[i->second.f1].re0 = true;
+                faces[i->second.f1].e0 = j;
+            }
+            else if (faces[i->second.f1].v1 == i->second.v1 && faces[i->second.f1].v2 == i->second.v0) {
+                faces[i->second.f1].re1 = true;
+                faces[i->second.f1].e1 = j;
+            }
+            else if (faces[i->second.f1].v2 == i->second.v1 && faces[i->second.f1].v0 == i->second.v0) {
+                faces[i->second.f1].re2 = true;
+                faces[i->second.f1].e2 = j;
+            }
+            edges.push_back(i->second);
+        }
+    }
+}
+
+// True if all corners of face lie on plane within flatAngle, seen from origin
+static bool OnPlane(const D3DXVECTOR4& plane, const D3DXVECTOR3& origin, const vector<D3DXVECTOR3>& vertices, const Face& face,
+                    float cosAngle, float sinAngle) {
+    const D3DXVECTOR3& normal = *(const D3DXVECTOR3*)&plane;
+    int corners[3] = { face.v0, face.v1, face.v2 };
+
+    if (D3DXVec3Dot(&normal, &face.normal) < cosAngle)
+        return false;
+    for(int k = 0; k<3; ++k) {
+        D3DXVECTOR3 offset = vertices[ corners[k] ] - origin;
+
+        if (fabs( D3DXVec3Dot(&normal, &vertices[ corners[k] ]) + plane.w ) > eps + sinAngle * D3DXVec3Length(&offset))
+            return false;
+    }
+    return true;
+}
+
+// Grow regions of coplanar faces over the edges. Faces are compared with
+// the first face of the region, not their neighbour, so a finely tessellated
+// curve does not creep into one region.
+void ShadowMesh::MergeFlatFaces(vector<int>& region) {
+    float       cosAngle = cos(flatAngle);
+    float       sinAngle = sin(flatAngle);
+    vector<int> stack;
+
+    region.resize( faces.size() );
+    for(int i = 0; i<(int)faces.size(); ++i)
+        region[i] = flatAngle > 0.0f ? -1 : i;
+    if (flatAngle <= 0.0f)
+        return;
+
+    for(int seed = 0; seed<(int)faces.size(); ++seed) {
+        if (region[seed] != -1)
+            continue;
+        region[seed] = seed;
+        stack.push_back(seed);
+
+        const D3DXVECTOR4  plane = facePlanes[seed];
+        const D3DXVECTOR3& origin = vertices[ faces[seed].v0 ];
+        while ( !stack.empty() ) {
+            int f = stack.back();
+            int faceEdges[3] = { faces[f].e0, faces[f].e1, faces[f].e2 };
+
+            stack.pop_back();
+            for(int k = 0; k<3; ++k) {
+                const Edge& edge = edges[ faceEdges[k] ];
+                int         g = edge.f0 == f ? edge.f1 : edge.f0;
+
+                if (region[g] != -1 || !OnPlane(plane, origin, vertices, faces[g], cosAngle, sinAngle))
+                    continue;
+                region[g] = seed;
+                facePlanes[g] = plane;
+                stack.push_back(g);
+            }
+        }
+    }
+}
+
+// Faces of one region share a plane, so they face the light together and an
+// edge between them can never be on the silhouette. Candidates keep their
+// order, flat edges follow and faces point at the new positions.
+void ShadowMesh::PruneFlatEdges(const vector<int>& region) {
+    vector<Edge> ordered;
+    vector<int>  remap( edges.size() );
+
+    memset(&edgeClasses, 0, sizeof(edgeClasses));
+    ordered.reserve( edges.size() );
+    for(int pass = 0; pass<2; ++pass) {
+        for(int i = 0; i<(int)edges.size(); ++i) {
+            const Edge& edge = edges[i];
+            bool        flat = region[edge.f0] == region[edge.f1];
+
+            if (flat != (pass == 1))
+                continue;
+            remap[i] = ordered.size();
+            ordered.push_back(edge);
+            if (flat) {
+                ++edgeClasses.flat;
+                continue;
+            }
+
+            // Convex if the far corner of f1 is behind the plane of f0
+            const Face& face = faces[edge.f1];
+            int         corner = face.v0 != edge.v0 && face.v0 != edge.v1 ? face.v0 : face.v1 != edge.v0 && face.v1 != edge.v1 ? face.v1 : face.v2;
+            if (D3DXVec3Dot((const D3DXVECTOR3*)&facePlanes[edge.f0], &vertices[corner]) + facePlanes[edge.f0].w <= 0.0f)
+                ++edgeClasses.convex;
+            else
+                ++edgeClasses.concave;
+        }
+        if (pass == 0)
+            silhouetteEdges = ordered.size();
+    }
+    edges.swap(ordered);
+
+    for(int i = 0; i<(int)faces.size(); ++i) {
+        faces[i].e0 = remap[ faces[i].e0 ];
+        faces[i].e1 = remap[ faces[i].e1 ];
+        faces[i].e2 = remap[ faces[i].e2 ];
+    }
+    edgeClasses.prunedBytes = 4 * edgeClasses.flat * sizeof(ShadowVert);
+}
+
+// Setup from welded vertices & faces
+bool ShadowMesh::Build(const vector<D3DXVECTOR3>& meshVertices, const vector<Face>& meshFaces, float meshError) {
+    int size;
+
+    vertices = meshVertices;
+    faces = meshFaces;
+    error = meshError;
+    memset(&buildTimes, 0, sizeof(buildTimes));
+    memset(&edgeClasses, 0, sizeof(edgeClasses));
+    silhouetteEdges = 0;
+
+    // Compute vertex normals
+    BuildClock::time_point start = BuildClock::now();
+    normals.resize( vertices.size() );
+    fill( normals.begin(), normals.end(), D3DXVECTOR3(0, 0, 0) );
+    for(int i = 0; i<(int)faces.size(); ++i)
+    {
+        normals[ faces[i].v0 ] += faces[i].normal;
+        normals[ faces[i].v1 ] += faces[i].normal;
+        normals[ faces[i].v2 ] += faces[i].normal;
+    }
+    for(int i = 0; i<(int)vertices.size(); ++i)
+    {
+        D3DXVec3Normalize(&normals[i], &normals[i]);
+    }
+    buildTimes.normals = Seconds(start);
+
+    // Edges, face planes for front face tests & flat regions
+    start = BuildClock::now();
+    MakeEdges();
+    if (edges.size() == 0) {
+        buildTimes.edges = Seconds(start);
+        return false;
+    }
+    firstOut.assign(vertices.size(), -1);
+
+    facePlanes.resize( faces.size() );
+    for(int i = 0; i<(int)faces.size(); ++i)
+        facePlanes[i] = D3DXVECTOR4( faces[i].normal, -D3DXVec3Dot(&faces[i].normal, &vertices[faces[i].v0]) );
+
+    vector<int> region;
+    MergeFlatFaces(region);
+    PruneFlatEdges(region);
+    buildTimes.edges = Seconds(start);
+
+	// 6 vertices per candidate edge: 3 at v0 then 3 at v1, unextruded then
+	// outer & inner, placed by ShadowIndex. Flat edges fill only corners
+	// 0 & 4 for the caps. Normals are the plane ones, shared in a region.
+    start = BuildClock::now();
+    size = edges.size();
+	shadowVertices.resize( GetShadowVertexCount() );
+	for(int i = 0; i<size; ++i)
+	{
+        D3DXVECTOR3 edge = vertices[ edges[i].v1 ] - vertices[ edges[i].v0 ];
+        const D3DXVECTOR3& normal0 = *(const D3DXVECTOR3*)&facePlanes[ edges[i].f0 ];
+        const D3DXVECTOR3& normal1 = *(const D3DXVECTOR3*)&facePlanes[ edges[i].f1 ];
+        ShadowVert  unused[6];
+        ShadowVert* v[6];
+
+        for(int k = 0; k<6; ++k)
+            v[k] = i < silhouetteEdges || k == 0 || k == 4 ? &shadowVertices[ ShadowIndex(i, k) ] : &unused[k];
+        //D3DXVec3Normalize(&edge, &edge);
+
+        // v0
+        v[0]->vertex = vertices[ edges[i].v0 ];
+        v[0]->vertNormal0 = normals[ edges[i].v0 ];
+        v[0]->vertNormal1 = normals[ edges[i].v1 ];
+        v[0]->normal = D3DXVECTOR4(normal0, 0.0f);
+        v[0]->backNormal = normal1;
+        v[0]->edge = D3DXVECTOR4(edge, 1.0f);
+
+		v[1]->vertex = vertices[ edges[i].v0 ];
+        v[1]->vertNormal0 = normals[ edges[i].v0 ];
+        v[1]->vertNormal1 = normals[ edges[i].v1 ];
+		v[1]->normal = D3DXVECTOR4(normal1, 1.0f);
+		v[1]->backNormal = normal0;
+        v[1]->edge = D3DXVECTOR4(edge, 1.0f);
+
+		v[2]->vertex = vertices[ edges[i].v0 ];
+        v[2]->vertNormal0 = normals[ edges[i].v0 ];
+        v[2]->vertNormal1 = normals[ edges[i].v1 ];
+		v[2]->normal = D3DXVECTOR4(normal1, -1.0f);
+		v[2]->backNormal = normal0;
+        v[2]->edge = D3DXVECTOR4(edge, 1.0f);
+
+        // v1
+		v[3]->vertex = vertices[ edges[i].v1 ];
+        v[3]->vertNormal0 = normals[ edges[i].v1 ];
+        v[3]->vertNormal1 = normals[ edges[i].v0 ];
+		v[3]->normal = D3DXVECTOR4(normal0, 0.0f);
+		v[3]->backNormal = normal1;
+        v[3]->edge = D3DXVECTOR4(-edge, -1.0f);
+
+		v[4]->vertex = vertices[ edges[i].v1 ];
+        v[4]->vertNormal0 = normals[ edges[i].v1 ];
+        v[4]->vertNormal1 = normals[ edges[i].v0 ];
+		v[4]->normal = D3DXVECTOR4(normal1, 1.0f);
+		v[4]->backNormal = normal0;
+        v[4]->edge = D3DXVECTOR4(-edge, -1.0f);
+
+		v[5]->vertex = vertices[ edges[i].v1 ];
+        v[5]->vertNormal0 = normals[ edges[i].v1 ];
+        v[5]->vertNormal1 = normals[ edges[i].v0 ];
+		v[5]->normal = D3DXVECTOR4(normal1, -1.0f);
+		v[5]->backNormal = normal0;
+        v[5]->edge = D3DXVECTOR4(-edge, -1.0f);
+	}
+    buildTimes.shadowVertices = Seconds(start);
+
+    // make umbra caps
+    start = BuildClock::now();
+    capIndices.resize( faces.size()*3 );
+	for(int i = 0; i<(int)faces.size(); ++i)
+	{
+        if ( faces[i].re0 )
+            capIndices[i*3] = ShadowIndex(faces[i].e0, 4);
+        else
+            capIndices[i*3] = ShadowIndex(faces[i].e0, 0);
+ 
+        if ( faces[i].re1 )
+            capIndices[i*3 + 1] = ShadowIndex(faces[i].e1, 4);
+        else
+            capIndices[i*3 + 1] = ShadowIndex(faces[i].e1, 0);
+
+        if ( faces[i].re2 )
+            capIndices[i*3 + 2] = ShadowIndex(faces[i].e2, 4);
+        else
+            capIndices[i*3 + 2] = ShadowIndex(faces[i].e2, 0);
+    }
+    capIndexCount = capIndices.size();
+    buildTimes.caps = Seconds(start);
+
+    // Silhouette cache cells scale with the mesh, its exactness test with
+    // the planes
+    D3DXVECTOR3 low = vertices[0], high = vertices[0];
+    float       maxNormalLength = 0.0f, maxPlaneDistance = 0.0f, radius = 0.0f;
+    for(int i = 1; i<(int)vertices.size(); ++i) {
+        D3DXVec3Minimize(&low, &low, &vertices[i]);
+        D3DXVec3Maximize(&high, &high, &vertices[i]);
+    }
+    for(int i = 0; i<(int)vertices.size(); ++i) {
+        D3DXVECTOR3 offset = vertices[i] - 0.5f * (low + high);
+        radius = max( radius, D3DXVec3Length(&offset) );
+    }
+    for(int i = 0; i<(int)facePlanes.size(); ++i) {
+        maxNormalLength = max( maxNormalLength, D3DXVec3Length((const D3DXVECTOR3*)&facePlanes[i]) );
+        maxPlaneDistance = max( maxPlaneDistance, fabs(facePlanes[i].w) );
+    }
+    silhouetteCache.Setup(radius, maxNormalLength, maxPlaneDistance);
+
+    return true;
+}
+
+// Add edge to penumbra volume
+void ShadowMesh::AddEdgeToVolume(ShadowVolume& volume, const int i) const
+{
+    int j = volume.penumbraIndices.size();
+    int corners[6];
+
+    for(int k = 0; k<6; ++k)
+        corners[k] = ShadowIndex(i, k);
+    volume.penumbraIndices.resize(j+24);
+    for(int k = 0; k<24; ++k)
+        volume.penumbraIndices[j+k] = corners[ wedgePattern[k] ];
+}
+
+// Umbra vertices of silhouette edge: front ones carry the lit face normal
+int ShadowMesh::TailFront(const SilhouetteEdge& s) const {
+    return s.reversed ? ShadowIndex(s.edge, 5) : ShadowIndex(s.edge, 0);
+}
+
+int ShadowMesh::TailBack(const SilhouetteEdge& s) const {
+    return s.reversed ? ShadowIndex(s.edge, 3) : ShadowIndex(s.edge, 2);
+}
+
+int ShadowMesh::HeadFront(const SilhouetteEdge& s) const {
+    return s.reversed ? ShadowIndex(s.edge, 2) : ShadowIndex(s.edge, 3);
+}
+
+int ShadowMesh::HeadBack(const SilhouetteEdge& s) const {
+    return s.reversed ? ShadowIndex(s.edge, 0) : ShadowIndex(s.edge, 5);
+}
+
+// Add one wedge spanning silhouette edges first..last
+void ShadowMesh::AddMergedWedge(ShadowVolume& volume, const SilhouetteEdge& first, const SilhouetteEdge& last) const {
+    int tail = Tail(first);
+    int head = Head(last);
+    const D3DXVECTOR3& frontT = *(const D3DXVECTOR3*)&facePlanes[ first.reversed ? edges[first.edge].f1 : edges[first.edge].f0 ];
+    const D3DXVECTOR3& backT  = *(const D3DXVECTOR3*)&facePlanes[ first.reversed ? edges[first.edge].f0 : edges[first.edge].f1 ];
+    const D3DXVECTOR3& frontH = *(const D3DXVECTOR3*)&facePlanes[ last.reversed ? edges[last.edge].f1 : edges[last.edge].f0 ];
+    const D3DXVECTOR3& backH  = *(const D3DXVECTOR3*)&facePlanes[ last.reversed ? edges[last.edge].f0 : edges[last.edge].f1 ];
+    D3DXVECTOR3 edge = vertices[head] - vertices[tail];
+    int j = volume.wedgeVertices.size();
+
+    // Same layout as the 6 vertices of an edge whose f0 is lit
+    volume.wedgeVertices.resize(j+6);
+    for(int k = 0; k<3; ++k) {
+        ShadowVert& t = volume.wedgeVertices[j + k];
+        ShadowVert& h = volume.wedgeVertices[j + 3 + k];
+
+        t.vertex = vertices[tail];
+        t.vertNormal0 = normals[tail];
+        t.vertNormal1 = normals[head];
+        t.edge = D3DXVECTOR4(edge, 1.0f);
+
+        h.vertex = vertices[head];
+        h.vertNormal0 = normals[head];
+        h.vertNormal1 = normals[tail];
+        h.edge = D3DXVECTOR4(-edge, -1.0f);
+    }
+
+    volume.wedgeVertices[j].normal = D3DXVECTOR4(frontT, 0.0f);
+    volume.wedgeVertices[j].backNormal = backT;
+    volume.wedgeVertices[j+1].normal = D3DXVECTOR4(backT, 1.0f);
+    volume.wedgeVertices[j+1].backNormal = frontT;
+    volume.wedgeVertices[j+2].normal = D3DXVECTOR4(backT, -1.0f);
+    volume.wedgeVertices[j+2].backNormal = frontT;
+
+    volume.wedgeVertices[j+3].normal = D3DXVECTOR4(frontH, 0.0f);
+    volume.wedgeVertices[j+3].backNormal = backH;
+    volume.wedgeVertices[j+4].normal = D3DXVECTOR4(backH, 1.0f);
+    volume.wedgeVertices[j+4].backNormal = frontH;
+    volume.wedgeVertices[j+5].normal = D3DXVECTOR4(backH, -1.0f);
+    volume.wedgeVertices[j+5].backNormal = frontH;
+}
+
+// Walk oriented silhouette edges into closed loops
+void ShadowMesh::ChainSilhouette(ShadowVolume& volume) const {
+    vector<SilhouetteEdge>& silhouette = volume.silhouette;
+    vector<int>& loopEdges = volume.loopEdges;
+    vector<int>& loopStarts = volume.loopStarts;
+
+    loopEdges.clear();
+    loopStarts.clear();
+
+    for(int i = 0; i<(int)silhouette.size(); ++i) {
+        int start = Tail(silhouette[i]);
+        int current = i;
+
+        if (silhouette[i].used)
+            continue;
+
+        // Every vertex of the lit region border has as many edges in as out,
+        // so the walk ends where it started
+        loopStarts.push_back(loopEdges.size());
+        while (current != -1) {
+            int v = Head(silhouette[current]);
+
+            silhouette[current].used = true;
+            loopEdges.push_back(current);
+            if (v == start)
+                break;
+
+            current = firstOut[v];
+            while (current != -1 && silhouette[current].used)
+                current = silhouette[current].next;
+        }
+    }
+    loopStarts.push_back(loopEdges.size());
+}
+
+// Emit the side strip of a loop & a wedge per run of near collinear edges
+void ShadowMesh::AddLoop(ShadowVolume& volume, int begin, int end) const {
+    const vector<SilhouetteEdge>& silhouette = volume.silhouette;
+    const vector<int>& loopEdges = volume.loopEdges;
+    vector<int>& strip = volume.umbraIndices;
+    float cosMerge = cos(mergeAngle);
+    int j = begin;
+
+    // Join with previous loop by degenerate triangles
+    if (!strip.empty()) {
+        strip.push_back( strip.back() );
+        strip.push_back( TailFront(silhouette[ loopEdges[begin] ]) );
+    }
+
+    while (j < end) {
+        const SilhouetteEdge& first = silhouette[ loopEdges[j] ];
+        int k = j + 1;
+
+        // Grow run while every edge stays close to the chord
+        while (mergeAngle > 0.0f && k < end) {
+            const SilhouetteEdge& last = silhouette[ loopEdges[k] ];
+            D3DXVECTOR3 chord = vertices[ Head(last) ] - vertices[ Tail(first) ];
+            float length = D3DXVec3Length(&chord);
+            bool collinear = length > eps;
+
+            for(int l = j; l<=k && collinear; ++l) {
+                const SilhouetteEdge& s = silhouette[ loopEdges[l] ];
+                D3DXVECTOR3 dir = vertices[ Head(s) ] - vertices[ Tail(s) ];
+
+                collinear = D3DXVec3Dot(&dir, &chord) >= cosMerge * D3DXVec3Length(&dir) * length;
+            }
+            if (!collinear)
+                break;
+            ++k;
+        }
+
+        // Sides follow every edge, so they meet the caps without cracks.
+        // Only the penumbra takes the chord.
+        volume.loopCorners[j] = 1;
+        for(int l = j; l<k; ++l) {
+            strip.push_back( TailFront(silhouette[ loopEdges[l] ]) );
+            strip.push_back( TailBack(silhouette[ loopEdges[l] ]) );
+        }
+        if (k - j == 1)
+            AddEdgeToVolume(volume, first.edge);
+        else
+            AddMergedWedge(volume, first, silhouette[ loopEdges[k-1] ]);
+        j = k;
+    }
+
+    // Close the loop
+    strip.push_back( HeadFront(silhouette[ loopEdges[end-1] ]) );
+    strip.push_back( HeadBack(silhouette[ loopEdges[end-1] ]) );
+}
+
+// Front face tests & silhouette edges oriented along the lit faces, linked
+// from firstOut
+void ShadowMesh::FindSilhouette(const D3DXVECTOR3& lightPos, vector<SilhouetteEdge>& silhouette, bool cache) const {
+    vector<bool> frontFace;
+    D3DXVECTOR4  light(lightPos, 1.0f);
+    float        margin = FLT_MAX;
+
+    // Check front or back faces, nearest plane bounds the lights that see
+    // the same
+    frontFace.resize(facePlanes.size());
+    if (cache) {
+        for(int i=0; i<(int)facePlanes.size(); ++i) {
+            float distance = D3DXVec4Dot(&facePlanes[i], &light);
+
+            frontFace[i] = distance > 0.0f;
+            margin = min(margin, fabs(distance));
+        }
+    }
+    else {
+        for(int i=0; i<(int)facePlanes.size(); ++i) {
+            frontFace[i] = D3DXVec4Dot(&facePlanes[i], &light) > 0.0f;
+        }
+    }
+
+    // Collect silhouette edges, flat edges can't be one
+    silhouette.clear();
+    for(int i = 0; i<silhouetteEdges; ++i) {
+        const Edge& edge = edges[i];
+
+        // Check silhouette edge
+        if (frontFace[edge.f0] != frontFace[edge.f1]) {
+            SilhouetteEdge s;
+
+            s.edge = i;
+            s.reversed = frontFace[edge.f1];
+            s.used = false;
+            s.next = firstOut[ Tail(s) ];
+            firstOut[ Tail(s) ] = silhouette.size();
+            silhouette.push_back(s);
+        }
+    }
+
+    if (cache)
+        silhouetteCache.Insert(lightPos, margin, silhouette);
+}
+
+// Find silhouette edges for light in object space
+void ShadowMesh::ExtractSilhouette(const D3DXVECTOR3& lightPos, ShadowVolume& volume) const {
+    vector<SilhouetteEdge>& silhouette = volume.silhouette;
+
+    volume.extractedLight = lightPos;
+    volume.silhouettePlane = D3DXVECTOR4(lightPos, 0.0f);
+    D3DXVec4Normalize(&volume.silhouettePlane, &volume.silhouettePlane);
+    volume.silhouettePlane.w = -D3DXVec3Dot(&lightPos, (const D3DXVECTOR3*)&volume.silhouettePlane);
+
+    // New contents for the shared buffers
+    volume.id = ++extractions;
+    if (volume.id == 0)
+        volume.id = ++extractions;
+
+    volume.umbraIndices.clear();
+    volume.penumbraIndices.clear();
+    volume.wedgeVertices.clear();
+    volume.sideStrip = true;
+
+    // Edges of a cached light no face plane lies between, or the front face
+    // tests
+    bool                  cached = silhouetteCache.IsEnabled();
+    BuildClock::time_point start;
+    if (cached) {
+        start = BuildClock::now();
+        if ( silhouetteCache.Find(lightPos, silhouette) ) {
+            for(int i = 0; i<(int)silhouette.size(); ++i) {
+                SilhouetteEdge& s = silhouette[i];
+
+                s.used = false;
+                s.next = firstOut[ Tail(s) ];
+                firstOut[ Tail(s) ] = i;
+            }
+            silhouetteCache.AddTime(true, Seconds(start));
+        }
+        else {
+            FindSilhouette(lightPos, silhouette, true);
+            silhouetteCache.AddTime(false, Seconds(start));
+        }
+    }
+    else
+        FindSilhouette(lightPos, silhouette, false);
+
+    ChainSilhouette(volume);
+    for(int i = 0; i<(int)silhouette.size(); ++i)
+        firstOut[ Tail(silhouette[i]) ] = -1;
+
+    // Umbra sides strip & penumbra wedges per loop
+    volume.loopCorners.assign(volume.loopEdges.size(), 0);
+    for(int i = 0; i+1<(int)volume.loopStarts.size(); ++i)
+        AddLoop(volume, volume.loopStarts[i], volume.loopStarts[i+1]);
+
+    volume.stats.edges = silhouette.size();
+    volume.stats.loops = volume.loopStarts.size() - 1;
+    volume.stats.wedges = volume.penumbraIndices.size()/24 + volume.wedgeVertices.size()/6;
+    volume.stats.umbraIndices = volume.umbraIndices.size();
+    volume.stats.penumbraIndices = volume.stats.wedges * 24;
+}
+
+// Winding number of closed polygon around point
+static int Winding(const vector<D3DXVECTOR2>& polygon, int begin, int end, const D3DXVECTOR2& p) {
+    int winding = 0;
+
+    for(int i = begin; i<end; ++i) {
+        const D3DXVECTOR2& a = polygon[i];
+        const D3DXVECTOR2& b = polygon[i+1 < end ? i+1 : begin];
+        float side = (b.x - a.x) * (p.y - a.y) - (p.x - a.x) * (b.y - a.y);
+
+        if (a.y <= p.y) {
+            if (b.y > p.y && side > 0.0f)
+                ++winding;
+        }
+        else if (b.y <= p.y && side < 0.0f)
+            --winding;
+    }
+
+    return winding;
+}
+
+// CPU reference comparison of exact & merged wedge silhouette
+float ShadowMesh::CompareMergedUmbra(const ShadowVolume& volume, const D3DXVECTOR3& lightPos, int resolution) const {
+    const vector<SilhouetteEdge>& silhouette = volume.silhouette;
+    const vector<int>& loopEdges = volume.loopEdges;
+    const vector<int>& loopStarts = volume.loopStarts;
+    D3DXVECTOR3 minBox = vertices[0], maxBox = vertices[0];
+    D3DXVECTOR3 center, dir, u, w, up, offset;
+    vector<D3DXVECTOR2> exact, merged;
+    vector<int> exactStarts, mergedStarts;
+    D3DXVECTOR2 minPlane(FLT_MAX, FLT_MAX), maxPlane(-FLT_MAX, -FLT_MAX);
+    int shadowed = 0, differ = 0;
+    float radius, distance;
+
+    if (loopEdges.empty() || resolution <= 0)
+        return 0.0f;
+
+    // Receiver plane facing the light behind the mesh
+    for(int i = 1; i<(int)vertices.size(); ++i) {
+        D3DXVec3Minimize(&minBox, &minBox, &vertices[i]);
+        D3DXVec3Maximize(&maxBox, &maxBox, &vertices[i]);
+    }
+    center = (minBox + maxBox) * 0.5f;
+    offset = maxBox - center;
+    radius = D3DXVec3Length(&offset);
+    dir = center - lightPos;
+    D3DXVec3Normalize(&dir, &dir);
+    up = fabs(dir.y) < 0.9f ? D3DXVECTOR3(0, 1, 0) : D3DXVECTOR3(1, 0, 0);
+    D3DXVec3Cross(&u, &dir, &up);
+    D3DXVec3Normalize(&u, &u);
+    D3DXVec3Cross(&w, &dir, &u);
+    offset = center - lightPos;
+    distance = D3DXVec3Dot(&offset, &dir) + 2.0f * radius;
+
+    // Project loop vertices, merged loops keep run corners only
+    for(int i = 0; i+1<(int)loopStarts.size(); ++i) {
+        exactStarts.push_back(exact.size());
+        mergedStarts.push_back(merged.size());
+        for(int j = loopStarts[i]; j<loopStarts[i+1]; ++j) {
+            D3DXVECTOR3 ray = vertices[ Tail(silhouette[ loopEdges[j] ]) ] - lightPos;
+            float depth = D3DXVec3Dot(&ray, &dir);
+            D3DXVECTOR3 p = ray * (distance / max(depth, eps));
+            D3DXVECTOR2 plane( D3DXVec3Dot(&p, &u), D3DXVec3Dot(&p, &w) );
+
+            exact.push_back(plane);
+            if (volume.loopCorners[j])
+                merged.push_back(plane);
+            D3DXVec2Minimize(&minPlane, &minPlane, &plane);
+            D3DXVec2Maximize(&maxPlane, &maxPlane, &plane);
+        }
+    }
+    exactStarts.push_back(exact.size());
+    mergedStarts.push_back(merged.size());
+
+    // Sample both masks at pixel centers
+    for(int y = 0; y<resolution; ++y) {
+        for(int x = 0; x<resolution; ++x) {
+            D3DXVECTOR2 p( minPlane.x + (maxPlane.x - minPlane.x) * (x + 0.5f) / resolution,
+                           minPlane.y + (maxPlane.y - minPlane.y) * (y + 0.5f) / resolution );
+            int exactWinding = 0, mergedWinding = 0;
+
+            for(int i = 0; i+1<(int)exactStarts.size(); ++i) {
+                exactWinding += Winding(exact, exactStarts[i], exactStarts[i+1], p);
+                mergedWinding += Winding(merged, mergedStarts[i], mergedStarts[i+1], p);
+            }
+
+            if (exactWinding != 0)
+                ++shadowed;
+            if ((exactWinding != 0) != (mergedWinding != 0))
+                ++differ;
+        }
+    }
+
+    return shadowed > 0 ? static_cast<float>(differ) / shadowed : 0.0f;
+}
+
+// Clip homogeneous polygon to inner side of plane dot(plane, v) >= 0
+static void ClipPolygon(vector<D3DXVECTOR4>& polygon, const D3DXVECTOR4& plane) {
+    vector<D3DXVECTOR4> clipped;
+
+    for(int i = 0; i<(int)polygon.size(); ++i) {
+        const D3DXVECTOR4& a = polygon[i];
+        const D3DXVECTOR4& b = polygon[(i + 1) % polygon.size()];
+        float da = D3DXVec4Dot(&plane, &a);
+        float db = D3DXVec4Dot(&plane, &b);
+
+        if (da >= 0.0f)
+            clipped.push_back(a);
+        if ((da >= 0.0f) != (db >= 0.0f))
+            clipped.push_back( a + (b - a) * (da / (da - db)) );
+    }
+    polygon.swap(clipped);
+}
+
+float ShadowMesh::GetUmbraArea(const ShadowVolume& volume, const D3DXVECTOR3& lightPos, float extrusion,
+                                   const D3DXMATRIX& worldViewProj, float width, float height) const {
+    // Clip space planes -w <= x, y <= w, 0 <= z <= w
+    static const D3DXVECTOR4 planes[6] = { D3DXVECTOR4( 1, 0, 0, 1), D3DXVECTOR4(-1, 0, 0, 1),
+                                           D3DXVECTOR4( 0, 1, 0, 1), D3DXVECTOR4( 0,-1, 0, 1),
+                                           D3DXVECTOR4( 0, 0, 1, 0), D3DXVECTOR4( 0, 0,-1, 1) };
+    vector<D3DXVECTOR4> polygon;
+    float area = 0.0f;
+
+    for(int i = 0; i<(int)volume.silhouette.size(); ++i) {
+        D3DXVECTOR3 quad[4];
+        float       quadArea = 0.0f;
+
+        // Side quad as the vertex shader extrudes it
+        quad[0] = vertices[ Tail(volume.silhouette[i]) ];
+        quad[1] = vertices[ Head(volume.silhouette[i]) ];
+        for(int j = 0; j<2; ++j) {
+            D3DXVECTOR3 dir = quad[1 - j] - lightPos;
+            float       length = D3DXVec3Length(&dir);
+
+            quad[2 + j] = quad[1 - j] + dir * ((extrusion - length) / max(length, eps));
+        }
+
+        polygon.resize(4);
+        for(int j = 0; j<4; ++j)
+            D3DXVec3Transform(&polygon[j], &quad[j], &worldViewProj);
+        for(int j = 0; j<6 && !polygon.empty(); ++j)
+            ClipPolygon(polygon, planes[j]);
+
+        // Shoelace over projected polygon, both facings count
+        for(int j = 0; j<(int)polygon.size(); ++j) {
+            const D3DXVECTOR4& a = polygon[j];
+            const D3DXVECTOR4& b = polygon[(j + 1) % polygon.size()];
+
+            quadArea += (a.x / a.w) * (b.y / b.w) - (b.x / b.w) * (a.y / a.w);
+        }
+        area += fabs(quadArea) * 0.125f * width * height;
+    }
+
+    return area;
+}
+
+// 6 texels: v0, v1, normals of v0 & v1, then of faces f0 & f1
+void ShadowMesh::GetEdgeRecord(int edge, D3DXVECTOR4 record[edgeRecordSize]) const {
+    const Edge& e = edges[edge];
+
+    record[0] = D3DXVECTOR4(vertices[e.v0], 1.0f);
+    record[1] = D3DXVECTOR4(vertices[e.v1], 1.0f);
+    record[2] = D3DXVECTOR4(normals[e.v0], 0.0f);
+    record[3] = D3DXVECTOR4(normals[e.v1], 0.0f);
+    record[4] = D3DXVECTOR4(*(const D3DXVECTOR3*)&facePlanes[e.f0], 0.0f);
+    record[5] = D3DXVECTOR4(*(const D3DXVECTOR3*)&facePlanes[e.f1], 0.0f);
+}
+
+// Same selects & arithmetic as FetchEdgeVertex in Lighting.fx
+void ShadowMesh::ExpandEdgeCorner(const D3DXVECTOR4 record[edgeRecordSize], int corner, ShadowVert& vertex) {
+    const float*       c = edgeCorners[corner];
+    const D3DXVECTOR3& v0 = *(const D3DXVECTOR3*)&record[0];
+    const D3DXVECTOR3& v1 = *(const D3DXVECTOR3*)&record[1];
+    const D3DXVECTOR3& n0 = *(const D3DXVECTOR3*)&record[2];
+    const D3DXVECTOR3& n1 = *(const D3DXVECTOR3*)&record[3];
+    const D3DXVECTOR3& f0 = *(const D3DXVECTOR3*)&record[4];
+    const D3DXVECTOR3& f1 = *(const D3DXVECTOR3*)&record[5];
+    D3DXVECTOR3        edge = v1 - v0;
+
+    vertex.vertex = c[0] > 0.5f ? v1 : v0;
+    vertex.vertNormal0 = c[0] > 0.5f ? n1 : n0;
+    vertex.vertNormal1 = c[0] > 0.5f ? n0 : n1;
+    vertex.normal = D3DXVECTOR4(c[1] > 0.5f ? f1 : f0, c[2]);
+    vertex.backNormal = c[1] > 0.5f ? f0 : f1;
+    vertex.edge = D3DXVECTOR4(edge * c[3], c[3]);
+}
+
+// Expanded corners of the silhouette edges against the static ones
+int ShadowMesh::CheckEdgeInstances(const ShadowVolume& volume) const {
+    D3DXVECTOR4 record[edgeRecordSize];
+    ShadowVert  expanded;
+    int         mismatches = 0;
+
+    if ( shadowVertices.empty() )
+        return -1;
+
+    for(int i = 0; i<(int)volume.silhouette.size(); ++i) {
+        int edge = volume.silhouette[i].edge;
+
+        GetEdgeRecord(edge, record);
+        for(int k = 0; k<6; ++k) {
+            ExpandEdgeCorner(record, k, expanded);
+            if ( memcmp(&expanded, &shadowVertices[ ShadowIndex(edge, k) ], sizeof(ShadowVert)) != 0 )
+                ++mismatches;
+        }
+    }
+    return mismatches;
+}
+
+// Check when mesh faces are closed
+bool ShadowMesh::IsClosed() const {
+    return edges.size() > 0;
+}
+
+VertexCacheStats ShadowMesh::GetCapCacheStats() const {
+    if ( capIndices.empty() )
+        return capCacheStats;
+    return VertexCache::Simulate(&capIndices[0], capIndices.size() / 3, GetShadowVertexCount(), sizeof(ShadowVert));
+}
+
+// Extraction reads vertices, normals, edges & planes only
+void ShadowMesh::ReleaseCpuCopies() {
+    capCacheStats = GetCapCacheStats();
+    vector<Face>().swap(faces);
+    vector<ShadowVert>().swap(shadowVertices);
+    vector<int>().swap(capIndices);
+}
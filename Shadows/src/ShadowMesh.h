@@ -0,0 +1,199 @@
+#pragma once
+#include "ShadowTypes.h"
+#include "SilhouetteCache.h"
+#include "VertexCache.h"
+
+// Seconds spent in the steps of ShadowMesh::Build
+struct GeometryBuildTimes
+{
+    double normals;         // vertex normal accumulation
+    double edges;           // adjacency, face planes & flat regions
+    double shadowVertices;  // shadow vertices, 6 per silhouette edge
+    double caps;            // static umbra cap indices
+    double upload;          // shadow vertex buffer, ShadowGeometry only
+};
+
+// Edges of the last ShadowMesh::Build by the angle of their faces
+struct EdgeClasses
+{
+    int    flat;            // inside a flat region, never on a silhouette
+    int    convex;
+    int    concave;
+    size_t prunedBytes;     // shadow vertices not made for flat edges
+};
+
+//-----------------------------------------------------------------------------
+// ShadowMesh class
+// Welded geometry, adjacency, shadow vertices & cap indices of one shadow
+// caster, and silhouette extraction into volume index lists. No device: the
+// library part of the shadow code, ShadowGeometry adds the buffers & draws.
+// Read only after Build, so instances share it: each instance keeps its own
+// ShadowVolume per light. Extraction scratch & the silhouette cache are the
+// exception, so one mesh extracts on one thread at a time.
+//-----------------------------------------------------------------------------
+class ShadowMesh {
+protected:
+    std::vector<D3DXVECTOR3> vertices;
+    std::vector<D3DXVECTOR3> normals;
+    std::vector<Face> faces;            // released with CPU copies
+    std::vector<D3DXVECTOR4> facePlanes;// normal & distance
+    std::vector<Edge> edges;            // silhouette candidates, then flat ones
+    int silhouetteEdges;                // candidates, the ones extraction tests
+    std::vector<ShadowVert> shadowVertices; // released with CPU copies
+    std::vector<int> capIndices;        // umbra caps, same for every light, released with CPU copies
+    int capIndexCount;                  // kept after the release
+    VertexCacheStats capCacheStats;     // of the released caps
+    float error;
+    GeometryBuildTimes buildTimes;     // of the last Build
+    EdgeClasses edgeClasses;           // of the last Build
+
+    // Extraction scratch, all -1 between extractions. Extraction of one
+    // mesh runs on one thread at a time.
+    mutable std::vector<int> firstOut;  // first silhouette edge leaving vertex
+    mutable SilhouetteCache silhouetteCache; // shared by instances & lights
+
+    // Add edge if it is unique
+    void AddEdge(EdgeMap& edgeMap, int v0, int v1, int face);
+
+    // Find mesh edges
+    void MakeEdges();
+
+    // Give coplanar neighbour faces the plane of the first face of their
+    // region, region of each face is its first face
+    void MergeFlatFaces(std::vector<int>& region);
+
+    // Count edge classes & move flat ones behind the silhouette candidates
+    void PruneFlatEdges(const std::vector<int>& region);
+
+    // Front face tests & silhouette edges for light, added to the cache if
+    // cache is set
+    void FindSilhouette(const D3DXVECTOR3& lightPos, std::vector<SilhouetteEdge>& silhouette, bool cache) const;
+
+    // Add edge to penumbra volume
+    void AddEdgeToVolume(ShadowVolume& volume, const int i) const;
+
+    // Add one wedge spanning silhouette edges first..last
+    void AddMergedWedge(ShadowVolume& volume, const SilhouetteEdge& first, const SilhouetteEdge& last) const;
+
+    // Walk oriented silhouette edges into closed loops
+    void ChainSilhouette(ShadowVolume& volume) const;
+
+    // Emit the side strip of a loop & a wedge per run of near collinear edges
+    void AddLoop(ShadowVolume& volume, int begin, int end) const;
+
+    // Shadow vertex corner of edge, corners as in wedgePattern. The cap
+    // corners 0 & 4 of all edges come first, two per edge, the other four
+    // of each silhouette candidate follow together: caps read one dense
+    // block, a side or wedge two short runs. Flat edges have cap corners only.
+    int ShadowIndex(int edge, int corner) const {
+        static const int sideCorner[6] = { 0, 0, 1, 2, 0, 3 };
+        return corner == 0 || corner == 4 ? 2*edge + corner/4 : 2*static_cast<int>( edges.size() ) + 4*edge + sideCorner[corner];
+    }
+
+    // Silhouette edge endpoints & umbra vertices
+    int Tail(const SilhouetteEdge& s) const { return s.reversed ? edges[s.edge].v1 : edges[s.edge].v0; }
+    int Head(const SilhouetteEdge& s) const { return s.reversed ? edges[s.edge].v0 : edges[s.edge].v1; }
+    int TailFront(const SilhouetteEdge& s) const;
+    int TailBack(const SilhouetteEdge& s) const;
+    int HeadFront(const SilhouetteEdge& s) const;
+    int HeadBack(const SilhouetteEdge& s) const;
+
+    // Drop faces, shadow vertices & caps once they are uploaded
+    void ReleaseCpuCopies();
+
+public:
+    // Penumbra wedge triangles over its 6 vertices: v0 unextruded, outer, inner, v1 ...
+    static const int wedgePattern[24];
+
+    // Umbra side of one edge over the same vertices, right for either
+    // orientation since the lit face decides which end extrudes
+    static const int umbraPattern[6];
+
+    // Corners of an edge instance in ShadowIndex order: end (0 at v0, 1 at
+    // v1), face of the normal (0 f0, 1 f1), normal w & edge w
+    static const float edgeCorners[6][4];
+
+    // Texels of an edge record, see GetEdgeRecord
+    static const int edgeRecordSize = 6;
+
+    // Max angle between edges merged into one penumbra wedge and its chord,
+    // 0 disables merging. Umbra sides always follow every edge.
+    static float mergeAngle;
+
+    // Max angle between faces of one flat region, whose inner edges are
+    // dropped from extraction & the shadow vertices. 0 keeps every edge.
+    static float flatAngle;
+
+    ShadowMesh();
+
+    // Merge vertices within eps on every axis & point faces at the merged ones.
+    // Face normals are kept.
+    static void Weld(std::vector<D3DXVECTOR3>& vertices, std::vector<Face>& faces);
+
+    // Faces in vertex cache order & vertices renumbered in first use order,
+    // after Weld. Edges & shadow vertices built from them follow the order.
+    static void OptimizeOrder(std::vector<D3DXVECTOR3>& vertices, std::vector<Face>& faces);
+
+    // Setup from welded vertices & faces. Returns false if mesh is not closed.
+    bool Build(const std::vector<D3DXVECTOR3>& meshVertices, const std::vector<Face>& meshFaces, float meshError);
+
+    // Find silhouette and fill index lists of volume. Light is in object space.
+    void ExtractSilhouette(const D3DXVECTOR3& lightPos, ShadowVolume& volume) const;
+
+    // CPU reference: fraction of umbra samples on a receiver plane behind the
+    // mesh that change when the chords of merged wedge runs replace the exact
+    // silhouette loops of the volume. Sides keep the exact loops, so this is
+    // how far the inner border of merged wedges strays from the umbra.
+    float CompareMergedUmbra(const ShadowVolume& volume, const D3DXVECTOR3& lightPos, int resolution) const;
+
+    // Screen area in pixels covered by umbra sides extruded to distance
+    // from the light, overdraw counted. Light is in object space.
+    float GetUmbraArea(const ShadowVolume& volume, const D3DXVECTOR3& lightPos, float extrusion,
+                       const D3DXMATRIX& worldViewProj, float width, float height) const;
+
+    // Edge record an instance of the edge template expands: both ends, their
+    // vertex normals & the normals of f0 & f1. Silhouette candidates only,
+    // kept after the CPU copies are released.
+    void GetEdgeRecord(int edge, D3DXVECTOR4 record[edgeRecordSize]) const;
+
+    // CPU stand-in of the instanced vertex shader: shadow vertex at corner of
+    // the edge of record
+    static void ExpandEdgeCorner(const D3DXVECTOR4 record[edgeRecordSize], int corner, ShadowVert& vertex);
+
+    // Corners of the silhouette edges of volume expanded from their records
+    // against the shadow vertices the indexed lists read, number that differ.
+    // -1 once the shadow vertices are released.
+    int CheckEdgeInstances(const ShadowVolume& volume) const;
+
+    bool IsClosed() const;
+
+    const std::vector<D3DXVECTOR3>& GetVertices() const { return vertices; }
+    int GetFaceCount() const { return facePlanes.size(); }
+    int GetEdgeCount() const { return edges.size(); }
+    int GetSilhouetteEdgeCount() const { return silhouetteEdges; }
+    const EdgeClasses& GetEdgeClasses() const { return edgeClasses; }
+
+    // Shadow vertices, 2 per edge & 4 more per silhouette candidate
+    int GetShadowVertexCount() const { return 2*edges.size() + 4*silhouetteEdges; }
+
+    // Vertex buffer contents & static cap indices into it.
+    // Empty after ShadowGeometry released the CPU copies.
+    const std::vector<ShadowVert>& GetShadowVertices() const { return shadowVertices; }
+    const std::vector<int>& GetCapIndices() const { return capIndices; }
+    // Cap indices, released or not
+    int GetCapIndexCount() const { return capIndexCount; }
+
+    // Simulated cost of drawing the caps, taken before their release
+    VertexCacheStats GetCapCacheStats() const;
+
+    // Object space simplification error
+    float GetError() const { return error; }
+
+    const GeometryBuildTimes& GetBuildTimes() const { return buildTimes; }
+
+    // Hits, memory & time saved of the silhouette cache since Build or the
+    // last ClearSilhouetteCache
+    const SilhouetteCacheStats& GetSilhouetteCacheStats() const { return silhouetteCache.GetStats(); }
+    // Drop cached silhouettes & their stats
+    void ClearSilhouetteCache() const { silhouetteCache.Clear(); }
+};
@@ -0,0 +1,270 @@
+#include "ShadowStreamer.h"
+#include "CounterRegistry.h"
+#include <algorithm>
+#include <fstream>
+
+using namespace std;
+
+size_t ShadowStreamer::budget = 0;
+int ShadowStreamer::maxLoads = 2;
+
+// Paging of the frame
+static CounterRegistry* frameCounters = CounterRegistry::Instance();
+static const int residentKb = frameCounters->Register("shadow pages resident KB");
+static const int inFlight = frameCounters->Register("shadow page loads in flight");
+static const int pagesLoaded = frameCounters->Register("shadow pages loaded");
+static const int pagesEvicted = frameCounters->Register("shadow pages evicted");
+static const int kbRead = frameCounters->Register("shadow page KB read");
+
+// Larger entries are taken as broken
+static const int maxPageElements = 1 << 26;
+
+ShadowStreamer::ShadowStreamer() : pool(NULL), loading(0) {
+    memset(&stats, 0, sizeof(stats));
+}
+
+ShadowStreamer::~ShadowStreamer() {
+    Stop();
+}
+
+// Start of frame: collect loads, evict & start new ones
+void ShadowStreamer::Update(const vector<Mesh>& meshes, const vector<Light>& lights, int nLights, const D3DXVECTOR3& eyePosition) {
+    size_t used = 0;
+
+    if (budget == 0)
+        return;
+
+    Collect();
+    FindTargets(meshes, lights, nLights, eyePosition);
+
+    // Budget goes to the most important meshes first, a level without
+    // source can't be paged in
+    for(int i = 0; i<order.size(); ++i) {
+        Target&                   target = *order[i];
+        const vector<ShadowPage>& pages = target.data->pages;
+        int                       proxy = pages.size() - 1;
+
+        target.level = target.wanted;
+        while ( target.level < proxy && (pages[target.level].offset < 0 || used + pages[target.level].bytes > budget) )
+            ++target.level;
+        if (target.level < proxy)
+            used += pages[target.level].bytes;
+    }
+
+    // Budget was lowered or wanted levels moved
+    while ( stats.residentBytes + stats.loadingBytes > budget && EvictOne() )
+        ;
+
+    // Missing levels by priority, unwanted ones make room
+    for(int i = 0; i<order.size() && loading < maxLoads; ++i) {
+        const Target& target = *order[i];
+        ShadowPage&   page = target.data->pages[target.level];
+
+        if ( target.level + 1 == target.data->pages.size() || target.data->shadowLods[target.level] || page.loading )
+            continue;
+        while ( stats.residentBytes + stats.loadingBytes + page.bytes > budget && EvictOne() )
+            ;
+        if (stats.residentBytes + stats.loadingBytes + page.bytes > budget)
+            break;
+        Load(target.data, target.level);
+    }
+
+    frameCounters->Set(residentKb, stats.residentBytes / 1024.0);
+    frameCounters->Set(inFlight, loading);
+}
+
+// Put finished loads in place
+void ShadowStreamer::Collect() {
+    vector<Page> finished;
+
+    {
+        lock_guard<std::mutex> lock(doneMutex);
+        finished.swap(done);
+    }
+
+    for(int i = 0; i<finished.size(); ++i) {
+        const Page& result = finished[i];
+        ShadowPage& page = result.data->pages[result.level];
+
+        page.loading = false;
+        --loading;
+        stats.loadingBytes -= page.bytes;
+        stats.bytesRead += result.bytesRead;
+        frameCounters->Add(kbRead, result.bytesRead / 1024.0);
+
+        // Not tried again
+        if (!result.geometry) {
+            page.offset = -1;
+            ++stats.failures;
+            continue;
+        }
+
+        result.data->shadowLods[result.level] = result.geometry;
+        stats.residentBytes += page.bytes;
+        ++stats.residentLevels;
+        ++stats.loads;
+        frameCounters->Add(pagesLoaded, 1);
+    }
+}
+
+// Instances in range of a drawn light want their level, nearer & larger
+// ones first
+void ShadowStreamer::FindTargets(const vector<Mesh>& meshes, const vector<Light>& lights, int nLights, const D3DXVECTOR3& eyePosition) {
+    targets.clear();
+    order.clear();
+
+    for(int i = 0; i<meshes.size(); ++i) {
+        const Mesh&     mesh = meshes[i];
+        const MeshData* data = mesh.GetData();
+        Bounds          bounds;
+
+        if ( !data || data->pages.size() < 2 )
+            continue;
+
+        mesh.GetBounds(bounds);
+        D3DXVECTOR3 boxMin(bounds.min[0], bounds.min[1], bounds.min[2]);
+        D3DXVECTOR3 boxMax(bounds.max[0], bounds.max[1], bounds.max[2]);
+        D3DXVECTOR3 center = (boxMin + boxMax) * 0.5f;
+        float       radius = D3DXVec3Length( &(boxMax - center) );
+        int         proxy = data->pages.size() - 1;
+        bool        lit = false;
+
+        map<const MeshData*, Target>::iterator found = targets.find(data);
+        if ( found == targets.end() ) {
+            Target target = { data, 0.0f, proxy, proxy };
+            found = targets.insert( make_pair(data, target) ).first;
+        }
+
+        Target& target = found->second;
+        for(int j = 0; j<nLights && j<lights.size(); ++j) {
+            const Light& light = lights[j];
+            D3DXVECTOR3  toLight = D3DXVECTOR3(light.position.x, light.position.y, light.position.z) - center;
+
+            if (D3DXVec3Length(&toLight) - radius < light.range) {
+                target.wanted = min( target.wanted, mesh.FindShadowLod(eyePosition, light) );
+                lit = true;
+            }
+        }
+        if (lit)
+            target.priority = max( target.priority, radius / max( D3DXVec3Length( &(center - eyePosition) ), 1e-3f ) );
+    }
+
+    for(map<const MeshData*, Target>::iterator i = targets.begin(); i != targets.end(); ++i)
+        order.push_back(&i->second);
+    sort(order.begin(), order.end(), HigherPriority);
+}
+
+bool ShadowStreamer::HigherPriority(const Target* a, const Target* b) {
+    return a->priority > b->priority;
+}
+
+// Drop a level nobody wants, lowest priority first
+bool ShadowStreamer::EvictOne() {
+    for(int i = order.size() - 1; i >= 0; --i) {
+        const Target&                  target = *order[i];
+        vector<ShadowGeometry*>&       shadowLods = target.data->shadowLods;
+
+        for(int level = shadowLods.size() - 2; level >= 0; --level) {
+            if ( level == target.level || !shadowLods[level] )
+                continue;
+
+            delete shadowLods[level];
+            shadowLods[level] = NULL;
+            stats.residentBytes -= target.data->pages[level].bytes;
+            --stats.residentLevels;
+            ++stats.evictions;
+            frameCounters->Add(pagesEvicted, 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Build level from its page on a worker
+void ShadowStreamer::Load(const MeshData* data, int level) {
+    ShadowPage& page = data->pages[level];
+    string      fileName = data->pageFile;
+    long long   offset = page.offset;
+    float       error = page.error;
+
+    page.loading = true;
+    ++loading;
+    stats.loadingBytes += page.bytes;
+    if (!pool)
+        pool = new Utils::WorkerPool(maxLoads);
+
+    pool->Push( [this, data, level, fileName, offset, error] {
+        vector<D3DXVECTOR3> vertices;
+        vector<Face>        faces;
+        Page                result = { data, level, NULL, 0 };
+
+        if ( ReadPage(fileName, offset, vertices, faces, result.bytesRead) ) {
+            result.geometry = new ShadowGeometry();
+            if ( !result.geometry->Build(vertices, faces, error) ) {
+                delete result.geometry;
+                result.geometry = NULL;
+            }
+        }
+
+        lock_guard<std::mutex> lock(doneMutex);
+        done.push_back(result);
+    } );
+}
+
+// Wait for loads in flight & drop them, before meshes are freed
+void ShadowStreamer::Stop() {
+    delete pool;
+    pool = NULL;
+    Collect();
+    targets.clear();
+    order.clear();
+}
+
+// Page file entry, returns its offset
+long long ShadowStreamer::WritePage(ostream& page, const vector<D3DXVECTOR3>& vertices, const vector<Face>& faces) {
+    long long offset = page.tellp();
+    int       counts[2] = { (int)vertices.size(), (int)faces.size() };
+
+    page.write((const char*)counts, sizeof(counts));
+    page.write((const char*)&vertices[0], vertices.size() * sizeof(D3DXVECTOR3));
+    for(int i = 0; i<faces.size(); ++i) {
+        int ids[3] = { faces[i].v0, faces[i].v1, faces[i].v2 };
+
+        page.write((const char*)ids, sizeof(ids));
+        page.write((const char*)&faces[i].normal, sizeof(D3DXVECTOR3));
+    }
+    return page ? offset : -1;
+}
+
+// Read entry at offset, false if file or entry is broken
+bool ShadowStreamer::ReadPage(const string& fileName, long long offset, vector<D3DXVECTOR3>& vertices, vector<Face>& faces, long long& bytesRead) {
+    ifstream file(fileName.c_str(), ios::binary);
+    int      counts[2];
+
+    bytesRead = 0;
+    if ( !file.seekg(offset) || !file.read((char*)counts, sizeof(counts)) )
+        return false;
+    if ( counts[0] <= 0 || counts[1] <= 0 || counts[0] > maxPageElements || counts[1] > maxPageElements )
+        return false;
+
+    vertices.resize(counts[0]);
+    faces.resize(counts[1]);
+    file.read((char*)&vertices[0], vertices.size() * sizeof(D3DXVECTOR3));
+    for(int i = 0; i<faces.size() && file; ++i) {
+        Face& face = faces[i];
+        int   ids[3];
+
+        file.read((char*)ids, sizeof(ids));
+        file.read((char*)&face.normal, sizeof(D3DXVECTOR3));
+        if ( ids[0] < 0 || ids[0] >= counts[0] || ids[1] < 0 || ids[1] >= counts[0] || ids[2] < 0 || ids[2] >= counts[0] )
+            return false;
+        face.v0 = ids[0];
+        face.v1 = ids[1];
+        face.v2 = ids[2];
+    }
+    if (!file)
+        return false;
+
+    bytesRead = sizeof(counts) + vertices.size() * sizeof(D3DXVECTOR3) + faces.size() * (sizeof(int) * 3 + sizeof(D3DXVECTOR3));
+    return true;
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include "Mesh.h"
+#include "WorkerPool.h"
+#include <map>
+#include <mutex>
+#include <vector>
+
+// Residency & paging of shadow levels since start
+struct StreamingStats
+{
+    size_t    residentBytes;    // paged levels in memory, proxies not counted
+    size_t    loadingBytes;     // paged levels being built
+    int       residentLevels;
+    int       loads;            // pages built
+    int       evictions;        // pages dropped
+    int       failures;         // pages that could not be read or built
+    long long bytesRead;        // page file sources
+};
+
+//-----------------------------------------------------------------------------
+// ShadowStreamer class
+// Pages shadow levels of meshes in & out under a memory budget. The coarsest
+// level of a mesh is its proxy & stays resident, finer ones are rebuilt on
+// worker threads from the sources MeshData wrote to its page file, and
+// instances draw the next coarser resident level while theirs is in flight.
+// Each frame a mesh wants the level its instances choose for the camera,
+// from instances in range of a drawn light only, & its priority is the
+// largest size over eye distance of them. Meshes get their levels by
+// priority until the budget is used, the rest settle for coarser ones.
+// Levels nobody wants stay cached while there is room & are evicted lowest
+// priority first. Render thread only, apart from the loads.
+//-----------------------------------------------------------------------------
+class ShadowStreamer
+{
+private:
+    // What a mesh gets this frame
+    struct Target
+    {
+        const MeshData* data;
+        float           priority;
+        int             wanted;     // level of the instances
+        int             level;      // level within budget
+    };
+
+    // Finished load
+    struct Page
+    {
+        const MeshData* data;
+        int             level;
+        ShadowGeometry* geometry;   // NULL if it failed
+        long long       bytesRead;
+    };
+
+    std::map<const MeshData*, Target>   targets;    // of this frame
+    std::vector<Target*>                order;      // by priority, highest first
+    std::vector<Page>                   done;       // guarded by doneMutex
+    std::mutex                          doneMutex;
+    Utils::WorkerPool*                  pool;
+    int                                 loading;
+    StreamingStats                      stats;
+
+    // Put finished loads in place
+    void Collect();
+
+    static bool HigherPriority(const Target* a, const Target* b);
+
+    // Level of each mesh & priority order
+    void FindTargets(const std::vector<Mesh>& meshes, const std::vector<Light>& lights, int nLights, const D3DXVECTOR3& eyePosition);
+
+    // Drop a level nobody wants, lowest priority first. False if there is none.
+    bool EvictOne();
+
+    void Load(const MeshData* data, int level);
+
+    ShadowStreamer(const ShadowStreamer&);
+    ShadowStreamer& operator = (const ShadowStreamer&);
+
+public:
+    // Bytes of resident & loading levels before the proxies, 0 keeps all
+    // levels resident. Read when meshes load.
+    static size_t budget;
+
+    // Page loads in flight, also the number of loading threads
+    static int maxLoads;
+
+    ShadowStreamer();
+    ~ShadowStreamer();
+
+    // Start of frame: collect loads, evict & start new ones
+    void Update(const std::vector<Mesh>& meshes, const std::vector<Light>& lights, int nLights, const D3DXVECTOR3& eyePosition);
+
+    // Wait for loads in flight & drop them, before meshes are freed
+    void Stop();
+
+    const StreamingStats& GetStats() const { return stats; }
+
+    // Page file entry: vertex & face counts, positions, then indices &
+    // normal of each face. Returns offset of the entry.
+    static long long WritePage(std::ostream& page, const std::vector<D3DXVECTOR3>& vertices, const std::vector<Face>& faces);
+
+    // Read entry at offset, false if file or entry is broken
+    static bool ReadPage(const std::string& fileName, long long offset, std::vector<D3DXVECTOR3>& vertices, std::vector<Face>& faces, long long& bytesRead);
+};
@@ -0,0 +1,86 @@
+#pragma once
+#include "ShadowMath.h"
+#include <cstring>
+#include <map>
+#include <vector>
+
+// Shadow vertex of an edge end, 6 per edge. Matches ShadowVertFormat::Decl.
+struct ShadowVert
+{
+	D3DXVECTOR3 vertex;
+	D3DXVECTOR3 vertNormal0;
+	D3DXVECTOR3 vertNormal1;
+	D3DXVECTOR4 normal;
+	D3DXVECTOR3 backNormal;
+	D3DXVECTOR4 edge;
+};
+
+struct Face
+{
+	int v0, v1, v2;
+	bool re0, re1, re2;
+	int e0, e1, e2;
+	D3DXVECTOR3 normal;
+};
+
+struct Edge
+{
+	int v0, v1;
+	int f0, f1;
+};
+typedef std::pair<int, int>	int_pair;
+typedef std::pair<int_pair, Edge> edge_pair;
+typedef std::map<int_pair, Edge> EdgeMap;
+
+// Silhouette edge oriented with the lit face on the left
+struct SilhouetteEdge
+{
+	int  edge;
+	bool reversed; // walked from v1 to v0
+	int  next;     // next edge leaving the same vertex
+	bool used;
+};
+
+// Work done by last silhouette extraction
+struct SilhouetteStats
+{
+	int edges;          // silhouette edges
+	int loops;          // chained loops
+	int wedges;         // penumbra wedges after merging
+	int umbraIndices;   // side indices
+	int penumbraIndices;// static + merged wedge indices
+};
+
+// Silhouette & volume lists of one caster instance for one light.
+// Indices point into the static shadow vertices of the geometry.
+struct ShadowVolume
+{
+	std::vector<int> umbraIndices; // sides, caps are static
+	std::vector<int> penumbraIndices;
+	std::vector<ShadowVert> wedgeVertices; // merged penumbra wedges, 6 per wedge
+
+	std::vector<SilhouetteEdge> silhouette;
+	std::vector<int> loopEdges;   // silhouette edges chained into loops
+	std::vector<int> loopStarts;  // first entry of each loop, plus end
+	std::vector<char> loopCorners;// entry starts a wedge run
+	SilhouetteStats stats;
+
+	D3DXVECTOR4 silhouettePlane; // plane containing silhouette
+	D3DXVECTOR4 silhouetteCenter; // center of the silhouette
+	D3DXVECTOR3 extractedLight; // object space light the lists were made for
+	bool sideStrip; // sides are triangle strip, not list
+	unsigned int id; // unique per extraction, 0 before the first one
+
+	// Light in object space, valid while light and transform version match
+	D3DXVECTOR4 objectLight;
+	D3DXVECTOR4 worldLight;
+	unsigned int transformVersion; // 0 before the first light
+
+	ShadowVolume() :
+		sideStrip(false),
+		id(0),
+		transformVersion(0)
+	{
+		memset(&stats, 0, sizeof(stats));
+	}
+};
@@ -0,0 +1,146 @@
+#include "SilhouetteCache.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+using namespace std;
+
+size_t SilhouetteCache::maxBytes = 64 * 1024;
+float SilhouetteCache::cellFraction = 0.05f;
+
+// Rounding of a front face test, relative to the size of its terms
+static const float testRoundoff = 8.0f * FLT_EPSILON;
+
+// List & map nodes of an entry
+static const size_t nodeBytes = 64;
+
+SilhouetteCache::SilhouetteCache() : cellSize(0.0f), normalScale(1.0f), planeDistance(0.0f), missSeconds(0.0) {
+    memset(&stats, 0, sizeof(stats));
+}
+
+void SilhouetteCache::Setup(float meshRadius, float maxNormalLength, float maxPlaneDistance) {
+    Clear();
+    cellSize = meshRadius * cellFraction;
+    normalScale = max(maxNormalLength, 1.0f);
+    planeDistance = maxPlaneDistance;
+}
+
+void SilhouetteCache::Clear() {
+    entries.clear();
+    cells.clear();
+    missSeconds = 0.0;
+    memset(&stats, 0, sizeof(stats));
+}
+
+SilhouetteCache::Cell SilhouetteCache::GetCell(const D3DXVECTOR3& light) const {
+    const float limit = 1e9f;
+    Cell        cell;
+
+    cell.x = static_cast<int>( max(-limit, min(limit, floor(light.x / cellSize))) );
+    cell.y = static_cast<int>( max(-limit, min(limit, floor(light.y / cellSize))) );
+    cell.z = static_cast<int>( max(-limit, min(limit, floor(light.z / cellSize))) );
+    return cell;
+}
+
+size_t SilhouetteCache::GetBytes(const Entry& entry) {
+    return sizeof(Entry) + nodeBytes + entry.code.capacity();
+}
+
+// Cached silhouette edges for light
+bool SilhouetteCache::Find(const D3DXVECTOR3& light, vector<SilhouetteEdge>& silhouette) {
+    map<Cell, EntryList::iterator>::iterator cell = cells.find( GetCell(light) );
+
+    if (cell == cells.end()) {
+        ++stats.misses;
+        return false;
+    }
+
+    // Plane distances move at most |light - cached| times the normal
+    // length, rounding of both tests aside
+    EntryList::iterator entry = cell->second;
+    D3DXVECTOR3 offset = light - entry->light;
+    float       slack = testRoundoff * ( (D3DXVec3Length(&light) + D3DXVec3Length(&entry->light)) * normalScale + planeDistance );
+    if (D3DXVec3Length(&offset) * normalScale + slack >= entry->margin) {
+        ++stats.misses;
+        return false;
+    }
+
+    // Most recently used
+    entries.splice(entries.begin(), entries, entry);
+    ++stats.hits;
+
+    const unsigned char* code = entry->code.empty() ? NULL : &entry->code[0];
+    int                  edge = 0;
+    silhouette.resize(entry->edges);
+    for(int i = 0; i<entry->edges; ++i) {
+        unsigned int value = 0;
+
+        for(int shift = 0; ; shift += 7) {
+            value |= (*code & 0x7f) << shift;
+            if ( !(*code++ & 0x80) )
+                break;
+        }
+        edge += value >> 1;
+        silhouette[i].edge = edge;
+        silhouette[i].reversed = (value & 1) != 0;
+    }
+    return true;
+}
+
+// Add silhouette extracted for light
+void SilhouetteCache::Insert(const D3DXVECTOR3& light, float margin, const vector<SilhouetteEdge>& silhouette) {
+    EntryList added(1);
+    Entry&    entry = added.front();
+    int       edge = 0;
+
+    // Faces through the light, nothing is provable
+    if (margin <= 0.0f)
+        return;
+
+    entry.cell = GetCell(light);
+    entry.light = light;
+    entry.margin = margin;
+    entry.edges = silhouette.size();
+    for(int i = 0; i<(int)silhouette.size(); ++i) {
+        unsigned int value = (static_cast<unsigned int>(silhouette[i].edge - edge) << 1) | (silhouette[i].reversed ? 1 : 0);
+
+        edge = silhouette[i].edge;
+        while (value >= 0x80) {
+            entry.code.push_back( static_cast<unsigned char>(value | 0x80) );
+            value >>= 7;
+        }
+        entry.code.push_back( static_cast<unsigned char>(value) );
+    }
+    entry.code.shrink_to_fit();
+    if (GetBytes(entry) > maxBytes)
+        return;
+
+    // A light of the cell that missed replaces the one cached there
+    map<Cell, EntryList::iterator>::iterator old = cells.find(entry.cell);
+    if (old != cells.end()) {
+        stats.bytes -= GetBytes(*old->second);
+        entries.erase(old->second);
+        cells.erase(old);
+    }
+
+    while (stats.bytes + GetBytes(entry) > maxBytes) {
+        stats.bytes -= GetBytes( entries.back() );
+        cells.erase( entries.back().cell );
+        entries.pop_back();
+        ++stats.evictions;
+    }
+
+    stats.bytes += GetBytes(entry);
+    entries.splice(entries.begin(), added);
+    cells[ entries.front().cell ] = entries.begin();
+    stats.entries = cells.size();
+}
+
+// Time of the edge search on a miss, or of decoding on a hit
+void SilhouetteCache::AddTime(bool hit, double seconds) {
+    if (!hit) {
+        missSeconds += (seconds - missSeconds) / max(stats.misses, 1);
+        return;
+    }
+    stats.secondsSaved += missSeconds - seconds;
+}
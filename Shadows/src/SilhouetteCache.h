@@ -0,0 +1,92 @@
+#pragma once
+#include "ShadowTypes.h"
+#include <list>
+#include <map>
+#include <vector>
+
+// Work of a silhouette cache since it was set up
+struct SilhouetteCacheStats
+{
+    int    hits;
+    int    misses;          // no entry, or light too far from the cached one
+    int    evictions;       // least recently used entries dropped for memory
+    int    entries;
+    size_t bytes;           // entries & their coded edges
+    double secondsSaved;    // face tests skipped, less the decoding
+
+    float GetHitRate() const { return hits + misses > 0 ? static_cast<float>(hits) / (hits + misses) : 0.0f; }
+};
+
+//-----------------------------------------------------------------------------
+// SilhouetteCache class
+// Silhouette edges of one mesh for the object space lights it was extracted
+// for, least recently used first out. Lights are looked up by the grid cell
+// they fall in. An entry is only returned if every face plane is farther
+// from the cached light than the new light is, so no face changes facing and
+// the edges are exactly the ones extraction would find. Edges are stored in
+// extraction order as delta coded varints, the reversed flag in the low bit.
+//-----------------------------------------------------------------------------
+class SilhouetteCache
+{
+private:
+    struct Cell
+    {
+        int x, y, z;
+
+        bool operator < (const Cell& cell) const {
+            return x < cell.x || (x == cell.x && (y < cell.y || (y == cell.y && z < cell.z)));
+        }
+    };
+
+    struct Entry
+    {
+        Cell                       cell;
+        D3DXVECTOR3                light;   // extracted for
+        float                      margin;  // distance to the nearest face plane
+        int                        edges;
+        std::vector<unsigned char> code;
+    };
+    typedef std::list<Entry> EntryList;
+
+    EntryList entries;                              // most recently used first
+    std::map<Cell, EntryList::iterator> cells;
+    float cellSize;
+    float normalScale;      // longest face normal, at least 1
+    float planeDistance;    // farthest face plane from the origin
+    double missSeconds;     // mean edge search of a miss
+    SilhouetteCacheStats stats;
+
+    Cell GetCell(const D3DXVECTOR3& light) const;
+
+    // Entry bytes counted against maxBytes
+    static size_t GetBytes(const Entry& entry);
+
+public:
+    // Memory of each mesh's cache, 0 disables caching
+    static size_t maxBytes;
+
+    // Grid cell edge over mesh radius
+    static float cellFraction;
+
+    SilhouetteCache();
+
+    // Empty the cache for a mesh of radius. Face normals may be up to
+    // maxNormalLength long, planes up to maxPlaneDistance from the origin.
+    void Setup(float meshRadius, float maxNormalLength, float maxPlaneDistance);
+    void Clear();
+
+    bool IsEnabled() const { return maxBytes > 0 && cellSize > 0.0f; }
+
+    // Cached silhouette edges for light, in extraction order with next &
+    // used unset. False if no entry is provably the same.
+    bool Find(const D3DXVECTOR3& light, std::vector<SilhouetteEdge>& silhouette);
+
+    // Add silhouette extracted for light, margin is the smallest distance of
+    // the light to a face plane as the front face tests computed it
+    void Insert(const D3DXVECTOR3& light, float margin, const std::vector<SilhouetteEdge>& silhouette);
+
+    // Time of the edge search on a miss, or of decoding on a hit
+    void AddTime(bool hit, double seconds);
+
+    const SilhouetteCacheStats& GetStats() const { return stats; }
+};
@@ -0,0 +1,300 @@
+#include "Simplifier.h"
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
+using namespace std;
+
+// Minimal cosine between face normal before and after collapse
+static const float flipThreshold = 0.2f;
+
+Simplifier::Quadric::Quadric() {
+    fill(m, m + 10, 0.0);
+}
+
+Simplifier::Quadric::Quadric(double a, double b, double c, double d) {
+    m[0] = a*a; m[1] = a*b; m[2] = a*c; m[3] = a*d;
+    m[4] = b*b; m[5] = b*c; m[6] = b*d;
+    m[7] = c*c; m[8] = c*d;
+    m[9] = d*d;
+}
+
+Simplifier::Quadric& Simplifier::Quadric::operator += (const Quadric& q) {
+    for(int i = 0; i<10; ++i)
+        m[i] += q.m[i];
+    return *this;
+}
+
+double Simplifier::Quadric::Error(const D3DXVECTOR3& v) const {
+    double x = v.x, y = v.y, z = v.z;
+
+    return m[0]*x*x + 2*m[1]*x*y + 2*m[2]*x*z + 2*m[3]*x
+         + m[4]*y*y + 2*m[5]*y*z + 2*m[6]*y
+         + m[7]*z*z + 2*m[8]*z
+         + m[9];
+}
+
+// Unnormalized face normal, length is twice the area
+static D3DXVECTOR3 FaceCross(const D3DXVECTOR3& v0, const D3DXVECTOR3& v1, const D3DXVECTOR3& v2) {
+    D3DXVECTOR3 normal;
+
+    D3DXVec3Cross(&normal, &(v1 - v0), &(v2 - v0));
+    return normal;
+}
+
+Simplifier::Simplifier(const vector<D3DXVECTOR3>& vertices, const vector<Face>& faces) :
+    vertices(vertices),
+    quadrics(vertices.size()),
+    stamps(vertices.size(), 0),
+    removedVertices(vertices.size(), false),
+    faces(faces),
+    removedFaces(faces.size(), false),
+    vertexFaces(vertices.size()),
+    numFaces(faces.size()),
+    maxCost(0.0)
+{
+    // Plane quadrics
+    for(int i = 0; i<faces.size(); ++i) {
+        const Face& face = faces[i];
+        D3DXVECTOR3 normal = FaceCross(vertices[face.v0], vertices[face.v1], vertices[face.v2]);
+
+        if (D3DXVec3Length(&normal) > 0.0f) {
+            D3DXVec3Normalize(&normal, &normal);
+
+            Quadric q(normal.x, normal.y, normal.z, -D3DXVec3Dot(&normal, &vertices[face.v0]));
+            quadrics[face.v0] += q;
+            quadrics[face.v1] += q;
+            quadrics[face.v2] += q;
+        }
+
+        vertexFaces[face.v0].push_back(i);
+        vertexFaces[face.v1].push_back(i);
+        vertexFaces[face.v2].push_back(i);
+    }
+
+    // Each edge of closed mesh is seen twice, take it once
+    for(int i = 0; i<faces.size(); ++i) {
+        const Face& face = faces[i];
+
+        if (face.v0 < face.v1) heap.push( ComputeCollapse(face.v0, face.v1) );
+        if (face.v1 < face.v2) heap.push( ComputeCollapse(face.v1, face.v2) );
+        if (face.v2 < face.v0) heap.push( ComputeCollapse(face.v2, face.v0) );
+    }
+}
+
+Simplifier::Collapse Simplifier::ComputeCollapse(int v0, int v1) const {
+    Collapse collapse;
+    Quadric  q = quadrics[v0];
+    double   det;
+
+    q += quadrics[v1];
+
+    collapse.v0 = v0;
+    collapse.v1 = v1;
+    collapse.stamp0 = stamps[v0];
+    collapse.stamp1 = stamps[v1];
+
+    // Solve for minimum of quadric
+    det = q.m[0] * (q.m[4]*q.m[7] - q.m[5]*q.m[5])
+        - q.m[1] * (q.m[1]*q.m[7] - q.m[5]*q.m[2])
+        + q.m[2] * (q.m[1]*q.m[5] - q.m[4]*q.m[2]);
+
+    if (fabs(det) > 1e-10) {
+        double x = -( q.m[3] * (q.m[4]*q.m[7] - q.m[5]*q.m[5])
+                    - q.m[1] * (q.m[6]*q.m[7] - q.m[5]*q.m[8])
+                    + q.m[2] * (q.m[6]*q.m[5] - q.m[4]*q.m[8]) ) / det;
+        double y = -( q.m[0] * (q.m[6]*q.m[7] - q.m[8]*q.m[5])
+                    - q.m[3] * (q.m[1]*q.m[7] - q.m[5]*q.m[2])
+                    + q.m[2] * (q.m[1]*q.m[8] - q.m[6]*q.m[2]) ) / det;
+        double z = -( q.m[0] * (q.m[4]*q.m[8] - q.m[5]*q.m[6])
+                    - q.m[1] * (q.m[1]*q.m[8] - q.m[6]*q.m[2])
+                    + q.m[3] * (q.m[1]*q.m[5] - q.m[4]*q.m[2]) ) / det;
+
+        collapse.target = D3DXVECTOR3( static_cast<float>(x), static_cast<float>(y), static_cast<float>(z) );
+
+        // Don't let badly conditioned solutions fly away from the edge
+        D3DXVECTOR3 mid = (vertices[v0] + vertices[v1]) * 0.5f;
+        if ( D3DXVec3Length( &(collapse.target - mid) ) <= D3DXVec3Length( &(vertices[v1] - vertices[v0]) ) ) {
+            collapse.cost = q.Error(collapse.target);
+            return collapse;
+        }
+    }
+
+    // Choose best of endpoints & midpoint
+    D3DXVECTOR3 candidates[3] = { vertices[v0], vertices[v1], (vertices[v0] + vertices[v1]) * 0.5f };
+
+    collapse.target = candidates[0];
+    collapse.cost = q.Error(candidates[0]);
+    for(int i = 1; i<3; ++i) {
+        double cost = q.Error(candidates[i]);
+        if (cost < collapse.cost) {
+            collapse.cost = cost;
+            collapse.target = candidates[i];
+        }
+    }
+
+    return collapse;
+}
+
+void Simplifier::GetNeighbours(int v, vector<int>& neighbours) const {
+    neighbours.clear();
+    for(int i = 0; i<vertexFaces[v].size(); ++i) {
+        const Face& face = faces[ vertexFaces[v][i] ];
+
+        if (face.v0 != v) neighbours.push_back(face.v0);
+        if (face.v1 != v) neighbours.push_back(face.v1);
+        if (face.v2 != v) neighbours.push_back(face.v2);
+    }
+    sort( neighbours.begin(), neighbours.end() );
+    neighbours.erase( unique(neighbours.begin(), neighbours.end()), neighbours.end() );
+}
+
+bool Simplifier::IsValid(const Collapse& collapse) const {
+    int v0 = collapse.v0;
+    int v1 = collapse.v1;
+    vector<int> n0, n1, common;
+    int shared = 0;
+
+    // Outdated
+    if ( removedVertices[v0] || removedVertices[v1] || stamps[v0] != collapse.stamp0 || stamps[v1] != collapse.stamp1 )
+        return false;
+
+    // Closed manifold edge has exactly two faces
+    for(int i = 0; i<vertexFaces[v0].size(); ++i) {
+        const Face& face = faces[ vertexFaces[v0][i] ];
+        if (face.v0 == v1 || face.v1 == v1 || face.v2 == v1)
+            ++shared;
+    }
+    if (shared != 2)
+        return false;
+
+    // Link condition: only the two opposite vertices may be common neighbours
+    GetNeighbours(v0, n0);
+    GetNeighbours(v1, n1);
+    set_intersection( n0.begin(), n0.end(), n1.begin(), n1.end(), back_inserter(common) );
+    if (common.size() != 2)
+        return false;
+
+    // Faces must not flip or degenerate
+    for(int k = 0; k<2; ++k) {
+        int v = k == 0 ? v0 : v1;
+
+        for(int i = 0; i<vertexFaces[v].size(); ++i) {
+            const Face& face = faces[ vertexFaces[v][i] ];
+            int ids[3] = { face.v0, face.v1, face.v2 };
+            D3DXVECTOR3 p[3];
+
+            // Faces around the edge are removed
+            if ( (ids[0] == v0 || ids[1] == v0 || ids[2] == v0) && (ids[0] == v1 || ids[1] == v1 || ids[2] == v1) )
+                continue;
+
+            for(int j = 0; j<3; ++j)
+                p[j] = (ids[j] == v0 || ids[j] == v1) ? collapse.target : vertices[ ids[j] ];
+
+            D3DXVECTOR3 before = FaceCross(vertices[face.v0], vertices[face.v1], vertices[face.v2]);
+            D3DXVECTOR3 after = FaceCross(p[0], p[1], p[2]);
+            float lenBefore = D3DXVec3Length(&before);
+            float lenAfter = D3DXVec3Length(&after);
+
+            if (lenAfter <= eps * lenBefore)
+                return false;
+            if (D3DXVec3Dot(&before, &after) < flipThreshold * lenBefore * lenAfter)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+void Simplifier::Apply(const Collapse& collapse) {
+    int v0 = collapse.v0;
+    int v1 = collapse.v1;
+    vector<int> neighbours;
+
+    for(int i = 0; i<vertexFaces[v1].size(); ++i) {
+        int  f = vertexFaces[v1][i];
+        Face& face = faces[f];
+
+        if (face.v0 == v0 || face.v1 == v0 || face.v2 == v0) {
+            // Remove face from the fans of its other vertices
+            int ids[3] = { face.v0, face.v1, face.v2 };
+
+            removedFaces[f] = true;
+            --numFaces;
+            for(int j = 0; j<3; ++j) {
+                if (ids[j] != v1) {
+                    vector<int>& fan = vertexFaces[ ids[j] ];
+                    fan.erase( remove(fan.begin(), fan.end(), f), fan.end() );
+                }
+            }
+        }
+        else {
+            if (face.v0 == v1) face.v0 = v0;
+            if (face.v1 == v1) face.v1 = v0;
+            if (face.v2 == v1) face.v2 = v0;
+            vertexFaces[v0].push_back(f);
+        }
+    }
+    vertexFaces[v1].clear();
+
+    vertices[v0] = collapse.target;
+    quadrics[v0] += quadrics[v1];
+    removedVertices[v1] = true;
+    ++stamps[v0];
+    ++stamps[v1];
+    maxCost = max(maxCost, collapse.cost);
+
+    // New candidates around merged vertex
+    GetNeighbours(v0, neighbours);
+    for(int i = 0; i<neighbours.size(); ++i)
+        heap.push( ComputeCollapse(v0, neighbours[i]) );
+}
+
+bool Simplifier::Simplify(int targetFaces) {
+    int startFaces = numFaces;
+
+    targetFaces = max(targetFaces, 4);
+    while ( numFaces > targetFaces && !heap.empty() ) {
+        Collapse collapse = heap.top();
+        heap.pop();
+
+        if ( IsValid(collapse) )
+            Apply(collapse);
+    }
+
+    return numFaces < startFaces;
+}
+
+int Simplifier::GetNumFaces() const {
+    return numFaces;
+}
+
+float Simplifier::GetError() const {
+    return static_cast<float>( sqrt(maxCost) );
+}
+
+void Simplifier::GetResult(vector<D3DXVECTOR3>& vertices, vector<Face>& faces) const {
+    vector<int> remap(this->vertices.size(), -1);
+
+    vertices.clear();
+    faces.clear();
+    for(int i = 0; i<this->vertices.size(); ++i) {
+        if (!removedVertices[i] && !vertexFaces[i].empty()) {
+            remap[i] = vertices.size();
+            vertices.push_back(this->vertices[i]);
+        }
+    }
+
+    for(int i = 0; i<this->faces.size(); ++i) {
+        if (!removedFaces[i]) {
+            Face face = this->faces[i];
+
+            face.v0 = remap[face.v0];
+            face.v1 = remap[face.v1];
+            face.v2 = remap[face.v2];
+            face.normal = FaceCross(vertices[face.v0], vertices[face.v1], vertices[face.v2]);
+            D3DXVec3Normalize(&face.normal, &face.normal);
+            faces.push_back(face);
+        }
+    }
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include "ShadowTypes.h"
+#include <queue>
+
+//-----------------------------------------------------------------------------
+// Simplifier class
+// Quadric error metric edge-collapse simplification of welded closed meshes.
+// Collapses keep the surface a closed 2-manifold (link condition test), so
+// the simplified levels are still accepted by MakeEdges.
+// Simplify can be called repeatedly with decreasing targets to build a chain.
+//-----------------------------------------------------------------------------
+class Simplifier
+{
+private:
+    // Symmetric 4x4 matrix: a2 ab ac ad b2 bc bd c2 cd d2
+    struct Quadric
+    {
+        double m[10];
+
+        Quadric();
+        Quadric(double a, double b, double c, double d);
+        Quadric& operator += (const Quadric& q);
+        double Error(const D3DXVECTOR3& v) const;
+    };
+
+    // Candidate collapse of v1 into v0
+    struct Collapse
+    {
+        double cost;
+        int v0, v1;
+        int stamp0, stamp1;
+        D3DXVECTOR3 target;
+
+        // Cheapest on top of the heap
+        bool operator < (const Collapse& other) const { return cost > other.cost; }
+    };
+
+    std::vector<D3DXVECTOR3> vertices;
+    std::vector<Quadric> quadrics;
+    std::vector<int> stamps;
+    std::vector<bool> removedVertices;
+    std::vector<Face> faces;
+    std::vector<bool> removedFaces;
+    std::vector< std::vector<int> > vertexFaces;
+    std::priority_queue<Collapse> heap;
+    int numFaces;
+    double maxCost;
+
+    // Find best position & cost for edge collapse
+    Collapse ComputeCollapse(int v0, int v1) const;
+
+    // Check manifold, closedness and face flips
+    bool IsValid(const Collapse& collapse) const;
+
+    // Collapse v1 into v0 and push new candidates
+    void Apply(const Collapse& collapse);
+
+    // Collect vertices connected to vertex
+    void GetNeighbours(int v, std::vector<int>& neighbours) const;
+
+public:
+    Simplifier(const std::vector<D3DXVECTOR3>& vertices, const std::vector<Face>& faces);
+
+    // Collapse edges until number of faces is not greater than target.
+    // Returns false if no edge could be collapsed.
+    bool Simplify(int targetFaces);
+
+    int GetNumFaces() const;
+
+    // Object space distance bound of all collapses done so far
+    float GetError() const;
+
+    // Copy remaining vertices & faces. Face adjacency is not filled.
+    void GetResult(std::vector<D3DXVECTOR3>& vertices, std::vector<Face>& faces) const;
+};
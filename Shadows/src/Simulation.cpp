@@ -0,0 +1,226 @@
+#include "Simulation.h"
+#include <chrono>
+#include <cmath>
+
+using namespace std;
+
+float Simulation::stepLength = 0.01f;
+
+// Late steps simulated at once before the clock is reset
+static const int maxLateSteps = 5;
+
+Simulation::Simulation() : scene(NULL), stop(false) {
+}
+
+Simulation::~Simulation() {
+    Stop();
+}
+
+void Simulation::Start(const Scene& scene, const SimulationState& initial) {
+    Stop();
+
+    this->scene = &scene;
+    state = initial;
+    angles.assign(scene.animations.size(), 0.0f);
+    snapshots.GetBack() = state;
+    snapshots.Publish();
+
+    stop = false;
+    thread = std::thread(&Simulation::Run, this);
+}
+
+void Simulation::Stop() {
+    stop = true;
+    if ( thread.joinable() )
+        thread.join();
+}
+
+void Simulation::Run() {
+    typedef chrono::steady_clock clock;
+
+    clock::duration   step = chrono::duration_cast<clock::duration>( chrono::duration<float>(stepLength) );
+    clock::time_point next = clock::now();
+    float             stepTime = 0.0f;
+
+    while (!stop) {
+        clock::time_point start = clock::now();
+
+        Step(stepLength);
+
+        // Running average, steps are too short to time one by one
+        stepTime += (chrono::duration<float, milli>(clock::now() - start).count() - stepTime) * 0.05f;
+        state.stepTime = stepTime;
+        ++state.step;
+
+        snapshots.GetBack() = state;
+        snapshots.Publish();
+
+        // Fixed rate, drop time we can not catch up with
+        next += step;
+        if (clock::now() - next > step * maxLateSteps)
+            next = clock::now();
+        this_thread::sleep_until(next);
+    }
+}
+
+void Simulation::Step(float length) {
+    D3DXMATRIX rotY;
+
+    {
+        lock_guard<mutex> lock(eventMutex);
+        pending.swap(events);
+    }
+
+    for(int i = 0; i<pending.size(); ++i) {
+        const InputEvent& event = pending[i];
+
+        switch (event.type) {
+            case InputEvent::Key:
+                HandleKey(event.key);
+                break;
+
+            case InputEvent::Look:
+                state.camera.yaw += event.x;
+                state.camera.pitch += event.y;
+                break;
+
+            case InputEvent::Zoom:
+                state.camera.radius -= event.x;
+                break;
+        }
+    }
+    pending.clear();
+
+    // Spin instances around Y of their parent. Transform is rebuilt from the
+    // scene each step, so rounding does not pile up over a long run.
+    if (state.animate) {
+        for(int i = 0; i<scene->animations.size(); ++i) {
+            int instance = scene->animations[i].instance;
+
+            angles[i] = fmod(angles[i] + scene->animations[i].speed * length, 2.0f * D3DX_PI);
+            D3DXMatrixRotationY(&rotY, angles[i]);
+            D3DXMatrixMultiply(&state.transforms[instance], &scene->instances[instance].transform, &rotY);
+        }
+    }
+}
+
+void Simulation::HandleKey(int key) {
+    Light& light = state.lights[0];
+
+    switch (key) {
+        // pause/contunie animation
+        case 0x50: // P-key
+            state.animate = !state.animate;
+            break;
+
+        // show/hide penumbra cone
+        case 0x52: // R-key
+            state.showPenumbraCone = !state.showPenumbraCone;
+            break;
+
+        // enable/disable shadow caster LOD
+        case 0x4F: // O-key
+            state.lodEnabled = !state.lodEnabled;
+            break;
+
+        // enable/disable silhouette edge merging
+        case 0x4D: // M-key
+            state.mergeEdges = !state.mergeEdges;
+            break;
+
+        // enable/disable instanced silhouette edges
+        case 0x49: // I-key
+            state.instancedEdges = !state.instancedEdges;
+            break;
+
+        // enable/disable clipping of shadow volumes to receivers
+        case 0x43: // C-key
+            state.clipExtrusion = !state.clipExtrusion;
+            break;
+
+        // show/hide shadow volume area
+        case 0x56: // V-key
+            state.showVolumeArea = !state.showVolumeArea;
+            break;
+
+        // show/hide simulation & render timings
+        case 0x54: // T-key
+            state.showTimings = !state.showTimings;
+            break;
+
+        // show/hide frame counters
+        case 0x4B: // K-key
+            state.showCounters = !state.showCounters;
+            break;
+
+        // enable/disable frame budget shadow quality
+        case 0x51: // Q-key
+            state.adaptiveQuality = !state.adaptiveQuality;
+            break;
+
+        // enable/disable baked shadows of static casters
+        case 0x42: // B-key
+            state.bakedShadows = !state.bakedShadows;
+            break;
+
+        // show/hide other lights
+        case 0x4C: // L-key
+            state.nLights = state.nLights == 1 ? state.lights.size() : 1;
+            break;
+
+        // increase light radius
+        case VK_OEM_PLUS:
+            light.radius += 0.02f;
+            break;
+
+        // Move 2nd light source
+        case VK_LEFT:
+            light.position.z -= 0.2f;
+            break;
+
+        case VK_RIGHT:
+            light.position.z += 0.2f;
+            break;
+
+        case VK_UP:
+            light.position.x -= 0.2f;
+            break;
+
+        case VK_DOWN:
+            light.position.x += 0.2f;
+            break;
+
+        case 0x44: // D key
+            light.position.y -= 0.2f;
+            break;
+
+        case 0x55: // U key
+            light.position.y += 0.2f;
+            break;
+
+        // decrease light radius
+        case VK_OEM_MINUS:
+            if (light.radius > 0.02) light.radius -= 0.02f;
+            break;
+    }
+}
+
+void Simulation::Post(const InputEvent& event) {
+    lock_guard<mutex> lock(eventMutex);
+    events.push_back(event);
+}
+
+void Simulation::PostKey(int key) {
+    InputEvent event = { InputEvent::Key, key, 0.0f, 0.0f };
+    Post(event);
+}
+
+void Simulation::PostLook(float yaw, float pitch) {
+    InputEvent event = { InputEvent::Look, 0, yaw, pitch };
+    Post(event);
+}
+
+void Simulation::PostZoom(float distance) {
+    InputEvent event = { InputEvent::Zoom, 0, distance, 0.0f };
+    Post(event);
+}
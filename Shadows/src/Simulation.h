@@ -0,0 +1,94 @@
+#pragma once
+#include "Scene.h"
+#include "TripleBuffer.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Scene state & switches owned by the simulation, the renderer gets copies
+struct SimulationState
+{
+    std::vector<D3DXMATRIX> transforms;     // per instance relative to parent, spinning ones change
+    std::vector<Light>      lights;
+    Camera                  camera;
+    int                     nLights;
+    bool                    animate;
+    bool                    showPenumbraCone;
+    bool                    showVolumeArea;
+    bool                    showTimings;
+    bool                    showCounters;
+    bool                    lodEnabled;
+    bool                    mergeEdges;
+    bool                    instancedEdges;     // silhouettes from edge ids where the device can
+    bool                    clipExtrusion;
+    bool                    adaptiveQuality;    // shadow quality follows the frame budget
+    bool                    bakedShadows;       // static casters from the lightmap where it matches
+    unsigned int            step;           // steps simulated so far
+    float                   stepTime;       // average ms per step of the simulation thread
+};
+
+// Window input for the simulation thread
+struct InputEvent
+{
+    enum Type { Key, Look, Zoom };
+
+    Type  type;
+    int   key;      // virtual key code
+    float x, y;     // look angles or zoom distance
+};
+
+//-----------------------------------------------------------------------------
+// Simulation class
+// Advances animation & applies input on its own thread at a fixed rate. Each
+// step is published through a triple buffer, so rendering a slow frame never
+// holds back animation or input and the renderer always draws the newest
+// complete step.
+//-----------------------------------------------------------------------------
+class Simulation
+{
+private:
+    const Scene*                            scene;
+    SimulationState                         state;
+    std::vector<float>                      angles;     // per animation, spin from scene transform
+    Utils::TripleBuffer<SimulationState>    snapshots;
+
+    std::vector<InputEvent>                 events;
+    std::vector<InputEvent>                 pending;    // simulation thread copy
+    std::mutex                              eventMutex;
+
+    std::thread                             thread;
+    std::atomic<bool>                       stop;
+
+    // Thread body
+    void Run();
+
+    // Apply queued input & animation for step seconds
+    void Step(float length);
+
+    void HandleKey(int key);
+    void Post(const InputEvent& event);
+
+    Simulation(const Simulation&);
+    Simulation& operator = (const Simulation&);
+
+public:
+    // Seconds per step
+    static float stepLength;
+
+    Simulation();
+    ~Simulation();
+
+    // Start thread from initial state, scene stays unchanged while running
+    void Start(const Scene& scene, const SimulationState& initial);
+    void Stop();
+
+    // Input, called from the window thread
+    void PostKey(int key);
+    void PostLook(float yaw, float pitch);
+    void PostZoom(float distance);
+
+    // Renderer: take newest step, false if there is none since last call
+    bool Acquire() { return snapshots.Acquire(); }
+    const SimulationState& GetState() const { return snapshots.GetFront(); }
+};
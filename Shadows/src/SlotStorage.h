@@ -0,0 +1,241 @@
+#pragma once
+
+#include <assert.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Utils
+{
+	//-----------------------------------------------------------------------------
+	// KeyTable class
+	// Interns string keys into dense ids, so a key is hashed only once.
+	//-----------------------------------------------------------------------------
+	class KeyTable
+	{
+	private:
+		std::unordered_map<std::string, unsigned int>	ids;
+		std::vector<const std::string*>					names;
+
+	public:
+		static const unsigned int invalid = 0xFFFFFFFF;
+
+		// Id of key, new keys get next free id
+		unsigned int Intern(const std::string& key)
+		{
+			std::pair<std::unordered_map<std::string, unsigned int>::iterator, bool> insPair = ids.insert( std::make_pair(key, (unsigned int)names.size()) );
+			if ( insPair.second ) names.push_back(&insPair.first->first);
+			return insPair.first->second;
+		}
+
+		// Id of key or invalid, never adds keys
+		unsigned int Find(const std::string& key) const
+		{
+			std::unordered_map<std::string, unsigned int>::const_iterator i = ids.find(key);
+			return i != ids.end() ? i->second : invalid;
+		}
+
+		const std::string& GetName(unsigned int id) const
+		{
+			return *names[id];
+		}
+
+		int GetSize() const
+		{
+			return names.size();
+		}
+	};
+
+	//-----------------------------------------------------------------------------
+	// SlotStorage class
+	// Storage backend on a dense slot map. Handles are 32-bit values of slot
+	// index and generation: copies are free and a handle of a removed item is
+	// detected in O(1). Items are reference counted explicitly with
+	// Acquire/Release. Objects are kept densely for iteration.
+	// Not thread safe, use from the owning thread only.
+	//-----------------------------------------------------------------------------
+	template <class Type>
+	class SlotStorage
+	{
+	public:
+		// Slot index in low bits, generation in high bits. Zero is never valid.
+		class handle
+		{
+		private:
+			unsigned int	value;
+
+			friend class SlotStorage;
+			handle(unsigned int index, unsigned int generation) : value( index | (generation << indexBits) ) {}
+
+		public:
+			handle() : value(0) {}
+
+			unsigned int GetIndex() const { return value & indexMask; }
+			unsigned int GetGeneration() const { return value >> indexBits; }
+			unsigned int GetValue() const { return value; }
+
+			bool operator == (const handle& other) const { return value == other.value; }
+			bool operator != (const handle& other) const { return value != other.value; }
+		};
+
+		static const unsigned int indexBits = 20;
+		static const unsigned int indexMask = (1 << indexBits) - 1;
+		static const unsigned int generationMask = (1 << (32 - indexBits)) - 1;
+
+	private:
+		// Slot points into dense arrays or to next free slot
+		struct slot
+		{
+			unsigned int	generation;
+			unsigned int	dense;
+		};
+
+		std::vector<slot>			slots;
+		unsigned int				freeSlot;
+		KeyTable					keys;
+		std::vector<handle>			keyHandles;	// by key id
+
+		// Dense items
+		std::vector<Type*>			objects;
+		std::vector<int>			refCounts;
+		std::vector<unsigned int>	itemKeys;
+		std::vector<unsigned int>	itemSlots;
+
+		// Remove item from dense arrays, moving the last one into its place
+		void Erase(unsigned int index)
+		{
+			slot&			removed = slots[index];
+			unsigned int	dense = removed.dense;
+			unsigned int	last = objects.size() - 1;
+
+			delete objects[dense];
+			keyHandles[ itemKeys[dense] ] = handle();
+
+			objects[dense] = objects[last];
+			refCounts[dense] = refCounts[last];
+			itemKeys[dense] = itemKeys[last];
+			itemSlots[dense] = itemSlots[last];
+			slots[ itemSlots[dense] ].dense = dense;
+
+			objects.pop_back();
+			refCounts.pop_back();
+			itemKeys.pop_back();
+			itemSlots.pop_back();
+
+			// Generation 0 is skipped so handle value 0 stays invalid
+			removed.generation = (removed.generation + 1) & generationMask;
+			if ( removed.generation == 0 ) removed.generation = 1;
+			removed.dense = freeSlot;
+			freeSlot = index;
+		}
+
+	public:
+		// Create & free
+		SlotStorage() : freeSlot(indexMask) {}
+		~SlotStorage()
+		{
+			for(int i = 0; i<(int)objects.size(); ++i)
+			{
+				delete objects[i];
+			}
+		}
+
+		// Intern key for later lookups without hashing
+		unsigned int Intern(const std::string& key)
+		{
+			unsigned int id = keys.Intern(key);
+			if ( id >= keyHandles.size() ) keyHandles.resize(id + 1);
+			return id;
+		}
+
+		// Add object with one reference. Storage owns it.
+		// If key is occupied returns empty handle and doesn't take the object.
+		handle Add(unsigned int key, Type* object)
+		{
+			unsigned int index;
+
+			assert( key < keyHandles.size() );
+			if ( IsValid(keyHandles[key]) ) return handle();
+
+			if ( freeSlot != indexMask )
+			{
+				index = freeSlot;
+				freeSlot = slots[index].dense;
+			}
+			else
+			{
+				slot newSlot = { 1, 0 };
+				index = slots.size();
+				assert( index < indexMask );
+				slots.push_back(newSlot);
+			}
+
+			slots[index].dense = objects.size();
+			objects.push_back(object);
+			refCounts.push_back(1);
+			itemKeys.push_back(key);
+			itemSlots.push_back(index);
+
+			keyHandles[key] = handle(index, slots[index].generation);
+			return keyHandles[key];
+		}
+
+		handle Add(const std::string& key, Type* object)
+		{
+			return Add(Intern(key), object);
+		}
+
+		// Find item by interned key, doesn't add reference
+		handle Get(unsigned int key) const
+		{
+			return key < keyHandles.size() ? keyHandles[key] : handle();
+		}
+
+		handle Get(const std::string& key) const
+		{
+			return Get( keys.Find(key) );
+		}
+
+		// Handle points to a live item?
+		bool IsValid(const handle& item) const
+		{
+			unsigned int index = item.GetIndex();
+			return index < slots.size() && slots[index].generation == item.GetGeneration();
+		}
+
+		// Object or NULL for stale handle
+		Type* GetObject(const handle& item) const
+		{
+			return IsValid(item) ? objects[ slots[item.GetIndex()].dense ] : NULL;
+		}
+
+		const std::string& GetKey(const handle& item) const
+		{
+			return keys.GetName( itemKeys[ slots[item.GetIndex()].dense ] );
+		}
+
+		// Reference counting
+		void Acquire(const handle& item)
+		{
+			assert( IsValid(item) );
+			++refCounts[ slots[item.GetIndex()].dense ];
+		}
+
+		void Release(const handle& item)
+		{
+			assert( IsValid(item) );
+			if ( --refCounts[ slots[item.GetIndex()].dense ] == 0 ) Erase( item.GetIndex() );
+		}
+
+		// Dense iteration
+		int GetSize() const
+		{
+			return objects.size();
+		}
+
+		Type* GetObjectAt(int i) const
+		{
+			return objects[i];
+		}
+	};
+}
@@ -0,0 +1,320 @@
+#include "SoftShadowReference.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+using namespace std;
+
+ReferenceSettings SoftShadowReference::settings = { 4, 4, 64, 0.01f, 16 };
+
+// Shadow ray origins leave the surface by this part of the scene size
+static const float offsetScale = 1e-4f;
+
+static const float pi = 3.14159265f;
+
+// Integer hash, spreads pixel & pass over the seeds
+static unsigned int Hash(unsigned int x) {
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+// Uniform in [0, 1)
+static float NextRandom(unsigned int& state) {
+    state = state * 1664525U + 1013904223U;
+    return (Hash(state) >> 8) * (1.0f / 16777216.0f);
+}
+
+// Point of clip space (x, y, z, 1) in world space
+static void Unproject(const float m[16], float x, float y, float z, float out[3]) {
+    float w = x * m[3] + y * m[7] + z * m[11] + m[15];
+
+    for(int i = 0; i<3; ++i)
+        out[i] = (x * m[i] + y * m[4 + i] + z * m[8 + i] + m[12 + i]) / w;
+}
+
+SoftShadowReference::SoftShadowReference() : offset(0.0f), width(0), height(0), lightRadius(0.0f) {
+    for(int i = 0; i<16; ++i)
+        invViewProj[i] = i % 5 == 0 ? 1.0f : 0.0f;
+    light[0] = light[1] = light[2] = 0.0f;
+    memset(&stats, 0, sizeof(stats));
+}
+
+void SoftShadowReference::SetGeometry(const vector<float>& receivers, const vector<float>& casters) {
+    scene.Build(receivers);
+    this->casters.Build(casters);
+
+    const Bounds& bounds = scene.GetBounds();
+    float         diagonal = 0.0f;
+    for(int i = 0; i<3; ++i)
+        diagonal += (bounds.max[i] - bounds.min[i]) * (bounds.max[i] - bounds.min[i]);
+    offset = offsetScale * sqrt(diagonal);
+}
+
+void SoftShadowReference::SetView(const float invViewProj[16], int width, int height) {
+    for(int i = 0; i<16; ++i)
+        this->invViewProj[i] = invViewProj[i];
+    this->width = width;
+    this->height = height;
+}
+
+void SoftShadowReference::SetLight(const float position[3], float radius) {
+    for(int i = 0; i<3; ++i)
+        light[i] = position[i];
+    lightRadius = radius;
+}
+
+void SoftShadowReference::TraceReceivers(int first, int last, long long& rays) {
+    for(int y = first; y<last; ++y) {
+        for(int x = 0; x<width; ++x) {
+            int   pixel = y * width + x;
+            float clipX = 2.0f * x / width - 1.0f;
+            float clipY = 1.0f - 2.0f * y / height;
+            float origin[3], end[3], direction[3];
+            float distance = 1.0f;
+
+            // Near plane to far plane, distances are parts of it
+            Unproject(invViewProj, clipX, clipY, 0.0f, origin);
+            Unproject(invViewProj, clipX, clipY, 1.0f, end);
+            for(int i = 0; i<3; ++i)
+                direction[i] = end[i] - origin[i];
+
+            int triangle = scene.Intersect(origin, direction, distance);
+            ++rays;
+
+            receiver[pixel] = triangle >= 0;
+            if (triangle < 0)
+                continue;
+
+            float* point = &points[3 * pixel];
+            float* normal = &normals[3 * pixel];
+
+            scene.GetNormal(triangle, normal);
+            float facing = normal[0] * direction[0] + normal[1] * direction[1] + normal[2] * direction[2];
+            for(int i = 0; i<3; ++i) {
+                point[i] = origin[i] + direction[i] * distance;
+                if (facing > 0.0f)
+                    normal[i] = -normal[i];
+            }
+        }
+    }
+}
+
+// Samples are spread uniformly over the solid angle of the light, so the
+// result is the visible part of the light disk seen from the pixel
+float SoftShadowReference::SampleLight(const TriangleBvh& casters, const float point[3], const float normal[3], float offset,
+                                       const float light[3], float lightRadius, int strata, unsigned int seed, long long& rays) {
+    float        axis[3], tangent[3], bitangent[3], origin[3];
+    float        directions[3][TriangleBvh::packetSize];
+    float        lengths[TriangleBvh::packetSize];
+    int          packet = 0;
+    int          visible = 0;
+    unsigned int random = Hash(seed);
+
+    for(int i = 0; i<3; ++i)
+        axis[i] = light[i] - point[i];
+    float distance = sqrt( axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2] );
+    if (distance <= lightRadius)
+        return 1.0f;
+    for(int i = 0; i<3; ++i) {
+        axis[i] /= distance;
+        origin[i] = point[i] + normal[i] * offset;
+    }
+
+    // Frame around the light direction
+    float sign = axis[2] >= 0.0f ? 1.0f : -1.0f;
+    float a = -1.0f / (sign + axis[2]);
+    float b = axis[0] * axis[1] * a;
+    tangent[0] = 1.0f + sign * axis[0] * axis[0] * a;
+    tangent[1] = sign * b;
+    tangent[2] = -sign * axis[0];
+    bitangent[0] = b;
+    bitangent[1] = sign + axis[1] * axis[1] * a;
+    bitangent[2] = -axis[1];
+
+    float cosMax = sqrt( max(0.0f, 1.0f - lightRadius * lightRadius / (distance * distance)) );
+
+    for(int k = 0; k<strata * strata; ++k) {
+        float u = (k % strata + NextRandom(random)) / strata;
+        float v = (k / strata + NextRandom(random)) / strata;
+        float cosTheta = 1.0f - u * (1.0f - cosMax);
+        float sinTheta = sqrt( max(0.0f, 1.0f - cosTheta * cosTheta) );
+        float phi = 2.0f * pi * v;
+        float direction[3];
+
+        for(int i = 0; i<3; ++i)
+            direction[i] = (tangent[i] * cos(phi) + bitangent[i] * sin(phi)) * sinTheta + axis[i] * cosTheta;
+
+        // Below the surface the receiver shadows itself
+        if (direction[0] * normal[0] + direction[1] * normal[1] + direction[2] * normal[2] > 0.0f) {
+            float along = distance * sinTheta;
+
+            for(int i = 0; i<3; ++i)
+                directions[i][packet] = direction[i];
+            lengths[packet++] = distance * cosTheta - sqrt( max(0.0f, lightRadius * lightRadius - along * along) );
+        }
+
+        if (packet == TriangleBvh::packetSize || (k == strata * strata - 1 && packet > 0)) {
+            for(int i = packet; i<TriangleBvh::packetSize; ++i)
+                lengths[i] = 0.0f;
+
+            int blocked = casters.Occluded(origin, directions, lengths);
+            for(int i = 0; i<packet; ++i)
+                visible += !(blocked & (1 << i));
+            rays += packet;
+            packet = 0;
+        }
+    }
+
+    return static_cast<float>(visible) / (strata * strata);
+}
+
+float SoftShadowReference::SamplePixel(int pixel, int pass, long long& rays) const {
+    return SampleLight(casters, &points[3 * pixel], &normals[3 * pixel], offset, light, lightRadius, settings.strata, pixel * 0x9e3779b9U + pass, rays);
+}
+
+int SoftShadowReference::RefineTile(int x0, int y0, int pass, long long& rays) {
+    int active = 0;
+
+    for(int y = y0; y<min(y0 + settings.tileSize, height); ++y) {
+        for(int x = x0; x<min(x0 + settings.tileSize, width); ++x) {
+            int pixel = y * width + x;
+            int k = passes[pixel];
+
+            if (!receiver[pixel])
+                continue;
+
+            // Standard error of the mean over passes
+            if (k >= settings.minPasses) {
+                float mean = sum[pixel] / k;
+                float variance = max(0.0f, sumSquares[pixel] - k * mean * mean) / (k - 1);
+
+                if (sqrt(variance / k) < settings.tolerance)
+                    continue;
+            }
+
+            float value = SamplePixel(pixel, pass, rays);
+            sum[pixel] += value;
+            sumSquares[pixel] += value * value;
+            ++passes[pixel];
+            ++active;
+        }
+    }
+
+    return active;
+}
+
+void SoftShadowReference::Compute(Utils::WorkerPool& pool) {
+    typedef chrono::steady_clock clock;
+
+    clock::time_point start = clock::now();
+    int               numPixels = width * height;
+    int               tilesX = (width + settings.tileSize - 1) / settings.tileSize;
+    int               tilesY = (height + settings.tileSize - 1) / settings.tileSize;
+    vector<long long> rays(tilesX * tilesY);
+    vector<int>       active(tilesX * tilesY);
+
+    memset(&stats, 0, sizeof(stats));
+    points.resize(3 * numPixels);
+    normals.resize(3 * numPixels);
+    receiver.assign(numPixels, 0);
+    sum.assign(numPixels, 0.0f);
+    sumSquares.assign(numPixels, 0.0f);
+    passes.assign(numPixels, 0);
+
+    // Receivers, a row of tiles per job
+    for(int i = 0; i<tilesY; ++i) {
+        int first = i * settings.tileSize;
+        int last = min(first + settings.tileSize, height);
+
+        rays[i] = 0;
+        pool.Push( [this, first, last, &rays, i] { TraceReceivers(first, last, rays[i]); } );
+    }
+    pool.Wait();
+    for(int i = 0; i<tilesY; ++i)
+        stats.primaryRays += rays[i];
+
+    // Passes until all pixels settle
+    for(int pass = 0; pass<settings.maxPasses; ++pass) {
+        for(int i = 0; i<tilesX * tilesY; ++i) {
+            int x0 = (i % tilesX) * settings.tileSize;
+            int y0 = (i / tilesX) * settings.tileSize;
+
+            rays[i] = 0;
+            pool.Push( [this, x0, y0, pass, &rays, &active, i] { active[i] = RefineTile(x0, y0, pass, rays[i]); } );
+        }
+        pool.Wait();
+
+        stats.activePixels = 0;
+        for(int i = 0; i<tilesX * tilesY; ++i) {
+            stats.shadowRays += rays[i];
+            stats.activePixels += active[i];
+        }
+        ++stats.passes;
+        if (stats.activePixels == 0)
+            break;
+    }
+
+    visibility.resize(numPixels);
+    for(int i = 0; i<numPixels; ++i)
+        visibility[i] = receiver[i] && passes[i] > 0 ? sum[i] / passes[i] : -1.0f;
+
+    stats.seconds = chrono::duration<double>(clock::now() - start).count();
+}
+
+VisibilityError SoftShadowReference::Compare(const vector<float>& reference, const vector<float>& approximation) {
+    VisibilityError error;
+    double          absSum = 0.0, squareSum = 0.0;
+    double          penumbraAbsSum = 0.0, penumbraSquareSum = 0.0;
+    int             over = 0;
+
+    memset(&error, 0, sizeof(error));
+    for(int i = 0; i<(int)min(reference.size(), approximation.size()); ++i) {
+        if (reference[i] < 0.0f || approximation[i] < 0.0f)
+            continue;
+
+        float difference = fabs(approximation[i] - reference[i]);
+
+        ++error.pixels;
+        absSum += difference;
+        squareSum += difference * difference;
+        error.max = max(error.max, difference);
+        over += difference > 0.1f;
+        if (reference[i] > 0.0f && reference[i] < 1.0f) {
+            ++error.penumbraPixels;
+            penumbraAbsSum += difference;
+            penumbraSquareSum += difference * difference;
+        }
+    }
+
+    if (error.pixels > 0) {
+        error.meanAbs = static_cast<float>(absSum / error.pixels);
+        error.rms = static_cast<float>( sqrt(squareSum / error.pixels) );
+        error.overTenth = static_cast<float>(over) / error.pixels;
+    }
+    if (error.penumbraPixels > 0) {
+        error.penumbraMeanAbs = static_cast<float>(penumbraAbsSum / error.penumbraPixels);
+        error.penumbraRms = static_cast<float>( sqrt(penumbraSquareSum / error.penumbraPixels) );
+    }
+    return error;
+}
+
+bool SoftShadowReference::WriteImage(const string& fileName, const vector<float>& values, int width, int height) {
+    ofstream              file(fileName.c_str(), ios::binary);
+    vector<unsigned char> bytes(width * height);
+
+    if (!file)
+        return false;
+
+    for(int i = 0; i<(int)bytes.size() && i<(int)values.size(); ++i)
+        bytes[i] = static_cast<unsigned char>( max(0.0f, min(1.0f, values[i])) * 255.0f + 0.5f );
+
+    file << "P5\n" << width << " " << height << "\n255\n";
+    file.write( reinterpret_cast<const char*>(&bytes[0]), bytes.size() );
+    return file.good();
+}
@@ -0,0 +1,119 @@
+#pragma once
+#include "TriangleBvh.h"
+#include "WorkerPool.h"
+#include <string>
+#include <vector>
+
+// Sampling of the reference, see SoftShadowReference::settings
+struct ReferenceSettings
+{
+    int   strata;       // light is split in strata x strata cells, one sample each per pass
+    int   minPasses;    // passes before a pixel may stop
+    int   maxPasses;
+    float tolerance;    // pixel stops when standard error of its visibility is below
+    int   tileSize;     // pixels per side of one job
+};
+
+// Work of the last Compute
+struct ReferenceStats
+{
+    long long primaryRays;
+    long long shadowRays;
+    int       passes;
+    int       activePixels;     // refined by the last pass
+    double    seconds;
+
+    double GetRaysPerSecond() const { return seconds > 0.0 ? (primaryRays + shadowRays) / seconds : 0.0; }
+};
+
+// Approximate visibility against the reference
+struct VisibilityError
+{
+    int   pixels;               // compared pixels
+    float meanAbs;
+    float rms;
+    float max;
+    float overTenth;            // fraction of pixels off by more than 0.1
+    int   penumbraPixels;       // reference strictly between umbra & lit
+    float penumbraMeanAbs;
+    float penumbraRms;
+};
+
+//-----------------------------------------------------------------------------
+// SoftShadowReference class
+// Ground truth visibility of a spherical light per pixel by ray tracing. Each
+// pixel casts a camera ray to find its receiver point, then shadow rays to
+// stratified points of the light cone, four rays per packet. Passes add a
+// new jittered set of strata until the pixel's estimate settles, tiles of
+// pixels run on all cores. Random numbers hang on pixel & pass only, so the
+// result does not depend on the thread count. Plain floats, runs without a
+// device.
+//-----------------------------------------------------------------------------
+class SoftShadowReference
+{
+private:
+    TriangleBvh        scene;       // camera rays
+    TriangleBvh        casters;     // shadow rays
+    float              offset;      // shadow ray origins leave the surface this far
+
+    int                width;
+    int                height;
+    float              invViewProj[16];     // row vectors, D3D clip space
+    float              light[3];
+    float              lightRadius;
+
+    // Per pixel: receiver point & normal facing the camera, pass means
+    std::vector<float> points;
+    std::vector<float> normals;
+    std::vector<char>  receiver;
+    std::vector<float> sum;
+    std::vector<float> sumSquares;
+    std::vector<int>   passes;
+    std::vector<float> visibility;  // -1 without receiver
+
+    ReferenceStats     stats;
+
+    // Camera rays of rows [first, last)
+    void TraceReceivers(int first, int last, long long& rays);
+
+    // One pass over unsettled pixels of tile, returns their count
+    int RefineTile(int x0, int y0, int pass, long long& rays);
+
+    // Fraction of pass samples of pixel reaching the light
+    float SamplePixel(int pixel, int pass, long long& rays) const;
+
+public:
+    static ReferenceSettings settings;
+
+    SoftShadowReference();
+
+    // 9 floats per triangle, world space. Receivers are all visible
+    // triangles, casters the ones that block light.
+    void SetGeometry(const std::vector<float>& receivers, const std::vector<float>& casters);
+
+    // Pixel i of a row is at clip x = 2i/width - 1 like D3D9 rasterization
+    void SetView(const float invViewProj[16], int width, int height);
+
+    void SetLight(const float position[3], float radius);
+
+    // Trace receivers & refine until every pixel settles or maxPasses
+    void Compute(Utils::WorkerPool& pool);
+
+    // Light fraction per pixel, rows top down, -1 without receiver
+    const std::vector<float>& GetVisibility() const { return visibility; }
+    const ReferenceStats& GetStats() const { return stats; }
+    int GetWidth() const { return width; }
+    int GetHeight() const { return height; }
+
+    // Fraction of strata x strata samples of a spherical light reaching point
+    // past casters, shadow rays leave the surface by offset along normal.
+    // Seed picks the jitter, directions below the surface count as blocked.
+    static float SampleLight(const TriangleBvh& casters, const float point[3], const float normal[3], float offset,
+                             const float light[3], float radius, int strata, unsigned int seed, long long& rays);
+
+    // Pixels negative in either buffer are skipped
+    static VisibilityError Compare(const std::vector<float>& reference, const std::vector<float>& approximation);
+
+    // 8 bit binary PGM, negative values black. Returns false if not written.
+    static bool WriteImage(const std::string& fileName, const std::vector<float>& values, int width, int height);
+};
@@ -1,109 +1,117 @@
 #pragma once
 
 #include <assert.h>
+#include <atomic>
+#include <functional>
 #include <map>
+#include <mutex>
 #include <iostream>
 #include <string>
+#include <vector>
+#include "WorkerPool.h"
 
 namespace Utils
 {
 	//-----------------------------------------------------------------------------
-	// Storage class	
+	// Storage class
 	// Manages resources in the collection. One item for each resource.
 	// Provides an interface with reference counting.
+	// Thread safe: items are spread over shards with own locks, reference
+	// counts are atomic. Load decodes resources on a worker pool; until then
+	// the handle shows the placeholder object.
 	//-----------------------------------------------------------------------------
-	template < class Type, class Key = std::string, class Traits = std::less<Key> >  
+	template < class Type, class Key = std::string, class Traits = std::less<Key> >
 	class Storage
 	{
 	public:
+		// Creates resource for key, returns NULL on failure. Runs on worker thread.
+		typedef std::function<Type* (const Key&)> loader;
+
 		// Reference type with ref. Counting
 		struct resource
 		{
-			Type		*object;
-			bool		copied;
-			int		refCount;
-
-            // Create & free
-			resource(const Type& obj) : copied(true), refCount(1)
-			{
-				// Copy it
-				object = new Type(obj);
-			}
-			resource(Type* obj) : object(obj), copied(false), refCount(1) 
+			Key					key;
+			std::atomic<Type*>	object;
+			std::atomic<int>	refCount;
+			std::atomic<bool>	loaded;
+			bool				ownsObject;	// false while object is a placeholder
+			int					shard;
+
+            // Create
+			resource(const Key& key, Type* obj, int shard, bool loaded) : key(key), object(obj), refCount(1), loaded(loaded), ownsObject(loaded), shard(shard)
 			{
 			}
 		};
 
 		// typedefs
-		typedef					std::pair< Key, resource >				key_pair;
-		typedef					std::map< Key, resource, Traits >		resource_map;
+		typedef					std::pair< Key, resource* >				key_pair;
+		typedef					std::map< Key, resource*, Traits >		resource_map;
 		typedef		typename	resource_map::iterator					resource_iterator;
 		typedef					std::pair< resource_iterator, bool >	insert_pair;
 
 		//-----------------------------------------------------------------------------
-		// Handle class	
+		// Handle class
 		// Provides interface to work with objects, stored in storage.
-		// Valid tests are implemented in map::iterator class.
+		// Empty handle points to no resource.
 		//-----------------------------------------------------------------------------
 		class handle
 		{
 		private:
 			// location in the collection
-			resource_iterator		location;
+			resource*		location;
 
         public:
 			// Create & free
-			handle() : location( Storage::Instance()->items.end() ) {}
-			explicit handle(const resource_iterator &location)
+			handle() : location(NULL) {}
+			// Takes over one reference of location
+			explicit handle(resource* location) : location(location)
 			{
-				this->location = location;
 			}
 			handle(const handle& handle) : location(handle.location)
 			{
-				if (location != Storage::Instance()->items.end()) Storage::Instance()->AddReference(location);
+				if (location) Storage::Instance()->AddReference(location);
 			}
-			~handle() 
-			{ 
-				if (location != Storage::Instance()->items.end()) Storage::Instance()->RemoveReference(location); 
+			~handle()
+			{
+				if (location) Storage::Instance()->RemoveReference(location);
 			}
 
-            // Get
+            // Get the only reference for change, NULL while shared or a placeholder
 			Type* Lock()
 			{
-				if (location->second.refCount == 1) return location->second.object;
+				if (location->refCount == 1 && location->loaded && location->ownsObject) return location->object;
 				else return NULL;
 			}
 
             const Type* GetObject() const
 			{
-				return location->second.object;
+				return location->object.load(std::memory_order_acquire);
 			}
 
             const Type& operator * () const
             {
-                return *(location->second.object);
+                return *GetObject();
             }
 
 			Key GetKey() const
 			{
-				return location->first;
+				return location->key;
 			}
 
 			// Operators
 			const Type* operator -> () const
 			{
-				return location->second.object;
+				return GetObject();
 			}
 
             // Copy handle
-			handle operator = (const handle& handle)
+			handle& operator = (const handle& handle)
 			{
-				// We must not compare incompatible iterators
 				if (location != handle.location)
 				{
-					if (location != Storage::Instance()->items.end()) Storage::Instance()->RemoveReference(location);
+					if (location) Storage::Instance()->RemoveReference(location);
 					location = handle.location;
-					if (location != Storage::Instance()->items.end()) Storage::Instance()->AddReference(location);
+					if (location) Storage::Instance()->AddReference(location);
 				}
 				return *this;
 			}
@@ -123,123 +131,276 @@ namespace Utils
 			// Handle is valid?
 			bool Exist() const
 			{
-				return location != Storage::Instance()->items.end();
+				return location != NULL;
+			}
+
+			// Loading is finished?
+			bool Ready() const
+			{
+				return location && location->loaded.load(std::memory_order_acquire);
 			}
 
 			// Destroy handle reference
 			void Destroy()
 			{
-				Storage::Instance()->RemoveReference(location);
+				if (location) Storage::Instance()->RemoveReference(location);
+				location = NULL;
 			}
 
 			// Clone object
 			// Because Storage don't know about key type, you must specify it yourself
 			Type* Clone() const
 			{
-				return new Type(*location->second->object);
+				return new Type(*GetObject());
 			}
 		};
 
 	protected:
 		friend class handle;
 
+		// Items with the same key hash
+		struct shard
+		{
+			std::mutex		mutex;
+			resource_map	items;
+		};
+		static const int numShards = 16;
+
         // Items
-		resource_map			items;
-		static	Storage*		instance;
+		shard							shards[numShards];
+		static	std::atomic<Storage*>	instance;
+		static	std::mutex				instanceMutex;
+
+		// Loading
+		std::atomic<Type*>				placeholder;
+		std::vector<Type*>				oldPlaceholders;	// replaced, items may still show them
+		std::mutex						placeholderMutex;
+		WorkerPool*						pool;
+		std::mutex						poolMutex;
 
         // Settings
 		bool					autoRemoveItems;
 
+		int GetShard(const Key& key) const
+		{
+			return std::hash<Key>()(key) % numShards;
+		}
+
+		WorkerPool* GetPool()
+		{
+			std::lock_guard<std::mutex> lock(poolMutex);
+			if ( !pool ) pool = new WorkerPool();
+			return pool;
+		}
+
+		void Delete(resource* item)
+		{
+			if ( item->ownsObject ) delete item->object.load();
+			delete item;
+		}
+
 		// Adds reference to item
-		void AddReference(const resource_iterator &location)
+		void AddReference(resource* location)
 		{
-			location->second.refCount++;
+			location->refCount.fetch_add(1, std::memory_order_relaxed);
 		}
 
 		// Removes reference
-		void RemoveReference(resource_iterator &location)
+		void RemoveReference(resource* location)
 		{
-			location->second.refCount--;
-			if ( location->second.refCount == 0 && autoRemoveItems ) 
+			int count = location->refCount.load(std::memory_order_relaxed);
+
+			// Others still hold the item
+			while ( count > 1 )
 			{
-				delete location->second.object;
-				items.erase(location);
+				if ( location->refCount.compare_exchange_weak(count, count - 1) ) return;
+			}
+
+			// Last reference is dropped under lock, so Get can't find dying item
+			shard& itemShard = shards[location->shard];
+			std::lock_guard<std::mutex> lock(itemShard.mutex);
+			if ( --location->refCount == 0 && autoRemoveItems )
+			{
+				Unlink(itemShard, location);
+				Delete(location);
 			}
 		}
 
+		// Removes item from its shard, unless the key went to a newer item.
+		// Shard must be locked.
+		void Unlink(shard& itemShard, resource* location)
+		{
+			resource_iterator entry = itemShard.items.find(location->key);
+			if ( entry != itemShard.items.end() && entry->second == location ) itemShard.items.erase(entry);
+		}
+
+		// Insert new item, returns NULL if key is occupied
+		resource* Insert(const Key& key, Type* object, bool loaded)
+		{
+			int				index = GetShard(key);
+			resource*		item = new resource(key, object, index, loaded);
+
+			std::lock_guard<std::mutex> lock(shards[index].mutex);
+			if ( shards[index].items.insert( key_pair(key, item) ).second ) return item;
+
+			delete item;
+			return NULL;
+		}
+
 	public:
 		// Create & free
-		Storage() : autoRemoveItems(true) {}
-		~Storage() 
+		Storage() : placeholder(NULL), pool(NULL), autoRemoveItems(true) {}
+		~Storage()
 		{
+			// Stop loading first, running jobs still release their items
+			delete pool;
+
 			// Erase all objects, that won't be erased with list
-			for(resource_iterator i = items.begin(); i != items.end(); ++i)
+			for(int i = 0; i<numShards; ++i)
 			{
-				delete i->second.object;
+				for(resource_iterator j = shards[i].items.begin(); j != shards[i].items.end(); ++j)
+				{
+					Delete(j->second);
+				}
+			}
+			delete placeholder.load();
+			for(int i = 0; i<(int)oldPlaceholders.size(); ++i)
+			{
+				delete oldPlaceholders[i];
 			}
 		}
 
 		// Returns singleton instance
 		static Storage* Instance()
 		{
-			if ( !instance ) instance = new Storage();
-			return instance;
+			Storage* storage = instance.load(std::memory_order_acquire);
+			if ( !storage )
+			{
+				std::lock_guard<std::mutex> lock(instanceMutex);
+				storage = instance.load(std::memory_order_relaxed);
+				if ( !storage )
+				{
+					storage = new Storage();
+					instance.store(storage, std::memory_order_release);
+				}
+			}
+			return storage;
 		}
 
 		// Free singleton instance
 		static void Free()
 		{
-			delete instance;
+			std::lock_guard<std::mutex> lock(instanceMutex);
+			delete instance.load();
 			instance = NULL;
 		}
 
+		// Object shown while resource is loading. Storage owns it. A replaced
+		// one stays alive until Free, loads started before still show it.
+		void SetPlaceholder(Type* object)
+		{
+			std::lock_guard<std::mutex> lock(placeholderMutex);
+			Type* old = placeholder.exchange(object);
+			if ( old ) oldPlaceholders.push_back(old);
+		}
+
 		// Add copy of resource in storage
 		// If can't return handle of occupied key return end handle
 		handle AddCopy(const Key& key, const Type& object)
 		{
-			resource		item(object);
+			Type*		copy = new Type(object);
+			resource*	item = Insert(key, copy, true);
 
-            // Try to insert item
-			insert_pair		insPair = items.insert( key_pair(key, item) );
-			// Check and return
-			if (insPair.second) return handle(insPair.first);
-			else return End();
+			if ( !item ) delete copy;
+			return handle(item);
 		}
 
 		// Add copy of resource in storage
 		// If can't return handle of occupied key return end handle
 		handle Add(const Key& key, Type* object)
 		{
-			resource		item(object);
-			// Try to insert item
-			insert_pair		insPair = items.insert( key_pair(key, item) );
-			// Check and return
-			if (insPair.second) return handle(insPair.first);
-			else return End();		
+			return handle( Insert(key, object, true) );
+		}
+
+		// Find item or start loading it on worker thread.
+		// Requests for a key that is already stored or loading share the item.
+		// A failed load leaves the storage, its handles keep the placeholder and
+		// the next Load of the key tries again.
+		handle Load(const Key& key, const loader& load)
+		{
+			int				index = GetShard(key);
+			resource*		item;
+
+			{
+				std::lock_guard<std::mutex> lock(shards[index].mutex);
+				resource_iterator location = shards[index].items.find(key);
+				if ( location != shards[index].items.end() )
+				{
+					AddReference(location->second);
+					return handle(location->second);
+				}
+
+				// One reference for the caller, one for the job
+				item = new resource(key, placeholder, index, false);
+				item->refCount = 2;
+				shards[index].items.insert( key_pair(key, item) );
+			}
+
+			GetPool()->Push( [this, item, load]
+			{
+				Type* object = load(item->key);
+				if ( object )
+				{
+					item->object.store(object, std::memory_order_release);
+					item->ownsObject = true;
+				}
+				else
+				{
+					std::lock_guard<std::mutex> lock(shards[item->shard].mutex);
+					Unlink(shards[item->shard], item);
+				}
+				item->loaded.store(true, std::memory_order_release);
+				RemoveReference(item);
+			} );
+			return handle(item);
+		}
+
+		// Block until all started loads are finished
+		void Wait()
+		{
+			GetPool()->Wait();
 		}
 
 		// Find specified object
 		handle Get(const Key& key)
 		{
-			resource_iterator location = items.find(key);
-			if ( location != items.end() ) AddReference(location);
-			return handle(location);
+			int				index = GetShard(key);
+
+			std::lock_guard<std::mutex> lock(shards[index].mutex);
+			resource_iterator location = shards[index].items.find(key);
+			if ( location == shards[index].items.end() ) return End();
+
+			AddReference(location->second);
+			return handle(location->second);
 		}
 
 		// Return end
 		handle End()
 		{
-			return handle( items.end() );
+			return handle();
 		}
 
         // Same
 		handle operator[](const Key& key)
 		{
-			return handle( items.find(key) );
+			return Get(key);
 		}
 	};
 
 	// Implementation
 	template<class T, class Key, class Traits>
-	Storage<T, Key, Traits>* Storage<T, Key, Traits>::instance;
+	std::atomic< Storage<T, Key, Traits>* > Storage<T, Key, Traits>::instance;
+
+	template<class T, class Key, class Traits>
+	std::mutex Storage<T, Key, Traits>::instanceMutex;
 }
@@ -0,0 +1,710 @@
+#include "TextureCompressor.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE__)
+#include <xmmintrin.h>
+#define TEXTURE_COMPRESSOR_SSE
+#endif
+
+using namespace std;
+
+TextureCompressorSettings TextureCompressor::settings = { 16, true };
+
+// Power iterations for the principal axis of a block's colors
+static const int axisIterations = 8;
+
+static int Read16(const unsigned char* bytes) {
+    return bytes[0] | (bytes[1] << 8);
+}
+
+static int Read32(const unsigned char* bytes) {
+    return static_cast<int>( bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (static_cast<unsigned int>(bytes[3]) << 24) );
+}
+
+static bool ReadFile(const string& fileName, vector<unsigned char>& bytes) {
+    ifstream file(fileName.c_str(), ios::binary);
+
+    if (!file)
+        return false;
+    file.seekg(0, ios::end);
+    bytes.resize( static_cast<size_t>( file.tellg() ) );
+    file.seekg(0, ios::beg);
+    if ( !bytes.empty() )
+        file.read((char*)&bytes[0], bytes.size());
+    return !file.fail();
+}
+
+static bool ValidSize(int width, int height) {
+    return width > 0 && height > 0 && width <= 32768 && height <= 32768;
+}
+
+// Levels of a complete chain down to 1x1
+static int GetLevelCount(int width, int height) {
+    int count = 1;
+
+    while (width > 1 || height > 1) {
+        width = width > 1 ? width / 2 : 1;
+        height = height > 1 ? height / 2 : 1;
+        ++count;
+    }
+    return count;
+}
+
+// 8, 24 & 32 bit BMP without run length compression
+static bool ReadBmp(const vector<unsigned char>& bytes, TextureImage& image) {
+    if ( bytes.size() < 54 || bytes[0] != 'B' || bytes[1] != 'M' )
+        return false;
+
+    int  offset = Read32(&bytes[10]);
+    int  headerSize = Read32(&bytes[14]);
+    int  width = Read32(&bytes[18]);
+    int  height = Read32(&bytes[22]);
+    int  bits = Read16(&bytes[28]);
+    int  compression = Read32(&bytes[30]);
+    int  colors = Read32(&bytes[46]);
+    bool topDown = height < 0;
+
+    height = abs(height);
+    if ( !ValidSize(width, height) || (bits != 8 && bits != 24 && bits != 32) || offset < 0 || headerSize < 40 )
+        return false;
+
+    // Bit fields are taken only in the usual BGRA order
+    bool alpha = false;
+    if (compression == 3) {
+        if ( bits != 32 || Read32(&bytes[54]) != 0xff0000 || Read32(&bytes[58]) != 0xff00 || Read32(&bytes[62]) != 0xff )
+            return false;
+        alpha = headerSize >= 56 && bytes.size() >= 70 && static_cast<unsigned int>( Read32(&bytes[66]) ) == 0xff000000;
+    }
+    else if (compression != 0)
+        return false;
+
+    int palette = 14 + headerSize;
+    if (bits == 8) {
+        colors = colors > 0 && colors <= 256 ? colors : 256;
+        if ( (long long)palette + 4 * colors > (long long)bytes.size() )
+            return false;
+    }
+
+    int pitch = (width * bits / 8 + 3) & ~3;
+    if ( (long long)offset + (long long)pitch * height > (long long)bytes.size() )
+        return false;
+
+    image.width = width;
+    image.height = height;
+    image.rgba.resize(4 * width * height);
+    for(int y = 0; y<height; ++y) {
+        const unsigned char* row = &bytes[offset + (topDown ? y : height - 1 - y) * pitch];
+        unsigned char*       texel = &image.rgba[4 * y * width];
+
+        for(int x = 0; x<width; ++x, texel += 4) {
+            const unsigned char* source = bits == 8 ? &bytes[palette + 4 * (row[x] < colors ? row[x] : 0)] : row + x * bits / 8;
+
+            texel[0] = source[2];
+            texel[1] = source[1];
+            texel[2] = source[0];
+            texel[3] = alpha ? source[3] : 255;
+        }
+    }
+    return true;
+}
+
+// 24 & 32 bit true color TGA, raw or run length encoded
+static bool ReadTga(const vector<unsigned char>& bytes, TextureImage& image) {
+    if ( bytes.size() < 18 || bytes[1] != 0 || (bytes[2] != 2 && bytes[2] != 10) )
+        return false;
+
+    int  width = Read16(&bytes[12]);
+    int  height = Read16(&bytes[14]);
+    int  bits = bytes[16];
+    int  size = bits / 8;
+    bool alpha = bits == 32 && (bytes[17] & 15) != 0;
+    bool topDown = (bytes[17] & 0x20) != 0;
+    bool rle = bytes[2] == 10;
+    int  offset = 18 + bytes[0];
+
+    if ( !ValidSize(width, height) || (bits != 24 && bits != 32) || (bytes[17] & 0x10) != 0 )
+        return false;
+
+    // Pixels in file order, bottom row first unless top down
+    vector<unsigned char> pixels(size * width * height);
+    for(int i = 0; i<(int)pixels.size(); ) {
+        int  count = 1;
+        bool repeat = false;
+
+        if (rle) {
+            if ( offset >= (int)bytes.size() )
+                return false;
+            count = (bytes[offset] & 0x7f) + 1;
+            repeat = (bytes[offset] & 0x80) != 0;
+            ++offset;
+        }
+        if ( i + count * size > (int)pixels.size() )
+            return false;
+        if (repeat) {
+            if ( offset + size > (int)bytes.size() )
+                return false;
+            for(int j = 0; j<count; ++j, i += size)
+                memcpy(&pixels[i], &bytes[offset], size);
+            offset += size;
+        }
+        else {
+            if ( offset + count * size > (int)bytes.size() )
+                return false;
+            memcpy(&pixels[i], &bytes[offset], count * size);
+            offset += count * size;
+            i += count * size;
+        }
+    }
+
+    image.width = width;
+    image.height = height;
+    image.rgba.resize(4 * width * height);
+    for(int y = 0; y<height; ++y) {
+        const unsigned char* row = &pixels[(topDown ? y : height - 1 - y) * width * size];
+        unsigned char*       texel = &image.rgba[4 * y * width];
+
+        for(int x = 0; x<width; ++x, texel += 4, row += size) {
+            texel[0] = row[2];
+            texel[1] = row[1];
+            texel[2] = row[0];
+            texel[3] = alpha ? row[3] : 255;
+        }
+    }
+    return true;
+}
+
+// Shift & largest value of a DDS channel mask
+static void MaskRange(unsigned int mask, int& shift, unsigned int& maximum) {
+    shift = 0;
+    maximum = 0;
+    if (!mask)
+        return;
+    while ( !(mask & 1) ) {
+        mask >>= 1;
+        ++shift;
+    }
+    maximum = mask;
+}
+
+// Format of a DDS header, false if it is not a plain 2D texture of BC1, BC3 or 24/32 bit RGB
+static bool ReadDdsHeader(const vector<unsigned char>& bytes, int& width, int& height, int& levels, bool& compressed, TextureFormat& format) {
+    if ( bytes.size() < 128 || memcmp(&bytes[0], "DDS ", 4) != 0 || (Read32(&bytes[112]) & 0x200200) != 0 )
+        return false;
+
+    int flags = Read32(&bytes[80]);
+
+    height = Read32(&bytes[12]);
+    width = Read32(&bytes[16]);
+    levels = (Read32(&bytes[8]) & 0x20000) && Read32(&bytes[28]) > 0 ? Read32(&bytes[28]) : 1;
+    compressed = (flags & 4) != 0;
+    format = TEXTURE_BC1;
+    if ( !ValidSize(width, height) )
+        return false;
+    if (compressed) {
+        if (memcmp(&bytes[84], "DXT1", 4) == 0)
+            format = TEXTURE_BC1;
+        else if (memcmp(&bytes[84], "DXT5", 4) == 0)
+            format = TEXTURE_BC3;
+        else
+            return false;
+        return true;
+    }
+    return (flags & 0x40) != 0 && (Read32(&bytes[88]) == 24 || Read32(&bytes[88]) == 32);
+}
+
+// First level of a DDS file, block compressed ones decoded
+static bool ReadDds(const vector<unsigned char>& bytes, TextureImage& image) {
+    int           width, height, levels;
+    bool          compressed;
+    TextureFormat format;
+
+    if ( !ReadDdsHeader(bytes, width, height, levels, compressed, format) )
+        return false;
+
+    image.width = width;
+    image.height = height;
+    image.rgba.resize(4 * width * height);
+
+    if (compressed) {
+        int blocksWide = (width + 3) / 4;
+        int blockBytes = format == TEXTURE_BC1 ? 8 : 16;
+
+        if ( 128LL + TextureFile::GetLevelBytes(format, width, height) > (long long)bytes.size() )
+            return false;
+        for(int by = 0; by<(height + 3) / 4; ++by) {
+            for(int bx = 0; bx<blocksWide; ++bx) {
+                unsigned char texels[64];
+
+                TextureCompressor::DecompressBlock(format, &bytes[128 + (by * blocksWide + bx) * blockBytes], texels);
+                for(int j = 0; j<4 && 4 * by + j < height; ++j) {
+                    for(int i = 0; i<4 && 4 * bx + i < width; ++i)
+                        memcpy(&image.rgba[4 * ((4 * by + j) * width + 4 * bx + i)], &texels[4 * (4 * j + i)], 4);
+                }
+            }
+        }
+        return true;
+    }
+
+    int          size = Read32(&bytes[88]) / 8;
+    bool         alpha = (Read32(&bytes[80]) & 1) != 0;
+    int          shifts[4];
+    unsigned int maximums[4];
+
+    for(int i = 0; i<4; ++i)
+        MaskRange( static_cast<unsigned int>( Read32(&bytes[92 + 4 * i]) ), shifts[i], maximums[i] );
+    if ( !maximums[0] || !maximums[1] || !maximums[2] || 128LL + (long long)size * width * height > (long long)bytes.size() )
+        return false;
+
+    for(int i = 0; i<width * height; ++i) {
+        const unsigned char* source = &bytes[128 + i * size];
+        unsigned int         value = source[0] | (source[1] << 8) | (source[2] << 16) | (size == 4 ? (unsigned int)source[3] << 24 : 0);
+
+        for(int j = 0; j<4; ++j) {
+            if (j == 3 && (!alpha || !maximums[3]))
+                image.rgba[4 * i + j] = 255;
+            else
+                image.rgba[4 * i + j] = static_cast<unsigned char>( ((value >> shifts[j]) & maximums[j]) * 255 / maximums[j] );
+        }
+    }
+    return true;
+}
+
+bool TextureCompressor::ReadImage(const string& fileName, TextureImage& image) {
+    vector<unsigned char> bytes;
+
+    if ( !ReadFile(fileName, bytes) )
+        return false;
+    return ReadBmp(bytes, image) || ReadDds(bytes, image) || ReadTga(bytes, image);
+}
+
+bool TextureCompressor::ReadBlocks(const string& fileName, TextureFormat& format, vector<TextureLevel>& levels, vector< vector<unsigned char> >& data) {
+    vector<unsigned char> bytes;
+    int                   width, height, count;
+    bool                  compressed;
+    long long             offset = 128;
+
+    if ( !ReadFile(fileName, bytes) || !ReadDdsHeader(bytes, width, height, count, compressed, format) ||
+         !compressed || count != GetLevelCount(width, height) )
+        return false;
+
+    levels.resize(count);
+    data.resize(count);
+    for(int i = 0; i<count; ++i) {
+        TextureLevel level = { width, height, 0, TextureFile::GetLevelBytes(format, width, height) };
+
+        if (offset + level.bytes > (long long)bytes.size())
+            return false;
+        levels[i] = level;
+        data[i].assign(bytes.begin() + offset, bytes.begin() + offset + level.bytes);
+        offset += level.bytes;
+        width = width > 1 ? width / 2 : 1;
+        height = height > 1 ? height / 2 : 1;
+    }
+    return true;
+}
+
+TextureFormat TextureCompressor::ChooseFormat(const TextureImage& image) {
+    for(int i = 3; i<(int)image.rgba.size(); i += 4) {
+        if (image.rgba[i] != 255)
+            return TEXTURE_BC3;
+    }
+    return TEXTURE_BC1;
+}
+
+void TextureCompressor::Downsample(const TextureImage& source, TextureImage& level) {
+    level.width = source.width > 1 ? source.width / 2 : 1;
+    level.height = source.height > 1 ? source.height / 2 : 1;
+    level.rgba.resize(4 * level.width * level.height);
+
+    // Odd sizes drop the last row or column, a side of one repeats it
+    for(int y = 0; y<level.height; ++y) {
+        const unsigned char* row0 = &source.rgba[4 * (2 * y) * source.width];
+        const unsigned char* row1 = &source.rgba[4 * (source.height > 1 ? 2 * y + 1 : 0) * source.width];
+
+        for(int x = 0; x<level.width; ++x) {
+            int x0 = 4 * 2 * x;
+            int x1 = 4 * (source.width > 1 ? 2 * x + 1 : 0);
+
+            for(int c = 0; c<4; ++c)
+                level.rgba[4 * (y * level.width + x) + c] = static_cast<unsigned char>( (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) / 4 );
+        }
+    }
+}
+
+// 565 color to 8 bits per channel, bits repeated like the hardware
+static void Expand565(unsigned short color, float rgb[3]) {
+    int r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+
+    rgb[0] = static_cast<float>( (r << 3) | (r >> 2) );
+    rgb[1] = static_cast<float>( (g << 2) | (g >> 4) );
+    rgb[2] = static_cast<float>( (b << 3) | (b >> 2) );
+}
+
+static int Quantize(float value, int maximum) {
+    int quantized = static_cast<int>( value * maximum / 255.0f + 0.5f );
+
+    return quantized < 0 ? 0 : (quantized > maximum ? maximum : quantized);
+}
+
+static unsigned short Round565(const float rgb[3]) {
+    return static_cast<unsigned short>( (Quantize(rgb[0], 31) << 11) | (Quantize(rgb[1], 63) << 5) | Quantize(rgb[2], 31) );
+}
+
+// Four colors of endpoints c0 > c1
+static void MakePalette(unsigned short c0, unsigned short c1, float palette[4][3]) {
+    Expand565(c0, palette[0]);
+    Expand565(c1, palette[1]);
+    for(int i = 0; i<3; ++i) {
+        palette[2][i] = (2.0f * palette[0][i] + palette[1][i]) / 3.0f;
+        palette[3][i] = (palette[0][i] + 2.0f * palette[1][i]) / 3.0f;
+    }
+}
+
+// Nearest palette color per texel of channels, returns the summed squared error
+static float FitIndices(const float channels[3][16], const float palette[4][3], unsigned char indices[16]) {
+    float error = 0.0f;
+
+#ifdef TEXTURE_COMPRESSOR_SSE
+    for(int i = 0; i<16; i += 4) {
+        __m128 r = _mm_loadu_ps(channels[0] + i);
+        __m128 g = _mm_loadu_ps(channels[1] + i);
+        __m128 b = _mm_loadu_ps(channels[2] + i);
+        __m128 best = _mm_set1_ps(FLT_MAX);
+        __m128 index = _mm_setzero_ps();
+        float  nearest[4], errors[4];
+
+        for(int k = 0; k<4; ++k) {
+            __m128 dr = _mm_sub_ps( r, _mm_set1_ps(palette[k][0]) );
+            __m128 dg = _mm_sub_ps( g, _mm_set1_ps(palette[k][1]) );
+            __m128 db = _mm_sub_ps( b, _mm_set1_ps(palette[k][2]) );
+            __m128 distance = _mm_add_ps( _mm_add_ps( _mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg) ), _mm_mul_ps(db, db) );
+            __m128 closer = _mm_cmplt_ps(distance, best);
+
+            best = _mm_min_ps(distance, best);
+            index = _mm_or_ps( _mm_and_ps( closer, _mm_set1_ps((float)k) ), _mm_andnot_ps(closer, index) );
+        }
+        _mm_storeu_ps(nearest, index);
+        _mm_storeu_ps(errors, best);
+        for(int j = 0; j<4; ++j) {
+            indices[i + j] = static_cast<unsigned char>( nearest[j] );
+            error += errors[j];
+        }
+    }
+#else
+    for(int i = 0; i<16; ++i) {
+        float best = FLT_MAX;
+
+        for(int k = 0; k<4; ++k) {
+            float dr = channels[0][i] - palette[k][0];
+            float dg = channels[1][i] - palette[k][1];
+            float db = channels[2][i] - palette[k][2];
+            float distance = dr * dr + dg * dg + db * db;
+
+            if (distance < best) {
+                best = distance;
+                indices[i] = static_cast<unsigned char>(k);
+            }
+        }
+        error += best;
+    }
+#endif
+    return error;
+}
+
+// Ends of the colors along their principal axis
+static void FitEndpoints(const float channels[3][16], float e0[3], float e1[3]) {
+    float mean[3] = { 0.0f, 0.0f, 0.0f };
+    float covariance[3][3] = { { 0.0f } };
+    float axis[3] = { 1.0f, 1.0f, 1.0f };
+
+    for(int c = 0; c<3; ++c) {
+        for(int i = 0; i<16; ++i)
+            mean[c] += channels[c][i];
+        mean[c] /= 16.0f;
+    }
+    for(int i = 0; i<16; ++i) {
+        float d[3] = { channels[0][i] - mean[0], channels[1][i] - mean[1], channels[2][i] - mean[2] };
+
+        for(int a = 0; a<3; ++a) {
+            for(int b = 0; b<3; ++b)
+                covariance[a][b] += d[a] * d[b];
+        }
+    }
+
+    for(int n = 0; n<axisIterations; ++n) {
+        float next[3], length = 0.0f;
+
+        for(int a = 0; a<3; ++a) {
+            next[a] = covariance[a][0] * axis[0] + covariance[a][1] * axis[1] + covariance[a][2] * axis[2];
+            length = max( length, fabs(next[a]) );
+        }
+        if (length < 1e-6f) {
+            // One color, both ends on it
+            memcpy(e0, mean, sizeof(mean));
+            memcpy(e1, mean, sizeof(mean));
+            return;
+        }
+        for(int a = 0; a<3; ++a)
+            axis[a] = next[a] / length;
+    }
+
+    float lowest = FLT_MAX, highest = -FLT_MAX;
+    float scale = 1.0f / (axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+    for(int i = 0; i<16; ++i) {
+        float t = ( (channels[0][i] - mean[0]) * axis[0] + (channels[1][i] - mean[1]) * axis[1] + (channels[2][i] - mean[2]) * axis[2] ) * scale;
+
+        lowest = min(lowest, t);
+        highest = max(highest, t);
+    }
+    for(int c = 0; c<3; ++c) {
+        e0[c] = mean[c] + axis[c] * highest;
+        e1[c] = mean[c] + axis[c] * lowest;
+    }
+}
+
+// Endpoints that best reproduce the colors with indices, false if they are degenerate
+static bool SolveEndpoints(const float channels[3][16], const unsigned char indices[16], float e0[3], float e1[3]) {
+    static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+    float              aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    float              ax[3] = { 0.0f, 0.0f, 0.0f }, bx[3] = { 0.0f, 0.0f, 0.0f };
+
+    for(int i = 0; i<16; ++i) {
+        float a = weights[indices[i]], b = 1.0f - a;
+
+        aa += a * a;
+        ab += a * b;
+        bb += b * b;
+        for(int c = 0; c<3; ++c) {
+            ax[c] += a * channels[c][i];
+            bx[c] += b * channels[c][i];
+        }
+    }
+
+    float determinant = aa * bb - ab * ab;
+    if (fabs(determinant) < 1e-6f)
+        return false;
+    for(int c = 0; c<3; ++c) {
+        e0[c] = (ax[c] * bb - bx[c] * ab) / determinant;
+        e1[c] = (bx[c] * aa - ax[c] * ab) / determinant;
+    }
+    return true;
+}
+
+// BC1 color block of 8 bytes, always with four colors
+static void EncodeColor(const float channels[3][16], unsigned char* block) {
+    float          e0[3], e1[3], palette[4][3];
+    unsigned char  indices[16];
+    unsigned short c0, c1;
+
+    FitEndpoints(channels, e0, e1);
+    c0 = Round565(e0);
+    c1 = Round565(e1);
+    MakePalette(c0, c1, palette);
+    float error = FitIndices(channels, palette, indices);
+
+    if (TextureCompressor::settings.refine && SolveEndpoints(channels, indices, e0, e1)) {
+        unsigned short r0 = Round565(e0), r1 = Round565(e1);
+        unsigned char  refined[16];
+
+        if (r0 != c0 || r1 != c1) {
+            MakePalette(r0, r1, palette);
+            if (FitIndices(channels, palette, refined) < error) {
+                c0 = r0;
+                c1 = r1;
+                memcpy(indices, refined, sizeof(indices));
+            }
+        }
+    }
+
+    // c0 > c1 selects four colors, swapped ends swap 0 & 1 and 2 & 3
+    if (c0 < c1) {
+        swap(c0, c1);
+        for(int i = 0; i<16; ++i)
+            indices[i] ^= 1;
+    }
+    else if (c0 == c1)
+        memset(indices, 0, sizeof(indices));
+
+    unsigned int bits = 0;
+    for(int i = 0; i<16; ++i)
+        bits |= static_cast<unsigned int>(indices[i]) << (2 * i);
+    block[0] = c0 & 0xff;
+    block[1] = c0 >> 8;
+    block[2] = c1 & 0xff;
+    block[3] = c1 >> 8;
+    for(int i = 0; i<4; ++i)
+        block[4 + i] = (bits >> (8 * i)) & 0xff;
+}
+
+// BC3 alpha block of 8 bytes, eight steps from the highest to the lowest alpha
+static void EncodeAlpha(const unsigned char texels[64], unsigned char* block) {
+    int                lowest = 255, highest = 0;
+    unsigned long long bits = 0;
+
+    for(int i = 0; i<16; ++i) {
+        lowest = min<int>(lowest, texels[4 * i + 3]);
+        highest = max<int>(highest, texels[4 * i + 3]);
+    }
+    for(int i = 0; highest > lowest && i<16; ++i) {
+        int step = ( (highest - texels[4 * i + 3]) * 7 + (highest - lowest) / 2 ) / (highest - lowest);
+        int index = step == 0 ? 0 : (step == 7 ? 1 : step + 1);
+
+        bits |= static_cast<unsigned long long>(index) << (3 * i);
+    }
+    block[0] = static_cast<unsigned char>(highest);
+    block[1] = static_cast<unsigned char>(lowest);
+    for(int i = 0; i<6; ++i)
+        block[2 + i] = (bits >> (8 * i)) & 0xff;
+}
+
+void TextureCompressor::CompressBlock(TextureFormat format, const unsigned char texels[64], unsigned char* block) {
+    float channels[3][16];
+
+    for(int i = 0; i<16; ++i) {
+        for(int c = 0; c<3; ++c)
+            channels[c][i] = texels[4 * i + c];
+    }
+    if (format == TEXTURE_BC3) {
+        EncodeAlpha(texels, block);
+        block += 8;
+    }
+    EncodeColor(channels, block);
+}
+
+void TextureCompressor::DecompressBlock(TextureFormat format, const unsigned char* block, unsigned char texels[64]) {
+    unsigned char alphas[8];
+
+    if (format == TEXTURE_BC3) {
+        alphas[0] = block[0];
+        alphas[1] = block[1];
+        for(int i = 1; i<7; ++i) {
+            if (alphas[0] > alphas[1])
+                alphas[i + 1] = static_cast<unsigned char>( ((7 - i) * alphas[0] + i * alphas[1]) / 7 );
+            else
+                alphas[i + 1] = i < 5 ? static_cast<unsigned char>( ((5 - i) * alphas[0] + i * alphas[1]) / 5 ) : (i == 5 ? 0 : 255);
+        }
+        unsigned long long bits = 0;
+        for(int i = 0; i<6; ++i)
+            bits |= static_cast<unsigned long long>(block[2 + i]) << (8 * i);
+        for(int i = 0; i<16; ++i)
+            texels[4 * i + 3] = alphas[(bits >> (3 * i)) & 7];
+        block += 8;
+    }
+
+    unsigned short c0 = static_cast<unsigned short>( Read16(block) ), c1 = static_cast<unsigned short>( Read16(block + 2) );
+    unsigned int   bits = static_cast<unsigned int>( Read32(block + 4) );
+    float          ends[2][3];
+    unsigned char  colors[4][4];
+    bool           four = c0 > c1 || format == TEXTURE_BC3;
+
+    Expand565(c0, ends[0]);
+    Expand565(c1, ends[1]);
+    for(int c = 0; c<3; ++c) {
+        int a = static_cast<int>( ends[0][c] ), b = static_cast<int>( ends[1][c] );
+
+        colors[0][c] = a;
+        colors[1][c] = b;
+        colors[2][c] = four ? (2 * a + b) / 3 : (a + b) / 2;
+        colors[3][c] = four ? (a + 2 * b) / 3 : 0;
+    }
+    colors[0][3] = colors[1][3] = colors[2][3] = 255;
+    colors[3][3] = four ? 255 : 0;
+    for(int i = 0; i<16; ++i) {
+        const unsigned char* color = colors[(bits >> (2 * i)) & 3];
+
+        texels[4 * i] = color[0];
+        texels[4 * i + 1] = color[1];
+        texels[4 * i + 2] = color[2];
+        if (format == TEXTURE_BC1)
+            texels[4 * i + 3] = color[3];
+    }
+}
+
+// 16 texels of block (bx, by), the image edge repeated past it
+static void GatherBlock(const TextureImage& image, int bx, int by, unsigned char texels[64]) {
+    for(int j = 0; j<4; ++j) {
+        int y = min(4 * by + j, image.height - 1);
+
+        for(int i = 0; i<4; ++i) {
+            int x = min(4 * bx + i, image.width - 1);
+
+            memcpy(&texels[4 * (4 * j + i)], &image.rgba[4 * (y * image.width + x)], 4);
+        }
+    }
+}
+
+// Block rows [first, last) of level
+static void CompressRows(const TextureImage* level, TextureFormat format, int first, int last, unsigned char* blocks) {
+    int blocksWide = (level->width + 3) / 4;
+    int blockBytes = format == TEXTURE_BC1 ? 8 : 16;
+
+    for(int by = first; by<last; ++by) {
+        for(int bx = 0; bx<blocksWide; ++bx) {
+            unsigned char texels[64];
+
+            GatherBlock(*level, bx, by, texels);
+            TextureCompressor::CompressBlock(format, texels, blocks + (by * blocksWide + bx) * blockBytes);
+        }
+    }
+}
+
+void TextureCompressor::Compress(const TextureImage& image, TextureFormat format, Utils::WorkerPool& pool,
+                                 vector<TextureLevel>& levels, vector< vector<unsigned char> >& data) {
+    int                  count = GetLevelCount(image.width, image.height);
+    vector<TextureImage> mips;
+
+    // Each level from the one above, all reserved so the pointers stay valid
+    mips.reserve(count - 1);
+    for(int i = 1; i<count; ++i) {
+        mips.push_back( TextureImage() );
+        Downsample(i == 1 ? image : mips[i - 2], mips.back());
+    }
+
+    levels.resize(count);
+    data.resize(count);
+    for(int i = 0; i<count; ++i) {
+        const TextureImage* level = i == 0 ? &image : &mips[i - 1];
+        int                 blockRows = (level->height + 3) / 4;
+        TextureLevel        entry = { level->width, level->height, 0, TextureFile::GetLevelBytes(format, level->width, level->height) };
+
+        levels[i] = entry;
+        data[i].resize(entry.bytes);
+        for(int first = 0; first<blockRows; first += settings.blockRowsPerJob) {
+            int            last = min(first + settings.blockRowsPerJob, blockRows);
+            unsigned char* blocks = &data[i][0];
+
+            pool.Push( [level, format, first, last, blocks] { CompressRows(level, format, first, last, blocks); } );
+        }
+    }
+    pool.Wait();
+}
+
+double TextureCompressor::GetError(const TextureImage& image, TextureFormat format, const vector<unsigned char>& blocks) {
+    int    blocksWide = (image.width + 3) / 4;
+    int    blockBytes = format == TEXTURE_BC1 ? 8 : 16;
+    double sum = 0.0;
+
+    for(int by = 0; by<(image.height + 3) / 4; ++by) {
+        for(int bx = 0; bx<blocksWide; ++bx) {
+            unsigned char texels[64];
+
+            DecompressBlock(format, &blocks[(by * blocksWide + bx) * blockBytes], texels);
+            for(int j = 0; j<4 && 4 * by + j < image.height; ++j) {
+                for(int i = 0; i<4 && 4 * bx + i < image.width; ++i) {
+                    const unsigned char* source = &image.rgba[4 * ((4 * by + j) * image.width + 4 * bx + i)];
+
+                    for(int c = 0; c<4; ++c) {
+                        double d = source[c] - texels[4 * (4 * j + i) + c];
+                        sum += d * d;
+                    }
+                }
+            }
+        }
+    }
+    return sqrt( sum / (4.0 * image.width * image.height) );
+}
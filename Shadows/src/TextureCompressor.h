@@ -0,0 +1,61 @@
+#pragma once
+#include "TextureFile.h"
+#include "WorkerPool.h"
+#include <string>
+#include <vector>
+
+// Decoded image, rows top down
+struct TextureImage
+{
+    int                        width;
+    int                        height;
+    std::vector<unsigned char> rgba;    // 4 bytes per texel
+};
+
+// See TextureCompressor::settings
+struct TextureCompressorSettings
+{
+    int  blockRowsPerJob;
+    bool refine;            // least squares pass on the color endpoints
+};
+
+//-----------------------------------------------------------------------------
+// TextureCompressor class
+// Offline BC1 & BC3 encoding for tools/TextureConvert. Colors of a 4x4 block
+// are fit along their principal axis, rounded to 565 endpoints and refined
+// by least squares on the indices they gave. Texels pick the nearest of the
+// four palette colors four at a time with SSE where there is SSE. BC3 alpha
+// spans the block's range in eight steps. Mips are 2x2 box filtered like
+// D3DX does by default, bands of block rows of every level run on the pool.
+// Reads uncompressed BMP & TGA files and DDS files, BC1 & BC3 ones included.
+//-----------------------------------------------------------------------------
+class TextureCompressor
+{
+public:
+    static TextureCompressorSettings settings;
+
+    // Decode fileName. Returns false if missing or in a format not read here.
+    static bool ReadImage(const std::string& fileName, TextureImage& image);
+
+    // Blocks of a BC1 or BC3 DDS file with a complete mip chain, taken as
+    // they are. Returns false for any other file.
+    static bool ReadBlocks(const std::string& fileName, TextureFormat& format, std::vector<TextureLevel>& levels,
+                           std::vector< std::vector<unsigned char> >& data);
+
+    // BC3 if any texel is not opaque
+    static TextureFormat ChooseFormat(const TextureImage& image);
+
+    // Next level of the chain, 2x2 box
+    static void Downsample(const TextureImage& source, TextureImage& level);
+
+    // One block of 16 texels given row by row, 4 bytes each
+    static void CompressBlock(TextureFormat format, const unsigned char texels[64], unsigned char* block);
+    static void DecompressBlock(TextureFormat format, const unsigned char* block, unsigned char texels[64]);
+
+    // Whole chain of image down to 1x1
+    static void Compress(const TextureImage& image, TextureFormat format, Utils::WorkerPool& pool,
+                         std::vector<TextureLevel>& levels, std::vector< std::vector<unsigned char> >& data);
+
+    // Root mean square error of the decoded first level against image, per channel
+    static double GetError(const TextureImage& image, TextureFormat format, const std::vector<unsigned char>& blocks);
+};
@@ -0,0 +1,194 @@
+#include "TextureFile.h"
+#include <cstring>
+#include <fstream>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+static const int textureFileVersion = 1;
+
+// Longest chain, 32768 texels on a side
+static const int maxLevels = 16;
+
+// Magic, version, format, levels & the source stamp
+static const int headerBytes = 4 + 3 * sizeof(int) + 2 * sizeof(long long);
+
+static int Align(int offset) {
+    return (offset + 15) & ~15;
+}
+
+TextureFile::TextureFile() : view(NULL), viewBytes(0), format(TEXTURE_BC1) {
+#ifdef _WIN32
+    hFile = INVALID_HANDLE_VALUE;
+    hMapping = NULL;
+#else
+    file = -1;
+#endif
+    stamp[0] = stamp[1] = 0;
+}
+
+TextureFile::~TextureFile() {
+    Close();
+}
+
+void TextureFile::Close() {
+#ifdef _WIN32
+    if (view)
+        UnmapViewOfFile(view);
+    if (hMapping)
+        CloseHandle(hMapping);
+    if (hFile != INVALID_HANDLE_VALUE)
+        CloseHandle(hFile);
+    hFile = INVALID_HANDLE_VALUE;
+    hMapping = NULL;
+#else
+    if (view)
+        munmap( const_cast<unsigned char*>(view), viewBytes );
+    if (file >= 0)
+        close(file);
+    file = -1;
+#endif
+    view = NULL;
+    viewBytes = 0;
+    levels.clear();
+}
+
+bool TextureFile::Open(const string& fileName) {
+    Close();
+
+#ifdef _WIN32
+    LARGE_INTEGER size;
+
+    hFile = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE || !GetFileSizeEx(hFile, &size) || size.QuadPart < headerBytes || size.QuadPart > 0x7fffffff) {
+        Close();
+        return false;
+    }
+    viewBytes = static_cast<size_t>(size.QuadPart);
+    hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (hMapping)
+        view = static_cast<const unsigned char*>( MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0) );
+#else
+    struct stat info;
+
+    file = open(fileName.c_str(), O_RDONLY);
+    if (file < 0 || fstat(file, &info) != 0 || info.st_size < headerBytes || info.st_size > 0x7fffffff) {
+        Close();
+        return false;
+    }
+    viewBytes = static_cast<size_t>(info.st_size);
+    void* mapping = mmap(NULL, viewBytes, PROT_READ, MAP_PRIVATE, file, 0);
+    if (mapping != MAP_FAILED)
+        view = static_cast<const unsigned char*>(mapping);
+#endif
+    if (!view) {
+        Close();
+        return false;
+    }
+
+    // Header & level table are checked against the mapping before use
+    int header[3];
+
+    memcpy(header, view + 4, sizeof(header));
+    memcpy(stamp, view + 4 + sizeof(header), sizeof(stamp));
+    if ( memcmp(view, "STEX", 4) != 0 || header[0] != textureFileVersion || (header[1] != TEXTURE_BC1 && header[1] != TEXTURE_BC3) ||
+         header[2] <= 0 || header[2] > maxLevels || headerBytes + header[2] * sizeof(TextureLevel) > viewBytes ) {
+        Close();
+        return false;
+    }
+    format = static_cast<TextureFormat>(header[1]);
+    levels.resize(header[2]);
+    memcpy(&levels[0], view + headerBytes, levels.size() * sizeof(TextureLevel));
+
+    for(int i = 0; i<(int)levels.size(); ++i) {
+        const TextureLevel& level = levels[i];
+        bool                halved = i == 0 || ( level.width == (levels[i-1].width > 1 ? levels[i-1].width / 2 : 1) &&
+                                                 level.height == (levels[i-1].height > 1 ? levels[i-1].height / 2 : 1) );
+
+        if ( !halved || level.width <= 0 || level.height <= 0 || level.width > 32768 || level.height > 32768 ||
+             level.offset < headerBytes || (level.offset & 15) != 0 || level.bytes != GetLevelBytes(format, level.width, level.height) ||
+             (long long)level.offset + level.bytes > (long long)viewBytes ) {
+            Close();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool TextureFile::IsCurrent(const string& sourceFile) const {
+    long long current[2];
+
+    if ( !GetStamp(sourceFile, current) )
+        return true;
+    return current[0] == stamp[0] && current[1] == stamp[1];
+}
+
+int TextureFile::GetRowBytes(int level) const {
+    return GetLevelBytes(format, levels[level].width, 4);
+}
+
+bool TextureFile::Save(const string& fileName, const string& sourceFile, TextureFormat format,
+                       const vector<TextureLevel>& levels, const vector< vector<unsigned char> >& data) {
+    ofstream             file(fileName.c_str(), ios::binary);
+    int                  header[3] = { textureFileVersion, format, (int)levels.size() };
+    long long            stamp[2] = { 0, 0 };
+    vector<TextureLevel> table(levels);
+    int                  offset = Align( headerBytes + table.size() * sizeof(TextureLevel) );
+    static const char    zeros[16] = { 0 };
+
+    if (!file || levels.empty() || levels.size() != data.size())
+        return false;
+
+    GetStamp(sourceFile, stamp);
+    for(int i = 0; i<(int)table.size(); ++i) {
+        table[i].offset = offset;
+        table[i].bytes = data[i].size();
+        offset = Align(offset + table[i].bytes);
+    }
+
+    file.write("STEX", 4);
+    file.write((const char*)header, sizeof(header));
+    file.write((const char*)stamp, sizeof(stamp));
+    file.write((const char*)&table[0], table.size() * sizeof(TextureLevel));
+    offset = headerBytes + table.size() * sizeof(TextureLevel);
+    for(int i = 0; i<(int)table.size(); ++i) {
+        file.write(zeros, table[i].offset - offset);
+        file.write((const char*)&data[i][0], data[i].size());
+        offset = table[i].offset + table[i].bytes;
+    }
+
+    file.close();
+    return !file.fail();
+}
+
+bool TextureFile::GetStamp(const string& fileName, long long stamp[2]) {
+#ifdef _WIN32
+    struct _stat64 info;
+
+    if (_stat64(fileName.c_str(), &info) != 0)
+        return false;
+#else
+    struct stat info;
+
+    if (stat(fileName.c_str(), &info) != 0)
+        return false;
+#endif
+    stamp[0] = info.st_size;
+    stamp[1] = info.st_mtime;
+    return true;
+}
+
+string TextureFile::GetFileName(const string& sourceFile) {
+    return sourceFile + ".stex";
+}
+
+int TextureFile::GetLevelBytes(TextureFormat format, int width, int height) {
+    return ((width + 3) / 4) * ((height + 3) / 4) * (format == TEXTURE_BC1 ? 8 : 16);
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// Block compression of a converted texture, values are the BCn number
+enum TextureFormat
+{
+    TEXTURE_BC1 = 1,    // 8 bytes per 4x4 block, opaque
+    TEXTURE_BC3 = 3     // 16 bytes per block, BC1 colors & interpolated alpha
+};
+
+// One mip level inside the file
+struct TextureLevel
+{
+    int width;
+    int height;
+    int offset;     // from the start of the file, 16 byte aligned
+    int bytes;      // rows of blocks, no padding between them
+};
+
+//-----------------------------------------------------------------------------
+// TextureFile class
+// Block compressed mip chain written by tools/TextureConvert next to its
+// source image. Open maps the file read only, so the levels are copied
+// straight from the mapping into the locked texture, nothing is decoded or
+// read into the heap. The size & time of the source when it was converted
+// are kept, so a changed source makes the file stale. Binary file like the
+// .lod files.
+//-----------------------------------------------------------------------------
+class TextureFile
+{
+private:
+    const unsigned char*      view;
+    size_t                    viewBytes;
+#ifdef _WIN32
+    void*                     hFile;
+    void*                     hMapping;
+#else
+    int                       file;
+#endif
+    TextureFormat             format;
+    long long                 stamp[2];     // size & modification time of the source
+    std::vector<TextureLevel> levels;
+
+    TextureFile(const TextureFile&);
+    TextureFile& operator = (const TextureFile&);
+
+public:
+    TextureFile();
+    ~TextureFile();
+
+    // Map fileName. Returns false if missing or damaged.
+    bool Open(const std::string& fileName);
+
+    void Close();
+
+    // Converted from sourceFile as it is now. A missing source does not make
+    // the file stale, converted files may ship without their sources.
+    bool IsCurrent(const std::string& sourceFile) const;
+
+    TextureFormat GetFormat() const { return format; }
+    int GetLevelCount() const { return levels.size(); }
+    const TextureLevel& GetLevel(int level) const { return levels[level]; }
+
+    // Blocks of level inside the mapping
+    const unsigned char* GetData(int level) const { return view + levels[level].offset; }
+
+    // Bytes of one row of 4x4 blocks of level
+    int GetRowBytes(int level) const;
+
+    // Write chain, data holds the blocks of each level. Returns false if not written.
+    static bool Save(const std::string& fileName, const std::string& sourceFile, TextureFormat format,
+                     const std::vector<TextureLevel>& levels, const std::vector< std::vector<unsigned char> >& data);
+
+    // Size & modification time, false if file is missing
+    static bool GetStamp(const std::string& fileName, long long stamp[2]);
+
+    // Next to the source, data/brick.bmp gives data/brick.bmp.stex
+    static std::string GetFileName(const std::string& sourceFile);
+
+    // Bytes of a level of that size
+    static int GetLevelBytes(TextureFormat format, int width, int height);
+};
@@ -0,0 +1,145 @@
+#include "TransformGraph.h"
+#include <stdexcept>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE__)
+#include <xmmintrin.h>
+#define TRANSFORM_GRAPH_SSE
+#endif
+
+using namespace std;
+
+TransformGraph::TransformGraph() : anyDirty(false), inversions(0), multiplications(0) {
+}
+
+void TransformGraph::Clear() {
+    parents.clear();
+    locals.clear();
+    localInverses.clear();
+    worlds.clear();
+    worldInverses.clear();
+    dirty.clear();
+    changed.clear();
+    updated.clear();
+    anyDirty = false;
+}
+
+int TransformGraph::Add(const D3DXMATRIX& local, int parent) {
+    int node = parents.size();
+
+    if (parent >= node)
+        throw runtime_error("Transform parent must be added before its children");
+
+    parents.push_back(parent);
+    locals.push_back(local);
+    localInverses.push_back(local);
+    worlds.push_back(local);
+    worldInverses.push_back(local);
+    dirty.push_back(1);
+    changed.push_back(0);
+    anyDirty = true;
+
+    return node;
+}
+
+void TransformGraph::SetLocal(int node, const D3DXMATRIX& local) {
+    locals[node] = local;
+    dirty[node] = 1;
+    anyDirty = true;
+}
+
+void TransformGraph::Update() {
+    updated.clear();
+    if (!anyDirty)
+        return;
+
+    // Children follow parents, so parents are final when reached
+    for(int i = 0; i<parents.size(); ++i) {
+        int parent = parents[i];
+
+        changed[i] = dirty[i] || (parent >= 0 && changed[parent]);
+        if (!changed[i])
+            continue;
+
+        if (dirty[i]) {
+            InvertAffine(localInverses[i], locals[i]);
+            ++inversions;
+            dirty[i] = 0;
+        }
+
+        // world = local * parent world, inverse the other way around
+        if (parent >= 0) {
+            Multiply(worlds[i], locals[i], worlds[parent]);
+            Multiply(worldInverses[i], worldInverses[parent], localInverses[i]);
+            multiplications += 2;
+        }
+        else {
+            worlds[i] = locals[i];
+            worldInverses[i] = localInverses[i];
+        }
+        updated.push_back(i);
+    }
+
+    anyDirty = false;
+}
+
+void TransformGraph::Multiply(D3DXMATRIX& out, const D3DXMATRIX& a, const D3DXMATRIX& b) {
+#ifdef TRANSFORM_GRAPH_SSE
+    // Row i of result is a linear combination of rows of b
+    __m128 b0 = _mm_loadu_ps(b.m[0]);
+    __m128 b1 = _mm_loadu_ps(b.m[1]);
+    __m128 b2 = _mm_loadu_ps(b.m[2]);
+    __m128 b3 = _mm_loadu_ps(b.m[3]);
+    __m128 rows[4];
+
+    for(int i = 0; i<4; ++i) {
+        __m128 row = _mm_mul_ps(_mm_set1_ps(a.m[i][0]), b0);
+
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a.m[i][1]), b1));
+        row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a.m[i][2]), b2));
+        rows[i] = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a.m[i][3]), b3));
+    }
+    for(int i = 0; i<4; ++i)
+        _mm_storeu_ps(out.m[i], rows[i]);
+#else
+    D3DXMatrixMultiply(&out, &a, &b);
+#endif
+}
+
+void TransformGraph::InvertAffine(D3DXMATRIX& out, const D3DXMATRIX& m) {
+    float det;
+    float inv[3][3];
+
+    if (m._14 != 0.0f || m._24 != 0.0f || m._34 != 0.0f || m._44 != 1.0f) {
+        D3DXMatrixInverse(&out, NULL, &m);
+        return;
+    }
+
+    // Upper 3x3 by cofactors
+    inv[0][0] = m._22 * m._33 - m._23 * m._32;
+    inv[0][1] = m._13 * m._32 - m._12 * m._33;
+    inv[0][2] = m._12 * m._23 - m._13 * m._22;
+    inv[1][0] = m._23 * m._31 - m._21 * m._33;
+    inv[1][1] = m._11 * m._33 - m._13 * m._31;
+    inv[1][2] = m._13 * m._21 - m._11 * m._23;
+    inv[2][0] = m._21 * m._32 - m._22 * m._31;
+    inv[2][1] = m._12 * m._31 - m._11 * m._32;
+    inv[2][2] = m._11 * m._22 - m._12 * m._21;
+    det = m._11 * inv[0][0] + m._12 * inv[1][0] + m._13 * inv[2][0];
+    if (det == 0.0f) {
+        D3DXMatrixIdentity(&out);
+        return;
+    }
+
+    D3DXMATRIX result;
+    for(int i = 0; i<3; ++i) {
+        for(int j = 0; j<3; ++j)
+            result.m[i][j] = inv[i][j] / det;
+        result.m[i][3] = 0.0f;
+    }
+
+    // Translation moves back through the inverted 3x3
+    for(int j = 0; j<3; ++j)
+        result.m[3][j] = -(m._41 * result.m[0][j] + m._42 * result.m[1][j] + m._43 * result.m[2][j]);
+    result.m[3][3] = 1.0f;
+    out = result;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include "ScreenQuad.h"
+#include <vector>
+
+//-----------------------------------------------------------------------------
+// TransformGraph class
+// Local transforms of scene nodes with optional parents. World matrices and
+// their inverses are cached and recomputed only below changed nodes. Parents
+// come before their children, so one pass in node order propagates changes.
+// Inverse of a world matrix is built from inverses of the locals, so only
+// changed locals are ever inverted.
+//-----------------------------------------------------------------------------
+class TransformGraph
+{
+private:
+    std::vector<int>        parents;        // -1 for roots
+    std::vector<D3DXMATRIX> locals;
+    std::vector<D3DXMATRIX> localInverses;
+    std::vector<D3DXMATRIX> worlds;
+    std::vector<D3DXMATRIX> worldInverses;
+    std::vector<char>       dirty;          // local changed since last Update
+    std::vector<char>       changed;        // world changed by last Update
+    std::vector<int>        updated;        // nodes changed by last Update
+    bool                    anyDirty;
+    int                     inversions;     // since ResetCounters
+    int                     multiplications;
+
+public:
+    TransformGraph();
+
+    void Clear();
+
+    // Add node, parent must be added before. Returns node index.
+    int Add(const D3DXMATRIX& local, int parent = -1);
+
+    void SetLocal(int node, const D3DXMATRIX& local);
+
+    // Propagate changed locals to worlds & inverses
+    void Update();
+
+    // Nodes whose world changed in last Update, in node order
+    const std::vector<int>& GetUpdated() const { return updated; }
+
+    int GetCount() const { return parents.size(); }
+    int GetParent(int node) const { return parents[node]; }
+    const D3DXMATRIX& GetLocal(int node) const { return locals[node]; }
+    const D3DXMATRIX& GetWorld(int node) const { return worlds[node]; }
+    const D3DXMATRIX& GetWorldInverse(int node) const { return worldInverses[node]; }
+
+    // Work done since last reset
+    int GetInversions() const { return inversions; }
+    int GetMultiplications() const { return multiplications; }
+    void ResetCounters() { inversions = multiplications = 0; }
+
+    // out = a * b, SSE when available. out may alias a or b.
+    static void Multiply(D3DXMATRIX& out, const D3DXMATRIX& a, const D3DXMATRIX& b);
+
+    // Inverse of matrix without projection, general inverse otherwise
+    static void InvertAffine(D3DXMATRIX& out, const D3DXMATRIX& m);
+};
@@ -0,0 +1,320 @@
+#include "TriangleBvh.h"
+#include <cfloat>
+#include <cmath>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE__)
+#include <xmmintrin.h>
+#define TRIANGLE_BVH_SSE
+#endif
+
+using namespace std;
+
+// Determinant below which ray & triangle are taken as parallel
+static const float parallelEps = 1e-12f;
+
+// Reciprocal of direction, zero axes get a huge value of the same sign
+static float Reciprocal(float value) {
+    if (fabs(value) < 1e-30f)
+        return value < 0.0f ? -1e30f : 1e30f;
+    return 1.0f / value;
+}
+
+// Entry distance into box if ray enters it before maxDistance
+static bool HitBox(const Bounds& bounds, const float origin[3], const float inverse[3], float maxDistance, float& entry) {
+    float tmin = 0.0f;
+    float tmax = maxDistance;
+
+    for(int i = 0; i<3; ++i) {
+        float t0 = (bounds.min[i] - origin[i]) * inverse[i];
+        float t1 = (bounds.max[i] - origin[i]) * inverse[i];
+
+        if (t0 > t1) {
+            float t = t0;
+            t0 = t1;
+            t1 = t;
+        }
+        tmin = t0 > tmin ? t0 : tmin;
+        tmax = t1 < tmax ? t1 : tmax;
+    }
+    entry = tmin;
+    return tmin <= tmax;
+}
+
+static void Cross(float out[3], const float a[3], const float b[3]) {
+    out[0] = a[1] * b[2] - a[2] * b[1];
+    out[1] = a[2] * b[0] - a[0] * b[2];
+    out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+static float Dot(const float a[3], const float b[3]) {
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+void TriangleBvh::Build(const vector<float>& positions) {
+    int            count = positions.size() / 9;
+    vector<Bounds> bounds(count);
+
+    for(int i = 0; i<count; ++i) {
+        const float* v = &positions[9 * i];
+
+        bounds[i].Reset();
+        for(int k = 0; k<3; ++k) {
+            for(int j = 0; j<3; ++j) {
+                if (v[3*k + j] < bounds[i].min[j]) bounds[i].min[j] = v[3*k + j];
+                if (v[3*k + j] > bounds[i].max[j]) bounds[i].max[j] = v[3*k + j];
+            }
+        }
+    }
+    bvh.Build(bounds);
+
+    // Leaves address triangles directly
+    triangles.resize(count);
+    for(int i = 0; i<count; ++i) {
+        const float* v = &positions[9 * bvh.GetLeafItem(i)];
+        Triangle&    triangle = triangles[i];
+
+        for(int j = 0; j<3; ++j) {
+            triangle.v0[j] = v[j];
+            triangle.e1[j] = v[3 + j] - v[j];
+            triangle.e2[j] = v[6 + j] - v[j];
+        }
+    }
+}
+
+// Moller-Trumbore, distance of hit in (0, maxDistance) or -1
+static float IntersectTriangle(const float v0[3], const float e1[3], const float e2[3], const float origin[3], const float direction[3], float maxDistance) {
+    float p[3], q[3], s[3];
+
+    Cross(p, direction, e2);
+    float det = Dot(e1, p);
+    if (fabs(det) < parallelEps)
+        return -1.0f;
+
+    float inverse = 1.0f / det;
+    for(int i = 0; i<3; ++i)
+        s[i] = origin[i] - v0[i];
+
+    float u = Dot(s, p) * inverse;
+    if (u < 0.0f || u > 1.0f)
+        return -1.0f;
+
+    Cross(q, s, e1);
+    float v = Dot(direction, q) * inverse;
+    if (v < 0.0f || u + v > 1.0f)
+        return -1.0f;
+
+    float t = Dot(e2, q) * inverse;
+    return t > 0.0f && t < maxDistance ? t : -1.0f;
+}
+
+int TriangleBvh::Intersect(const float origin[3], const float direction[3], float& distance) const {
+    float inverse[3];
+    int   stack[Bvh::maxStack];
+    int   top = 0;
+    int   hit = -1;
+    float entry;
+
+    if (triangles.empty())
+        return -1;
+
+    for(int i = 0; i<3; ++i)
+        inverse[i] = Reciprocal(direction[i]);
+
+    stack[top++] = 0;
+    while (top > 0) {
+        const Bvh::Node& node = bvh.GetNode(stack[--top]);
+
+        if ( !HitBox(node.bounds, origin, inverse, distance, entry) )
+            continue;
+
+        if (node.count > 0) {
+            for(int i = node.first; i<node.first + node.count; ++i) {
+                const Triangle& triangle = triangles[i];
+                float           t = IntersectTriangle(triangle.v0, triangle.e1, triangle.e2, origin, direction, distance);
+
+                if (t > 0.0f) {
+                    distance = t;
+                    hit = i;
+                }
+            }
+            continue;
+        }
+
+        // Nearer child on top, its hits cut the farther one
+        float nearEntry, farEntry;
+        bool  nearHit = HitBox(bvh.GetNode(node.first).bounds, origin, inverse, distance, nearEntry);
+        bool  farHit = HitBox(bvh.GetNode(node.first + 1).bounds, origin, inverse, distance, farEntry);
+        int   nearChild = node.first;
+        int   farChild = node.first + 1;
+
+        if (nearHit && farHit && farEntry < nearEntry) {
+            nearChild = node.first + 1;
+            farChild = node.first;
+        }
+        else if (!nearHit) {
+            nearChild = node.first + 1;
+            nearHit = farHit;
+            farHit = false;
+        }
+        if (farHit)
+            stack[top++] = farChild;
+        if (nearHit)
+            stack[top++] = nearChild;
+    }
+
+    return hit;
+}
+
+int TriangleBvh::Occluded(const float origin[3], const float directions[3][packetSize], const float lengths[packetSize]) const {
+    int stack[Bvh::maxStack];
+    int top = 0;
+    int active = 0;
+    int blocked = 0;
+
+    for(int i = 0; i<packetSize; ++i) {
+        if (lengths[i] > 0.0f)
+            active |= 1 << i;
+    }
+    if (triangles.empty() || !active)
+        return 0;
+
+#ifdef TRIANGLE_BVH_SSE
+    __m128 o[3], d[3], inverse[3], s[3];
+    __m128 zero = _mm_setzero_ps();
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 length = _mm_loadu_ps(lengths);
+
+    for(int i = 0; i<3; ++i) {
+        o[i] = _mm_set1_ps(origin[i]);
+        d[i] = _mm_loadu_ps(directions[i]);
+        inverse[i] = _mm_set_ps( Reciprocal(directions[i][3]), Reciprocal(directions[i][2]),
+                                 Reciprocal(directions[i][1]), Reciprocal(directions[i][0]) );
+    }
+
+    stack[top++] = 0;
+    while (top > 0) {
+        const Bvh::Node& node = bvh.GetNode(stack[--top]);
+
+        // Slabs of all rays against the shared box
+        __m128 tmin = zero;
+        __m128 tmax = length;
+        for(int i = 0; i<3; ++i) {
+            __m128 t0 = _mm_mul_ps( _mm_sub_ps(_mm_set1_ps(node.bounds.min[i]), o[i]), inverse[i] );
+            __m128 t1 = _mm_mul_ps( _mm_sub_ps(_mm_set1_ps(node.bounds.max[i]), o[i]), inverse[i] );
+
+            tmin = _mm_max_ps( tmin, _mm_min_ps(t0, t1) );
+            tmax = _mm_min_ps( tmax, _mm_max_ps(t0, t1) );
+        }
+        if ( !(_mm_movemask_ps( _mm_cmple_ps(tmin, tmax) ) & active & ~blocked) )
+            continue;
+
+        if (node.count == 0) {
+            stack[top++] = node.first + 1;
+            stack[top++] = node.first;
+            continue;
+        }
+
+        for(int k = node.first; k<node.first + node.count; ++k) {
+            const Triangle& triangle = triangles[k];
+            float           sv[3], qv[3];
+
+            // Rays share the origin, so s, q and the distance numerator do too
+            for(int i = 0; i<3; ++i)
+                sv[i] = origin[i] - triangle.v0[i];
+            Cross(qv, sv, triangle.e1);
+            __m128 tNumerator = _mm_set1_ps( Dot(triangle.e2, qv) );
+            __m128 e2[3];
+            for(int i = 0; i<3; ++i) {
+                e2[i] = _mm_set1_ps(triangle.e2[i]);
+                s[i] = _mm_set1_ps(sv[i]);
+            }
+
+            // p = d x e2
+            __m128 p0 = _mm_sub_ps( _mm_mul_ps(d[1], e2[2]), _mm_mul_ps(d[2], e2[1]) );
+            __m128 p1 = _mm_sub_ps( _mm_mul_ps(d[2], e2[0]), _mm_mul_ps(d[0], e2[2]) );
+            __m128 p2 = _mm_sub_ps( _mm_mul_ps(d[0], e2[1]), _mm_mul_ps(d[1], e2[0]) );
+            __m128 det = _mm_add_ps( _mm_add_ps( _mm_mul_ps(_mm_set1_ps(triangle.e1[0]), p0),
+                                                 _mm_mul_ps(_mm_set1_ps(triangle.e1[1]), p1) ),
+                                     _mm_mul_ps(_mm_set1_ps(triangle.e1[2]), p2) );
+            __m128 absDet = _mm_max_ps( det, _mm_sub_ps(zero, det) );
+            __m128 inverseDet = _mm_div_ps(one, det);
+
+            __m128 u = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps(s[0], p0), _mm_mul_ps(s[1], p1) ), _mm_mul_ps(s[2], p2) ), inverseDet );
+            __m128 v = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps(d[0], _mm_set1_ps(qv[0])), _mm_mul_ps(d[1], _mm_set1_ps(qv[1])) ),
+                                               _mm_mul_ps(d[2], _mm_set1_ps(qv[2])) ), inverseDet );
+            __m128 t = _mm_mul_ps(tNumerator, inverseDet);
+
+            __m128 hit = _mm_cmpgt_ps( absDet, _mm_set1_ps(parallelEps) );
+            hit = _mm_and_ps( hit, _mm_cmpge_ps(u, zero) );
+            hit = _mm_and_ps( hit, _mm_cmpge_ps(v, zero) );
+            hit = _mm_and_ps( hit, _mm_cmple_ps(_mm_add_ps(u, v), one) );
+            hit = _mm_and_ps( hit, _mm_cmpgt_ps(t, zero) );
+            hit = _mm_and_ps( hit, _mm_cmplt_ps(t, length) );
+
+            blocked |= _mm_movemask_ps(hit) & active;
+            if (blocked == active)
+                return blocked;
+        }
+    }
+#else
+    float inverses[packetSize][3];
+    float direction[packetSize][3];
+
+    for(int j = 0; j<packetSize; ++j) {
+        for(int i = 0; i<3; ++i) {
+            direction[j][i] = directions[i][j];
+            inverses[j][i] = Reciprocal(directions[i][j]);
+        }
+    }
+
+    stack[top++] = 0;
+    while (top > 0) {
+        const Bvh::Node& node = bvh.GetNode(stack[--top]);
+        int              entering = 0;
+        float            entry;
+
+        for(int j = 0; j<packetSize; ++j) {
+            if ( (active & ~blocked & (1 << j)) && HitBox(node.bounds, origin, inverses[j], lengths[j], entry) )
+                entering |= 1 << j;
+        }
+        if (!entering)
+            continue;
+
+        if (node.count == 0) {
+            stack[top++] = node.first + 1;
+            stack[top++] = node.first;
+            continue;
+        }
+
+        for(int k = node.first; k<node.first + node.count; ++k) {
+            const Triangle& triangle = triangles[k];
+
+            for(int j = 0; j<packetSize; ++j) {
+                if ( (entering & ~blocked & (1 << j)) && IntersectTriangle(triangle.v0, triangle.e1, triangle.e2, origin, direction[j], lengths[j]) > 0.0f )
+                    blocked |= 1 << j;
+            }
+            if (blocked == active)
+                return blocked;
+        }
+    }
+#endif
+
+    return blocked;
+}
+
+void TriangleBvh::GetNormal(int triangle, float normal[3]) const {
+    const Triangle& t = triangles[triangle];
+
+    Cross(normal, t.e1, t.e2);
+    float length = sqrt( Dot(normal, normal) );
+    if (length > 0.0f) {
+        for(int i = 0; i<3; ++i)
+            normal[i] /= length;
+    }
+}
+
+const Bounds& TriangleBvh::GetBounds() const {
+    static Bounds empty = { { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 0.0f } };
+
+    return triangles.empty() ? empty : bvh.GetNode(0).bounds;
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include "Bvh.h"
+#include <vector>
+
+//-----------------------------------------------------------------------------
+// TriangleBvh class
+// Ray queries against a triangle soup. Triangles are stored in leaf order of
+// a Bvh over their boxes. Occlusion is tested for packets of four rays from
+// one point, the rays share nodes & triangles and are tested side by side
+// with SSE where available. Plain floats, so it runs without a device.
+//-----------------------------------------------------------------------------
+class TriangleBvh
+{
+private:
+    // First vertex & edges to the other two
+    struct Triangle
+    {
+        float v0[3];
+        float e1[3];
+        float e2[3];
+    };
+
+    Bvh                   bvh;
+    std::vector<Triangle> triangles;    // in leaf order
+
+public:
+    static const int packetSize = 4;
+
+    // positions holds 9 floats per triangle, world space
+    void Build(const std::vector<float>& positions);
+
+    // Closest triangle the ray hits before distance, -1 if none. Distance is
+    // updated to the hit in lengths of direction.
+    int Intersect(const float origin[3], const float direction[3], float& distance) const;
+
+    // Rays from origin blocked before their lengths, bit i for ray i.
+    // directions[axis][ray], rays with length <= 0 are ignored.
+    int Occluded(const float origin[3], const float directions[3][packetSize], const float lengths[packetSize]) const;
+
+    // Unit geometric normal of triangle returned by Intersect, either side
+    void GetNormal(int triangle, float normal[3]) const;
+
+    int GetTriangleCount() const { return triangles.size(); }
+    const Bounds& GetBounds() const;
+};
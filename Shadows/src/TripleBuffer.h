@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+
+namespace Utils
+{
+	//-----------------------------------------------------------------------------
+	// TripleBuffer class
+	// Hands values from one writer thread to one reader thread without locks.
+	// Writer fills the back buffer and publishes it, reader takes the newest
+	// published one. Neither waits for the other; values the reader missed are
+	// overwritten.
+	//-----------------------------------------------------------------------------
+	template<class T>
+	class TripleBuffer
+	{
+	private:
+		static const int indexMask = 3;
+		static const int freshBit = 4;
+
+		T					buffers[3];
+		std::atomic<int>	middle;	// index of buffer between threads, fresh if not taken yet
+		int					back;	// owned by writer
+		int					front;	// owned by reader
+
+		TripleBuffer(const TripleBuffer&);
+		TripleBuffer& operator = (const TripleBuffer&);
+
+	public:
+		TripleBuffer() : middle(1), back(0), front(2)
+		{
+		}
+
+		// Writer: buffer to fill, keeps contents of an older value
+		T& GetBack()
+		{
+			return buffers[back];
+		}
+
+		// Writer: make back buffer the newest value
+		void Publish()
+		{
+			back = middle.exchange(back | freshBit, std::memory_order_acq_rel) & indexMask;
+		}
+
+		// Reader: take newest value if one was published since last call
+		bool Acquire()
+		{
+			if ( !(middle.load(std::memory_order_relaxed) & freshBit) ) return false;
+
+			front = middle.exchange(front, std::memory_order_acq_rel) & indexMask;
+			return true;
+		}
+
+		// Reader: value taken last
+		const T& GetFront() const
+		{
+			return buffers[front];
+		}
+	};
+}
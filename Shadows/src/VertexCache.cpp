@@ -0,0 +1,217 @@
+#include "VertexCache.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+int VertexCache::cacheSize = 24;
+
+// Forsyth's scoring: LRU model size & weights
+static const int   lruSize = 32;
+static const float decayPower = 1.5f;
+static const float lastTriangleScore = 0.75f;
+static const float valenceScale = 2.0f;
+static const float valencePower = 0.5f;
+static const int   maxValence = 64;     // boost is flat above
+static const int   maxCandidates = 32;  // triangles rescored per cached vertex & step
+
+// Vertex fetch model: lines of a small FIFO in front of memory
+static const int   lineSize = 64;
+static const int   numLines = 128;
+
+// Score of cache positions & remaining triangle counts
+struct ScoreTables
+{
+    float cache[lruSize];
+    float valence[maxValence];
+
+    ScoreTables() {
+        // Last triangle's vertices get a fixed score so the next one does
+        // not simply reuse the same edge
+        for(int i = 0; i<lruSize; ++i) {
+            if (i < 3)
+                cache[i] = lastTriangleScore;
+            else
+                cache[i] = pow(1.0f - static_cast<float>(i - 3) / (lruSize - 3), decayPower);
+        }
+        valence[0] = 0.0f;
+        for(int i = 1; i<maxValence; ++i)
+            valence[i] = valenceScale * pow(static_cast<float>(i), -valencePower);
+    }
+};
+
+// Vertex with remaining triangles at cache position, -1 outside the cache
+static float VertexScore(const ScoreTables& tables, int position, int remaining) {
+    if (remaining == 0)
+        return -1.0f;
+
+    float score = position >= 0 ? tables.cache[position] : 0.0f;
+    return score + tables.valence[ min(remaining, maxValence - 1) ];
+}
+
+// Post-transform misses of triangles in order, all of them without order
+static int CountMisses(const int* indices, const vector<int>* order, int numTriangles, int numVertices) {
+    vector<int> loaded(numVertices, -1);
+    int         misses = 0;
+
+    for(int t = 0; t<numTriangles; ++t) {
+        const int* triangle = indices + 3 * (order ? (*order)[t] : t);
+
+        for(int k = 0; k<3; ++k) {
+            int v = triangle[k];
+
+            if (loaded[v] < 0 || misses - loaded[v] >= VertexCache::cacheSize)
+                loaded[v] = misses++;
+        }
+    }
+    return misses;
+}
+
+void VertexCache::Optimize(const int* indices, int numTriangles, int numVertices, vector<int>& order) {
+    vector<int>   remaining(numVertices, 0);
+    vector<int>   first(numVertices + 1, 0);
+    vector<int>   adjacent(3 * numTriangles);  // corners, 3 per triangle
+    vector<int>   slot(3 * numTriangles);      // of each corner in adjacent
+    vector<int>   position(numVertices, -1);
+    vector<float> vertexScores(numVertices);
+    vector<float> triangleScores(numTriangles);
+    vector<char>  emitted(numTriangles, 0);
+    int           cache[lruSize + 3];
+    int           cacheCount = 0;
+    int           next = 0;         // fallback scan, only moves forward
+    static const ScoreTables tables;
+
+    order.clear();
+    order.reserve(numTriangles);
+
+    // Corners of each vertex, live ones first
+    for(int i = 0; i<3 * numTriangles; ++i)
+        ++remaining[ indices[i] ];
+    for(int v = 0; v<numVertices; ++v)
+        first[v + 1] = first[v] + remaining[v];
+    for(int i = 0; i<3 * numTriangles; ++i) {
+        slot[i] = first[ indices[i] ]++;
+        adjacent[ slot[i] ] = i;
+    }
+    for(int v = numVertices; v>0; --v)
+        first[v] = first[v - 1];
+    first[0] = 0;
+
+    for(int v = 0; v<numVertices; ++v)
+        vertexScores[v] = VertexScore(tables, -1, remaining[v]);
+    for(int t = 0; t<numTriangles; ++t)
+        triangleScores[t] = vertexScores[ indices[3*t] ] + vertexScores[ indices[3*t + 1] ] + vertexScores[ indices[3*t + 2] ];
+
+    int best = -1;
+    while ((int)order.size() < numTriangles) {
+        // Nothing left around the cache, start over at the next unused one
+        if (best < 0) {
+            while (emitted[next])
+                ++next;
+            best = next;
+        }
+
+        emitted[best] = 1;
+        order.push_back(best);
+
+        // Drop it from its vertices & put them in front of the cache
+        int newCache[lruSize + 3];
+        int newCount = 0;
+        for(int k = 0; k<3; ++k) {
+            int v = indices[3*best + k];
+            int j = slot[3*best + k];
+            int last = first[v] + remaining[v] - 1;
+
+            swap( adjacent[j], adjacent[last] );
+            slot[ adjacent[j] ] = j;
+            slot[ adjacent[last] ] = last;
+            --remaining[v];
+            newCache[newCount++] = v;
+        }
+        for(int i = 0; i<cacheCount; ++i) {
+            int v = cache[i];
+            if (v != newCache[0] && v != newCache[1] && v != newCache[2])
+                newCache[newCount++] = v;
+        }
+
+        // Scores of everything that moved, pushed out vertices included
+        for(int i = 0; i<newCount; ++i) {
+            int v = newCache[i];
+
+            position[v] = i < lruSize ? i : -1;
+            vertexScores[v] = VertexScore(tables, position[v], remaining[v]);
+        }
+
+        // A few triangles of each cached vertex, so a step stays cheap on
+        // high valence vertices like fan centers
+        float bestScore = -1.0f;
+        best = -1;
+        for(int i = 0; i<newCount; ++i) {
+            int v = newCache[i];
+            int candidates = min(remaining[v], maxCandidates);
+
+            for(int j = 0; j<candidates; ++j) {
+                int t = adjacent[ first[v] + j ] / 3;
+
+                triangleScores[t] = vertexScores[ indices[3*t] ] + vertexScores[ indices[3*t + 1] ] + vertexScores[ indices[3*t + 2] ];
+                if (triangleScores[t] > bestScore) {
+                    bestScore = triangleScores[t];
+                    best = t;
+                }
+            }
+        }
+
+        cacheCount = min(newCount, lruSize);
+        copy(newCache, newCache + cacheCount, cache);
+    }
+
+    // The LRU model can lose against an order that is already good for
+    // the FIFO, e.g. strips of a generated mesh
+    if ( CountMisses(indices, &order, numTriangles, numVertices) >= CountMisses(indices, NULL, numTriangles, numVertices) ) {
+        for(int t = 0; t<numTriangles; ++t)
+            order[t] = t;
+    }
+}
+
+void VertexCache::FirstUseOrder(const int* indices, int numTriangles, int numVertices, vector<int>& remap) {
+    int next = 0;
+
+    remap.assign(numVertices, -1);
+    for(int i = 0; i<3 * numTriangles; ++i) {
+        if (remap[ indices[i] ] < 0)
+            remap[ indices[i] ] = next++;
+    }
+    for(int v = 0; v<numVertices; ++v) {
+        if (remap[v] < 0)
+            remap[v] = next++;
+    }
+}
+
+// A vertex is cached while fewer than cacheSize misses followed its own,
+// same for fetch lines
+VertexCacheStats VertexCache::Simulate(const int* indices, int numTriangles, int numVertices, int vertexSize) {
+    VertexCacheStats stats = VertexCacheStats();
+    vector<int>      loaded(numVertices, -1);
+    vector<int>      lineLoaded( (static_cast<long long>(numVertices) * vertexSize + lineSize - 1) / lineSize, -1 );
+
+    stats.triangles = numTriangles;
+    for(int i = 0; i<3 * numTriangles; ++i) {
+        int v = indices[i];
+
+        if (loaded[v] >= 0 && stats.misses - loaded[v] < cacheSize)
+            continue;
+
+        if (loaded[v] < 0)
+            ++stats.vertices;
+        loaded[v] = stats.misses++;
+
+        long long begin = static_cast<long long>(v) * vertexSize;
+        for(long long line = begin / lineSize; line <= (begin + vertexSize - 1) / lineSize; ++line) {
+            if (lineLoaded[line] >= 0 && stats.lines - lineLoaded[line] < numLines)
+                continue;
+            lineLoaded[line] = stats.lines++;
+        }
+    }
+
+    return stats;
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <vector>
+
+// Cost of drawing a triangle list through the simulated caches
+struct VertexCacheStats
+{
+    int   triangles;
+    int   vertices;     // distinct vertices referenced
+    int   misses;       // post-transform misses, vertex shader runs
+    int   lines;        // 64 byte lines read by the vertex fetch
+
+    // Misses per triangle, 0.5 is the limit for large regular meshes
+    float GetAcmr() const { return triangles > 0 ? static_cast<float>(misses) / triangles : 0.0f; }
+
+    // Misses per referenced vertex, 1 is the best possible
+    float GetAtvr() const { return vertices > 0 ? static_cast<float>(misses) / vertices : 0.0f; }
+
+    float GetLinesPerTriangle() const { return triangles > 0 ? static_cast<float>(lines) / triangles : 0.0f; }
+};
+
+//-----------------------------------------------------------------------------
+// VertexCache class
+// Triangle order for post-transform vertex cache reuse, after Forsyth's
+// linear speed optimizer: triangles are scored by how recently their
+// vertices were used and how few triangles are left on them, the best one
+// next to the cache goes first. Vertices can then be renumbered in first
+// use order so fetches walk the vertex buffer forward. A FIFO simulation
+// measures both on the CPU. Plain index lists, 3 per triangle.
+//-----------------------------------------------------------------------------
+class VertexCache
+{
+public:
+    // Entries of the simulated post-transform FIFO
+    static int cacheSize;
+
+    // order[i] is the triangle of indices to draw i-th. Input order is kept
+    // if it simulates better.
+    static void Optimize(const int* indices, int numTriangles, int numVertices, std::vector<int>& order);
+
+    // remap[v] is the new number of vertex v, in first use order. Unused
+    // vertices go last.
+    static void FirstUseOrder(const int* indices, int numTriangles, int numVertices, std::vector<int>& remap);
+
+    // Post-transform misses & vertex fetch lines of vertexSize byte vertices
+    static VertexCacheStats Simulate(const int* indices, int numTriangles, int numVertices, int vertexSize);
+};
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Utils
+{
+	//-----------------------------------------------------------------------------
+	// WorkerPool class
+	// Fixed set of threads running queued jobs in FIFO order.
+	// Destructor drops jobs that have not started and waits for running ones.
+	//-----------------------------------------------------------------------------
+	class WorkerPool
+	{
+	public:
+		typedef std::function<void ()> job;
+
+	private:
+		std::vector<std::thread>	threads;
+		std::deque<job>				jobs;
+		std::mutex					mutex;
+		std::condition_variable		wakeUp;
+		std::condition_variable		idle;
+		int							running;
+		bool						stop;
+
+		// Thread body
+		void Work()
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+
+			for(;;)
+			{
+				wakeUp.wait( lock, [this] { return stop || !jobs.empty(); } );
+				if ( stop ) return;
+
+				job current = jobs.front();
+				jobs.pop_front();
+				++running;
+
+				lock.unlock();
+				current();
+				lock.lock();
+
+				--running;
+				if ( jobs.empty() && running == 0 ) idle.notify_all();
+			}
+		}
+
+		WorkerPool(const WorkerPool&);
+		WorkerPool& operator = (const WorkerPool&);
+
+	public:
+		// Create & free
+		// Zero threads means one per hardware thread
+		explicit WorkerPool(int numThreads = 0) : running(0), stop(false)
+		{
+			if ( numThreads <= 0 ) numThreads = std::thread::hardware_concurrency();
+			if ( numThreads <= 0 ) numThreads = 1;
+			for(int i = 0; i<numThreads; ++i)
+			{
+				threads.push_back( std::thread(&WorkerPool::Work, this) );
+			}
+		}
+		~WorkerPool()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stop = true;
+				jobs.clear();
+			}
+			wakeUp.notify_all();
+			for(int i = 0; i<(int)threads.size(); ++i)
+			{
+				threads[i].join();
+			}
+		}
+
+		// Queue job
+		void Push(const job& newJob)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				jobs.push_back(newJob);
+			}
+			wakeUp.notify_one();
+		}
+
+		// Block until queue is empty and no job is running
+		void Wait()
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			idle.wait( lock, [this] { return jobs.empty() && running == 0; } );
+		}
+
+		int GetNumThreads() const
+		{
+			return threads.size();
+		}
+	};
+}
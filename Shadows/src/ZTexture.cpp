@@ -1,4 +1,5 @@
 #include "ZTexture.h"
+#include "RenderCalls.h"
 using namespace std;
 
 ZTexture*   ZTexture::instance;
@@ -27,13 +28,13 @@ void ZTexture::SetAsTarget() {
 		LPDIRECT3DSURFACE9 pRenderSurface;
 		pZTexture->GetSurfaceLevel(0, &pRenderSurface);
 		pd3dDevice->GetRenderTarget(0, &pBackBuffer);
-		pd3dDevice->SetRenderTarget(0, pRenderSurface);
+		Device::SetRenderTarget(0, pRenderSurface);
 	}
 }
 
 void ZTexture::RestoreTarget() {
 	if (pBackBuffer)
-		pd3dDevice->SetRenderTarget(0, pBackBuffer);
+		Device::SetRenderTarget(0, pBackBuffer);
 }
 
 IDirect3DTexture9* ZTexture::GetZTexture() {
@@ -0,0 +1,103 @@
+// Offline soft shadows of the static part of a scene: loads the scene & its
+// meshes without a device, packs charts of the instances that never move
+// into one atlas & ray traces the visible part of every light per texel on
+// all cores, see LightmapBaker. Writes the lightmap next to the scene, where
+// the renderer picks it up while the scene's static instances stay as they
+// were, and with --images a PGM per light to look at. Exits with 1 if the
+// scene or a mesh fails to load or nothing static can receive, e.g.:
+// make -C .. tools/LightmapBake
+// LightmapBake ../data/default.scene
+// LightmapBake -j 4 --size 512 --images room.scene
+#include "LightmapBaker.h"
+#include "SoftShadowReference.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static void Usage() {
+    fprintf(stderr, "Usage: LightmapBake [-j threads] [--size texels] [--images] <scene>\n");
+}
+
+int main(int argc, char* argv[]) {
+    Scene            scene;
+    vector<MeshFile> meshes;
+    string           sceneFile;
+    int              threads = 0;
+    bool             images = false;
+
+    for(int i = 1; i<argc; ++i) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1<argc)
+            threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--size") == 0 && i + 1<argc)
+            LightmapBaker::settings.size = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--images") == 0)
+            images = true;
+        else if (argv[i][0] != '-' && sceneFile.empty())
+            sceneFile = argv[i];
+        else {
+            Usage();
+            return 2;
+        }
+    }
+    if (sceneFile.empty() || LightmapBaker::settings.size <= 0) {
+        Usage();
+        return 2;
+    }
+
+    try {
+        scene.Load(sceneFile);
+    }
+    catch (const runtime_error& error) {
+        fprintf(stderr, "%s\n", error.what());
+        return 1;
+    }
+
+    meshes.resize( scene.meshes.size() );
+    for(int i = 0; i<(int)meshes.size(); ++i) {
+        if ( !meshes[i].Load( scene.GetPath(scene.meshes[i]) ) ) {
+            fprintf(stderr, "Can't load %s\n", scene.GetPath(scene.meshes[i]).c_str());
+            return 1;
+        }
+    }
+
+    Utils::WorkerPool pool(threads);
+    LightmapBaker     baker;
+    Lightmap          lightmap;
+    string            fileName = Lightmap::GetFileName(sceneFile);
+
+    if ( !baker.Bake(scene, meshes, pool, lightmap) ) {
+        fprintf(stderr, "%s has no static instances\n", sceneFile.c_str());
+        return 1;
+    }
+
+    const LightmapStats& stats = baker.GetStats();
+    printf("%d static receivers, %d casters with %d triangles\n", stats.receivers, stats.casters, stats.casterTriangles);
+    printf("%d charts, %d from texture coordinates, %.2f texels per unit, %.1f%% of %d x %d covered, %.2f s\n",
+           stats.charts, stats.textureCharts, stats.texelsPerUnit, stats.coverage * 100.0f, lightmap.size, lightmap.size, stats.chartSeconds);
+    printf("%d lights, %d texels each, %lld shadow rays, %.2f s on %d threads, %.2f Mrays/s\n",
+           (int)lightmap.layers.size(), stats.texels, stats.rays, stats.bakeSeconds, pool.GetNumThreads(),
+           stats.bakeSeconds > 0.0 ? stats.rays / stats.bakeSeconds * 1e-6 : 0.0);
+
+    if ( !lightmap.Save(fileName) ) {
+        fprintf(stderr, "Can't write %s\n", fileName.c_str());
+        return 1;
+    }
+    printf("wrote %s\n", fileName.c_str());
+
+    for(int i = 0; images && i<(int)lightmap.layers.size(); ++i) {
+        const vector<unsigned char>& visibility = lightmap.layers[i].visibility;
+        vector<float>                values(visibility.size());
+        char                         name[32];
+
+        for(int j = 0; j<(int)values.size(); ++j)
+            values[j] = visibility[j] / 255.0f;
+        sprintf(name, "_light%d.pgm", i);
+        SoftShadowReference::WriteImage(fileName.substr(0, fileName.size() - 9) + name, values, lightmap.size, lightmap.size);
+    }
+    return 0;
+}
@@ -0,0 +1,44 @@
+// Headless replay of frames captured by the renderer with F-key or
+// -capture <frame>: runs the device & effect calls of a capture against the
+// recording backend of CaptureReplay, nothing is drawn. Reports calls,
+// redundant state sets & uploaded bytes per op & per stage, and indexed
+// draws reading outside their uploaded index lists. Given two captures,
+// writes what differs between them & exits with 1 if anything does, so a
+// change to the renderer can be checked against a capture made before it:
+// make -C .. tools/ReplayCapture
+// ReplayCapture capture_120.cap
+// ReplayCapture before.cap after.cap
+#include "CaptureReplay.h"
+#include <cstdio>
+#include <iostream>
+
+using namespace std;
+
+int main(int argc, char* argv[]) {
+    FrameCapture captures[2];
+
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: ReplayCapture <capture> [capture to compare]\n");
+        return 2;
+    }
+
+    for(int i = 1; i<argc; ++i) {
+        if ( !captures[i - 1].Load(argv[i]) ) {
+            fprintf(stderr, "Can't read %s\n", argv[i]);
+            return 2;
+        }
+    }
+
+    if (argc == 2) {
+        CaptureReplay replay;
+
+        replay.Run(captures[0]);
+        cout << argv[1] << ": frame " << captures[0].GetFrame() << ", " << captures[0].GetCommands().size() << " commands, "
+             << captures[0].GetObjectCount() << " objects" << endl << endl;
+        replay.Write(cout);
+        return replay.GetBadDraws() > 0 ? 1 : 0;
+    }
+
+    cout << argv[1] << " -> " << argv[2] << endl << endl;
+    return CaptureReplay::Diff(captures[0], captures[1], cout) ? 0 : 1;
+}
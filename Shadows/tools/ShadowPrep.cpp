@@ -0,0 +1,306 @@
+// Offline check of shadow casters: loads text .x files, welds them, orders
+// them for the vertex cache, builds adjacency, shadow vertices & caps with
+// the shadow geometry library and extracts silhouettes for a few lights
+// around each mesh. Reports sizes of the buffers the renderer would create,
+// simulated vertex cache misses per triangle (ACMR) of the triangles before
+// & after ordering, of the caps and of the light dependent sides, edges
+// inside flat regions left out of extraction & the memory that saved, bytes
+// uploaded per light by the indexed lists against the edge ids of instanced
+// drawing, and time per stage. Corners of the edge instances are expanded
+// on the CPU like the shader does & compared with the shadow vertices.
+// Meshes run in parallel. Exits with 1 if a file fails to load or an
+// instance corner differs, or if a mesh is open and --closed is given, so
+// it can gate an asset export, e.g.:
+// make -C .. tools/ShadowPrep
+// ShadowPrep ../data                  every .x file below data
+// ShadowPrep -j 4 --lights 64 --closed a.x b.x
+// ShadowPrep --keep-order ../data     file order, to compare
+#include "MeshFile.h"
+#include "ShadowMesh.h"
+#include "WorkerPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+typedef chrono::steady_clock PrepClock;
+
+// Outcome of one file
+struct PrepResult
+{
+    string    fileName;
+    bool      loaded;
+    bool      closed;
+    int       vertices;         // after welding
+    int       triangles;
+    int       edges;
+    int       flatEdges;        // dropped from extraction
+    size_t    vertexBytes;      // shadow vertex buffer
+    size_t    prunedBytes;      // shadow vertices flat edges would have had
+    size_t    capBytes;         // static cap indices
+    double    wedges;           // penumbra wedges, mean over the lights
+    float     acmrBefore;       // welded triangles in file order
+    float     acmrAfter;        // & in the order built
+    float     capsAcmr;
+    float     capsLines;        // vertex fetch lines per cap triangle
+    double    sideAcmr;         // umbra & penumbra sides, mean over the lights
+    double    sideLines;        // vertex fetch lines per side triangle
+    double    listBytes;        // side & wedge uploads per light, indexed lists
+    double    idBytes;          // edge id uploads per light, instanced
+    int       instanceErrors;   // expanded instance corners unlike the shadow vertices
+    double    load, weld, order, build, extract;    // seconds, extract per light
+};
+
+static double Seconds(PrepClock::time_point start) {
+    return chrono::duration<double>(PrepClock::now() - start).count();
+}
+
+static bool EndsWithX(const string& fileName) {
+    return fileName.size() > 2 && fileName[fileName.size() - 2] == '.' && (fileName.back() == 'x' || fileName.back() == 'X');
+}
+
+// Path itself if it is a file, else the .x files below it
+static void FindFiles(const string& path, vector<string>& files) {
+#ifdef _WIN32
+    _finddata_t data;
+    intptr_t    handle = _findfirst( (path + "\\*").c_str(), &data );
+
+    if (handle == -1) {
+        files.push_back(path);
+        return;
+    }
+    do {
+        string name = data.name;
+        if (name == "." || name == "..")
+            continue;
+        if (data.attrib & _A_SUBDIR)
+            FindFiles(path + "\\" + name, files);
+        else if ( EndsWithX(name) )
+            files.push_back(path + "\\" + name);
+    } while (_findnext(handle, &data) == 0);
+    _findclose(handle);
+#else
+    struct stat info;
+    DIR*        dir;
+
+    if (stat(path.c_str(), &info) != 0 || !S_ISDIR(info.st_mode) || !(dir = opendir( path.c_str() ))) {
+        files.push_back(path);
+        return;
+    }
+    vector<string> names;
+    for(dirent* entry = readdir(dir); entry; entry = readdir(dir)) {
+        string name = entry->d_name;
+        if (name != "." && name != "..")
+            names.push_back(name);
+    }
+    closedir(dir);
+
+    // Same order on every run
+    sort(names.begin(), names.end());
+    for(int i = 0; i<(int)names.size(); ++i) {
+        string child = path + "/" + names[i];
+
+        if (stat(child.c_str(), &info) == 0 && S_ISDIR(info.st_mode))
+            FindFiles(child, files);
+        else if ( EndsWithX(names[i]) )
+            files.push_back(child);
+    }
+#endif
+}
+
+// ACMR of welded faces
+static float FaceAcmr(const vector<Face>& faces, int numVertices) {
+    vector<int> indices( 3 * faces.size() );
+
+    for(int i = 0; i<(int)faces.size(); ++i) {
+        indices[3*i] = faces[i].v0;
+        indices[3*i + 1] = faces[i].v1;
+        indices[3*i + 2] = faces[i].v2;
+    }
+    return VertexCache::Simulate(&indices[0], faces.size(), numVertices, sizeof(D3DXVECTOR3)).GetAcmr();
+}
+
+static void Prepare(PrepResult& result, int numLights, bool keepOrder) {
+    MeshFile   file;
+    ShadowMesh mesh;
+
+    PrepClock::time_point start = PrepClock::now();
+    result.loaded = file.Load(result.fileName);
+    result.load = Seconds(start);
+    if (!result.loaded)
+        return;
+    result.triangles = file.faces.size();
+
+    start = PrepClock::now();
+    ShadowMesh::Weld(file.vertices, file.faces);
+    result.weld = Seconds(start);
+    result.vertices = file.vertices.size();
+
+    result.acmrBefore = FaceAcmr(file.faces, file.vertices.size());
+    start = PrepClock::now();
+    if (!keepOrder)
+        ShadowMesh::OptimizeOrder(file.vertices, file.faces);
+    result.order = Seconds(start);
+    result.acmrAfter = FaceAcmr(file.faces, file.vertices.size());
+
+    start = PrepClock::now();
+    result.closed = mesh.Build(file.vertices, file.faces, 0.0f);
+    result.build = Seconds(start);
+    result.edges = mesh.GetEdgeCount();
+    result.flatEdges = mesh.GetEdgeClasses().flat;
+    result.prunedBytes = mesh.GetEdgeClasses().prunedBytes;
+    result.vertexBytes = mesh.GetShadowVertices().size() * sizeof(ShadowVert);
+    result.capBytes = mesh.GetCapIndexCount() * sizeof(int);
+    if (!result.closed)
+        return;
+    VertexCacheStats caps = mesh.GetCapCacheStats();
+    result.capsAcmr = caps.GetAcmr();
+    result.capsLines = caps.GetLinesPerTriangle();
+
+    // Lights on a ring around the bounds, a little above
+    D3DXVECTOR3 low = file.vertices[0], high = file.vertices[0];
+    for(int i = 1; i<(int)file.vertices.size(); ++i) {
+        D3DXVec3Minimize(&low, &low, &file.vertices[i]);
+        D3DXVec3Maximize(&high, &high, &file.vertices[i]);
+    }
+    D3DXVECTOR3 center = 0.5f * (low + high);
+    D3DXVECTOR3 extent = high - low;
+    float       radius = max(D3DXVec3Length(&extent), eps);
+
+    ShadowVolume volume;
+    vector<int>  sides;
+    double       extractSeconds = 0.0;
+    for(int i = 0; i<numLights; ++i) {
+        float       angle = 2.0f * D3DX_PI * i / numLights;
+        D3DXVECTOR3 light = center + radius * D3DXVECTOR3( cos(angle), 0.5f, sin(angle) );
+
+        start = PrepClock::now();
+        mesh.ExtractSilhouette(light, volume);
+        extractSeconds += Seconds(start);
+        result.wedges += volume.penumbraIndices.size() / 24.0;
+        result.listBytes += (volume.umbraIndices.size() + volume.penumbraIndices.size()) * sizeof(int) +
+                            volume.wedgeVertices.size() * sizeof(ShadowVert);
+        result.idBytes += volume.silhouette.size() * sizeof(unsigned int);
+        result.instanceErrors += mesh.CheckEdgeInstances(volume);
+
+        // Strip sides as a list, then the per edge wedges
+        sides.clear();
+        if (volume.sideStrip) {
+            const vector<int>& strip = volume.umbraIndices;
+
+            for(int j = 0; j+2<(int)strip.size(); ++j) {
+                if (strip[j] != strip[j+1] && strip[j+1] != strip[j+2] && strip[j] != strip[j+2])
+                    sides.insert(sides.end(), strip.begin() + j, strip.begin() + j + 3);
+            }
+        }
+        else
+            sides = volume.umbraIndices;
+        sides.insert(sides.end(), volume.penumbraIndices.begin(), volume.penumbraIndices.end());
+        if ( sides.empty() )
+            continue;
+
+        VertexCacheStats stats = VertexCache::Simulate(&sides[0], sides.size() / 3, mesh.GetShadowVertexCount(), sizeof(ShadowVert));
+        result.sideAcmr += stats.GetAcmr();
+        result.sideLines += stats.GetLinesPerTriangle();
+    }
+    result.extract = extractSeconds / numLights;
+    result.wedges /= numLights;
+    result.listBytes /= numLights;
+    result.idBytes /= numLights;
+    result.sideAcmr /= numLights;
+    result.sideLines /= numLights;
+}
+
+int main(int argc, char* argv[]) {
+    vector<string> paths;
+    int            numThreads = 0;
+    int            numLights = 16;
+    bool           requireClosed = false;
+    bool           keepOrder = false;
+
+    for(int i = 1; i<argc; ++i) {
+        string option = argv[i];
+
+        if (option == "-j" && i + 1 < argc)
+            numThreads = atoi(argv[++i]);
+        else if (option == "--lights" && i + 1 < argc)
+            numLights = max(1, atoi(argv[++i]));
+        else if (option == "--closed")
+            requireClosed = true;
+        else if (option == "--keep-order")
+            keepOrder = true;
+        else if (option[0] == '-') {
+            printf("usage: %s [-j threads] [--lights 16] [--closed] [--keep-order] file.x|folder ...\n", argv[0]);
+            return 2;
+        }
+        else
+            paths.push_back(option);
+    }
+    if ( paths.empty() )
+        paths.push_back("data");
+
+    vector<string> files;
+    for(int i = 0; i<(int)paths.size(); ++i)
+        FindFiles(paths[i], files);
+
+    // A job per file, results stay in input order
+    vector<PrepResult> results( files.size(), PrepResult() );
+    PrepClock::time_point start = PrepClock::now();
+    {
+        Utils::WorkerPool pool(numThreads);
+
+        for(int i = 0; i<(int)files.size(); ++i) {
+            PrepResult* result = &results[i];
+
+            result->fileName = files[i];
+            pool.Push( [result, numLights, keepOrder] { Prepare(*result, numLights, keepOrder); } );
+        }
+        pool.Wait();
+    }
+    double wall = Seconds(start);
+
+    int    failed = 0, open = 0, wrong = 0;
+    double totalTriangles = 0.0, totalBytes = 0.0, totalPruned = 0.0, totalTime = 0.0;
+
+    printf("%-32s %9s %9s %9s %9s %6s %9s %9s %8s %8s %12s %6s %6s %6s %6s %9s %8s %5s %8s %8s %8s %8s %8s\n", "file", "vertices", "triangles", "edges", "flat",
+        "closed", "VB KB", "saved KB", "caps KB", "wedges", "ACMR", "caps", "lines", "sides", "lines", "lists KB", "ids KB", "inst",
+        "load ms", "weld ms", "order ms", "build ms", "extr. ms");
+    for(int i = 0; i<(int)results.size(); ++i) {
+        const PrepResult& r = results[i];
+        string name = r.fileName.size() > 32 ? "..." + r.fileName.substr(r.fileName.size() - 29) : r.fileName;
+
+        if (!r.loaded) {
+            printf("%-32s not found or not a text .x file\n", name.c_str());
+            ++failed;
+            continue;
+        }
+        open += !r.closed;
+        wrong += r.instanceErrors > 0;
+        totalTriangles += r.triangles;
+        totalBytes += r.vertexBytes + r.capBytes;
+        totalPruned += r.prunedBytes;
+        totalTime += r.load + r.weld + r.order + r.build + r.extract * numLights;
+
+        printf("%-32s %9d %9d %9d %9d %6s %9.1f %9.1f %8.1f %8.0f  %4.2f->%4.2f %6.2f %6.2f %6.2f %6.2f %9.1f %8.2f %5s %8.2f %8.2f %8.2f %8.2f %8.3f\n", name.c_str(),
+            r.vertices, r.triangles, r.edges, r.flatEdges, r.closed ? "yes" : "NO", r.vertexBytes / 1024.0, r.prunedBytes / 1024.0,
+            r.capBytes / 1024.0, r.wedges,
+            r.acmrBefore, r.acmrAfter, r.capsAcmr, r.capsLines, r.sideAcmr, r.sideLines,
+            r.listBytes / 1024.0, r.idBytes / 1024.0, !r.closed ? "-" : r.instanceErrors > 0 ? "WRONG" : "ok",
+            r.load * 1e3, r.weld * 1e3, r.order * 1e3, r.build * 1e3, r.extract * 1e3);
+    }
+
+    printf("%d files, %d open, %d failed, %d with wrong instances: %.0f triangles, %.1f KB static shadow buffers, %.1f KB saved on flat edges, %.2f s of work in %.2f s\n",
+        static_cast<int>( results.size() ), open, failed, wrong, totalTriangles, totalBytes / 1024.0, totalPruned / 1024.0, totalTime, wall);
+
+    return failed > 0 || wrong > 0 || (requireClosed && open > 0) ? 1 : 0;
+}
@@ -0,0 +1,186 @@
+// Offline texture conversion: every BMP, TGA & DDS file given or below a
+// folder gets a block compressed mip chain next to it, BC1 when it is
+// opaque & BC3 otherwise, which the renderer maps & uploads instead of
+// decoding the image, see TextureFile. Blocks of each level are encoded on
+// all cores. DDS files that are BC1 or BC3 with a full chain already are
+// repacked as they are. Files converted from their source as it is now are
+// skipped unless --force is given. Exits with 1 if a file can't be read or
+// written, e.g.:
+// make -C .. tools/TextureConvert
+// TextureConvert ../data              every image below data
+// TextureConvert -j 4 --force brick.bmp
+#include "TextureCompressor.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+typedef chrono::steady_clock ConvertClock;
+
+static double Seconds(ConvertClock::time_point start) {
+    return chrono::duration<double>(ConvertClock::now() - start).count();
+}
+
+static bool IsImage(const string& fileName) {
+    string extension = fileName.size() > 4 ? fileName.substr(fileName.size() - 4) : "";
+
+    for(int i = 0; i<(int)extension.size(); ++i)
+        extension[i] = static_cast<char>( tolower(extension[i]) );
+    return extension == ".bmp" || extension == ".tga" || extension == ".dds";
+}
+
+// Path itself if it is a file, else the images below it
+static void FindFiles(const string& path, vector<string>& files) {
+#ifdef _WIN32
+    _finddata_t data;
+    intptr_t    handle = _findfirst( (path + "\\*").c_str(), &data );
+
+    if (handle == -1) {
+        files.push_back(path);
+        return;
+    }
+    do {
+        string name = data.name;
+        if (name == "." || name == "..")
+            continue;
+        if (data.attrib & _A_SUBDIR)
+            FindFiles(path + "\\" + name, files);
+        else if ( IsImage(name) )
+            files.push_back(path + "\\" + name);
+    } while (_findnext(handle, &data) == 0);
+    _findclose(handle);
+#else
+    struct stat info;
+    DIR*        dir;
+
+    if (stat(path.c_str(), &info) != 0 || !S_ISDIR(info.st_mode) || !(dir = opendir( path.c_str() ))) {
+        files.push_back(path);
+        return;
+    }
+    vector<string> names;
+    for(dirent* entry = readdir(dir); entry; entry = readdir(dir)) {
+        string name = entry->d_name;
+        if (name != "." && name != "..")
+            names.push_back(name);
+    }
+    closedir(dir);
+
+    // Same order on every run
+    sort(names.begin(), names.end());
+    for(int i = 0; i<(int)names.size(); ++i) {
+        string child = path + "/" + names[i];
+
+        if (stat(child.c_str(), &info) == 0 && S_ISDIR(info.st_mode))
+            FindFiles(child, files);
+        else if ( IsImage(names[i]) )
+            files.push_back(child);
+    }
+#endif
+}
+
+int main(int argc, char* argv[]) {
+    vector<string> paths;
+    int            numThreads = 0;
+    bool           force = false;
+
+    for(int i = 1; i<argc; ++i) {
+        string option = argv[i];
+
+        if (option == "-j" && i + 1 < argc)
+            numThreads = atoi(argv[++i]);
+        else if (option == "--force")
+            force = true;
+        else if (option[0] == '-') {
+            printf("usage: %s [-j threads] [--force] image|folder ...\n", argv[0]);
+            return 2;
+        }
+        else
+            paths.push_back(option);
+    }
+    if ( paths.empty() )
+        paths.push_back("data");
+
+    vector<string> files;
+    for(int i = 0; i<(int)paths.size(); ++i)
+        FindFiles(paths[i], files);
+
+    Utils::WorkerPool pool(numThreads);
+    int               converted = 0, current = 0, skipped = 0, failed = 0;
+    double            sourceBytes = 0.0, convertedBytes = 0.0, seconds = 0.0;
+
+    printf("%-32s %11s %4s %6s %10s %10s %6s %9s\n", "file", "size", "fmt", "levels", "RGBA KB", "blocks KB", "RMSE", "ms");
+    for(int i = 0; i<(int)files.size(); ++i) {
+        string      name = files[i].size() > 32 ? "..." + files[i].substr(files[i].size() - 29) : files[i];
+        string      fileName = TextureFile::GetFileName(files[i]);
+        TextureFile existing;
+
+        if ( !force && existing.Open(fileName) && existing.IsCurrent(files[i]) ) {
+            ++current;
+            continue;
+        }
+        existing.Close();
+
+        // Compressed chains are kept, anything else is decoded & encoded
+        ConvertClock::time_point        start = ConvertClock::now();
+        TextureImage                    image;
+        TextureFormat                   format;
+        vector<TextureLevel>            levels;
+        vector< vector<unsigned char> > data;
+        double                          error = 0.0;
+
+        if ( !TextureCompressor::ReadBlocks(files[i], format, levels, data) ) {
+            if ( !TextureCompressor::ReadImage(files[i], image) ) {
+                printf("%-32s not found or not an uncompressed BMP, TGA or a DDS file\n", name.c_str());
+                ++failed;
+                continue;
+            }
+
+            // D3D9 creates block compressed textures only in whole blocks
+            if (image.width % 4 != 0 || image.height % 4 != 0) {
+                printf("%-32s %5d x %-5d is not a multiple of 4, left to D3DX\n", name.c_str(), image.width, image.height);
+                ++skipped;
+                continue;
+            }
+            format = TextureCompressor::ChooseFormat(image);
+            TextureCompressor::Compress(image, format, pool, levels, data);
+            error = TextureCompressor::GetError(image, format, data[0]);
+        }
+        double elapsed = Seconds(start);
+
+        if ( !TextureFile::Save(fileName, files[i], format, levels, data) ) {
+            printf("%-32s can't write %s\n", name.c_str(), fileName.c_str());
+            ++failed;
+            continue;
+        }
+
+        // Uncompressed chain is a third more than its first level
+        double rgba = 4.0 * levels[0].width * levels[0].height * 4.0 / 3.0;
+        double blocks = 0.0;
+        for(int j = 0; j<(int)data.size(); ++j)
+            blocks += data[j].size();
+
+        ++converted;
+        sourceBytes += rgba;
+        convertedBytes += blocks;
+        seconds += elapsed;
+        printf("%-32s %5d x %-5d %4s %6d %10.1f %10.1f %6.2f %9.2f\n", name.c_str(), levels[0].width, levels[0].height,
+            format == TEXTURE_BC1 ? "BC1" : "BC3", (int)levels.size(), rgba / 1024.0, blocks / 1024.0, error, elapsed * 1e3);
+    }
+
+    printf("%d files, %d converted, %d up to date, %d left to D3DX, %d failed: %.1f KB of RGBA chains in %.1f KB, %.2f s on %d threads\n",
+        static_cast<int>( files.size() ), converted, current, skipped, failed, sourceBytes / 1024.0, convertedBytes / 1024.0,
+        seconds, pool.GetNumThreads());
+
+    return failed > 0 ? 1 : 0;
+}